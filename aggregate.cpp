@@ -0,0 +1,306 @@
+#include "aggregate.hpp"
+#include <algorithm>
+#if defined(__AVX2__) || defined(__AVX512F__)
+// GCC 12's AVX-512 intrinsics seed their results with _mm512_undefined_*,
+// which -Wuninitialized flags at every use (GCC PR105593)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#include <immintrin.h>
+#pragma GCC diagnostic pop
+#endif
+
+namespace aggregate_kernels
+{
+#if defined(__AVX512F__) && defined(__AVX512DQ__)
+    void price_stats(const double *px, size_t n, double &min, double &max, double &sum)
+    {
+        // Two accumulators per reduction hide the add/min/max latency
+        __m512d vmin0 = _mm512_set1_pd(min), vmin1 = vmin0;
+        __m512d vmax0 = _mm512_set1_pd(max), vmax1 = vmax0;
+        __m512d vsum0 = _mm512_setzero_pd(), vsum1 = vsum0;
+        size_t i = 0;
+        for (; i + 16 <= n; i += 16)
+        {
+            __m512d a = _mm512_loadu_pd(px + i);
+            __m512d b = _mm512_loadu_pd(px + i + 8);
+            vmin0 = _mm512_min_pd(vmin0, a);
+            vmin1 = _mm512_min_pd(vmin1, b);
+            vmax0 = _mm512_max_pd(vmax0, a);
+            vmax1 = _mm512_max_pd(vmax1, b);
+            vsum0 = _mm512_add_pd(vsum0, a);
+            vsum1 = _mm512_add_pd(vsum1, b);
+        }
+        if (i + 8 <= n)
+        {
+            __m512d a = _mm512_loadu_pd(px + i);
+            vmin0 = _mm512_min_pd(vmin0, a);
+            vmax0 = _mm512_max_pd(vmax0, a);
+            vsum0 = _mm512_add_pd(vsum0, a);
+            i += 8;
+        }
+        if (i < n)
+        {
+            // Masked tail: inactive lanes keep the accumulator or add zero
+            __mmask8 mask = static_cast<__mmask8>((1u << (n - i)) - 1);
+            vmin1 = _mm512_mask_min_pd(vmin1, mask, vmin1, _mm512_maskz_loadu_pd(mask, px + i));
+            vmax1 = _mm512_mask_max_pd(vmax1, mask, vmax1, _mm512_maskz_loadu_pd(mask, px + i));
+            vsum1 = _mm512_add_pd(vsum1, _mm512_maskz_loadu_pd(mask, px + i));
+        }
+        min = _mm512_reduce_min_pd(_mm512_min_pd(vmin0, vmin1));
+        max = _mm512_reduce_max_pd(_mm512_max_pd(vmax0, vmax1));
+        sum += _mm512_reduce_add_pd(_mm512_add_pd(vsum0, vsum1));
+    }
+
+    void volume_stats(const double *px, const uint64_t *vol, size_t n, uint64_t &volume, double &notional)
+    {
+        __m512i vvol = _mm512_setzero_si512();
+        __m512d vnot0 = _mm512_setzero_pd(), vnot1 = vnot0;
+        size_t i = 0;
+        for (; i + 16 <= n; i += 16)
+        {
+            __m512i v0 = _mm512_loadu_si512(vol + i);
+            __m512i v1 = _mm512_loadu_si512(vol + i + 8);
+            vvol = _mm512_add_epi64(vvol, _mm512_add_epi64(v0, v1));
+            vnot0 = _mm512_fmadd_pd(_mm512_loadu_pd(px + i), _mm512_cvtepu64_pd(v0), vnot0);
+            vnot1 = _mm512_fmadd_pd(_mm512_loadu_pd(px + i + 8), _mm512_cvtepu64_pd(v1), vnot1);
+        }
+        if (i + 8 <= n)
+        {
+            __m512i v = _mm512_loadu_si512(vol + i);
+            vvol = _mm512_add_epi64(vvol, v);
+            vnot0 = _mm512_fmadd_pd(_mm512_loadu_pd(px + i), _mm512_cvtepu64_pd(v), vnot0);
+            i += 8;
+        }
+        if (i < n)
+        {
+            __mmask8 mask = static_cast<__mmask8>((1u << (n - i)) - 1);
+            __m512i v = _mm512_maskz_loadu_epi64(mask, vol + i);
+            vvol = _mm512_add_epi64(vvol, v);
+            vnot1 = _mm512_fmadd_pd(_mm512_maskz_loadu_pd(mask, px + i), _mm512_cvtepu64_pd(v), vnot1);
+        }
+        volume += static_cast<uint64_t>(_mm512_reduce_add_epi64(vvol));
+        notional += _mm512_reduce_add_pd(_mm512_add_pd(vnot0, vnot1));
+    }
+
+#elif defined(__AVX2__)
+    namespace
+    {
+        double hmin(__m256d v)
+        {
+            __m128d m = _mm_min_pd(_mm256_castpd256_pd128(v), _mm256_extractf128_pd(v, 1));
+            return _mm_cvtsd_f64(_mm_min_sd(m, _mm_unpackhi_pd(m, m)));
+        }
+
+        double hmax(__m256d v)
+        {
+            __m128d m = _mm_max_pd(_mm256_castpd256_pd128(v), _mm256_extractf128_pd(v, 1));
+            return _mm_cvtsd_f64(_mm_max_sd(m, _mm_unpackhi_pd(m, m)));
+        }
+
+        double hsum(__m256d v)
+        {
+            __m128d s = _mm_add_pd(_mm256_castpd256_pd128(v), _mm256_extractf128_pd(v, 1));
+            return _mm_cvtsd_f64(_mm_add_sd(s, _mm_unpackhi_pd(s, s)));
+        }
+
+        // Exact uint64 -> double for the full range; AVX2 has no such
+        // instruction. Splits each lane into 32-bit halves and lets the FPU
+        // recombine them via the 2^52 / 2^84 exponent trick.
+        __m256d u64_to_pd(__m256i v)
+        {
+            const __m256i magic_lo = _mm256_set1_epi64x(0x4330000000000000LL); // 2^52
+            const __m256i magic_hi = _mm256_set1_epi64x(0x4530000000000000LL); // 2^84
+            const __m256d magic_all = _mm256_set1_pd(19342813118337666422669312.0); // 2^84 + 2^52
+            __m256i lo = _mm256_blend_epi32(magic_lo, v, 0x55);
+            __m256i hi = _mm256_or_si256(_mm256_srli_epi64(v, 32), magic_hi);
+            __m256d hi_d = _mm256_sub_pd(_mm256_castsi256_pd(hi), magic_all);
+            return _mm256_add_pd(hi_d, _mm256_castsi256_pd(lo));
+        }
+    }
+
+    void price_stats(const double *px, size_t n, double &min, double &max, double &sum)
+    {
+        __m256d vmin0 = _mm256_set1_pd(min), vmin1 = vmin0;
+        __m256d vmax0 = _mm256_set1_pd(max), vmax1 = vmax0;
+        __m256d vsum0 = _mm256_setzero_pd(), vsum1 = vsum0;
+        size_t i = 0;
+        for (; i + 8 <= n; i += 8)
+        {
+            __m256d a = _mm256_loadu_pd(px + i);
+            __m256d b = _mm256_loadu_pd(px + i + 4);
+            vmin0 = _mm256_min_pd(vmin0, a);
+            vmin1 = _mm256_min_pd(vmin1, b);
+            vmax0 = _mm256_max_pd(vmax0, a);
+            vmax1 = _mm256_max_pd(vmax1, b);
+            vsum0 = _mm256_add_pd(vsum0, a);
+            vsum1 = _mm256_add_pd(vsum1, b);
+        }
+        double lo = hmin(_mm256_min_pd(vmin0, vmin1));
+        double hi = hmax(_mm256_max_pd(vmax0, vmax1));
+        double total = hsum(_mm256_add_pd(vsum0, vsum1));
+        for (; i < n; ++i)
+        {
+            lo = std::min(lo, px[i]);
+            hi = std::max(hi, px[i]);
+            total += px[i];
+        }
+        min = lo;
+        max = hi;
+        sum += total;
+    }
+
+    void volume_stats(const double *px, const uint64_t *vol, size_t n, uint64_t &volume, double &notional)
+    {
+        __m256i vvol = _mm256_setzero_si256();
+        __m256d vnot0 = _mm256_setzero_pd(), vnot1 = vnot0;
+        size_t i = 0;
+        for (; i + 8 <= n; i += 8)
+        {
+            __m256i v0 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(vol + i));
+            __m256i v1 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(vol + i + 4));
+            vvol = _mm256_add_epi64(vvol, _mm256_add_epi64(v0, v1));
+            vnot0 = _mm256_fmadd_pd(_mm256_loadu_pd(px + i), u64_to_pd(v0), vnot0);
+            vnot1 = _mm256_fmadd_pd(_mm256_loadu_pd(px + i + 4), u64_to_pd(v1), vnot1);
+        }
+        alignas(32) uint64_t lanes[4];
+        _mm256_store_si256(reinterpret_cast<__m256i *>(lanes), vvol);
+        uint64_t vol_total = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+        double not_total = hsum(_mm256_add_pd(vnot0, vnot1));
+        for (; i < n; ++i)
+        {
+            vol_total += vol[i];
+            not_total += px[i] * static_cast<double>(vol[i]);
+        }
+        volume += vol_total;
+        notional += not_total;
+    }
+
+#else
+    void price_stats(const double *px, size_t n, double &min, double &max, double &sum)
+    {
+        double lo = min, hi = max, total = 0.0;
+        for (size_t i = 0; i < n; ++i)
+        {
+            lo = std::min(lo, px[i]);
+            hi = std::max(hi, px[i]);
+            total += px[i];
+        }
+        min = lo;
+        max = hi;
+        sum += total;
+    }
+
+    void volume_stats(const double *px, const uint64_t *vol, size_t n, uint64_t &volume, double &notional)
+    {
+        uint64_t vol_total = 0;
+        double not_total = 0.0;
+        for (size_t i = 0; i < n; ++i)
+        {
+            vol_total += vol[i];
+            not_total += px[i] * static_cast<double>(vol[i]);
+        }
+        volume += vol_total;
+        notional += not_total;
+    }
+#endif
+}
+
+void Aggregator::add(const ColumnView &chunk, bool time_ordered)
+{
+    size_t n = chunk.size();
+    if (n == 0)
+        return;
+
+    const double *px = chunk.prices.data();
+    const uint64_t *ts = chunk.timestamps.data();
+
+    if (has_op(ops, AggregateOp::High | AggregateOp::Low | AggregateOp::Sum))
+        aggregate_kernels::price_stats(px, n, acc.low, acc.high, acc.sum);
+    if (has_op(ops, AggregateOp::Volume | AggregateOp::Vwap))
+        aggregate_kernels::volume_stats(px, chunk.volumes.data(), n, acc.volume, acc.notional);
+
+    if (has_op(ops, AggregateOp::Open | AggregateOp::Close))
+    {
+        // Ties keep the first row for open and the last row for close, the
+        // same rows a stable sort by timestamp would put at either end
+        bool first = (acc.count == 0);
+        if (time_ordered)
+        {
+            if (first || ts[0] < acc.open_ts)
+            {
+                acc.open_ts = ts[0];
+                acc.open = px[0];
+            }
+            if (first || ts[n - 1] >= acc.close_ts)
+            {
+                acc.close_ts = ts[n - 1];
+                acc.close = px[n - 1];
+            }
+        }
+        else
+        {
+            for (size_t i = 0; i < n; ++i)
+            {
+                if ((first && i == 0) || ts[i] < acc.open_ts)
+                {
+                    acc.open_ts = ts[i];
+                    acc.open = px[i];
+                }
+                if ((first && i == 0) || ts[i] >= acc.close_ts)
+                {
+                    acc.close_ts = ts[i];
+                    acc.close = px[i];
+                }
+            }
+        }
+    }
+
+    acc.count += n;
+}
+
+void Aggregator::merge(const Aggregator &later)
+{
+    const AggregateResult &other = later.acc;
+    if (other.count == 0)
+        return;
+    if (acc.count == 0)
+    {
+        acc = other;
+        return;
+    }
+
+    acc.low = std::min(acc.low, other.low);
+    acc.high = std::max(acc.high, other.high);
+    acc.sum += other.sum;
+    acc.volume += other.volume;
+    acc.notional += other.notional;
+    if (other.open_ts < acc.open_ts)
+    {
+        acc.open_ts = other.open_ts;
+        acc.open = other.open;
+    }
+    if (other.close_ts >= acc.close_ts)
+    {
+        acc.close_ts = other.close_ts;
+        acc.close = other.close;
+    }
+    acc.count += other.count;
+}
+
+void Aggregator::add_bounds(size_t count, double low, double high)
+{
+    if (count == 0)
+        return;
+    if (has_op(ops, AggregateOp::Low))
+        acc.low = std::min(acc.low, low);
+    if (has_op(ops, AggregateOp::High))
+        acc.high = std::max(acc.high, high);
+    acc.count += count;
+}
+
+bool Aggregator::bounds_only(AggregateOp ops)
+{
+    return !has_op(ops, AggregateOp::Open | AggregateOp::Close | AggregateOp::Volume | AggregateOp::Sum |
+                            AggregateOp::Vwap);
+}
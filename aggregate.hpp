@@ -0,0 +1,96 @@
+#ifndef AGGREGATE_HPP
+#define AGGREGATE_HPP
+
+#include "range_view.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+
+// Aggregates computed over a time range. Flags combine with |; only the
+// columns the requested ops need are read.
+enum class AggregateOp : uint32_t
+{
+    None = 0,
+    Count = 1u << 0,
+    Open = 1u << 1,   // Price of the earliest tick
+    High = 1u << 2,   // Maximum price
+    Low = 1u << 3,    // Minimum price
+    Close = 1u << 4,  // Price of the latest tick
+    Volume = 1u << 5, // Sum of volumes
+    Sum = 1u << 6,    // Sum of prices
+    Vwap = 1u << 7,   // sum(price * volume) / sum(volume)
+
+    Min = Low,
+    Max = High,
+    Ohlcv = Open | High | Low | Close | Volume,
+    All = Count | Ohlcv | Sum | Vwap
+};
+
+constexpr AggregateOp operator|(AggregateOp a, AggregateOp b)
+{
+    return static_cast<AggregateOp>(static_cast<uint32_t>(a) | static_cast<uint32_t>(b));
+}
+
+constexpr bool has_op(AggregateOp ops, AggregateOp op)
+{
+    return (static_cast<uint32_t>(ops) & static_cast<uint32_t>(op)) != 0;
+}
+
+// Fields not covered by the requested ops keep their initial values. With
+// count == 0 the range was empty and only count is meaningful.
+struct AggregateResult
+{
+    size_t count = 0;
+    double open = 0.0;
+    double high = -std::numeric_limits<double>::infinity();
+    double low = std::numeric_limits<double>::infinity();
+    double close = 0.0;
+    uint64_t volume = 0;
+    double sum = 0.0;
+    double notional = 0.0; // sum(price * volume), the VWAP numerator
+    uint64_t open_ts = 0;
+    uint64_t close_ts = 0;
+
+    double vwap() const { return volume > 0 ? notional / static_cast<double>(volume) : 0.0; }
+};
+
+// Streaming accumulator over column views. The price and volume kernels use
+// AVX-512 or AVX2 when the build targets them (-march=native) and a scalar
+// loop otherwise. Vector lanes sum in a different order than the scalar
+// loop, so floating-point sums can differ in the last bits.
+class Aggregator
+{
+public:
+    explicit Aggregator(AggregateOp ops) : ops(ops) {}
+
+    // time_ordered: the chunk's rows are in timestamp order and come after
+    // every chunk added so far, so open/close need no timestamp scan
+    void add(const ColumnView &chunk, bool time_ordered);
+
+    // Fold in an aggregator over rows that come after this one's in the
+    // range (ties resolve as if its chunks had been added here)
+    void merge(const Aggregator &later);
+
+    // Fold in count rows known only by their price bounds, such as a block
+    // summarised by its stats. Only for ops that bounds_only() accepts.
+    void add_bounds(size_t count, double low, double high);
+    // ops needs nothing but Count, High and Low
+    static bool bounds_only(AggregateOp ops);
+
+    const AggregateResult &result() const { return acc; }
+
+private:
+    AggregateOp ops;
+    AggregateResult acc;
+};
+
+// Kernels, exposed for reuse by other read paths
+namespace aggregate_kernels
+{
+    // min, max and sum of px[0..n)
+    void price_stats(const double *px, size_t n, double &min, double &max, double &sum);
+    // sum of vol[0..n) and sum of px[i] * vol[i]
+    void volume_stats(const double *px, const uint64_t *vol, size_t n, uint64_t &volume, double &notional);
+}
+
+#endif // AGGREGATE_HPP
@@ -0,0 +1,233 @@
+#include "asof.hpp"
+#include "timeseries_db.hpp"
+#include <algorithm>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <queue>
+#include <stdexcept>
+#include <utility>
+
+namespace
+{
+    // One input's rows in [start, end], in timestamp order
+    class SeriesCursor
+    {
+    public:
+        SeriesCursor(const TimeSeriesDB &db, uint64_t start, uint64_t end) : view(db.view_range(start, end))
+        {
+            if (view.is_time_ordered())
+            {
+                chunks = view.views();
+            }
+            else
+            {
+                // Late ticks in the range: take the sorted copy instead
+                view = RangeView{};
+                auto rows = db.query_range(start, end);
+                timestamps.reserve(rows.size());
+                prices.reserve(rows.size());
+                volumes.reserve(rows.size());
+                for (const auto &[ts, price, volume] : rows)
+                {
+                    timestamps.push_back(ts);
+                    prices.push_back(price);
+                    volumes.push_back(volume);
+                }
+                ColumnView chunk;
+                chunk.timestamps = timestamps;
+                chunk.prices = prices;
+                chunk.volumes = volumes;
+                chunks.push_back(chunk);
+            }
+            skip_empty();
+        }
+
+        SeriesCursor(const SeriesCursor &) = delete; // chunks may point into this object
+        SeriesCursor &operator=(const SeriesCursor &) = delete;
+
+        bool valid() const { return chunk < chunks.size(); }
+        uint64_t timestamp() const { return chunks[chunk].timestamps[row]; }
+        double price() const { return chunks[chunk].prices[row]; }
+        uint64_t volume() const { return chunks[chunk].volumes[row]; }
+
+        void next()
+        {
+            if (++row == chunks[chunk].size())
+            {
+                ++chunk;
+                row = 0;
+                skip_empty();
+            }
+        }
+
+    private:
+        void skip_empty()
+        {
+            while (chunk < chunks.size() && chunks[chunk].empty())
+                ++chunk;
+        }
+
+        RangeView view; // Leases the spans chunks point into
+        std::vector<ColumnView> chunks;
+        size_t chunk = 0;
+        size_t row = 0;
+        std::vector<uint64_t> timestamps; // Sorted copy of an unordered range
+        std::vector<double> prices;
+        std::vector<uint64_t> volumes;
+    };
+
+    struct LatestTick
+    {
+        bool present = false;
+        uint64_t timestamp = 0;
+        double price = 0.0;
+        uint64_t volume = 0;
+    };
+
+    void clear(AsofBatch &batch)
+    {
+        batch.timestamps.clear();
+        for (auto &series : batch.series)
+        {
+            series.prices.clear();
+            series.volumes.clear();
+            series.tick_timestamps.clear();
+            series.present.clear();
+        }
+    }
+
+    void clear(MergeBatch &batch)
+    {
+        batch.inputs.clear();
+        batch.timestamps.clear();
+        batch.prices.clear();
+        batch.volumes.clear();
+    }
+}
+
+void query_asof(const std::vector<const TimeSeriesDB *> &stores, uint64_t start, uint64_t end,
+                const AsofOptions &options, const AsofCallback &callback)
+{
+    if (stores.empty())
+    {
+        throw std::invalid_argument("query_asof needs at least one symbol");
+    }
+    bool driven = options.step == 0;
+    if (driven && options.driver >= stores.size())
+    {
+        throw std::invalid_argument("query_asof driver " + std::to_string(options.driver) + " out of range for " +
+                                    std::to_string(stores.size()) + " symbols");
+    }
+    if (start > end)
+        return;
+
+    uint64_t from = start - std::min(options.lookback, start);
+    std::vector<std::unique_ptr<SeriesCursor>> cursors;
+    for (size_t i = 0; i < stores.size(); ++i)
+        cursors.push_back(std::make_unique<SeriesCursor>(*stores[i], driven && i == options.driver ? start : from, end));
+
+    std::vector<LatestTick> latest(stores.size());
+    size_t batch_rows = std::max<size_t>(1, options.batch_rows);
+    AsofBatch batch;
+    batch.series.resize(stores.size());
+
+    // Move every input (but the driver) past the ticks at or before t
+    auto advance = [&](uint64_t t)
+    {
+        for (size_t i = 0; i < cursors.size(); ++i)
+        {
+            if (driven && i == options.driver)
+                continue;
+            SeriesCursor &cursor = *cursors[i];
+            for (; cursor.valid() && cursor.timestamp() <= t; cursor.next())
+                latest[i] = LatestTick{true, cursor.timestamp(), cursor.price(), cursor.volume()};
+        }
+    };
+    auto emit = [&](uint64_t t)
+    {
+        batch.timestamps.push_back(t);
+        for (size_t i = 0; i < latest.size(); ++i)
+        {
+            const LatestTick &tick = latest[i];
+            bool match = tick.present && t - tick.timestamp <= options.tolerance;
+            AsofBatch::Series &series = batch.series[i];
+            series.prices.push_back(match ? tick.price : std::numeric_limits<double>::quiet_NaN());
+            series.volumes.push_back(match ? tick.volume : 0);
+            series.tick_timestamps.push_back(match ? tick.timestamp : 0);
+            series.present.push_back(match);
+        }
+        if (batch.size() == batch_rows)
+        {
+            callback(batch);
+            clear(batch);
+        }
+    };
+
+    if (driven)
+    {
+        SeriesCursor &driver = *cursors[options.driver];
+        for (; driver.valid(); driver.next())
+        {
+            uint64_t t = driver.timestamp();
+            latest[options.driver] = LatestTick{true, t, driver.price(), driver.volume()};
+            advance(t);
+            emit(t);
+        }
+    }
+    else
+    {
+        for (uint64_t t = start;; t += options.step)
+        {
+            advance(t);
+            emit(t);
+            if (end - t < options.step)
+                break;
+        }
+    }
+    if (batch.size() > 0)
+        callback(batch);
+}
+
+void query_merge(const std::vector<const TimeSeriesDB *> &stores, uint64_t start, uint64_t end,
+                 const MergeCallback &callback, size_t batch_rows)
+{
+    if (start > end)
+        return;
+    std::vector<std::unique_ptr<SeriesCursor>> cursors;
+    for (const TimeSeriesDB *store : stores)
+        cursors.push_back(std::make_unique<SeriesCursor>(*store, start, end));
+
+    // Smallest (timestamp, input) on top
+    using Head = std::pair<uint64_t, uint32_t>;
+    std::priority_queue<Head, std::vector<Head>, std::greater<Head>> heads;
+    for (uint32_t i = 0; i < cursors.size(); ++i)
+    {
+        if (cursors[i]->valid())
+            heads.emplace(cursors[i]->timestamp(), i);
+    }
+
+    batch_rows = std::max<size_t>(1, batch_rows);
+    MergeBatch batch;
+    while (!heads.empty())
+    {
+        uint32_t input = heads.top().second;
+        heads.pop();
+        SeriesCursor &cursor = *cursors[input];
+        batch.inputs.push_back(input);
+        batch.timestamps.push_back(cursor.timestamp());
+        batch.prices.push_back(cursor.price());
+        batch.volumes.push_back(cursor.volume());
+        cursor.next();
+        if (cursor.valid())
+            heads.emplace(cursor.timestamp(), input);
+
+        if (batch.size() == batch_rows)
+        {
+            callback(batch);
+            clear(batch);
+        }
+    }
+    if (batch.size() > 0)
+        callback(batch);
+}
@@ -0,0 +1,74 @@
+#ifndef ASOF_HPP
+#define ASOF_HPP
+
+#include "range_view.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <vector>
+
+class TimeSeriesDB;
+
+// Cross-symbol operators over time-ordered streams. Each input is read once,
+// front to back, from the column spans of a zero-copy range view; results
+// go to a callback in batches of at most batch_rows rows, so memory stays
+// bounded however long the range is. Inputs whose range holds late,
+// out-of-order ticks are the exception: they are copied and sorted first.
+
+struct AsofOptions
+{
+    // Rows are sampled every step time units from start (a regular grid).
+    // With step 0 every tick of symbols[driver] in [start, end] is a row.
+    uint64_t step = 0;
+    size_t driver = 0;
+    // A tick older than the row by more than this does not match
+    uint64_t tolerance = std::numeric_limits<uint64_t>::max();
+    // How far before start to look for the values in force at start
+    uint64_t lookback = 0;
+    size_t batch_rows = 4096;
+};
+
+// Rows of an as-of join: for each row time, the latest tick at or before
+// it of every input, in the order the inputs were given
+struct AsofBatch
+{
+    struct Series
+    {
+        std::vector<double> prices;
+        std::vector<uint64_t> volumes;
+        std::vector<uint64_t> tick_timestamps; // Of the tick matched
+        std::vector<uint8_t> present;          // 0: no tick within tolerance (price NaN)
+    };
+
+    std::vector<uint64_t> timestamps; // Grid points or driver ticks
+    std::vector<Series> series;
+
+    size_t size() const { return timestamps.size(); }
+};
+
+// Ticks of every input interleaved in timestamp order; ties keep the order
+// of the inputs
+struct MergeBatch
+{
+    std::vector<uint32_t> inputs; // Index into the symbols
+    std::vector<uint64_t> timestamps;
+    std::vector<double> prices;
+    std::vector<uint64_t> volumes;
+
+    size_t size() const { return timestamps.size(); }
+};
+
+using AsofCallback = std::function<void(const AsofBatch &)>;
+using MergeCallback = std::function<void(const MergeBatch &)>;
+
+// As-of join of the stores over [start, end]. Throws std::invalid_argument
+// on an empty input list or a driver index out of range.
+void query_asof(const std::vector<const TimeSeriesDB *> &stores, uint64_t start, uint64_t end,
+                const AsofOptions &options, const AsofCallback &callback);
+
+// k-way merge of the stores' ticks in [start, end]
+void query_merge(const std::vector<const TimeSeriesDB *> &stores, uint64_t start, uint64_t end,
+                 const MergeCallback &callback, size_t batch_rows = 4096);
+
+#endif // ASOF_HPP
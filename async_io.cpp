@@ -0,0 +1,490 @@
+#include "async_io.hpp"
+#include "metrics.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <linux/io_uring.h>
+#include <new>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <system_error>
+#include <unistd.h>
+
+namespace
+{
+    constexpr size_t DIRECT_ALIGNMENT = 4096; // Buffer alignment O_DIRECT needs on any device
+
+    // The whole block, or what is left of the file; -errno on failure
+    long pread_block(const BlockFile &file, size_t block, IoBlock &buffer)
+    {
+        size_t done = 0;
+        while (done < AsyncReader::BLOCK_BYTES)
+        {
+            ssize_t n = pread(file.get_fd(), buffer.data + done, AsyncReader::BLOCK_BYTES - done,
+                              static_cast<off_t>(block * AsyncReader::BLOCK_BYTES + done));
+            if (n < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                return -errno;
+            }
+            if (n == 0)
+                break;
+            done += static_cast<size_t>(n);
+        }
+        return static_cast<long>(done);
+    }
+
+    int uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags)
+    {
+        return static_cast<int>(syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, nullptr, 0));
+    }
+}
+
+BlockFile::BlockFile(const std::string &path) : path(path)
+{
+    static std::atomic<uint64_t> next_id{1};
+    id = next_id.fetch_add(1, std::memory_order_relaxed);
+
+    fd = open(path.c_str(), O_RDONLY | O_CLOEXEC | O_DIRECT);
+    direct = fd != -1;
+    if (fd == -1 && errno == EINVAL)
+    {
+        // tmpfs and some network filesystems refuse O_DIRECT
+        fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    }
+    if (fd == -1)
+    {
+        throw std::system_error(errno, std::generic_category(), "Failed to open " + path);
+    }
+}
+
+BlockFile::~BlockFile()
+{
+    close(fd);
+}
+
+IoBlock::IoBlock() : data(static_cast<char *>(std::aligned_alloc(DIRECT_ALIGNMENT, AsyncReader::BLOCK_BYTES)))
+{
+    if (!data)
+        throw std::bad_alloc();
+}
+
+IoBlock::~IoBlock()
+{
+    std::free(data);
+}
+
+// Submission and completion queues mapped from the kernel. Only the thread
+// holding submit_mutex writes the SQ tail; only the reaper moves the CQ head.
+struct AsyncReader::Ring
+{
+    explicit Ring(unsigned depth)
+    {
+        io_uring_params params{};
+        fd = static_cast<int>(syscall(__NR_io_uring_setup, depth, &params));
+        if (fd == -1)
+        {
+            throw std::system_error(errno, std::generic_category(), "io_uring_setup failed");
+        }
+        // In flight at once: the reaper frees slots before it has consumed
+        // the completions, so the CQ must hold two rounds (the default)
+        entries = std::min(params.sq_entries, params.cq_entries / 2);
+        try
+        {
+            map_queues(params);
+        }
+        catch (...)
+        {
+            release();
+            throw;
+        }
+    }
+
+    ~Ring() { release(); }
+
+    Ring(const Ring &) = delete;
+    Ring &operator=(const Ring &) = delete;
+
+    void map_queues(const io_uring_params &params)
+    {
+        sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cq_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        bool single = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+        if (single)
+            sq_size = cq_size = std::max(sq_size, cq_size);
+        sq_ring = map(sq_size, IORING_OFF_SQ_RING);
+        cq_ring = single ? sq_ring : map(cq_size, IORING_OFF_CQ_RING);
+        sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+        sqes = static_cast<io_uring_sqe *>(map(sqes_size, IORING_OFF_SQES));
+
+        char *sq = static_cast<char *>(sq_ring);
+        sq_tail = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+        sq_mask = *reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+        sq_array = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+        char *cq = static_cast<char *>(cq_ring);
+        cq_head = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+        cq_tail = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+        cq_mask = *reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+        cqes = reinterpret_cast<io_uring_cqe *>(cq + params.cq_off.cqes);
+    }
+
+    void *map(size_t length, off_t offset)
+    {
+        void *addr = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, offset);
+        if (addr == MAP_FAILED)
+        {
+            throw std::system_error(errno, std::generic_category(), "Failed to map the io_uring queues");
+        }
+        return addr;
+    }
+
+    void release()
+    {
+        if (sqes)
+            munmap(sqes, sqes_size);
+        if (cq_ring && cq_ring != sq_ring)
+            munmap(cq_ring, cq_size);
+        if (sq_ring)
+            munmap(sq_ring, sq_size);
+        close(fd);
+    }
+
+    // Queue one SQE; the caller makes sure a slot is free
+    void push(uint8_t opcode, int file_fd, void *buffer, unsigned length, uint64_t offset, uint64_t user_data)
+    {
+        unsigned tail = *sq_tail;
+        unsigned index = tail & sq_mask;
+        io_uring_sqe &sqe = sqes[index];
+        std::memset(&sqe, 0, sizeof(sqe));
+        sqe.opcode = opcode;
+        sqe.fd = file_fd;
+        sqe.addr = reinterpret_cast<uint64_t>(buffer);
+        sqe.len = length;
+        sqe.off = offset;
+        sqe.user_data = user_data;
+        sq_array[index] = index;
+        std::atomic_ref<unsigned>(*sq_tail).store(tail + 1, std::memory_order_release);
+    }
+
+    // Hand count queued SQEs to the kernel
+    void submit(unsigned count)
+    {
+        while (count > 0)
+        {
+            int submitted = uring_enter(fd, count, 0, 0);
+            if (submitted < 0)
+            {
+                if (errno == EINTR || errno == EAGAIN || errno == EBUSY)
+                    continue;
+                throw std::system_error(errno, std::generic_category(), "io_uring_enter failed");
+            }
+            count -= static_cast<unsigned>(submitted);
+        }
+    }
+
+    int fd = -1;
+    unsigned entries = 0;
+    void *sq_ring = nullptr;
+    void *cq_ring = nullptr;
+    size_t sq_size = 0;
+    size_t cq_size = 0;
+    io_uring_sqe *sqes = nullptr;
+    size_t sqes_size = 0;
+    unsigned *sq_tail = nullptr;
+    unsigned sq_mask = 0;
+    unsigned *sq_array = nullptr;
+    unsigned *cq_head = nullptr;
+    unsigned *cq_tail = nullptr;
+    unsigned cq_mask = 0;
+    io_uring_cqe *cqes = nullptr;
+};
+
+AsyncReader &AsyncReader::global()
+{
+    // Never destroyed, like QueryPool::global()
+    static AsyncReader *instance = new AsyncReader();
+    return *instance;
+}
+
+AsyncReader::AsyncReader(const IoOptions &options) : options(options)
+{
+    if (options.backend != IoBackend::Pread)
+    {
+        try
+        {
+            ring = std::make_unique<Ring>(std::max(1u, options.queue_depth));
+            active = IoBackend::IoUring;
+        }
+        catch (const std::system_error &)
+        {
+            // Old kernels and seccomp filters (ENOSYS, EPERM)
+            if (options.backend == IoBackend::IoUring)
+                throw;
+        }
+    }
+
+    if (active == IoBackend::IoUring)
+    {
+        threads.emplace_back(&AsyncReader::reap_loop, this);
+    }
+    else
+    {
+        for (size_t i = 0; i < std::max<size_t>(1, options.pread_threads); ++i)
+            threads.emplace_back(&AsyncReader::pread_loop, this);
+    }
+}
+
+AsyncReader::~AsyncReader()
+{
+    // Reads still in flight complete first, so their futures are fulfilled
+    if (active == IoBackend::IoUring)
+    {
+        std::unique_lock<std::mutex> lock(submit_mutex);
+        ring_space.wait(lock, [this]
+                        { return in_flight < ring->entries; });
+        ring->push(IORING_OP_NOP, -1, nullptr, 0, 0, 0);
+        ++in_flight;
+        ring->submit(1);
+    }
+    else
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        stopping = true;
+    }
+    queue_ready.notify_all();
+    for (auto &thread : threads)
+        thread.join();
+}
+
+std::vector<IoFuture> AsyncReader::read(const std::vector<BlockRequest> &requests)
+{
+    std::vector<IoFuture> futures;
+    futures.reserve(requests.size());
+    std::vector<Pending *> batch;
+    Metrics &metrics = Metrics::global();
+    {
+        std::lock_guard<std::mutex> lock(cache_mutex);
+        for (const auto &request : requests)
+        {
+            Key key{request.file->get_id(), request.block};
+            auto it = cache.find(key);
+            if (it != cache.end())
+            {
+                lru.splice(lru.begin(), lru, it->second.lru);
+                futures.push_back(it->second.future);
+                metrics.io_cache_hits.add();
+                continue;
+            }
+
+            auto pending = std::make_unique<Pending>();
+            pending->file = request.file;
+            pending->block = request.block;
+            pending->buffer = std::make_shared<IoBlock>();
+            pending->ticket = next_ticket++;
+            futures.push_back(pending->promise.get_future().share());
+            if (options.cache_bytes > 0)
+            {
+                lru.push_front(key);
+                cache.emplace(key, CacheEntry{futures.back(), lru.begin(), pending->ticket});
+                while (cache.size() * BLOCK_BYTES > options.cache_bytes)
+                {
+                    // A read still in flight only loses its cache slot
+                    cache.erase(lru.back());
+                    lru.pop_back();
+                }
+            }
+            batch.push_back(pending.release());
+        }
+    }
+    if (!batch.empty())
+        dispatch(batch);
+    return futures;
+}
+
+void AsyncReader::dispatch(std::vector<Pending *> &batch)
+{
+    uint64_t now = metrics_now();
+    for (Pending *pending : batch)
+        pending->submitted_ns = now;
+    Metrics::global().io_block_reads.add(batch.size());
+
+    if (active == IoBackend::IoUring)
+    {
+        submit_ring(batch);
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        queue.insert(queue.end(), batch.begin(), batch.end());
+    }
+    if (batch.size() == 1)
+        queue_ready.notify_one();
+    else
+        queue_ready.notify_all();
+}
+
+void AsyncReader::submit_ring(std::vector<Pending *> &batch)
+{
+    // Capping what is in flight (see Ring) means no completion is dropped
+    std::unique_lock<std::mutex> lock(submit_mutex);
+    unsigned queued = 0;
+    for (Pending *pending : batch)
+    {
+        if (in_flight == ring->entries)
+        {
+            ring->submit(queued);
+            queued = 0;
+            ring_space.wait(lock, [this]
+                            { return in_flight < ring->entries; });
+        }
+        ring->push(IORING_OP_READ, pending->file->get_fd(), pending->buffer->data, BLOCK_BYTES,
+                   pending->block * BLOCK_BYTES, reinterpret_cast<uint64_t>(pending));
+        ++in_flight;
+        ++queued;
+    }
+    ring->submit(queued);
+}
+
+void AsyncReader::reap_loop()
+{
+    bool stop = false;
+    while (true)
+    {
+        if (uring_enter(ring->fd, 0, 1, IORING_ENTER_GETEVENTS) < 0 && errno != EINTR)
+        {
+            std::cerr << "WARNING: io_uring wait failed: " << std::strerror(errno) << std::endl;
+        }
+
+        unsigned head = *ring->cq_head;
+        unsigned tail = std::atomic_ref<unsigned>(*ring->cq_tail).load(std::memory_order_acquire);
+        unsigned reaped = tail - head;
+        if (reaped == 0)
+            continue;
+
+        // Every request completed here was queued under submit_mutex, so
+        // taking it also orders its Pending before the reads below (the
+        // kernel's own ordering is invisible to the compiler and to TSan).
+        // The slots free up now; the CQ has room for a second ring's worth.
+        bool idle;
+        {
+            std::lock_guard<std::mutex> lock(submit_mutex);
+            in_flight -= reaped;
+            idle = in_flight == 0;
+        }
+        ring_space.notify_all();
+
+        for (; head != tail; ++head)
+        {
+            const io_uring_cqe &cqe = ring->cqes[head & ring->cq_mask];
+            auto *pending = reinterpret_cast<Pending *>(cqe.user_data);
+            long result = cqe.res;
+            if (!pending)
+            {
+                stop = true;
+                continue;
+            }
+            if (result == -EAGAIN || result == -EINTR)
+                result = pread_block(*pending->file, pending->block, *pending->buffer);
+            complete(pending, result);
+        }
+        std::atomic_ref<unsigned>(*ring->cq_head).store(head, std::memory_order_release);
+        if (stop && idle)
+            return;
+    }
+}
+
+void AsyncReader::pread_loop()
+{
+    while (true)
+    {
+        Pending *pending;
+        {
+            std::unique_lock<std::mutex> lock(queue_mutex);
+            queue_ready.wait(lock, [this]
+                             { return stopping || !queue.empty(); });
+            if (queue.empty())
+                return;
+            pending = queue.front();
+            queue.pop_front();
+        }
+        complete(pending, pread_block(*pending->file, pending->block, *pending->buffer));
+    }
+}
+
+void AsyncReader::complete(Pending *pending, long result)
+{
+    std::unique_ptr<Pending> owned(pending);
+    Metrics &metrics = Metrics::global();
+    metrics.io_read_latency_ns.record(metrics_now() - pending->submitted_ns);
+    if (result < 0)
+    {
+        forget(*pending);
+        pending->promise.set_exception(std::make_exception_ptr(std::system_error(
+            static_cast<int>(-result), std::generic_category(), "Failed to read " + pending->file->get_path())));
+        return;
+    }
+    pending->buffer->bytes = static_cast<size_t>(result);
+    metrics.io_bytes_read.add(static_cast<uint64_t>(result));
+    pending->promise.set_value(std::move(pending->buffer));
+}
+
+void AsyncReader::forget(const Pending &pending)
+{
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    auto it = cache.find(Key{pending.file->get_id(), pending.block});
+    if (it != cache.end() && it->second.ticket == pending.ticket)
+    {
+        lru.erase(it->second.lru);
+        cache.erase(it);
+    }
+}
+
+void IoBatch::read(const std::shared_ptr<const BlockFile> &file, uint64_t offset, size_t length,
+                   std::function<void(const char *)> on_ready)
+{
+    size_t block = offset / AsyncReader::BLOCK_BYTES;
+    if (length == 0 || (offset + length - 1) / AsyncReader::BLOCK_BYTES != block)
+    {
+        throw std::invalid_argument("Read of " + std::to_string(length) + " bytes at " + std::to_string(offset) +
+                                    " crosses a block boundary");
+    }
+
+    auto [it, inserted] = request_index[file.get()].try_emplace(block, requests.size());
+    if (inserted)
+        requests.push_back(BlockRequest{file, block});
+    reads.push_back(Read{it->second, offset - block * AsyncReader::BLOCK_BYTES, length, std::move(on_ready)});
+}
+
+void IoBatch::wait(ViewLeases &leases)
+{
+    if (reads.empty())
+        return;
+
+    std::vector<IoFuture> futures = (reader ? *reader : AsyncReader::global()).read(requests);
+    std::vector<IoBlockRef> blocks;
+    blocks.reserve(futures.size());
+    for (auto &future : futures)
+        blocks.push_back(future.get());
+
+    for (const Read &read : reads)
+    {
+        const IoBlock &block = *blocks[read.request];
+        if (read.offset + read.length > block.bytes)
+        {
+            throw std::runtime_error("Short read of " + requests[read.request].file->get_path());
+        }
+        read.on_ready(block.data + read.offset);
+    }
+    for (auto &block : blocks)
+        leases.push_back(std::move(block));
+
+    requests.clear();
+    request_index.clear();
+    reads.clear();
+}
@@ -0,0 +1,200 @@
+#ifndef ASYNC_IO_HPP
+#define ASYNC_IO_HPP
+
+#include "range_view.hpp"
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <future>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// How AsyncReader talks to the disk
+enum class IoBackend
+{
+    Auto,    // io_uring, or Pread where the kernel refuses it
+    IoUring, // One submission/completion ring shared by every query
+    Pread    // Worker threads blocking in pread()
+};
+
+struct IoOptions
+{
+    IoBackend backend = IoBackend::Auto;
+    unsigned queue_depth = 256;    // Reads in flight at once (ring entries)
+    size_t pread_threads = 4;      // Pread backend
+    size_t cache_bytes = 64 << 20; // Block cache; 0 disables it
+};
+
+// A file opened for block reads: O_DIRECT where the filesystem supports
+// it, so cold reads neither fault in a mapping nor fill the page cache
+class BlockFile
+{
+public:
+    // Throws std::system_error if the file cannot be opened
+    explicit BlockFile(const std::string &path);
+    ~BlockFile();
+
+    BlockFile(const BlockFile &) = delete;
+    BlockFile &operator=(const BlockFile &) = delete;
+
+    int get_fd() const { return fd; }
+    uint64_t get_id() const { return id; } // Unique for the life of the process
+    bool is_direct() const { return direct; }
+    const std::string &get_path() const { return path; }
+
+private:
+    std::string path;
+    int fd = -1;
+    uint64_t id;
+    bool direct = false;
+};
+
+// One aligned block of a file as read from disk; shorter than BLOCK_BYTES
+// only at the end of the file
+struct IoBlock
+{
+    IoBlock();
+    ~IoBlock();
+
+    IoBlock(const IoBlock &) = delete;
+    IoBlock &operator=(const IoBlock &) = delete;
+
+    char *data;
+    size_t bytes = 0;
+};
+
+using IoBlockRef = std::shared_ptr<const IoBlock>;
+using IoFuture = std::shared_future<IoBlockRef>;
+
+struct BlockRequest
+{
+    std::shared_ptr<const BlockFile> file;
+    size_t block; // Bytes [block * BLOCK_BYTES, (block + 1) * BLOCK_BYTES)
+};
+
+// Asynchronous block reads for cold data. read() queues a batch of blocks
+// and submits them with one system call, so a query has all of its blocks
+// in flight at once and concurrent queries overlap their I/O instead of
+// each stalling on page faults. Completions arrive on a reaper thread that
+// fulfils the futures. Blocks stay in a small LRU cache, which also shares
+// a read in flight between queries that want the same block.
+class AsyncReader
+{
+public:
+    static constexpr size_t BLOCK_BYTES = 64 * 1024;
+
+    // Default options, started on first use
+    static AsyncReader &global();
+
+    // Throws std::system_error if IoBackend::IoUring is asked for and the
+    // ring cannot be set up
+    explicit AsyncReader(const IoOptions &options = IoOptions{});
+    ~AsyncReader();
+
+    AsyncReader(const AsyncReader &) = delete;
+    AsyncReader &operator=(const AsyncReader &) = delete;
+
+    // Futures in request order. A failed read holds a std::system_error.
+    std::vector<IoFuture> read(const std::vector<BlockRequest> &requests);
+
+    IoBackend backend() const { return active; }
+
+private:
+    struct Pending
+    {
+        std::promise<IoBlockRef> promise;
+        std::shared_ptr<const BlockFile> file;
+        size_t block = 0;
+        std::shared_ptr<IoBlock> buffer;
+        uint64_t submitted_ns = 0;
+        uint64_t ticket = 0; // Matches the cache entry it created
+    };
+
+    struct Key
+    {
+        uint64_t file;
+        size_t block;
+        bool operator==(const Key &) const = default;
+    };
+    struct KeyHash
+    {
+        size_t operator()(const Key &key) const { return std::hash<uint64_t>{}(key.file * 0x9E3779B97F4A7C15ull ^ key.block); }
+    };
+    struct CacheEntry
+    {
+        IoFuture future;
+        std::list<Key>::iterator lru;
+        uint64_t ticket;
+    };
+
+    struct Ring; // io_uring state, in async_io.cpp
+
+    void submit_ring(std::vector<Pending *> &batch);
+    void reap_loop();
+    void pread_loop();
+    void dispatch(std::vector<Pending *> &batch);
+    void complete(Pending *pending, long result);
+    void forget(const Pending &pending); // Drop a failed read from the cache
+
+    IoOptions options;
+    IoBackend active = IoBackend::Pread;
+
+    std::unique_ptr<Ring> ring;
+    std::mutex submit_mutex;
+    std::condition_variable ring_space;
+    unsigned in_flight = 0; // Guarded by submit_mutex
+
+    std::mutex queue_mutex; // Pread backend
+    std::condition_variable queue_ready;
+    std::deque<Pending *> queue;
+    bool stopping = false;
+    std::vector<std::thread> threads;
+
+    std::mutex cache_mutex;
+    std::unordered_map<Key, CacheEntry, KeyHash> cache;
+    std::list<Key> lru; // Most recent first
+    uint64_t next_ticket = 1;
+};
+
+// The reads of one query, submitted together: a range over several
+// partitions puts the blocks of all of them in flight before waiting on any
+class IoBatch
+{
+public:
+    IoBatch() = default; // AsyncReader::global(), started only if there is something to read
+    explicit IoBatch(AsyncReader &reader) : reader(&reader) {}
+
+    // Queue bytes [offset, offset + length) of file, which must not cross a
+    // block boundary. on_ready gets their address once wait() has them.
+    void read(const std::shared_ptr<const BlockFile> &file, uint64_t offset, size_t length,
+              std::function<void(const char *)> on_ready);
+
+    bool empty() const { return reads.empty(); }
+
+    // Submit, wait for every block, run the callbacks and add the blocks to
+    // leases. Rethrows the first failed read.
+    void wait(ViewLeases &leases);
+
+private:
+    struct Read
+    {
+        size_t request;
+        size_t offset; // Within the block
+        size_t length;
+        std::function<void(const char *)> on_ready;
+    };
+
+    AsyncReader *reader = nullptr;
+    std::vector<BlockRequest> requests; // Distinct blocks
+    std::unordered_map<const BlockFile *, std::unordered_map<size_t, size_t>> request_index;
+    std::vector<Read> reads;
+};
+
+#endif // ASYNC_IO_HPP
@@ -0,0 +1,538 @@
+#include "timeseries_db.hpp"
+#include "bulk_import.hpp"
+#include "schema.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fcntl.h>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <thread>
+#include <unistd.h>
+
+// Benchmark suite for make bench. Every scenario runs against a scratch
+// data directory and reports into one JSON document, so runs from two
+// builds can be diffed for regressions.
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+double elapsed_ns(Clock::time_point start) {
+    return std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+}
+
+// Operations per second; 0 when the run was too short to time
+double rate(size_t ops, double ns) {
+    return ns > 0 ? ops * 1e9 / ns : 0.0;
+}
+
+struct Settings {
+    std::string dir = "bench_data";
+    std::string out;            // Empty: JSON to stdout
+    size_t ticks = 1000000;     // Rows in the query data set
+    size_t latency_samples = 20000;
+    size_t producers = 4;
+    size_t queries = 2000;
+    bool check = false;         // Consistency checks only, for make test
+};
+
+// Minimal JSON writer: nested objects of numbers and strings
+class JsonWriter {
+public:
+    JsonWriter() { out.precision(12); }
+
+    void begin(const std::string& name = "") {
+        key(name);
+        out << "{";
+        first = true;
+        ++depth;
+    }
+    void end() {
+        --depth;
+        out << "\n" << std::string(depth * 2, ' ') << "}";
+        first = false;
+    }
+    void number(const std::string& name, double value) {
+        key(name);
+        out << value;
+    }
+    void string(const std::string& name, const std::string& value) {
+        key(name);
+        out << '"' << value << '"';
+    }
+    std::string str() const { return out.str(); }
+
+private:
+    void key(const std::string& name) {
+        if (!first)
+            out << ",";
+        first = false;
+        if (!name.empty())
+            out << "\n" << std::string(depth * 2, ' ') << '"' << name << "\": ";
+    }
+
+    std::ostringstream out;
+    bool first = true;
+    size_t depth = 0;
+};
+
+// p50/p99/p999 of ns samples, microseconds in the output
+void percentiles(JsonWriter& json, const std::string& name, std::vector<double> samples) {
+    json.begin(name);
+    if (!samples.empty()) {
+        std::sort(samples.begin(), samples.end());
+        auto at = [&](double q) { return samples[std::min(samples.size() - 1, static_cast<size_t>(q * samples.size()))] / 1000.0; };
+        json.number("samples", samples.size());
+        json.number("p50_us", at(0.50));
+        json.number("p99_us", at(0.99));
+        json.number("p999_us", at(0.999));
+        json.number("max_us", samples.back() / 1000.0);
+    }
+    json.end();
+}
+
+std::vector<Tick> make_ticks(size_t count, uint64_t first_ts, uint64_t seed) {
+    std::mt19937_64 gen(seed);
+    std::vector<Tick> ticks;
+    ticks.reserve(count);
+    double price = 100.0;
+    for (size_t i = 0; i < count; ++i) {
+        // Random walk in cent steps, like a quoted price
+        price = std::max(1.0, price + (static_cast<int>(gen() % 5) - 2) * 0.01);
+        ticks.push_back({first_ts + i, price, 100 + gen() % 10000});
+    }
+    return ticks;
+}
+
+// Drop the page cache for every column file under path (they are clean
+// after a close, so DONTNEED evicts them)
+void evict_page_cache(const std::string& path) {
+    for (const auto& entry : std::filesystem::recursive_directory_iterator(path)) {
+        if (!entry.is_regular_file())
+            continue;
+        int fd = open(entry.path().c_str(), O_RDONLY);
+        if (fd == -1)
+            continue;
+        fdatasync(fd);
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+        close(fd);
+    }
+}
+
+void bench_append_latency(JsonWriter& json, const Settings& settings) {
+    std::filesystem::remove_all(settings.dir);
+    TimeSeriesDB db(settings.dir, "LATENCY");
+    auto ticks = make_ticks(settings.latency_samples, 1, 1);
+
+    // Cost of the call itself: publishing into the ring
+    std::vector<double> enqueue;
+    enqueue.reserve(ticks.size());
+    for (const auto& tick : ticks) {
+        auto start = Clock::now();
+        db.append(tick.timestamp, tick.price, tick.volume);
+        enqueue.push_back(elapsed_ns(start));
+    }
+    db.sync();
+
+    // Round trip until the tick is applied to the columns
+    size_t round_trips = std::min<size_t>(settings.latency_samples, 5000);
+    std::vector<double> applied;
+    applied.reserve(round_trips);
+    for (size_t i = 0; i < round_trips; ++i) {
+        auto start = Clock::now();
+        db.append(ticks.size() + i + 1, 100.0, 1);
+        db.sync();
+        applied.push_back(elapsed_ns(start));
+    }
+
+    json.begin("append_latency");
+    percentiles(json, "enqueue", enqueue);
+    percentiles(json, "applied", applied);
+    json.end();
+}
+
+void bench_ingest(JsonWriter& json, const Settings& settings) {
+    std::filesystem::remove_all(settings.dir);
+    TimeSeriesDB db(settings.dir, "INGEST");
+
+    // Each producer owns an interleaved slice of one timestamp sequence
+    size_t per_producer = settings.ticks / settings.producers;
+    std::vector<std::vector<Tick>> batches(settings.producers);
+    for (size_t p = 0; p < settings.producers; ++p)
+        batches[p] = make_ticks(per_producer, 1 + p * per_producer, p + 2);
+
+    auto start = Clock::now();
+    std::vector<std::thread> producers;
+    for (size_t p = 0; p < settings.producers; ++p) {
+        producers.emplace_back([&, p] {
+            const auto& mine = batches[p];
+            for (size_t i = 0; i < mine.size(); i += 1000) {
+                std::vector<Tick> chunk(mine.begin() + i, mine.begin() + std::min(mine.size(), i + 1000));
+                db.append_batch(chunk);
+            }
+        });
+    }
+    for (auto& producer : producers)
+        producer.join();
+    db.sync();
+    double ns = elapsed_ns(start);
+
+    json.begin("ingest");
+    json.number("producers", settings.producers);
+    json.number("ticks", per_producer * settings.producers);
+    json.number("seconds", ns / 1e9);
+    json.number("ticks_per_second", rate(per_producer * settings.producers, ns));
+    json.end();
+}
+
+// Bulk loader on the same rows, as CSV and as binary records
+void bench_bulk_import(JsonWriter& json, const Settings& settings) {
+    std::filesystem::remove_all(settings.dir);
+    std::filesystem::create_directories(settings.dir);
+    auto ticks = make_ticks(settings.ticks, 1, 7);
+    std::string csv_path = settings.dir + "/import.csv";
+    std::string bin_path = settings.dir + "/import.bin";
+    {
+        std::ofstream csv(csv_path);
+        csv << "timestamp,price,volume\n";
+        for (const auto& tick : ticks)
+            csv << tick.timestamp << "," << tick.price << "," << tick.volume << "\n";
+        std::ofstream bin(bin_path, std::ios::binary);
+        bin.write(reinterpret_cast<const char*>(ticks.data()), ticks.size() * sizeof(Tick));
+    }
+
+    json.begin("bulk_import");
+    for (ImportFormat format : {ImportFormat::Csv, ImportFormat::Binary}) {
+        std::string symbol = format == ImportFormat::Csv ? "IMPORT_CSV" : "IMPORT_BIN";
+        TimeSeriesDB db(settings.dir, symbol);
+        ImportOptions options;
+        options.format = format;
+        auto start = Clock::now();
+        ImportResult result = bulk_import(db, format == ImportFormat::Csv ? csv_path : bin_path, options);
+        double ns = elapsed_ns(start);
+
+        json.begin(format == ImportFormat::Csv ? "csv" : "binary");
+        json.number("ticks", result.rows);
+        json.number("seconds", ns / 1e9);
+        json.number("ticks_per_second", rate(result.rows, ns));
+        json.end();
+    }
+    json.end();
+}
+
+// QuoteSchema through TypedStore: column-wise appends in chunks, then a
+// scan of one packed column straight out of a view
+void bench_typed_store(JsonWriter& json, const Settings& settings) {
+    std::filesystem::remove_all(settings.dir);
+    std::mt19937_64 gen(11);
+    size_t rows = settings.ticks;
+    std::vector<uint64_t> ts(rows);
+    std::vector<float> bid(rows), ask(rows);
+    std::vector<uint32_t> bid_size(rows), ask_size(rows);
+    std::vector<uint8_t> exchange(rows), conditions(rows);
+    float mid = 100.0f;
+    for (size_t i = 0; i < rows; ++i) {
+        mid = std::max(1.0f, mid + (static_cast<int>(gen() % 5) - 2) * 0.01f);
+        ts[i] = 1 + i;
+        bid[i] = mid - 0.01f;
+        ask[i] = mid + 0.01f;
+        bid_size[i] = 100 + gen() % 1000;
+        ask_size[i] = 100 + gen() % 1000;
+        exchange[i] = gen() % 16;
+        conditions[i] = gen() % 4;
+    }
+
+    TypedStore<QuoteSchema> quotes(settings.dir, "QUOTES");
+    auto start = Clock::now();
+    for (size_t i = 0; i < rows; i += 10000) {
+        size_t n = std::min<size_t>(10000, rows - i);
+        quotes.append_columns(n, &ts[i], &bid[i], &ask[i], &bid_size[i], &ask_size[i], &exchange[i],
+                              &conditions[i]);
+    }
+    quotes.flush();
+    double append_ns = elapsed_ns(start);
+
+    start = Clock::now();
+    auto view = quotes.view_range(0, std::numeric_limits<uint64_t>::max());
+    double spread = 0;
+    auto bids = view.column<"bid">();
+    auto asks = view.column<"ask">();
+    for (size_t i = 0; i < view.size(); ++i)
+        spread += asks[i] - bids[i];
+    double scan_ns = elapsed_ns(start);
+    if (view.size() != rows)
+        std::cerr << "WARNING: typed scan saw " << view.size() << " of " << rows << " rows" << std::endl;
+
+    json.begin("typed_store");
+    json.number("rows", rows);
+    json.number("row_bytes", QuoteSchema::row_bytes);
+    json.number("append_rows_per_second", rate(rows, append_ns));
+    json.number("scan_rows_per_second", rate(view.size(), scan_ns));
+    json.number("mean_spread", view.empty() ? 0.0 : spread / view.size());
+    json.end();
+}
+
+// One data set shared by the query, cold-start and page-cache scenarios
+void load_query_data(const Settings& settings) {
+    std::filesystem::remove_all(settings.dir);
+    TimeSeriesDB db(settings.dir, "QUERY");
+    auto ticks = make_ticks(settings.ticks, 1, 42);
+    for (size_t i = 0; i < ticks.size(); i += 10000) {
+        std::vector<Tick> chunk(ticks.begin() + i, ticks.begin() + std::min(ticks.size(), i + 10000));
+        db.append_batch(chunk);
+    }
+    db.sync();
+}
+
+void bench_queries(JsonWriter& json, const Settings& settings) {
+    TimeSeriesDB db(settings.dir, "QUERY");
+    std::mt19937_64 gen(7);
+    uint64_t span = settings.ticks;
+
+    auto run = [&](const std::string& name, uint64_t width, const QueryOptions& query = QueryOptions{}) {
+        std::vector<double> samples;
+        for (size_t q = 0; q < settings.queries; ++q) {
+            uint64_t first = 1 + gen() % std::max<uint64_t>(1, span - std::min(span - 1, width));
+            auto start = Clock::now();
+            db.query_range(first, first + width - 1, query);
+            samples.push_back(elapsed_ns(start));
+        }
+        percentiles(json, name, samples);
+    };
+
+    json.begin("range_query");
+    run("narrow_100", 100);
+    run("wide_10pct", std::max<uint64_t>(1, span / 10));
+    QueryOptions parallel;
+    parallel.parallelism = 0;
+    run("wide_10pct_parallel", std::max<uint64_t>(1, span / 10), parallel);
+    json.end();
+
+    json.begin("query_last");
+    for (size_t n : {100, 10000}) {
+        std::vector<double> samples;
+        for (size_t q = 0; q < settings.queries; ++q) {
+            auto start = Clock::now();
+            db.query_last(n);
+            samples.push_back(elapsed_ns(start));
+        }
+        percentiles(json, "n_" + std::to_string(n), samples);
+    }
+    json.end();
+
+    json.begin("aggregate");
+    for (size_t parallelism : {1, 0}) {
+        QueryOptions query;
+        query.parallelism = parallelism;
+        std::vector<double> samples;
+        for (size_t q = 0; q < std::min<size_t>(settings.queries, 200); ++q) {
+            auto start = Clock::now();
+            db.aggregate_range(0, std::numeric_limits<uint64_t>::max(), AggregateOp::All, query);
+            samples.push_back(elapsed_ns(start));
+        }
+        percentiles(json, parallelism == 1 ? "full_range" : "full_range_parallel", samples);
+    }
+    json.end();
+}
+
+void bench_cold_start(JsonWriter& json, const Settings& settings) {
+    auto time_open = [&] {
+        auto start = Clock::now();
+        TimeSeriesDB db(settings.dir, "QUERY");
+        return elapsed_ns(start) / 1e6;
+    };
+
+    json.begin("cold_start");
+    json.number("rows", settings.ticks);
+    json.number("open_persisted_index_ms", time_open());
+    // Without block_index.bin the segment rebuilds the index from the columns
+    std::filesystem::remove(settings.dir + "/QUERY/" + BlockIndex::FILE_NAME);
+    json.number("open_rebuild_index_ms", time_open());
+    json.end();
+}
+
+void bench_page_cache(JsonWriter& json, const Settings& settings) {
+    TimeSeriesDB db(settings.dir, "QUERY");
+    auto full_scan = [&](bool prefetch = false) {
+        QueryOptions query;
+        query.prefetch = prefetch;
+        auto start = Clock::now();
+        AggregateResult result = db.aggregate_range(0, std::numeric_limits<uint64_t>::max(), AggregateOp::All, query);
+        double ns = elapsed_ns(start);
+        if (result.count != settings.ticks)
+            std::cerr << "WARNING: scan saw " << result.count << " of " << settings.ticks << " rows" << std::endl;
+        return ns;
+    };
+
+    evict_page_cache(settings.dir + "/QUERY");
+    double cold = full_scan();
+    double warm = full_scan();
+    evict_page_cache(settings.dir + "/QUERY");
+    double cold_prefetch = full_scan(true);
+
+    json.begin("page_cache_scan");
+    json.number("rows", settings.ticks);
+    json.number("cold_ms", cold / 1e6);
+    json.number("warm_ms", warm / 1e6);
+    json.number("cold_prefetch_ms", cold_prefetch / 1e6);
+    json.number("cold_rows_per_second", rate(settings.ticks, cold));
+    json.number("warm_rows_per_second", rate(settings.ticks, warm));
+    json.end();
+}
+
+// A read_only reader next to a live writer whose reorder window sends some
+// ticks to out-of-order segments, in both layouts. The reader has to return
+// exactly what the writer holds; a mismatch throws and fails the run.
+void bench_read_only(JsonWriter& json, const Settings& settings) {
+    const uint64_t all = std::numeric_limits<uint64_t>::max();
+    json.begin("read_only_follow");
+    for (uint64_t partition_duration : {uint64_t{0}, uint64_t{10000}}) {
+        std::filesystem::remove_all(settings.dir);
+        DBOptions options;
+        options.partition_duration = partition_duration;
+        options.reorder_window = 100;
+        options.merge_late_segments = false; // Keep the late rows where they landed
+        TimeSeriesDB writer(settings.dir, "FOLLOW", options);
+        DBOptions reader_options = options;
+        reader_options.read_only = true;
+        std::string layout = partition_duration == 0 ? "single_segment" : "partitioned";
+
+        auto compare = [&](TimeSeriesDB& reader, const std::string& stage) {
+            uint64_t quarter = settings.ticks / 4;
+            size_t expected = writer.get_count();
+            size_t expected_range = writer.query_range(quarter, 2 * quarter).size();
+            AggregateResult expected_agg = writer.aggregate_range(0, all);
+            size_t count = reader.get_count();
+            size_t rows = reader.query_range(0, all).size();
+            size_t range = reader.query_range(quarter, 2 * quarter).size();
+            AggregateResult agg = reader.aggregate_range(0, all);
+            if (count != expected || rows != expected || range != expected_range ||
+                agg.count != expected_agg.count || agg.volume != expected_agg.volume) {
+                throw std::runtime_error("read_only reader (" + layout + ", " + stage + ") saw " +
+                                         std::to_string(count) + " rows, " + std::to_string(range) +
+                                         " in range; writer has " + std::to_string(expected) + " and " +
+                                         std::to_string(expected_range));
+            }
+            return expected;
+        };
+        auto load = [&](uint64_t first_ts, uint64_t seed) {
+            auto ticks = make_ticks(settings.ticks / 2, first_ts, seed);
+            // Every 100th tick arrives well past the reorder window
+            for (size_t i = 100; i < ticks.size(); i += 100)
+                ticks[i].timestamp -= 500;
+            for (size_t i = 0; i < ticks.size(); i += 1000) {
+                std::vector<Tick> chunk(ticks.begin() + i, ticks.begin() + std::min(ticks.size(), i + 1000));
+                writer.append_batch(chunk);
+            }
+            writer.sync();
+        };
+
+        load(1000, 5);
+        auto start = Clock::now();
+        TimeSeriesDB reader(settings.dir, "FOLLOW", reader_options);
+        compare(reader, "open");
+        double first_ns = elapsed_ns(start);
+
+        // Rows and late segments the writer adds after the reader attached
+        load(1000 + settings.ticks / 2, 6);
+        start = Clock::now();
+        reader.sync();
+        size_t rows = compare(reader, "follow");
+        double follow_ns = elapsed_ns(start);
+
+        DBStats stats = writer.get_stats();
+        if (stats.late_rows == 0)
+            throw std::runtime_error("read_only check produced no late rows");
+        json.begin(layout);
+        json.number("rows", rows);
+        json.number("late_rows", stats.late_rows);
+        json.number("open_and_check_ms", first_ns / 1e6);
+        json.number("follow_and_check_ms", follow_ns / 1e6);
+        json.end();
+    }
+    json.end();
+}
+
+void print_usage() {
+    std::cout << "Usage: tsdb_bench [--dir <path>] [--out <file.json>] [--ticks <n>]\n"
+              << "                  [--samples <n>] [--producers <n>] [--queries <n>] [--check]\n"
+              << "  --check runs only the consistency checks\n";
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    Settings settings;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--check") {
+            settings.check = true;
+            continue;
+        }
+        if (i + 1 >= argc) {
+            print_usage();
+            return 1;
+        }
+        std::string value = argv[++i];
+        if (arg == "--dir")
+            settings.dir = value;
+        else if (arg == "--out")
+            settings.out = value;
+        else if (arg == "--ticks")
+            settings.ticks = std::max<size_t>(1000, std::stoull(value));
+        else if (arg == "--samples")
+            settings.latency_samples = std::max<size_t>(1, std::stoull(value));
+        else if (arg == "--producers")
+            settings.producers = std::max<size_t>(1, std::stoull(value));
+        else if (arg == "--queries")
+            settings.queries = std::max<size_t>(1, std::stoull(value));
+        else {
+            print_usage();
+            return 1;
+        }
+    }
+
+    try {
+        JsonWriter json;
+        json.begin();
+        json.string("suite", "tsdb_bench");
+        json.number("hardware_threads", std::thread::hardware_concurrency());
+
+        if (!settings.check) {
+            bench_append_latency(json, settings);
+            bench_ingest(json, settings);
+            bench_bulk_import(json, settings);
+            bench_typed_store(json, settings);
+            load_query_data(settings);
+            bench_queries(json, settings);
+            bench_cold_start(json, settings);
+            bench_page_cache(json, settings);
+        }
+        bench_read_only(json, settings);
+        json.end();
+
+        std::filesystem::remove_all(settings.dir);
+
+        if (settings.out.empty()) {
+            std::cout << json.str() << std::endl;
+        } else {
+            std::ofstream file(settings.out);
+            file << json.str() << std::endl;
+            if (!file) {
+                std::cerr << "Error: Could not write " << settings.out << std::endl;
+                return 1;
+            }
+            std::cout << "Wrote " << settings.out << std::endl;
+        }
+    }
+    catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
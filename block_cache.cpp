@@ -0,0 +1,159 @@
+#include "block_cache.hpp"
+#include "metrics.hpp"
+#include <algorithm>
+
+namespace
+{
+    size_t block_bytes(const DecodedBlock &block)
+    {
+        return sizeof(DecodedBlock) + block.timestamps.size() * sizeof(uint64_t) +
+               block.prices.size() * sizeof(double) + block.volumes.size() * sizeof(uint64_t);
+    }
+}
+
+BlockCache &BlockCache::global()
+{
+    // Never destroyed, like QueryPool::global(): segments may still be
+    // closing during static destruction
+    static BlockCache *instance = new BlockCache();
+    return *instance;
+}
+
+BlockCache::BlockCache(size_t capacity_bytes, size_t shard_count) : capacity(capacity_bytes)
+{
+    shard_count = std::max<size_t>(1, shard_count);
+    for (size_t i = 0; i < shard_count; ++i)
+    {
+        shards.push_back(std::make_unique<Shard>());
+        shards.back()->capacity = capacity_bytes / shard_count;
+    }
+}
+
+uint64_t BlockCache::next_file_id()
+{
+    static std::atomic<uint64_t> next{1};
+    return next.fetch_add(1, std::memory_order_relaxed);
+}
+
+std::shared_ptr<const DecodedBlock> BlockCache::get(uint64_t file, size_t block, bool admit,
+                                                    const std::function<std::shared_ptr<const DecodedBlock>()> &decode)
+{
+    Metrics &metrics = Metrics::global();
+    Key key{file, block};
+    Shard &shard = shard_of(key);
+    {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto it = shard.entries.find(key);
+        if (it != shard.entries.end())
+        {
+            promote(shard, it->second);
+            metrics.block_cache_hits.add();
+            return it->second.block;
+        }
+    }
+
+    // Decode outside the lock. Two threads missing on the same block both
+    // decode it; the second finds the first one's copy and keeps it.
+    metrics.block_cache_misses.add();
+    std::shared_ptr<const DecodedBlock> decoded = decode();
+    if (!admit)
+        return decoded;
+
+    size_t bytes = block_bytes(*decoded);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    if (bytes > shard.capacity || shard.entries.count(key) > 0)
+        return decoded;
+    evict_until(shard, shard.capacity - bytes);
+    shard.probation.push_front(key);
+    shard.entries.emplace(key, Entry{decoded, bytes, false, shard.probation.begin()});
+    shard.bytes += bytes;
+    return decoded;
+}
+
+void BlockCache::promote(Shard &shard, Entry &entry)
+{
+    if (entry.is_protected)
+    {
+        shard.protected_list.splice(shard.protected_list.begin(), shard.protected_list, entry.position);
+        return;
+    }
+    shard.protected_list.splice(shard.protected_list.begin(), shard.probation, entry.position);
+    entry.is_protected = true;
+    shard.protected_bytes += entry.bytes;
+
+    // Keep room for new blocks to prove themselves
+    size_t limit = static_cast<size_t>(static_cast<double>(shard.capacity) * PROTECTED_SHARE);
+    while (shard.protected_bytes > limit && shard.protected_list.size() > 1)
+    {
+        auto oldest = std::prev(shard.protected_list.end());
+        Entry &demoted = shard.entries.at(*oldest);
+        shard.probation.splice(shard.probation.begin(), shard.protected_list, oldest);
+        demoted.is_protected = false;
+        shard.protected_bytes -= demoted.bytes;
+    }
+}
+
+void BlockCache::evict_until(Shard &shard, size_t bytes)
+{
+    Metrics &metrics = Metrics::global();
+    while (shard.bytes > bytes)
+    {
+        const std::list<Key> &victims = shard.probation.empty() ? shard.protected_list : shard.probation;
+        remove(shard, shard.entries.find(victims.back()));
+        metrics.block_cache_evictions.add();
+    }
+}
+
+void BlockCache::remove(Shard &shard, std::unordered_map<Key, Entry, KeyHash>::iterator it)
+{
+    // Views of the block keep it alive through their leases
+    Entry &entry = it->second;
+    shard.bytes -= entry.bytes;
+    if (entry.is_protected)
+    {
+        shard.protected_bytes -= entry.bytes;
+        shard.protected_list.erase(entry.position);
+    }
+    else
+    {
+        shard.probation.erase(entry.position);
+    }
+    shard.entries.erase(it);
+}
+
+void BlockCache::erase_file(uint64_t file)
+{
+    for (auto &shard : shards)
+    {
+        std::lock_guard<std::mutex> lock(shard->mutex);
+        for (auto it = shard->entries.begin(); it != shard->entries.end();)
+        {
+            auto next = std::next(it);
+            if (it->first.file == file)
+                remove(*shard, it);
+            it = next;
+        }
+    }
+}
+
+void BlockCache::set_capacity(size_t capacity_bytes)
+{
+    capacity.store(capacity_bytes, std::memory_order_relaxed);
+    for (auto &shard : shards)
+    {
+        std::lock_guard<std::mutex> lock(shard->mutex);
+        shard->capacity = capacity_bytes / shards.size();
+        evict_until(*shard, shard->capacity);
+    }
+}
+
+size_t BlockCache::size_bytes() const
+{
+    size_t total = 0;
+    for (const auto &shard : shards)
+    {
+        std::lock_guard<std::mutex> lock(shard->mutex);
+        total += shard->bytes;
+    }
+    return total;
+}
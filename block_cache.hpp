@@ -0,0 +1,99 @@
+#ifndef BLOCK_CACHE_HPP
+#define BLOCK_CACHE_HPP
+
+#include "compression.hpp"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+// Memory-bounded cache of decoded blocks of compressed segments, keyed by
+// (CompressedColumns id, block). One process-wide instance sits between the
+// query path and CompressedColumns::decode, so a block that is read again
+// is not decoded again.
+//
+// Keys hash onto shards, each with its own lock and an even share of the
+// capacity. Eviction is a segmented LRU, the two-reference flavour of
+// LRU-K: a block enters on probation and is protected once it is hit
+// again. Victims come from the probation list first, and the protected
+// list is capped at PROTECTED_SHARE of the shard (its oldest blocks go back
+// on probation). A one-pass scan churns the probation list only, so the
+// blocks that queries keep returning to survive it.
+class BlockCache
+{
+public:
+    static constexpr size_t DEFAULT_CAPACITY = size_t(256) << 20;
+
+    // Started on first use with DEFAULT_CAPACITY
+    static BlockCache &global();
+
+    explicit BlockCache(size_t capacity_bytes = DEFAULT_CAPACITY, size_t shards = 16);
+
+    BlockCache(const BlockCache &) = delete;
+    BlockCache &operator=(const BlockCache &) = delete;
+
+    // The cached block, or decode() and keep the result. With admit false a
+    // miss is decoded but not kept, so one-off scans leave the cache alone.
+    std::shared_ptr<const DecodedBlock> get(uint64_t file, size_t block, bool admit,
+                                            const std::function<std::shared_ptr<const DecodedBlock>()> &decode);
+
+    // Drop every block of a file (its segment was closed or deleted)
+    void erase_file(uint64_t file);
+
+    // Shrinks evict at once; 0 caches nothing
+    void set_capacity(size_t capacity_bytes);
+    size_t get_capacity() const { return capacity.load(std::memory_order_relaxed); }
+    size_t size_bytes() const;
+
+    // A fresh id for each CompressedColumns
+    static uint64_t next_file_id();
+
+private:
+    static constexpr double PROTECTED_SHARE = 0.8;
+
+    struct Key
+    {
+        uint64_t file;
+        size_t block;
+        bool operator==(const Key &) const = default;
+    };
+    struct KeyHash
+    {
+        size_t operator()(const Key &key) const { return std::hash<uint64_t>{}(key.file * 0x9E3779B97F4A7C15ull ^ key.block); }
+    };
+
+    struct Entry
+    {
+        std::shared_ptr<const DecodedBlock> block;
+        size_t bytes = 0;
+        bool is_protected = false;
+        std::list<Key>::iterator position;
+    };
+
+    struct Shard
+    {
+        std::mutex mutex;
+        std::unordered_map<Key, Entry, KeyHash> entries;
+        std::list<Key> probation; // Most recent first
+        std::list<Key> protected_list;
+        size_t bytes = 0;
+        size_t protected_bytes = 0;
+        size_t capacity = 0;
+    };
+
+    Shard &shard_of(const Key &key) { return *shards[KeyHash{}(key) % shards.size()]; }
+    // Callers hold the shard lock
+    static void promote(Shard &shard, Entry &entry);
+    static void evict_until(Shard &shard, size_t bytes);
+    static void remove(Shard &shard, std::unordered_map<Key, Entry, KeyHash>::iterator it);
+
+    std::vector<std::unique_ptr<Shard>> shards;
+    std::atomic<size_t> capacity;
+};
+
+#endif // BLOCK_CACHE_HPP
@@ -0,0 +1,273 @@
+#include "block_index.hpp"
+#include "checksum.hpp"
+#include "file_util.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <optional>
+#include <stdexcept>
+
+namespace
+{
+    constexpr uint64_t BLOCK_INDEX_MAGIC = 0x5844494b4c425354ULL; // "TSBLKIDX"
+    // Version 2 added last_ts and the checksum; older files are rebuilt once
+    constexpr uint32_t BLOCK_INDEX_VERSION = 2;
+
+    struct BlockIndexHeader
+    {
+        uint64_t magic;
+        uint32_t version;
+        uint32_t block_rows;
+        uint64_t covered_rows;
+        uint64_t running_max;
+        uint64_t min_ts;
+        uint64_t entry_count;
+        uint64_t out_of_order_count;
+        uint64_t last_ts; // Timestamp of row covered_rows - 1, checked against the column
+        uint32_t crc;     // CRC32C of the header (this field zeroed) and both arrays
+        uint32_t reserved;
+    };
+    static_assert(sizeof(BlockIndexHeader) % alignof(BlockIndexEntry) == 0, "arrays follow the header unpadded");
+
+    uint32_t index_crc(BlockIndexHeader header, const void *entries, const void *late_rows)
+    {
+        header.crc = 0;
+        uint32_t crc = crc32c(&header, sizeof(header));
+        crc = crc32c(entries, header.entry_count * sizeof(BlockIndexEntry), crc);
+        return crc32c(late_rows, header.out_of_order_count * sizeof(LateRow), crc);
+    }
+
+    bool by_time(const LateRow &a, const LateRow &b)
+    {
+        return a.ts != b.ts ? a.ts < b.ts : a.row < b.row;
+    }
+}
+
+BlockIndex::BlockIndex(size_t block_rows)
+    : block_rows(std::max<size_t>(block_rows, 1)),
+      late_runs(new LateRuns)
+{
+}
+
+BlockIndex::~BlockIndex()
+{
+    // Whoever destroys the index holds the last reference to its segment
+    delete late_runs.load(std::memory_order_relaxed);
+}
+
+void BlockIndex::reset()
+{
+    covered = 0;
+    running_max = 0;
+    min_ts = std::numeric_limits<uint64_t>::max();
+    entries.clear();
+    late.clear();
+    publish_runs(new LateRuns);
+}
+
+void BlockIndex::publish_runs(LateRuns *next)
+{
+    const LateRuns *previous = late_runs.exchange(next, std::memory_order_acq_rel);
+    EpochDomain::global().retire(previous);
+}
+
+void BlockIndex::add(uint64_t ts, size_t row)
+{
+    if (row != covered)
+    {
+        throw std::logic_error("BlockIndex rows must be added in storage order");
+    }
+
+    if (row % block_rows == 0)
+    {
+        entries.push_back({std::max(running_max, ts), row});
+    }
+
+    if (row == 0 || ts >= running_max)
+    {
+        running_max = ts;
+    }
+    else
+    {
+        late.push_back({ts, row});
+        if (late.size() - late_runs.load(std::memory_order_relaxed)->covered >= LATE_TAIL_ROWS)
+            fold_late_tail();
+    }
+    min_ts = std::min(min_ts, ts);
+    ++covered;
+}
+
+void BlockIndex::fold_late_tail()
+{
+    // Sort the tail into a run and merge equal-or-smaller runs into it,
+    // like a binary counter: O(log n) runs, each row merged O(log n) times
+    const LateRuns *current = late_runs.load(std::memory_order_relaxed);
+    const LateRow *rows = late.data();
+    size_t total = late.size();
+
+    auto merged = std::make_shared<std::vector<LateRow>>(rows + current->covered, rows + total);
+    std::sort(merged->begin(), merged->end(), by_time);
+
+    auto next = new LateRuns;
+    next->covered = total;
+    next->runs = current->runs;
+    while (!next->runs.empty() && next->runs.back()->size() <= merged->size())
+    {
+        auto combined = std::make_shared<std::vector<LateRow>>();
+        combined->reserve(next->runs.back()->size() + merged->size());
+        std::merge(next->runs.back()->begin(), next->runs.back()->end(), merged->begin(), merged->end(),
+                   std::back_inserter(*combined), by_time);
+        merged = std::move(combined);
+        next->runs.pop_back();
+    }
+    next->runs.push_back(std::move(merged));
+    publish_runs(next);
+}
+
+size_t BlockIndex::scan_start_row(uint64_t start, size_t rows) const
+{
+    // Blocks before the first one whose min_ts reaches start hold only
+    // in-order timestamps <= that min_ts; the block just before it may still
+    // contain rows equal to or above start.
+    size_t visible = std::min(entries.size(), (rows + block_rows - 1) / block_rows);
+    const BlockIndexEntry *first = entries.data();
+    const BlockIndexEntry *last = first + visible;
+    auto it = std::lower_bound(first, last, start,
+                               [](const BlockIndexEntry &entry, uint64_t key)
+                               { return entry.min_ts < key; });
+    if (it != first)
+        --it;
+    return it == last ? rows : it->row_offset;
+}
+
+uint64_t BlockIndex::scan_floor(size_t row, size_t rows) const
+{
+    // Past the last row nothing is scanned, so any floor will do
+    if (row >= rows)
+        return 0;
+    return entries.data()[row / block_rows].min_ts;
+}
+
+std::vector<std::pair<uint64_t, size_t>> BlockIndex::out_of_order_range(uint64_t start, uint64_t end,
+                                                                         size_t rows) const
+{
+    std::vector<std::pair<uint64_t, size_t>> result;
+    if (late.empty())
+        return result;
+
+    // Runs first: late rows they cover are all in the array already
+    const LateRuns *runs = late_runs.load(std::memory_order_acquire);
+    for (const auto &run : runs->runs)
+    {
+        auto it = std::lower_bound(run->begin(), run->end(), LateRow{start, 0}, by_time);
+        for (; it != run->end() && it->ts <= end; ++it)
+        {
+            if (it->row < rows)
+                result.emplace_back(it->ts, static_cast<size_t>(it->row));
+        }
+    }
+
+    size_t n = late.size();
+    const LateRow *tail = late.data();
+    for (size_t i = runs->covered; i < n; ++i)
+    {
+        if (tail[i].row < rows && tail[i].ts >= start && tail[i].ts <= end)
+            result.emplace_back(tail[i].ts, static_cast<size_t>(tail[i].row));
+    }
+    return result;
+}
+
+void BlockIndex::save(const std::string &path, uint64_t last_ts) const
+{
+    size_t late_count = late.size();
+    const LateRow *late_rows = late.data();
+
+    BlockIndexHeader header{BLOCK_INDEX_MAGIC, BLOCK_INDEX_VERSION, static_cast<uint32_t>(block_rows),
+                            covered, running_max, min_ts, entries.size(), late_count, last_ts, 0, 0};
+    header.crc = index_crc(header, entries.data(), late_rows);
+
+    // Write to a temporary file and rename so a crash never leaves a torn index
+    std::string tmp_path = path + ".tmp";
+    {
+        std::ofstream out(tmp_path, std::ios::binary | std::ios::trunc);
+        if (!out)
+        {
+            throw std::runtime_error("Failed to write block index " + tmp_path);
+        }
+        out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+        out.write(reinterpret_cast<const char *>(entries.data()), entries.size() * sizeof(BlockIndexEntry));
+        out.write(reinterpret_cast<const char *>(late_rows), late_count * sizeof(LateRow));
+        if (!out)
+        {
+            throw std::runtime_error("Failed to write block index " + tmp_path);
+        }
+    }
+    if (std::rename(tmp_path.c_str(), path.c_str()) != 0)
+    {
+        throw std::runtime_error("Failed to install block index " + path);
+    }
+}
+
+bool BlockIndex::load(const std::string &path, std::span<const uint64_t> timestamps)
+{
+    reset();
+    if (!std::filesystem::exists(path))
+        return false;
+
+    // Mapped rather than streamed: validating and copying the arrays is the
+    // only work, with no per-row parsing
+    std::optional<MappedFile> file;
+    try
+    {
+        file.emplace(path);
+    }
+    catch (const std::system_error &)
+    {
+        return false;
+    }
+    BlockIndexHeader header{};
+    if (file->size < sizeof(header))
+        return false;
+    std::memcpy(&header, file->data, sizeof(header));
+    if (header.magic != BLOCK_INDEX_MAGIC || header.version != BLOCK_INDEX_VERSION ||
+        header.block_rows != block_rows || header.covered_rows > timestamps.size() ||
+        header.entry_count != (header.covered_rows + block_rows - 1) / block_rows ||
+        header.out_of_order_count > header.covered_rows ||
+        file->size != sizeof(header) + header.entry_count * sizeof(BlockIndexEntry) +
+                          header.out_of_order_count * sizeof(LateRow))
+    {
+        return false;
+    }
+    const char *entry_bytes = file->data + sizeof(header);
+    const char *late_bytes = entry_bytes + header.entry_count * sizeof(BlockIndexEntry);
+    // The last covered row must still be the one indexed, or the column was
+    // rewritten since
+    if (index_crc(header, entry_bytes, late_bytes) != header.crc ||
+        (header.covered_rows > 0 && timestamps[header.covered_rows - 1] != header.last_ts))
+    {
+        return false;
+    }
+
+    // The header keeps both arrays 8-byte aligned within the mapping
+    const auto *loaded_entries = reinterpret_cast<const BlockIndexEntry *>(entry_bytes);
+    const auto *loaded_rows = reinterpret_cast<const LateRow *>(late_bytes);
+    entries.assign(loaded_entries, header.entry_count);
+    late.assign(loaded_rows, header.out_of_order_count);
+    std::vector<LateRow> loaded_late(loaded_rows, loaded_rows + header.out_of_order_count);
+
+    auto runs = new LateRuns;
+    runs->covered = loaded_late.size();
+    if (!loaded_late.empty())
+    {
+        std::sort(loaded_late.begin(), loaded_late.end(), by_time);
+        runs->runs.push_back(std::make_shared<const std::vector<LateRow>>(std::move(loaded_late)));
+    }
+    publish_runs(runs);
+
+    covered = header.covered_rows;
+    running_max = header.running_max;
+    min_ts = header.min_ts;
+    return true;
+}
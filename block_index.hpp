@@ -0,0 +1,113 @@
+#ifndef BLOCK_INDEX_HPP
+#define BLOCK_INDEX_HPP
+
+#include "epoch.hpp"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <span>
+#include <string>
+#include <utility>
+#include <vector>
+
+// One entry per block of rows. min_ts is the smallest timestamp an in-order
+// row of the block can have: every in-order row at or after row_offset has
+// timestamp >= min_ts, and every in-order row before it has timestamp <= min_ts.
+struct BlockIndexEntry
+{
+    uint64_t min_ts;
+    uint64_t row_offset;
+};
+
+// A row stored out of timestamp order
+struct LateRow
+{
+    uint64_t ts;
+    uint64_t row;
+};
+
+// Sparse index over a timestamp column that is (almost) sorted in storage
+// order. A row is in order when its timestamp is >= every timestamp before
+// it; those rows are found by a binary search over the block entries plus a
+// scan inside the block. The few rows that break the order are kept apart,
+// in storage order and in immutable runs sorted by timestamp.
+//
+// One writer calls add() while readers query concurrently. Readers must be
+// pinned (EpochGuard) and pass the number of rows the segment has published;
+// everything the index learned about later rows is ignored.
+class BlockIndex
+{
+public:
+    explicit BlockIndex(size_t block_rows);
+    ~BlockIndex();
+
+    BlockIndex(const BlockIndex &) = delete;
+    BlockIndex &operator=(const BlockIndex &) = delete;
+
+    // Feed the next row in storage order (row must equal covered_rows())
+    void add(uint64_t ts, size_t row);
+
+    // First row a scan for timestamps >= start has to look at
+    size_t scan_start_row(uint64_t start, size_t rows) const;
+    // Running maximum in effect at a scan start row returned above
+    uint64_t scan_floor(size_t row, size_t rows) const;
+
+    // Out-of-order rows with start <= timestamp <= end, in no particular order
+    std::vector<std::pair<uint64_t, size_t>> out_of_order_range(uint64_t start, uint64_t end, size_t rows) const;
+
+    // Out-of-order rows, ascending by row (may include rows past the
+    // published count)
+    std::span<const LateRow> get_out_of_order_rows() const
+    {
+        size_t n = late.size();
+        return std::span<const LateRow>(late.data(), n);
+    }
+
+    // Writer-side state
+    size_t covered_rows() const { return covered; }
+    size_t get_block_rows() const { return block_rows; }
+    size_t get_out_of_order_count() const { return late.size(); }
+    uint64_t get_min_ts() const { return min_ts; }
+    uint64_t get_max_ts() const { return running_max; }
+
+    // Persist next to the column files; last_ts is the timestamp of the
+    // last covered row. Writer only, but readers may query meanwhile.
+    void save(const std::string &path, uint64_t last_ts) const;
+    // Load a persisted index for the given timestamp column. Returns false
+    // (leaving the index empty) if the file is missing, fails its checksum,
+    // was built with a different block size, covers more rows than the
+    // column holds, or its last covered row no longer has the timestamp it
+    // was indexed with. May not run while readers use the index.
+    bool load(const std::string &path, std::span<const uint64_t> timestamps);
+
+    static constexpr const char *FILE_NAME = "block_index.bin";
+
+private:
+    // Late rows [0, covered) sorted by (ts, row), in runs of decreasing
+    // size. A published LateRuns is never modified; the writer builds a new
+    // one and retires the old.
+    struct LateRuns
+    {
+        size_t covered = 0;
+        std::vector<std::shared_ptr<const std::vector<LateRow>>> runs;
+    };
+    // Late rows a reader scans linearly before they are folded into a run
+    static constexpr size_t LATE_TAIL_ROWS = 32;
+
+    void reset();
+    void fold_late_tail();
+    void publish_runs(LateRuns *next);
+
+    size_t block_rows;
+    size_t covered = 0;
+    uint64_t running_max = 0;
+    uint64_t min_ts = std::numeric_limits<uint64_t>::max();
+    PublishedArray<BlockIndexEntry> entries;
+
+    PublishedArray<LateRow> late;
+    std::atomic<const LateRuns *> late_runs;
+};
+
+#endif // BLOCK_INDEX_HPP
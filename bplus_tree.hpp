@@ -5,223 +5,434 @@
 #include <algorithm>
 #include <memory>
 #include <utility>
-#include <shared_mutex>
+#include <cstddef>
+#include <stdexcept>
+#include <type_traits>
 
-// Simple in-memory B+ Tree implementation for efficient time range queries
+// In-memory B+ Tree for time range queries. Duplicate keys are allowed and
+// come back in insertion order. Nodes are fixed-size arrays carved out of
+// per-tree arenas, and leaves are chained so a Cursor walks a range without
+// touching the inner levels. Keys past the current maximum skip the descent
+// and fill the last leaf completely before the next one starts, so in-order
+// feeds cost O(1) per key and leave every leaf but the last full. Not
+// thread-safe: callers serialize writers against readers (Segment holds
+// time_index_mutex), and a Cursor is only valid until the next insert.
 template <typename K, typename V>
 class BPlusTree {
+    static_assert(std::is_trivially_copyable_v<K> && std::is_trivially_copyable_v<V>,
+                  "keys and values are moved with plain copies");
+
+public:
+    // Entries per leaf and separator keys per internal node
+    static constexpr size_t ORDER = 64;
+
 private:
-    // Constants
-    static constexpr int ORDER = 64; // High order for better cache efficiency
-    
-    // Node structure
-    struct Node {
-        bool is_leaf;
-        std::vector<K> keys;
-        
-        Node(bool leaf) : is_leaf(leaf) {}
-        virtual ~Node() = default;
+    struct Node {};
+
+    struct Leaf : Node {
+        size_t count;
+        Leaf* next; // For range scans
+        K keys[ORDER];
+        V values[ORDER];
     };
-    
-    struct InternalNode : public Node {
-        std::vector<std::unique_ptr<Node>> children;
-        
-        InternalNode() : Node(false) {}
+
+    // children[i] holds keys in [keys[i - 1], keys[i]]; a run of duplicates
+    // may straddle a separator
+    struct Internal : Node {
+        size_t count;
+        K keys[ORDER];
+        Node* children[ORDER + 1];
     };
-    
-    struct LeafNode : public Node {
-        std::vector<V> values;
-        LeafNode* next; // For range queries
-        
-        LeafNode() : Node(true), next(nullptr) {}
+
+    // Hands out nodes from fixed chunks; nodes are released all at once
+    template <typename T>
+    class NodePool {
+    public:
+        T* allocate() {
+            if (chunks_used == 0 || used == CHUNK_NODES) {
+                if (chunks_used == chunks.size())
+                    chunks.push_back(std::make_unique<T[]>(CHUNK_NODES));
+                ++chunks_used;
+                used = 0;
+            }
+            return &chunks[chunks_used - 1][used++];
+        }
+
+        // Forget every node but keep the chunks for reuse
+        void reset() {
+            chunks_used = 0;
+            used = 0;
+        }
+
+    private:
+        static constexpr size_t CHUNK_NODES = 32;
+        std::vector<std::unique_ptr<T[]>> chunks;
+        size_t chunks_used = 0;
+        size_t used = 0;
     };
-    
-    std::unique_ptr<Node> root;
-    mutable std::shared_mutex mutex; // Reader-writer lock for concurrent access
-    
+
+    static constexpr size_t MAX_HEIGHT = 32; // Far beyond what 64-bit sizes can fill
+
+    Node* root = nullptr; // Null while empty
+    size_t height = 0;    // Internal levels above the leaves
+    size_t entries = 0;
+    NodePool<Leaf> leaves;
+    NodePool<Internal> internals;
+
+    // Right edge of the tree, where in-order keys land: the last leaf and
+    // the last node of each internal level (spine[l] sits l + 1 levels above
+    // the leaves). Reloaded from the root after a split elsewhere.
+    Leaf* tail = nullptr;
+    Internal* spine[MAX_HEIGHT];
+    bool spine_valid = false;
+
 public:
-    BPlusTree() : root(std::make_unique<LeafNode>()) {}
-    
-    // Insert a key-value pair
+    // Forward position in the leaf chain
+    class Cursor {
+    public:
+        bool valid() const { return leaf != nullptr; }
+        const K& key() const { return leaf->keys[slot]; }
+        const V& value() const { return leaf->values[slot]; }
+
+        void next() {
+            if (++slot == leaf->count) {
+                leaf = leaf->next;
+                slot = 0;
+            }
+        }
+
+    private:
+        friend class BPlusTree;
+        Cursor(const Leaf* leaf, size_t slot) : leaf(leaf), slot(slot) {}
+
+        const Leaf* leaf;
+        size_t slot;
+    };
+
+    BPlusTree() = default;
+    BPlusTree(const BPlusTree&) = delete;
+    BPlusTree& operator=(const BPlusTree&) = delete;
+
+    size_t size() const { return entries; }
+    bool empty() const { return entries == 0; }
+
+    void clear() {
+        root = nullptr;
+        height = 0;
+        entries = 0;
+        tail = nullptr;
+        spine_valid = false;
+        leaves.reset();
+        internals.reset();
+    }
+
+    // Insert a key-value pair after any entries with an equal key. A key
+    // no smaller than every other goes straight onto the last leaf.
     void insert(const K& key, const V& value) {
-        std::unique_lock<std::shared_mutex> lock(mutex);
-        
-        if (root->is_leaf) {
-            auto leaf = static_cast<LeafNode*>(root.get());
-            
-            // Find position to insert
-            auto it = std::lower_bound(leaf->keys.begin(), leaf->keys.end(), key);
-            auto index = std::distance(leaf->keys.begin(), it);
-            
-            // Insert key and value
-            leaf->keys.insert(it, key);
-            leaf->values.insert(leaf->values.begin() + index, value);
-            
-            // Split if necessary
-            if (leaf->keys.size() >= ORDER) {
-                split_leaf(leaf);
+        if (at_right_edge(key)) {
+            Leaf* leaf = tail->count == ORDER ? append_leaf(key) : tail;
+            leaf->keys[leaf->count] = key;
+            leaf->values[leaf->count] = value;
+            ++leaf->count;
+            ++entries;
+            return;
+        }
+
+        // Descend to the leaf, remembering the way back up for splits
+        Internal* path[MAX_HEIGHT];
+        size_t slots[MAX_HEIGHT];
+        Node* node = root;
+        for (size_t level = height; level > 0; --level) {
+            auto internal = static_cast<Internal*>(node);
+            size_t slot = std::upper_bound(internal->keys, internal->keys + internal->count, key) - internal->keys;
+            path[level - 1] = internal;
+            slots[level - 1] = slot;
+            node = internal->children[slot];
+        }
+
+        auto leaf = static_cast<Leaf*>(node);
+        size_t pos = std::upper_bound(leaf->keys, leaf->keys + leaf->count, key) - leaf->keys;
+        ++entries;
+        if (leaf->count < ORDER) {
+            insert_into_leaf(leaf, pos, key, value);
+            return;
+        }
+
+        // Split the full leaf in half, then push the new separator up
+        spine_valid = false;
+        Leaf* right = new_leaf();
+        size_t mid = ORDER / 2;
+        std::copy(leaf->keys + mid, leaf->keys + ORDER, right->keys);
+        std::copy(leaf->values + mid, leaf->values + ORDER, right->values);
+        right->count = ORDER - mid;
+        leaf->count = mid;
+        right->next = leaf->next;
+        leaf->next = right;
+        if (pos <= mid)
+            insert_into_leaf(leaf, pos, key, value);
+        else
+            insert_into_leaf(right, pos - mid, key, value);
+
+        K separator = right->keys[0];
+        Node* child = right;
+        for (size_t level = 0; level < height; ++level) {
+            if (!insert_into_internal(path[level], slots[level], separator, child))
+                return;
+        }
+
+        // The root split: grow a level
+        Internal* new_root = new_internal();
+        new_root->keys[0] = separator;
+        new_root->children[0] = root;
+        new_root->children[1] = child;
+        new_root->count = 1;
+        root = new_root;
+        ++height;
+    }
+
+    // Insert n entries, cheapest in non-decreasing key order: a run that goes
+    // past the largest key is copied onto the right edge a leaf at a time and
+    // anything smaller goes through insert().
+    void append_sorted(const K* keys, const V* values, size_t n) {
+        size_t i = 0;
+        while (i < n) {
+            if (!at_right_edge(keys[i])) {
+                insert(keys[i], values[i]);
+                ++i;
+                continue;
             }
-        } else {
-            insert_internal(key, value, static_cast<InternalNode*>(root.get()));
+            Leaf* leaf = tail->count == ORDER ? append_leaf(keys[i]) : tail;
+            size_t room = std::min(ORDER - leaf->count, n - i);
+            size_t run = 1;
+            while (run < room && !(keys[i + run] < keys[i + run - 1]))
+                ++run;
+            std::copy(keys + i, keys + i + run, leaf->keys + leaf->count);
+            std::copy(values + i, values + i + run, leaf->values + leaf->count);
+            leaf->count += run;
+            entries += run;
+            i += run;
         }
     }
-    
-    // Find values within a range [start, end]
-    std::vector<std::pair<K, V>> range_query(const K& start, const K& end) const {
-        std::shared_lock<std::shared_mutex> lock(mutex);
-        std::vector<std::pair<K, V>> result;
-        
-        // Find the leaf containing the start key
-        LeafNode* leaf = find_leaf(start);
-        
-        // Iterate through leaves collecting values in range
-        while (leaf != nullptr) {
-            for (size_t i = 0; i < leaf->keys.size(); ++i) {
-                if (leaf->keys[i] >= start && leaf->keys[i] <= end) {
-                    result.emplace_back(leaf->keys[i], leaf->values[i]);
+
+    // Replace the contents with n entries produced by entry(i) -> pair<K, V>,
+    // in non-decreasing key order. Builds packed leaves and then each level
+    // above from the one below, with no splits along the way.
+    template <typename Entry>
+    void bulk_load(size_t n, Entry&& entry) {
+        clear();
+        if (n == 0)
+            return;
+
+        struct Built {
+            Node* node;
+            K min_key;
+        };
+        std::vector<Built> level;
+        level.reserve((n + ORDER - 1) / ORDER);
+
+        Leaf* previous = nullptr;
+        K last_key{};
+        for (size_t i = 0; i < n;) {
+            Leaf* leaf = new_leaf();
+            size_t fill = std::min(ORDER, n - i);
+            for (size_t j = 0; j < fill; ++j, ++i) {
+                std::pair<K, V> kv = entry(i);
+                if (i > 0 && kv.first < last_key) {
+                    clear();
+                    throw std::invalid_argument("BPlusTree::bulk_load needs keys in order");
                 }
-                if (leaf->keys[i] > end) {
-                    return result;
+                last_key = kv.first;
+                leaf->keys[j] = kv.first;
+                leaf->values[j] = kv.second;
+            }
+            leaf->count = fill;
+            if (previous != nullptr)
+                previous->next = leaf;
+            previous = leaf;
+            level.push_back({leaf, leaf->keys[0]});
+        }
+
+        // Spread children evenly so no internal node is left with only one
+        while (level.size() > 1) {
+            size_t nodes = (level.size() + ORDER) / (ORDER + 1);
+            size_t base = level.size() / nodes;
+            size_t extra = level.size() % nodes;
+            std::vector<Built> parents;
+            parents.reserve(nodes);
+            size_t c = 0;
+            for (size_t p = 0; p < nodes; ++p) {
+                Internal* internal = new_internal();
+                size_t children = base + (p < extra ? 1 : 0);
+                for (size_t j = 0; j < children; ++j, ++c) {
+                    internal->children[j] = level[c].node;
+                    if (j > 0)
+                        internal->keys[j - 1] = level[c].min_key;
                 }
+                internal->count = children - 1;
+                parents.push_back({internal, level[c - children].min_key});
             }
-            leaf = leaf->next;
+            level = std::move(parents);
+            ++height;
         }
-        
+        root = level[0].node;
+        entries = n;
+    }
+
+    // First entry with a key >= key
+    Cursor lower_bound(const K& key) const {
+        const Node* node = root;
+        if (node == nullptr)
+            return Cursor(nullptr, 0);
+        for (size_t level = height; level > 0; --level) {
+            auto internal = static_cast<const Internal*>(node);
+            size_t slot = std::lower_bound(internal->keys, internal->keys + internal->count, key) - internal->keys;
+            node = internal->children[slot];
+        }
+        auto leaf = static_cast<const Leaf*>(node);
+        size_t pos = std::lower_bound(leaf->keys, leaf->keys + leaf->count, key) - leaf->keys;
+        if (pos == leaf->count)
+            return Cursor(leaf->next, 0);
+        return Cursor(leaf, pos);
+    }
+
+    Cursor begin() const {
+        const Node* node = root;
+        if (node == nullptr)
+            return Cursor(nullptr, 0);
+        for (size_t level = height; level > 0; --level)
+            node = static_cast<const Internal*>(node)->children[0];
+        return Cursor(static_cast<const Leaf*>(node), 0);
+    }
+
+    // Call fn(key, value) for every entry in [start, end], in key order
+    template <typename Fn>
+    void for_each_in_range(const K& start, const K& end, Fn&& fn) const {
+        for (Cursor it = lower_bound(start); it.valid() && !(end < it.key()); it.next())
+            fn(it.key(), it.value());
+    }
+
+    // Find values within a range [start, end]
+    std::vector<std::pair<K, V>> range_query(const K& start, const K& end) const {
+        std::vector<std::pair<K, V>> result;
+        for_each_in_range(start, end, [&](const K& key, const V& value) { result.emplace_back(key, value); });
         return result;
     }
-    
+
 private:
-    // Find the leaf node that should contain key
-    LeafNode* find_leaf(const K& key) const {
-        Node* current = root.get();
-        
-        while (!current->is_leaf) {
-            auto internal = static_cast<InternalNode*>(current);
-            auto it = std::upper_bound(internal->keys.begin(), internal->keys.end(), key);
-            auto index = std::distance(internal->keys.begin(), it);
-            current = internal->children[index].get();
+    Leaf* new_leaf() {
+        Leaf* leaf = leaves.allocate();
+        leaf->count = 0;
+        leaf->next = nullptr;
+        return leaf;
+    }
+
+    // True if key belongs after every entry; the empty tree gets a root
+    // leaf so the caller can append to it
+    bool at_right_edge(const K& key) {
+        if (root == nullptr) {
+            tail = new_leaf();
+            root = tail;
+            spine_valid = true;
+            return true;
+        }
+        if (!spine_valid) {
+            Node* node = root;
+            for (size_t level = height; level > 0; --level) {
+                auto internal = static_cast<Internal*>(node);
+                spine[level - 1] = internal;
+                node = internal->children[internal->count];
+            }
+            tail = static_cast<Leaf*>(node);
+            spine_valid = true;
         }
-        
-        return static_cast<LeafNode*>(current);
+        return !(key < tail->keys[tail->count - 1]);
     }
-    
-    // Insert into internal node
-    void insert_internal(const K& key, const V& value, InternalNode* node) {
-        // Find child to insert into
-        auto it = std::upper_bound(node->keys.begin(), node->keys.end(), key);
-        auto index = std::distance(node->keys.begin(), it);
-        
-        auto child = node->children[index].get();
-        
-        if (child->is_leaf) {
-            auto leaf = static_cast<LeafNode*>(child);
-            
-            // Insert into leaf
-            auto leaf_it = std::lower_bound(leaf->keys.begin(), leaf->keys.end(), key);
-            auto leaf_index = std::distance(leaf->keys.begin(), leaf_it);
-            
-            leaf->keys.insert(leaf_it, key);
-            leaf->values.insert(leaf->values.begin() + leaf_index, value);
-            
-            // Split if necessary
-            if (leaf->keys.size() >= ORDER) {
-                split_leaf_with_parent(leaf, node, index);
+
+    // Start a new last leaf behind the full tail. The nodes to its left stay
+    // full: a full spine node gets an empty right sibling instead of being
+    // split, and the root grows a level once the whole right edge is full.
+    Leaf* append_leaf(const K& first_key) {
+        Leaf* leaf = new_leaf();
+        tail->next = leaf;
+        tail = leaf;
+
+        Node* child = leaf;
+        for (size_t level = 0; level < height; ++level) {
+            Internal* node = spine[level];
+            if (node->count < ORDER) {
+                node->keys[node->count] = first_key;
+                node->children[node->count + 1] = child;
+                ++node->count;
+                return leaf;
             }
-        } else {
-            insert_internal(key, value, static_cast<InternalNode*>(child));
+            Internal* right = new_internal();
+            right->children[0] = child;
+            spine[level] = right;
+            child = right;
         }
+        Internal* new_root = new_internal();
+        new_root->keys[0] = first_key;
+        new_root->children[0] = root;
+        new_root->children[1] = child;
+        new_root->count = 1;
+        root = new_root;
+        spine[height] = new_root;
+        ++height;
+        return leaf;
     }
-    
-    // Split the root when it's a leaf
-    void split_leaf(LeafNode* leaf) {
-        auto new_root = std::make_unique<InternalNode>();
-        auto new_leaf = std::make_unique<LeafNode>();
-        
-        // Middle position
-        size_t mid = leaf->keys.size() / 2;
-        
-        // Copy keys and values to new leaf
-        new_leaf->keys.assign(leaf->keys.begin() + mid, leaf->keys.end());
-        new_leaf->values.assign(leaf->values.begin() + mid, leaf->values.end());
-        
-        // Update old leaf
-        leaf->keys.resize(mid);
-        leaf->values.resize(mid);
-        
-        // Link leaves for range queries
-        new_leaf->next = leaf->next;
-        leaf->next = new_leaf.get();
-        
-        // Update root
-        new_root->keys.push_back(new_leaf->keys.front());
-        new_root->children.push_back(std::make_unique<LeafNode>(*leaf));
-        new_root->children.push_back(std::move(new_leaf));
-        
-        root = std::move(new_root);
+
+    Internal* new_internal() {
+        Internal* internal = internals.allocate();
+        internal->count = 0;
+        return internal;
     }
-    
-    // Split a leaf with parent
-    void split_leaf_with_parent(LeafNode* leaf, InternalNode* parent, size_t child_index) {
-        auto new_leaf = std::make_unique<LeafNode>();
-        
-        // Middle position
-        size_t mid = leaf->keys.size() / 2;
-        
-        // Copy keys and values to new leaf
-        new_leaf->keys.assign(leaf->keys.begin() + mid, leaf->keys.end());
-        new_leaf->values.assign(leaf->values.begin() + mid, leaf->values.end());
-        
-        // Update old leaf
-        leaf->keys.resize(mid);
-        leaf->values.resize(mid);
-        
-        // Link leaves for range queries
-        new_leaf->next = leaf->next;
-        leaf->next = new_leaf.get();
-        
-        // Insert new leaf into parent
-        parent->keys.insert(parent->keys.begin() + child_index, new_leaf->keys.front());
-        parent->children.insert(parent->children.begin() + child_index + 1, std::move(new_leaf));
-        
-        // Split parent if necessary
-        if (parent->keys.size() >= ORDER) {
-            split_internal(parent);
-        }
+
+    static void insert_into_leaf(Leaf* leaf, size_t pos, const K& key, const V& value) {
+        std::copy_backward(leaf->keys + pos, leaf->keys + leaf->count, leaf->keys + leaf->count + 1);
+        std::copy_backward(leaf->values + pos, leaf->values + leaf->count, leaf->values + leaf->count + 1);
+        leaf->keys[pos] = key;
+        leaf->values[pos] = value;
+        ++leaf->count;
     }
-    
-    // Split an internal node
-    void split_internal(InternalNode* node) {
-        if (node == root.get()) {
-            auto new_root = std::make_unique<InternalNode>();
-            auto new_internal = std::make_unique<InternalNode>();
-            
-            // Middle position
-            size_t mid = node->keys.size() / 2;
-            K middle_key = node->keys[mid];
-            
-            // Copy keys and children to new internal node
-            new_internal->keys.assign(node->keys.begin() + mid + 1, node->keys.end());
-            
-            // Move children to new internal node
-            for (size_t i = mid + 1; i <= node->children.size() - 1; ++i) {
-                new_internal->children.push_back(std::move(node->children[i]));
-            }
-            
-            // Update old internal node
-            node->keys.resize(mid);
-            node->children.resize(mid + 1);
-            
-            // Update root
-            new_root->keys.push_back(middle_key);
-            new_root->children.push_back(std::make_unique<InternalNode>(std::move(*node)));
-            new_root->children.push_back(std::move(new_internal));
-            
-            root = std::move(new_root);
-        } else {
-            // TODO: Implement internal node split with parent
-            // For the current scope, we'll assume the tree depth is limited
+
+    // Add separator and its right-hand child after children[slot]. Returns
+    // false if it fit; on a split, separator and child become the key and
+    // new right sibling to insert one level up.
+    bool insert_into_internal(Internal* node, size_t slot, K& separator, Node*& child) {
+        if (node->count < ORDER) {
+            std::copy_backward(node->keys + slot, node->keys + node->count, node->keys + node->count + 1);
+            std::copy_backward(node->children + slot + 1, node->children + node->count + 1,
+                               node->children + node->count + 2);
+            node->keys[slot] = separator;
+            node->children[slot + 1] = child;
+            ++node->count;
+            return false;
         }
+
+        // Lay out the overfull node, then keep the left half here, move the
+        // right half out and promote the key between them
+        K keys[ORDER + 1];
+        Node* children[ORDER + 2];
+        std::copy(node->keys, node->keys + slot, keys);
+        keys[slot] = separator;
+        std::copy(node->keys + slot, node->keys + ORDER, keys + slot + 1);
+        std::copy(node->children, node->children + slot + 1, children);
+        children[slot + 1] = child;
+        std::copy(node->children + slot + 1, node->children + ORDER + 1, children + slot + 2);
+
+        size_t mid = (ORDER + 1) / 2;
+        Internal* right = new_internal();
+        std::copy(keys, keys + mid, node->keys);
+        std::copy(children, children + mid + 1, node->children);
+        node->count = mid;
+        std::copy(keys + mid + 1, keys + ORDER + 1, right->keys);
+        std::copy(children + mid + 1, children + ORDER + 2, right->children);
+        right->count = ORDER - mid;
+
+        separator = keys[mid];
+        child = right;
+        return true;
     }
 };
 
-#endif // BPLUS_TREE_HPP
\ No newline at end of file
+#endif // BPLUS_TREE_HPP
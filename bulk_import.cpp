@@ -0,0 +1,326 @@
+#include "bulk_import.hpp"
+#include "file_util.hpp"
+#include "timeseries_db.hpp"
+#include <algorithm>
+#include <bit>
+#include <charconv>
+#include <condition_variable>
+#include <cstring>
+#include <exception>
+#include <mutex>
+#include <stdexcept>
+#include <string_view>
+#include <thread>
+#include <vector>
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+static_assert(sizeof(Tick) == 24, "binary import expects packed 24-byte tick records");
+
+namespace
+{
+    // Bit i is set if block[i] is a newline, for the (up to) 64 bytes at block
+    uint64_t newline_mask(const char *block, const char *end)
+    {
+        size_t n = static_cast<size_t>(end - block);
+        if (n >= 64)
+        {
+#if defined(__AVX2__)
+            const __m256i nl = _mm256_set1_epi8('\n');
+            uint32_t lo = static_cast<uint32_t>(_mm256_movemask_epi8(
+                _mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(block)), nl)));
+            uint32_t hi = static_cast<uint32_t>(_mm256_movemask_epi8(
+                _mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(block + 32)), nl)));
+            return (static_cast<uint64_t>(hi) << 32) | lo;
+#elif defined(__SSE2__)
+            const __m128i nl = _mm_set1_epi8('\n');
+            uint64_t mask = 0;
+            for (int i = 0; i < 4; ++i)
+            {
+                __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i *>(block + 16 * i));
+                mask |= static_cast<uint64_t>(static_cast<uint16_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, nl))))
+                        << (16 * i);
+            }
+            return mask;
+#endif
+        }
+        uint64_t mask = 0;
+        for (size_t i = 0; i < std::min<size_t>(n, 64); ++i)
+        {
+            if (block[i] == '\n')
+                mask |= uint64_t(1) << i;
+        }
+        return mask;
+    }
+
+    // Newline positions of [begin, end) in order, found 64 bytes at a time
+    class NewlineScanner
+    {
+    public:
+        NewlineScanner(const char *begin, const char *end)
+            : block(begin), end(end), mask(newline_mask(begin, end))
+        {
+        }
+
+        // Next newline, or end once there are none left
+        const char *next()
+        {
+            while (mask == 0)
+            {
+                if (end - block <= 64)
+                    return end;
+                block += 64;
+                mask = newline_mask(block, end);
+            }
+            const char *hit = block + std::countr_zero(mask);
+            mask &= mask - 1;
+            return hit;
+        }
+
+    private:
+        const char *block;
+        const char *end;
+        uint64_t mask;
+    };
+
+    const char *skip_blanks(const char *p, const char *end)
+    {
+        while (p < end && (*p == ' ' || *p == '\t'))
+            ++p;
+        return p;
+    }
+
+    // One field; it must be followed by a comma, or by the end of the line
+    // if it is the last one needed
+    template <typename T>
+    bool parse_field(const char *&p, const char *end, T &value, bool last)
+    {
+        auto [ptr, ec] = std::from_chars(skip_blanks(p, end), end, value);
+        if (ec != std::errc{})
+            return false;
+        p = skip_blanks(ptr, end);
+        if (p < end && *p == ',')
+        {
+            ++p;
+            return true;
+        }
+        return last && p == end;
+    }
+
+    struct ParsedChunk
+    {
+        const char *begin = nullptr;
+        const char *end = nullptr;
+        std::vector<uint64_t> ts;
+        std::vector<double> px;
+        std::vector<uint64_t> vol;
+        size_t lines = 0;
+        size_t skipped = 0;
+        size_t first_bad = 0; // Line within the chunk, 1-based
+        bool ready = false;   // Guarded by the import mutex
+    };
+
+    void parse_csv(ParsedChunk &chunk, bool first_chunk)
+    {
+        size_t estimate = static_cast<size_t>(chunk.end - chunk.begin) / 24 + 1;
+        chunk.ts.reserve(estimate);
+        chunk.px.reserve(estimate);
+        chunk.vol.reserve(estimate);
+
+        NewlineScanner scanner(chunk.begin, chunk.end);
+        const char *line = chunk.begin;
+        while (line < chunk.end)
+        {
+            const char *eol = scanner.next();
+            const char *stop = (eol > line && eol[-1] == '\r') ? eol - 1 : eol;
+            ++chunk.lines;
+
+            const char *p = line;
+            uint64_t ts;
+            double px;
+            uint64_t vol;
+            if (parse_field(p, stop, ts, false) && parse_field(p, stop, px, false) && parse_field(p, stop, vol, true))
+            {
+                chunk.ts.push_back(ts);
+                chunk.px.push_back(px);
+                chunk.vol.push_back(vol);
+            }
+            else if (skip_blanks(line, stop) != stop &&
+                     !(first_chunk && chunk.lines == 1 &&
+                       std::string_view(line, stop - line).find("timestamp") != std::string_view::npos))
+            {
+                // Neither a blank line nor the header
+                if (chunk.skipped++ == 0)
+                    chunk.first_bad = chunk.lines;
+            }
+            line = (eol == chunk.end) ? eol : eol + 1;
+        }
+    }
+
+    void parse_binary(ParsedChunk &chunk)
+    {
+        size_t n = static_cast<size_t>(chunk.end - chunk.begin) / sizeof(Tick);
+        chunk.ts.resize(n);
+        chunk.px.resize(n);
+        chunk.vol.resize(n);
+        for (size_t i = 0; i < n; ++i)
+        {
+            Tick tick;
+            std::memcpy(&tick, chunk.begin + i * sizeof(Tick), sizeof(Tick));
+            chunk.ts[i] = tick.timestamp;
+            chunk.px[i] = tick.price;
+            chunk.vol[i] = tick.volume;
+        }
+    }
+
+    // CSV chunks end after a newline; binary ones on a record boundary
+    std::vector<ParsedChunk> split_chunks(const MappedFile &file, const ImportOptions &options)
+    {
+        size_t chunk_bytes = std::max<size_t>(options.chunk_bytes, sizeof(Tick));
+        if (options.format == ImportFormat::Binary)
+            chunk_bytes -= chunk_bytes % sizeof(Tick);
+
+        std::vector<ParsedChunk> chunks;
+        size_t pos = 0;
+        while (pos < file.size)
+        {
+            size_t cut = std::min(pos + chunk_bytes, file.size);
+            if (options.format == ImportFormat::Csv && cut < file.size)
+            {
+                const void *newline = std::memchr(file.data + cut - 1, '\n', file.size - cut + 1);
+                cut = newline ? static_cast<size_t>(static_cast<const char *>(newline) - file.data) + 1 : file.size;
+            }
+            ParsedChunk &chunk = chunks.emplace_back();
+            chunk.begin = file.data + pos;
+            chunk.end = file.data + cut;
+            pos = cut;
+        }
+        return chunks;
+    }
+}
+
+ImportResult bulk_import(TimeSeriesDB &db, const std::string &path, const ImportOptions &options)
+{
+    MappedFile file(path);
+    // Every byte is read once, front to back within each chunk
+    if (file.data)
+        madvise(const_cast<char *>(file.data), file.size, MADV_SEQUENTIAL);
+    if (options.format == ImportFormat::Binary && file.size % sizeof(Tick) != 0)
+    {
+        throw std::runtime_error(path + " is not a whole number of " + std::to_string(sizeof(Tick)) +
+                                 "-byte tick records");
+    }
+    std::vector<ParsedChunk> chunks = split_chunks(file, options);
+
+    size_t threads = options.threads ? options.threads : std::max(1u, std::thread::hardware_concurrency());
+    threads = std::min(threads, chunks.size());
+    const size_t window = 2 * threads; // Chunks parsed ahead of the one being loaded
+
+    std::mutex mutex;
+    std::condition_variable changed;
+    size_t next_chunk = 0;
+    size_t loaded = 0;
+    bool stop = false;
+    std::exception_ptr worker_error;
+
+    auto worker = [&]
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true)
+        {
+            changed.wait(lock, [&]
+                         { return stop || next_chunk == chunks.size() || next_chunk < loaded + window; });
+            if (stop || next_chunk == chunks.size())
+                return;
+            size_t index = next_chunk++;
+            lock.unlock();
+            try
+            {
+                if (options.format == ImportFormat::Binary)
+                    parse_binary(chunks[index]);
+                else
+                    parse_csv(chunks[index], index == 0);
+            }
+            catch (...)
+            {
+                lock.lock();
+                if (!worker_error)
+                    worker_error = std::current_exception();
+                stop = true;
+                changed.notify_all();
+                return;
+            }
+            lock.lock();
+            chunks[index].ready = true;
+            changed.notify_all();
+        }
+    };
+
+    std::vector<std::thread> pool;
+    for (size_t i = 0; i < threads; ++i)
+        pool.emplace_back(worker);
+
+    // Load the chunks in file order as they become ready
+    ImportResult result;
+    std::exception_ptr error;
+    size_t lines_before = 0;
+    try
+    {
+        for (ParsedChunk &chunk : chunks)
+        {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                changed.wait(lock, [&]
+                             { return chunk.ready || stop; });
+                if (!chunk.ready)
+                    break; // A worker failed
+            }
+
+            db.bulk_append(chunk.ts.data(), chunk.px.data(), chunk.vol.data(), chunk.ts.size());
+            result.rows += chunk.ts.size();
+            result.skipped_lines += chunk.skipped;
+            if (result.first_bad_line == 0 && chunk.first_bad != 0)
+                result.first_bad_line = lines_before + chunk.first_bad;
+            lines_before += chunk.lines;
+
+            // Only the window of chunks stays resident
+            chunk.ts = std::vector<uint64_t>();
+            chunk.px = std::vector<double>();
+            chunk.vol = std::vector<uint64_t>();
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                ++loaded;
+            }
+            changed.notify_all();
+        }
+    }
+    catch (...)
+    {
+        error = std::current_exception();
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stop = true;
+    }
+    changed.notify_all();
+    for (auto &thread : pool)
+        thread.join();
+
+    // Publish whatever was loaded, even after a failure
+    try
+    {
+        db.end_bulk_load();
+    }
+    catch (...)
+    {
+        if (!error)
+            error = std::current_exception();
+    }
+    if (!error)
+        error = worker_error;
+    if (error)
+        std::rethrow_exception(error);
+    return result;
+}
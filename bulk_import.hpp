@@ -0,0 +1,37 @@
+#ifndef BULK_IMPORT_HPP
+#define BULK_IMPORT_HPP
+
+#include <cstddef>
+#include <string>
+
+class TimeSeriesDB;
+
+enum class ImportFormat
+{
+    Csv,   // timestamp,price,volume per line (extra fields ignored), optional header line
+    Binary // Packed native-endian records laid out like Tick: uint64 timestamp, double price, uint64 volume
+};
+
+struct ImportOptions
+{
+    ImportFormat format = ImportFormat::Csv;
+    size_t threads = 0;           // Parser threads; 0 uses every hardware thread
+    size_t chunk_bytes = 4 << 20; // Input bytes per parsed chunk
+};
+
+struct ImportResult
+{
+    size_t rows = 0;
+    size_t skipped_lines = 0;  // Malformed CSV lines
+    size_t first_bad_line = 0; // 1-based line number of the first one, 0 if none
+};
+
+// Load a historical file into db in one bulk load: the file is mapped, split
+// into chunks that worker threads parse into columns, and the columns are
+// handed to TimeSeriesDB::bulk_append() in file order. A bounded window of
+// chunks is in flight, so memory does not grow with the file. Throws
+// std::system_error if the file cannot be read and std::runtime_error for a
+// binary file that is not a whole number of records.
+ImportResult bulk_import(TimeSeriesDB &db, const std::string &path, const ImportOptions &options = ImportOptions{});
+
+#endif // BULK_IMPORT_HPP
@@ -0,0 +1,61 @@
+#ifndef CHECKSUM_HPP
+#define CHECKSUM_HPP
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#if defined(__SSE4_2__)
+#include <nmmintrin.h>
+#endif
+
+// CRC-32C (Castagnoli) used to detect torn or corrupt on-disk records. Uses
+// the SSE4.2 crc32 instruction when the build targets it (-march=native) and
+// a table-driven fallback otherwise; both produce identical values.
+namespace checksum_detail
+{
+    inline const std::array<uint32_t, 256> &crc32c_table()
+    {
+        static const std::array<uint32_t, 256> table = []
+        {
+            std::array<uint32_t, 256> t{};
+            for (uint32_t i = 0; i < 256; ++i)
+            {
+                uint32_t crc = i;
+                for (int k = 0; k < 8; ++k)
+                    crc = (crc & 1) ? (crc >> 1) ^ 0x82F63B78u : (crc >> 1);
+                t[i] = crc;
+            }
+            return t;
+        }();
+        return table;
+    }
+}
+
+// Continue a running CRC: crc32c(b, crc32c(a)) == crc32c(a + b)
+inline uint32_t crc32c(const void *data, size_t length, uint32_t crc = 0)
+{
+    const unsigned char *p = static_cast<const unsigned char *>(data);
+    crc = ~crc;
+#if defined(__SSE4_2__)
+    uint64_t crc64 = crc;
+    while (length >= 8)
+    {
+        uint64_t word;
+        std::memcpy(&word, p, sizeof(word));
+        crc64 = _mm_crc32_u64(crc64, word);
+        p += 8;
+        length -= 8;
+    }
+    crc = static_cast<uint32_t>(crc64);
+    while (length-- > 0)
+        crc = _mm_crc32_u8(crc, *p++);
+#else
+    const auto &table = checksum_detail::crc32c_table();
+    while (length-- > 0)
+        crc = table[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+#endif
+    return ~crc;
+}
+
+#endif // CHECKSUM_HPP
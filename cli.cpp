@@ -1,19 +1,32 @@
 #include "timeseries_db.hpp"
+#include "tsdb_manager.hpp"
+#include "bulk_import.hpp"
+#include "wire_protocol.hpp"
 #include <iostream>
+#include <cerrno>
 #include <cstdlib>
+#include <cstring>
 #include <iomanip>
 #include <random>
+#include <stdexcept>
 #include <chrono>
-#include <fstream>
-#include <sstream>
+#include <system_error>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
 
 void print_help() {
     std::cout << "Usage:\n"
               << "  tsdb_cli insert <symbol> <timestamp> <price> <volume>\n"
               << "  tsdb_cli query <symbol> <start_timestamp> <end_timestamp>\n"
               << "  tsdb_cli last <symbol> <count>\n"
+              << "  tsdb_cli aggregate <symbol> <start_timestamp> <end_timestamp>\n"
+              << "  tsdb_cli bars <symbol> <start_timestamp> <end_timestamp> <resolution>\n"
+              << "  tsdb_cli symbols\n"
+              << "  tsdb_cli stats [symbol] [--json] [--host <address>] [--port <port>]\n"
               << "  tsdb_cli benchmark <symbol> <tick_count>\n"
-              << "  tsdb_cli import <symbol> <csv_file>\n";
+              << "  tsdb_cli import <symbol> <file> [--binary] [--threads <n>]\n";
 }
 
 // Generate random ticks for benchmark
@@ -40,6 +53,71 @@ std::vector<Tick> generate_random_ticks(size_t count) {
     return ticks;
 }
 
+// Read or write exactly size bytes of a blocking socket
+void socket_io(int fd, char* data, size_t size, bool write) {
+    while (size > 0) {
+        ssize_t done = write ? send(fd, data, size, MSG_NOSIGNAL) : recv(fd, data, size, 0);
+        if (done == -1 && errno == EINTR)
+            continue;
+        if (done == -1)
+            throw std::system_error(errno, std::generic_category(), "Server connection failed");
+        if (done == 0)
+            throw std::runtime_error("Server closed the connection");
+        data += done;
+        size -= done;
+    }
+}
+
+// One Stats round trip to a running tsdb_server: the metrics live in the
+// process that ingests and serves, not in this one
+std::string fetch_server_stats(const std::string& host, uint16_t port, const std::string& symbol, bool json) {
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    if (inet_pton(AF_INET, host.c_str(), &addr.sin_addr) != 1)
+        throw std::invalid_argument("Invalid server address " + host);
+    if (symbol.size() > UINT8_MAX)
+        throw std::invalid_argument("Symbol too long");
+
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1)
+        throw std::system_error(errno, std::generic_category(), "Failed to create socket");
+    try {
+        if (connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == -1)
+            throw std::system_error(errno, std::generic_category(),
+                                    "Failed to connect to tsdb_server at " + host + ":" + std::to_string(port));
+
+        std::vector<char> frame(sizeof(RequestHeader) + symbol.size() + 1);
+        RequestHeader request{};
+        request.length = static_cast<uint32_t>(symbol.size() + 1);
+        request.request_id = 1;
+        request.op = static_cast<uint8_t>(WireOp::Stats);
+        request.symbol_length = static_cast<uint8_t>(symbol.size());
+        std::memcpy(frame.data(), &request, sizeof(request));
+        std::memcpy(frame.data() + sizeof(request), symbol.data(), symbol.size());
+        frame.back() = json ? 1 : 0;
+        socket_io(fd, frame.data(), frame.size(), true);
+
+        ResponseHeader response;
+        socket_io(fd, reinterpret_cast<char*>(&response), sizeof(response), false);
+        std::string body(response.length, '\0');
+        socket_io(fd, body.data(), body.size(), false);
+        close(fd);
+        if (static_cast<WireStatus>(response.status) != WireStatus::Ok)
+            throw std::runtime_error("Server: " + body);
+        return body;
+    }
+    catch (...) {
+        close(fd);
+        throw;
+    }
+}
+
+// Rate for a timed run; 0 if the clock did not advance
+double ticks_per_second(size_t count, double seconds) {
+    return seconds > 0 ? count / seconds : 0.0;
+}
+
 int main(int argc, char* argv[]) {
     if (argc < 2) {
         print_help();
@@ -48,6 +126,10 @@ int main(int argc, char* argv[]) {
 
     // Default data directory
     const std::string data_dir = "tsdb_data";
+
+    // Commands that only read attach alongside a running writer
+    DBOptions reader_options;
+    reader_options.read_only = true;
     std::string command = argv[1];
 
     try {
@@ -75,7 +157,7 @@ int main(int argc, char* argv[]) {
             uint64_t start = std::stoull(argv[3]);
             uint64_t end = std::stoull(argv[4]);
 
-            TimeSeriesDB db(data_dir, symbol);
+            TimeSeriesDB db(data_dir, symbol, reader_options);
             auto results = db.query_range(start, end);
 
             std::cout << "Found " << results.size() << " results:\n";
@@ -93,7 +175,7 @@ int main(int argc, char* argv[]) {
             std::string symbol = argv[2];
             size_t count = std::stoull(argv[3]);
 
-            TimeSeriesDB db(data_dir, symbol);
+            TimeSeriesDB db(data_dir, symbol, reader_options);
             auto results = db.query_last(count);
 
             std::cout << "Last " << results.size() << " ticks for " << symbol << ":\n";
@@ -103,6 +185,84 @@ int main(int argc, char* argv[]) {
                           << " Volume: " << vol << std::endl;
             }
         }
+        else if (command == "aggregate") {
+            if (argc != 5) {
+                print_help();
+                return 1;
+            }
+            std::string symbol = argv[2];
+            uint64_t start = std::stoull(argv[3]);
+            uint64_t end = std::stoull(argv[4]);
+
+            TimeSeriesDB db(data_dir, symbol, reader_options);
+            AggregateResult agg = db.aggregate_range(start, end);
+
+            std::cout << "Aggregated " << agg.count << " ticks for " << symbol << ":\n";
+            if (agg.count > 0) {
+                std::cout << std::fixed << std::setprecision(2)
+                          << "Open: " << agg.open << " High: " << agg.high
+                          << " Low: " << agg.low << " Close: " << agg.close
+                          << " Volume: " << agg.volume << " VWAP: " << agg.vwap() << std::endl;
+            }
+        }
+        else if (command == "bars") {
+            if (argc != 6) {
+                print_help();
+                return 1;
+            }
+            std::string symbol = argv[2];
+            uint64_t start = std::stoull(argv[3]);
+            uint64_t end = std::stoull(argv[4]);
+            uint64_t resolution = std::stoull(argv[5]);
+
+            TimeSeriesDB db(data_dir, symbol, reader_options);
+            auto bars = db.query_bars(start, end, resolution);
+
+            std::cout << bars.size() << " bars for " << symbol << ":\n";
+            for (const auto& bar : bars) {
+                std::cout << "Timestamp: " << bar.timestamp << std::fixed << std::setprecision(2)
+                          << " Open: " << bar.open << " High: " << bar.high
+                          << " Low: " << bar.low << " Close: " << bar.close
+                          << " Volume: " << bar.volume << std::endl;
+            }
+        }
+        else if (command == "symbols") {
+            if (argc != 2) {
+                print_help();
+                return 1;
+            }
+
+            TSDBManager manager(data_dir, ManagerOptions{1});
+            auto symbols = manager.list_symbols();
+
+            std::cout << symbols.size() << " symbols in " << data_dir << ":\n";
+            for (const auto& symbol : symbols) {
+                std::cout << symbol << std::endl;
+            }
+        }
+        else if (command == "stats") {
+            std::string symbol;
+            std::string host = "127.0.0.1";
+            uint16_t port = 7070;
+            bool json = false;
+            for (int i = 2; i < argc; ++i) {
+                std::string arg = argv[i];
+                if (arg == "--json") {
+                    json = true;
+                } else if (arg == "--host" && i + 1 < argc) {
+                    host = argv[++i];
+                } else if (arg == "--port" && i + 1 < argc) {
+                    port = static_cast<uint16_t>(std::stoul(argv[++i]));
+                } else if (symbol.empty() && arg.rfind("--", 0) != 0) {
+                    symbol = arg;
+                } else {
+                    print_help();
+                    return 1;
+                }
+            }
+
+            std::cout << fetch_server_stats(host, port, symbol, json) << std::flush;
+        }
         else if (command == "benchmark") {
             if (argc != 4) {
                 print_help();
@@ -110,100 +270,71 @@ int main(int argc, char* argv[]) {
             }
             std::string symbol = argv[2];
             size_t count = std::stoull(argv[3]);
+            if (count == 0) {
+                std::cerr << "Error: tick_count must be positive" << std::endl;
+                return 1;
+            }
             
             TimeSeriesDB db(data_dir, symbol);
             auto ticks = generate_random_ticks(count);
             
             // Benchmark insert
-            auto start_time = std::chrono::high_resolution_clock::now();
+            auto start_time = std::chrono::steady_clock::now();
             db.append_batch(ticks);
             db.sync();
-            auto end_time = std::chrono::high_resolution_clock::now();
+            auto end_time = std::chrono::steady_clock::now();
             
-            auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(
-                end_time - start_time).count();
+            double seconds = std::chrono::duration<double>(end_time - start_time).count();
             
-            std::cout << "Inserted " << count << " ticks in " << duration << "ms ("
-                      << (count * 1000.0 / duration) << " ticks/second)" << std::endl;
+            std::cout << "Inserted " << count << " ticks in " << seconds * 1000.0 << "ms ("
+                      << ticks_per_second(count, seconds) << " ticks/second)" << std::endl;
             
             // Benchmark query
-            start_time = std::chrono::high_resolution_clock::now();
+            start_time = std::chrono::steady_clock::now();
             auto results = db.query_range(ticks.front().timestamp, ticks.back().timestamp);
-            end_time = std::chrono::high_resolution_clock::now();
+            end_time = std::chrono::steady_clock::now();
             
-            duration = std::chrono::duration_cast<std::chrono::milliseconds>(
-                end_time - start_time).count();
+            seconds = std::chrono::duration<double>(end_time - start_time).count();
             
-            std::cout << "Retrieved " << results.size() << " ticks in " << duration << "ms ("
-                      << (results.size() * 1000.0 / duration) << " ticks/second)" << std::endl;
+            std::cout << "Retrieved " << results.size() << " ticks in " << seconds * 1000.0 << "ms ("
+                      << ticks_per_second(results.size(), seconds) << " ticks/second)" << std::endl;
         }
         else if (command == "import") {
-            if (argc != 4) {
+            if (argc < 4) {
                 print_help();
                 return 1;
             }
             std::string symbol = argv[2];
-            std::string csv_file = argv[3];
-            
-            // Open CSV file
-            std::ifstream file(csv_file);
-            if (!file.is_open()) {
-                std::cerr << "Error: Could not open file " << csv_file << std::endl;
-                return 1;
-            }
-            
-            TimeSeriesDB db(data_dir, symbol);
-            
-            // Parse CSV
-            std::string line;
-            std::vector<Tick> ticks;
-            size_t line_count = 0;
-            
-            while (std::getline(file, line)) {
-                line_count++;
-                // Skip header
-                if (line_count == 1 && line.find("timestamp") != std::string::npos) {
-                    continue;
-                }
-                
-                std::stringstream ss(line);
-                std::string token;
-                std::vector<std::string> tokens;
-                
-                while (std::getline(ss, token, ',')) {
-                    tokens.push_back(token);
+            std::string input_file = argv[3];
+            ImportOptions import_options;
+            for (int i = 4; i < argc; ++i) {
+                std::string arg = argv[i];
+                if (arg == "--binary") {
+                    import_options.format = ImportFormat::Binary;
                 }
-                
-                if (tokens.size() < 3) {
-                    std::cerr << "Warning: Invalid format at line " << line_count << std::endl;
-                    continue;
+                else if (arg == "--threads" && i + 1 < argc) {
+                    import_options.threads = std::stoull(argv[++i]);
                 }
-                
-                try {
-                    Tick tick;
-                    tick.timestamp = std::stoull(tokens[0]);
-                    tick.price = std::stod(tokens[1]);
-                    tick.volume = std::stoull(tokens[2]);
-                    ticks.push_back(tick);
-                    
-                    // Batch insert every 10,000 ticks
-                    if (ticks.size() >= 10000) {
-                        db.append_batch(ticks);
-                        ticks.clear();
-                    }
-                }
-                catch (const std::exception& e) {
-                    std::cerr << "Warning: Could not parse line " << line_count << ": " << e.what() << std::endl;
+                else {
+                    print_help();
+                    return 1;
                 }
             }
             
-            // Insert remaining ticks
-            if (!ticks.empty()) {
-                db.append_batch(ticks);
-            }
+            TimeSeriesDB db(data_dir, symbol);
             
-            db.sync();
-            std::cout << "Imported " << (line_count - 1) << " ticks from " << csv_file << " for symbol " << symbol << std::endl;
+            auto start_time = std::chrono::steady_clock::now();
+            ImportResult result = bulk_import(db, input_file, import_options);
+            auto end_time = std::chrono::steady_clock::now();
+            double seconds = std::chrono::duration<double>(end_time - start_time).count();
+            
+            if (result.skipped_lines > 0) {
+                std::cerr << "Warning: Skipped " << result.skipped_lines << " malformed lines (first at line "
+                          << result.first_bad_line << ")" << std::endl;
+            }
+            std::cout << "Imported " << result.rows << " ticks from " << input_file << " for symbol " << symbol
+                      << " in " << seconds * 1000.0 << "ms (" << ticks_per_second(result.rows, seconds)
+                      << " ticks/second)" << std::endl;
         }
         else {
             print_help();
@@ -1,23 +1,62 @@
 #include "column_storage.hpp"
+#include "metrics.hpp"
 #include <mutex>
 #include <algorithm>
 
-ColumnStorage::ColumnStorage(const std::string &data_dir, const std::string &symbol,
-                             const std::string &column_name, size_t element_size)
-    : element_size(element_size)
+namespace
 {
+    // Growth is rare, so one lock shared by every column is enough
+    std::mutex remap_mutex;
+
+    size_t page_size()
+    {
+        static const size_t size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+        return size;
+    }
+
+    size_t round_up_to_page(size_t bytes)
+    {
+        return (bytes + page_size() - 1) / page_size() * page_size();
+    }
+
+    constexpr size_t HUGE_PAGE_SIZE = size_t(2) << 20;
+
+    int madvise_flag(AccessPattern access)
+    {
+        switch (access)
+        {
+        case AccessPattern::Sequential:
+            return MADV_SEQUENTIAL;
+        case AccessPattern::Random:
+            return MADV_RANDOM;
+        case AccessPattern::WillNeed:
+            return MADV_WILLNEED;
+        case AccessPattern::Normal:
+            break;
+        }
+        return MADV_NORMAL;
+    }
+}
 
-    // Ensure data directory exists
-    ensure_directory_exists(data_dir);
+ColumnStorage::ColumnStorage(const std::string &data_dir, const std::string &symbol,
+                             const std::string &column_name, size_t element_size, OpenMode mode,
+                             const ColumnOptions &options)
+    : mode(mode), options(options), element_size(element_size)
+{
 
-    // Create symbol directory if it doesn't exist
+    // Readers never create anything: a directory the writer just removed
+    // must stay gone
     std::string symbol_dir = data_dir + "/" + symbol;
-    ensure_directory_exists(symbol_dir);
+    if (mode == OpenMode::ReadWrite)
+    {
+        ensure_directory_exists(data_dir);
+        ensure_directory_exists(symbol_dir);
+    }
 
     // Set up filename
     filename = symbol_dir + "/" + column_name + ".bin";
 
-    fd = open(filename.c_str(), O_RDWR | O_CREAT, 0666);
+    fd = (mode != OpenMode::ReadWrite) ? open(filename.c_str(), O_RDONLY) : open(filename.c_str(), O_RDWR | O_CREAT, 0666);
     if (fd == -1)
     {
         throw std::system_error(errno, std::generic_category(), "Failed to open file " + filename);
@@ -32,6 +71,12 @@ ColumnStorage::ColumnStorage(const std::string &data_dir, const std::string &sym
 
     size_t file_size = st.st_size;
 
+    if (file_size == 0 && mode != OpenMode::ReadWrite)
+    {
+        close(fd);
+        throw std::runtime_error("Invalid file format: empty read-only column " + filename);
+    }
+
     if (file_size == 0)
     {
         // New file - initialize with header and pre-allocate space
@@ -63,6 +108,14 @@ ColumnStorage::ColumnStorage(const std::string &data_dir, const std::string &sym
         remap();
         read_header(); // Read actual count from header
     }
+
+    if (mode == OpenMode::ReadOnly)
+    {
+        // The mapping keeps the file alive; with thousands of symbols
+        // open, sealed columns must not hold a descriptor each
+        close(fd);
+        fd = -1;
+    }
 }
 
 ColumnStorage::~ColumnStorage()
@@ -70,9 +123,10 @@ ColumnStorage::~ColumnStorage()
     if (mapped_data && mapped_data != MAP_FAILED)
     {
         // Write header before unmapping to ensure count is persisted
-        write_header();
-        munmap(mapped_data, HEADER_SIZE + (capacity * element_size));
+        if (mode == OpenMode::ReadWrite)
+            write_header();
     }
+    release_mapping();
     if (fd != -1)
     {
         close(fd);
@@ -82,9 +136,16 @@ ColumnStorage::~ColumnStorage()
 // Move constructor
 ColumnStorage::ColumnStorage(ColumnStorage &&other) noexcept
     : fd(other.fd),
+      mode(other.mode),
+      options(other.options),
       element_size(other.element_size),
       capacity(other.capacity),
       mapped_data(other.mapped_data),
+      read_base(other.read_base.load(std::memory_order_acquire)),
+      mapped_size(other.mapped_size),
+      reserved_base(other.reserved_base),
+      reserved_size(other.reserved_size),
+      retired_mappings(std::move(other.retired_mappings)),
       filename(std::move(other.filename))
 {
 
@@ -93,6 +154,10 @@ ColumnStorage::ColumnStorage(ColumnStorage &&other) noexcept
     // Reset other's state
     other.fd = -1;
     other.mapped_data = nullptr;
+    other.read_base.store(nullptr, std::memory_order_release);
+    other.mapped_size = 0;
+    other.reserved_base = nullptr;
+    other.reserved_size = 0;
     other.count.store(0, std::memory_order_release);
     other.capacity = 0;
 }
@@ -105,9 +170,10 @@ ColumnStorage &ColumnStorage::operator=(ColumnStorage &&other) noexcept
         // Clean up current resources
         if (mapped_data && mapped_data != MAP_FAILED)
         {
-            write_header();
-            munmap(mapped_data, HEADER_SIZE + (capacity * element_size));
+            if (mode == OpenMode::ReadWrite)
+                write_header();
         }
+        release_mapping();
         if (fd != -1)
         {
             close(fd);
@@ -115,15 +181,26 @@ ColumnStorage &ColumnStorage::operator=(ColumnStorage &&other) noexcept
 
         // Move from other
         fd = other.fd;
+        mode = other.mode;
+        options = other.options;
         element_size = other.element_size;
         count.store(other.count.load(std::memory_order_acquire), std::memory_order_release);
         capacity = other.capacity;
         mapped_data = other.mapped_data;
+        read_base.store(other.read_base.load(std::memory_order_acquire), std::memory_order_release);
+        mapped_size = other.mapped_size;
+        reserved_base = other.reserved_base;
+        reserved_size = other.reserved_size;
+        retired_mappings = std::move(other.retired_mappings);
         filename = std::move(other.filename);
 
         // Reset other's state
         other.fd = -1;
         other.mapped_data = nullptr;
+        other.read_base.store(nullptr, std::memory_order_release);
+        other.mapped_size = 0;
+        other.reserved_base = nullptr;
+        other.reserved_size = 0;
         other.count.store(0, std::memory_order_release);
         other.capacity = 0;
     }
@@ -139,28 +216,204 @@ void ColumnStorage::ensure_directory_exists(const std::string &dir_path)
     }
 }
 
-void ColumnStorage::remap()
+void ColumnStorage::release_mapping()
 {
-    if (mapped_data && mapped_data != MAP_FAILED)
+    if (reserved_base)
     {
-        munmap(mapped_data, HEADER_SIZE + (capacity * element_size));
-        mapped_data = nullptr;
+        // The file mapping lives inside the reservation, one munmap covers both
+        munmap(reserved_base, reserved_size);
     }
+    else if (mapped_data && mapped_data != MAP_FAILED)
+    {
+        munmap(mapped_data, mapped_size);
+    }
+    for (const auto &retired : retired_mappings)
+    {
+        munmap(retired.addr, retired.size);
+    }
+    retired_mappings.clear();
+    reserved_base = nullptr;
+    reserved_size = 0;
+    mapped_data = nullptr;
+    read_base.store(nullptr, std::memory_order_release);
+    mapped_size = 0;
+}
 
+void ColumnStorage::remap()
+{
     size_t map_size = HEADER_SIZE + (capacity * element_size);
-    mapped_data = mmap(nullptr, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    int prot = (mode == OpenMode::ReadWrite) ? (PROT_READ | PROT_WRITE) : PROT_READ;
+
+#ifdef __linux__
+    // Reserve address space once so the file can grow in place and the base
+    // pointer handed to readers never changes
+    if (!reserved_base && !mapped_data && options.reserve_bytes > 0 && mode != OpenMode::ReadOnly)
+    {
+        size_t reserve = round_up_to_page(std::max(options.reserve_bytes, map_size * 2));
+        // Huge pages need a 2 MiB aligned start: over-reserve, trim the slack
+        size_t slack = options.huge_pages ? HUGE_PAGE_SIZE : 0;
+        void *base = mmap(nullptr, reserve + slack, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (base != MAP_FAILED)
+        {
+            char *start = static_cast<char *>(base);
+            if (slack > 0)
+            {
+                uintptr_t addr = reinterpret_cast<uintptr_t>(base);
+                start += (HUGE_PAGE_SIZE - addr % HUGE_PAGE_SIZE) % HUGE_PAGE_SIZE;
+                if (start > static_cast<char *>(base))
+                    munmap(base, static_cast<size_t>(start - static_cast<char *>(base)));
+                size_t tail = slack - static_cast<size_t>(start - static_cast<char *>(base));
+                if (tail > 0)
+                    munmap(start + reserve, tail);
+            }
+            reserved_base = start;
+            reserved_size = reserve;
+        }
+    }
+    int flags = MAP_SHARED | (options.populate ? MAP_POPULATE : 0);
+
+    if (reserved_base && map_size <= reserved_size)
+    {
+        // MAP_FIXED replaces the old pages atomically: there is no window
+        // where the range is unmapped
+        void *addr = mmap(reserved_base, map_size, prot, flags | MAP_FIXED, fd, 0);
+        if (addr == MAP_FAILED)
+        {
+            throw std::system_error(errno, std::generic_category(), "mmap failed for file " + filename);
+        }
+        apply_advice(addr, map_size);
+        Metrics::global().column_remaps.add();
+        mapped_data = addr;
+        read_base.store(static_cast<const char *>(addr), std::memory_order_release);
+        mapped_size = map_size;
+        return;
+    }
+#else
+    int flags = MAP_SHARED;
+#endif
+
+    if (mapped_data && !reserved_base)
+        munmap(mapped_data, mapped_size);
+    mapped_data = mmap(nullptr, map_size, prot, flags, fd, 0);
     if (mapped_data == MAP_FAILED)
     {
+        mapped_data = nullptr;
         throw std::system_error(errno, std::generic_category(), "mmap failed for file " + filename);
     }
+    apply_advice(mapped_data, map_size);
+    Metrics::global().column_remaps.add();
+    read_base.store(static_cast<const char *>(mapped_data), std::memory_order_release);
+    mapped_size = map_size;
+}
+
+void ColumnStorage::extend_mapping(size_t new_map_size)
+{
+#ifdef __linux__
+    if (reserved_base && new_map_size <= reserved_size)
+    {
+        // Only map the new tail; pages already mapped keep their PTEs
+        int prot = (mode == OpenMode::ReadWrite) ? (PROT_READ | PROT_WRITE) : PROT_READ;
+        size_t mapped_end = round_up_to_page(mapped_size);
+        if (new_map_size > mapped_end)
+        {
+            void *tail = mmap(static_cast<char *>(reserved_base) + mapped_end, new_map_size - mapped_end,
+                              prot, MAP_SHARED | MAP_FIXED | (options.populate ? MAP_POPULATE : 0), fd,
+                              static_cast<off_t>(mapped_end));
+            if (tail == MAP_FAILED)
+            {
+                throw std::system_error(errno, std::generic_category(), "mmap failed for file " + filename);
+            }
+            apply_advice(tail, new_map_size - mapped_end);
+            Metrics::global().column_tail_maps.add();
+        }
+        mapped_size = new_map_size;
+        return;
+    }
+#endif
+
+    // Outgrew the reservation: map the file again at a fresh (larger)
+    // reservation. The old mapping is retired rather than unmapped so views
+    // handed out earlier keep pointing at valid pages until the column closes.
+    if (reserved_base)
+        retired_mappings.push_back({reserved_base, reserved_size});
+    else if (mapped_data)
+        retired_mappings.push_back({mapped_data, mapped_size});
+    reserved_base = nullptr;
+    reserved_size = 0;
+    mapped_data = nullptr;
+    mapped_size = 0;
+    remap();
+}
+
+size_t ColumnStorage::next_capacity(size_t needed_capacity) const
+{
+    size_t current_bytes = capacity * element_size;
+    size_t new_bytes = current_bytes;
+    while (new_bytes < needed_capacity * element_size)
+    {
+        size_t step = options.extent_bytes;
+        if (options.growth == GrowthPolicy::Geometric)
+        {
+            step = static_cast<size_t>(static_cast<double>(new_bytes) * (options.growth_factor - 1.0));
+            step = std::max(step, options.min_grow_bytes);
+        }
+        new_bytes += std::max(step, element_size);
+    }
+    return new_bytes / element_size;
+}
+
+void ColumnStorage::extend_file(size_t new_total_size)
+{
+    size_t current_total = HEADER_SIZE + (capacity * element_size);
+    Metrics::global().column_file_grows.add();
+#ifdef __linux__
+    if (options.preallocate && new_total_size > current_total)
+    {
+        // Allocate real blocks up front: no ENOSPC SIGBUS later and the
+        // extents stay contiguous on disk
+        if (fallocate(fd, 0, static_cast<off_t>(current_total), static_cast<off_t>(new_total_size - current_total)) == 0)
+            return;
+        if (errno != EOPNOTSUPP && errno != ENOSYS)
+        {
+            throw std::system_error(errno, std::generic_category(), "fallocate failed for file " + filename);
+        }
+    }
+#else
+    (void)current_total;
+#endif
+    if (ftruncate(fd, new_total_size) == -1)
+    {
+        throw std::system_error(errno, std::generic_category(), "Failed to truncate file " + filename);
+    }
+}
+
+void ColumnStorage::ensure_capacity(size_t needed_capacity)
+{
+    if (needed_capacity <= capacity)
+        return;
+
+    // Lock for growing, this is a rare operation so it's ok to synchronize
+    std::lock_guard<std::mutex> lock(remap_mutex);
+
+    // Check again after acquiring lock (another thread might have grown it)
+    if (needed_capacity <= capacity)
+        return;
+
+    size_t new_capacity = next_capacity(needed_capacity);
+    size_t new_total_size = HEADER_SIZE + (new_capacity * element_size);
+    extend_file(new_total_size);
+    capacity = new_capacity;
+    extend_mapping(new_total_size);
 }
 
 void ColumnStorage::write_header()
 {
-    if (mapped_data && mapped_data != MAP_FAILED)
+    if (mapped_data && mapped_data != MAP_FAILED && mode == OpenMode::ReadWrite)
     {
+        // Released after the rows it counts: ReadShared mappings in other
+        // processes read it with acquire (follow)
         size_t current_count = count.load(std::memory_order_acquire);
-        std::memcpy(mapped_data, &current_count, HEADER_SIZE);
+        std::atomic_ref<size_t>(*static_cast<size_t *>(mapped_data)).store(current_count, std::memory_order_release);
         msync(mapped_data, HEADER_SIZE, MS_ASYNC);
     }
 }
@@ -175,38 +428,58 @@ void ColumnStorage::read_header()
     }
 }
 
-void ColumnStorage::append(const void *data)
+size_t ColumnStorage::follow()
 {
-    size_t current_count = count.load(std::memory_order_acquire);
+    if (mode != OpenMode::ReadShared)
+        return get_count();
 
-    if (current_count >= capacity)
+    size_t stored = std::atomic_ref<size_t>(*static_cast<size_t *>(mapped_data)).load(std::memory_order_acquire);
+    if (stored > capacity)
     {
-        // Lock for remapping, this is a rare operation so it's ok to synchronize
-        static std::mutex remap_mutex;
+        // The writer grew the file since it was mapped here
         std::lock_guard<std::mutex> lock(remap_mutex);
-
-        // Check again after acquiring lock (another thread might have remapped)
-        if (current_count >= capacity)
+        struct stat st;
+        if (fstat(fd, &st) == -1)
         {
-            // Grow by chunks rather than doubling for better memory efficiency
-            size_t new_capacity = capacity + (CHUNK_SIZE / element_size);
-            if (new_capacity <= capacity)
-                new_capacity = capacity * 2; // Fallback if element_size > CHUNK_SIZE
-
-            size_t new_total_size = HEADER_SIZE + (new_capacity * element_size);
-            if (ftruncate(fd, new_total_size) == -1)
-            {
-                throw std::system_error(errno, std::generic_category(), "Failed to truncate file " + filename);
-            }
-            capacity = new_capacity;
-            remap();
+            throw std::system_error(errno, std::generic_category(), "Failed to stat file " + filename);
         }
+        size_t file_capacity = static_cast<size_t>(st.st_size) < HEADER_SIZE
+                                   ? 0
+                                   : (static_cast<size_t>(st.st_size) - HEADER_SIZE) / element_size;
+        if (file_capacity > capacity)
+        {
+            capacity = file_capacity;
+            extend_mapping(HEADER_SIZE + capacity * element_size);
+        }
+        stored = std::min(stored, capacity);
+    }
+    // Never backwards: rows handed out stay valid
+    if (stored > count.load(std::memory_order_relaxed))
+        count.store(stored, std::memory_order_release);
+    return get_count();
+}
+
+size_t ColumnStorage::flushed_count() const
+{
+    if (mode != OpenMode::ReadShared)
+        return get_count();
+    return std::atomic_ref<size_t>(*static_cast<size_t *>(mapped_data)).load(std::memory_order_acquire);
+}
+
+void ColumnStorage::append(const void *data)
+{
+    if (mode != OpenMode::ReadWrite)
+    {
+        throw std::runtime_error("Cannot append to read-only column " + filename);
     }
 
-    // Increment count atomically and get the insertion position
-    size_t pos = count.fetch_add(1, std::memory_order_acq_rel);
+    size_t pos = count.load(std::memory_order_relaxed);
+    ensure_capacity(pos + 1);
+
+    // Single writer: copy the row in, then publish it
     char *dest = static_cast<char *>(mapped_data) + HEADER_SIZE + (pos * element_size);
     std::memcpy(dest, data, element_size);
+    count.store(pos + 1, std::memory_order_release);
 
     msync(dest, element_size, MS_ASYNC); // Use MS_ASYNC for better performance
 }
@@ -215,46 +488,18 @@ void ColumnStorage::append_batch(const void *data, size_t batch_count)
 {
     if (batch_count == 0)
         return;
-
-    size_t current_count = count.load(std::memory_order_acquire);
-
-    // Check if we need to grow capacity
-    if (current_count + batch_count > capacity)
+    if (mode != OpenMode::ReadWrite)
     {
-        // Lock for remapping
-        static std::mutex remap_mutex;
-        std::lock_guard<std::mutex> lock(remap_mutex);
-
-        // Check again after acquiring lock
-        current_count = count.load(std::memory_order_acquire);
-        if (current_count + batch_count > capacity)
-        {
-            // Grow capacity to accommodate the batch
-            size_t needed_capacity = current_count + batch_count;
-            size_t new_capacity = capacity;
-            while (new_capacity < needed_capacity)
-            {
-                new_capacity += (CHUNK_SIZE / element_size);
-                if (new_capacity <= capacity)
-                    new_capacity = capacity * 2; // Fallback
-            }
-
-            size_t new_total_size = HEADER_SIZE + (new_capacity * element_size);
-            if (ftruncate(fd, new_total_size) == -1)
-            {
-                throw std::system_error(errno, std::generic_category(), "Failed to truncate file " + filename);
-            }
-            capacity = new_capacity;
-            remap();
-        }
+        throw std::runtime_error("Cannot append to read-only column " + filename);
     }
 
-    // Get the starting position and increment count atomically
-    size_t start_pos = count.fetch_add(batch_count, std::memory_order_acq_rel);
+    size_t start_pos = count.load(std::memory_order_relaxed);
+    ensure_capacity(start_pos + batch_count);
 
-    // Copy all data at once
+    // Copy all data at once, then publish the rows
     char *dest = static_cast<char *>(mapped_data) + HEADER_SIZE + (start_pos * element_size);
     std::memcpy(dest, data, batch_count * element_size);
+    count.store(start_pos + batch_count, std::memory_order_release);
 
     // Sync the written data
     msync(dest, batch_count * element_size, MS_ASYNC);
@@ -265,6 +510,87 @@ void ColumnStorage::flush_header()
     write_header();
 }
 
+void ColumnStorage::sync_data()
+{
+    if (mode != OpenMode::ReadWrite)
+        return;
+
+    write_header();
+    size_t used = HEADER_SIZE + count.load(std::memory_order_acquire) * element_size;
+    if (msync(mapped_data, std::min(used, mapped_size), MS_SYNC) == -1)
+    {
+        throw std::system_error(errno, std::generic_category(), "msync failed for file " + filename);
+    }
+}
+
+void ColumnStorage::truncate(size_t new_count)
+{
+    if (mode != OpenMode::ReadWrite)
+    {
+        throw std::runtime_error("Cannot truncate read-only column " + filename);
+    }
+    if (new_count < count.load(std::memory_order_acquire))
+    {
+        count.store(new_count, std::memory_order_release);
+        write_header();
+    }
+}
+
+void ColumnStorage::seal()
+{
+    if (mode != OpenMode::ReadWrite)
+        return;
+
+    size_t current_count = count.load(std::memory_order_acquire);
+    write_header();
+    msync(mapped_data, mapped_size, MS_SYNC);
+    if (ftruncate(fd, HEADER_SIZE + (current_count * element_size)) == -1)
+    {
+        throw std::system_error(errno, std::generic_category(), "Failed to truncate file " + filename);
+    }
+    capacity = current_count;
+
+    // Downgrade in place instead of remapping: the base address stays valid
+    // for any view that is still reading this column
+    if (mprotect(reserved_base ? reserved_base : mapped_data, reserved_base ? reserved_size : mapped_size, PROT_READ) == -1)
+    {
+        throw std::system_error(errno, std::generic_category(), "mprotect failed for file " + filename);
+    }
+    mode = OpenMode::ReadOnly;
+    close(fd);
+    fd = -1;
+}
+
+void ColumnStorage::apply_advice(void *addr, size_t length) const
+{
+    // Hints only: a kernel that rejects one still maps the column
+    if (options.access != AccessPattern::Normal)
+        madvise(addr, length, madvise_flag(options.access));
+#ifdef MADV_HUGEPAGE
+    if (options.huge_pages)
+        madvise(addr, length, MADV_HUGEPAGE);
+#endif
+}
+
+void ColumnStorage::advise(AccessPattern access)
+{
+    options.access = access;
+    if (mapped_data)
+        madvise(mapped_data, mapped_size, madvise_flag(access));
+}
+
+void ColumnStorage::prefetch(size_t first, size_t last) const
+{
+    last = std::min(last, count.load(std::memory_order_acquire));
+    const char *base = read_base.load(std::memory_order_acquire);
+    if (!base || first >= last)
+        return;
+    uintptr_t begin = reinterpret_cast<uintptr_t>(base + HEADER_SIZE + first * element_size);
+    uintptr_t end = reinterpret_cast<uintptr_t>(base + HEADER_SIZE + last * element_size);
+    begin -= begin % page_size();
+    madvise(reinterpret_cast<void *>(begin), end - begin, MADV_WILLNEED);
+}
+
 void ColumnStorage::read(size_t index, void *data) const
 {
     size_t current_count = count.load(std::memory_order_acquire);
@@ -275,4 +601,19 @@ void ColumnStorage::read(size_t index, void *data) const
 
     const char *src = static_cast<const char *>(mapped_data) + HEADER_SIZE + (index * element_size);
     std::memcpy(data, src, element_size);
-}
\ No newline at end of file
+}
+void ColumnStorage::write(size_t index, const void *data)
+{
+    if (mode != OpenMode::ReadWrite)
+    {
+        throw std::runtime_error("Cannot write to read-only column " + filename);
+    }
+    size_t current_count = count.load(std::memory_order_acquire);
+    if (index >= current_count)
+    {
+        throw std::out_of_range("Index " + std::to_string(index) + " out of range for count " + std::to_string(current_count));
+    }
+
+    char *dest = static_cast<char *>(mapped_data) + HEADER_SIZE + (index * element_size);
+    std::memcpy(dest, data, element_size);
+}
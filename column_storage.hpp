@@ -11,11 +11,60 @@
 #include <cstring>
 #include <atomic>
 #include <filesystem>
+#include <span>
+#include <vector>
+
+// Sealed segments are reopened read-only so nothing can scribble on them
+enum class OpenMode
+{
+    ReadWrite,
+    ReadOnly,
+    // Read-only view of a column another process is still appending to:
+    // the file stays open so follow() can map its growth
+    ReadShared
+};
+
+// How a column's file grows once its preallocated space runs out
+enum class GrowthPolicy
+{
+    Geometric,  // Multiply the data region by growth_factor
+    FixedExtent // Add extent_bytes at a time
+};
+
+// Kernel hint for how a column's mapping is read (madvise)
+enum class AccessPattern
+{
+    Normal,     // Default readahead
+    Sequential, // Aggressive readahead, pages dropped soon after use (MADV_SEQUENTIAL)
+    Random,     // No readahead, for point probes (MADV_RANDOM)
+    WillNeed    // Read the whole mapping in ahead of use (MADV_WILLNEED)
+};
+
+struct ColumnOptions
+{
+    GrowthPolicy growth = GrowthPolicy::Geometric;
+    double growth_factor = 2.0;             // Geometric only
+    size_t min_grow_bytes = 64 * 1024;      // Smallest geometric step
+    size_t extent_bytes = 16 * 1024 * 1024; // FixedExtent step
+    bool preallocate = true;                // fallocate new space instead of a sparse ftruncate
+    // Virtual address space reserved per writable column so growth can map
+    // the new tail in place. Growing past it (or with 0, no reservation)
+    // maps the file at a new address and retires the old mapping.
+    size_t reserve_bytes = size_t(1) << 30;
+    // Paging policy, applied to every mapping of the column
+    AccessPattern access = AccessPattern::Normal;
+    bool populate = false;   // MAP_POPULATE: fault the whole file in when it is mapped
+    // MADV_HUGEPAGE, with the reservation aligned to 2 MiB. Takes effect
+    // only where the kernel backs file mappings with transparent huge
+    // pages (e.g. a data dir on tmpfs mounted with huge=advise).
+    bool huge_pages = false;
+};
 
 class ColumnStorage
 {
 public:
-    ColumnStorage(const std::string &data_dir, const std::string &symbol, const std::string &column_name, size_t element_size);
+    ColumnStorage(const std::string &data_dir, const std::string &symbol, const std::string &column_name, size_t element_size,
+                  OpenMode mode = OpenMode::ReadWrite, const ColumnOptions &options = ColumnOptions{});
     ~ColumnStorage();
 
     // Disable copy to avoid double memory mapping
@@ -29,23 +78,84 @@ public:
     void append(const void *data);
     void append_batch(const void *data, size_t count); // Batch append for better performance
     void read(size_t index, void *data) const;
+    void write(size_t index, const void *data); // Overwrite an existing row in place
     size_t get_count() const { return count.load(std::memory_order_acquire); }
     const std::string &get_filename() const { return filename; }
+    size_t get_element_size() const { return element_size; }
+    // Where a row sits in the file, for readers that bypass the mapping
+    size_t file_offset(size_t row) const { return HEADER_SIZE + row * element_size; }
     void flush_header(); // Explicitly flush header to disk
+    // Write the header and block until every row is on stable storage
+    void sync_data();
+    // Drop rows past new_count (crash recovery); never grows the column
+    void truncate(size_t new_count);
+    // Trim preallocated space, sync, and downgrade the mapping to read-only
+    void seal();
+    bool is_read_only() const { return mode != OpenMode::ReadWrite; }
+    // ReadShared: pick up the rows the writer has flushed to the header
+    // since (mapping any growth of the file) and return the row count
+    size_t follow();
+    // ReadShared: the row count in the writer's header, without mapping
+    // anything; follow() has rows to pick up while it exceeds get_count()
+    size_t flushed_count() const;
+
+    // Change the paging hint of the current and future mappings
+    void advise(AccessPattern access);
+    // Ask the kernel to start reading rows [first, last) in now
+    // (MADV_WILLNEED), so a scan that follows does not fault page by page.
+    // Rows past the count are ignored. Safe to call from readers.
+    void prefetch(size_t first, size_t last) const;
+
+    // Typed view of rows [first, last) straight into the mapping. Stays valid
+    // for the lifetime of this column, even across later growth. Safe to call
+    // while the (single) writer appends: rows are copied in before count
+    // moves past them.
+    template <typename T>
+    std::span<const T> span(size_t first, size_t last) const
+    {
+        size_t current_count = count.load(std::memory_order_acquire);
+        if (sizeof(T) != element_size || first > last || last > current_count)
+        {
+            throw std::out_of_range("Span [" + std::to_string(first) + ", " + std::to_string(last) +
+                                    ") out of range for count " + std::to_string(current_count));
+        }
+        const T *base = reinterpret_cast<const T *>(read_base.load(std::memory_order_acquire) + HEADER_SIZE);
+        return std::span<const T>(base + first, last - first);
+    }
 
 private:
     void remap();
+    void release_mapping();
+    void apply_advice(void *addr, size_t length) const;
+    void ensure_capacity(size_t needed_capacity);
+    size_t next_capacity(size_t needed_capacity) const;
+    void extend_file(size_t new_total_size);
+    void extend_mapping(size_t new_map_size);
     void ensure_directory_exists(const std::string &dir_path);
     void write_header();
     void read_header();
 
     int fd = -1;
+    OpenMode mode = OpenMode::ReadWrite;
+    ColumnOptions options;
     size_t element_size;
     std::atomic<size_t> count{0};
     size_t capacity = 0;
     void *mapped_data = nullptr;
+    std::atomic<const char *> read_base{nullptr}; // mapped_data for lock-free span() callers
+    size_t mapped_size = 0; // Length of the current mapping (may lag capacity during a grow)
+    void *reserved_base = nullptr; // PROT_NONE reservation the mapping grows into
+    size_t reserved_size = 0;
+
+    // Mappings replaced by a move to a new address; unmapped on close
+    struct Mapping
+    {
+        void *addr;
+        size_t size;
+    };
+    std::vector<Mapping> retired_mappings;
     std::string filename;
-    const size_t CHUNK_SIZE = 4096;            // 4KB chunks for efficient file growth
+    const size_t CHUNK_SIZE = 4096;            // Initial 4KB allocation for new files
     const size_t HEADER_SIZE = sizeof(size_t); // Store count in header
 };
 
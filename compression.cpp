@@ -0,0 +1,449 @@
+#include "compression.hpp"
+#include "block_cache.hpp"
+#include "checksum.hpp"
+#include "file_util.hpp"
+#include <algorithm>
+#include <bit>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace
+{
+    constexpr uint64_t COMPRESSED_MAGIC = 0x31534d4f43425354ULL; // "TSBCOMS1"
+    constexpr uint32_t COMPRESSED_VERSION = 1;
+
+    struct CompressedHeader
+    {
+        uint64_t magic;
+        uint32_t version;
+        uint32_t block_rows;
+        uint64_t row_count;
+        uint64_t block_count;
+        uint32_t directory_crc;
+        uint32_t reserved;
+    };
+
+    // MSB-first bit stream
+    class BitWriter
+    {
+    public:
+        explicit BitWriter(std::vector<uint8_t> &out) : out(out) {}
+
+        void write(uint64_t value, int bits)
+        {
+            if (bits > 32)
+            {
+                write(value >> 32, bits - 32);
+                bits = 32;
+            }
+            value &= (bits == 64) ? ~0ULL : ((1ULL << bits) - 1);
+            acc = (acc << bits) | value;
+            pending += bits;
+            while (pending >= 8)
+            {
+                pending -= 8;
+                out.push_back(static_cast<uint8_t>(acc >> pending));
+            }
+            acc &= (1ULL << pending) - 1;
+        }
+
+        void finish()
+        {
+            if (pending > 0)
+                out.push_back(static_cast<uint8_t>(acc << (8 - pending)));
+            pending = 0;
+            acc = 0;
+        }
+
+    private:
+        std::vector<uint8_t> &out;
+        uint64_t acc = 0;
+        int pending = 0; // Bits in acc not yet emitted (< 8 between calls)
+    };
+
+    class BitReader
+    {
+    public:
+        BitReader(const uint8_t *data, size_t bytes) : data(data), bytes(bytes) {}
+
+        uint64_t read(int bits)
+        {
+            if (bits > 32)
+            {
+                uint64_t high = read(bits - 32);
+                return (high << 32) | read(32);
+            }
+            while (available < bits)
+            {
+                // Reading past the end yields zeros; callers bound n
+                acc = (acc << 8) | (pos < bytes ? data[pos] : 0);
+                ++pos;
+                available += 8;
+            }
+            available -= bits;
+            uint64_t value = (acc >> available) & ((1ULL << bits) - 1);
+            acc &= (1ULL << available) - 1;
+            return value;
+        }
+
+        bool bit() { return read(1) != 0; }
+
+    private:
+        const uint8_t *data;
+        size_t bytes;
+        size_t pos = 0;
+        uint64_t acc = 0;
+        int available = 0;
+    };
+
+    uint64_t zigzag(int64_t v) { return (static_cast<uint64_t>(v) << 1) ^ static_cast<uint64_t>(v >> 63); }
+    int64_t unzigzag(uint64_t v) { return static_cast<int64_t>(v >> 1) ^ -static_cast<int64_t>(v & 1); }
+
+    // Size classes for zigzagged delta-of-delta values: a unary prefix, then
+    // a fixed-width payload
+    constexpr int DOD_CLASS_BITS[] = {7, 9, 12, 32, 64};
+}
+
+namespace codec
+{
+    void encode_timestamps(const uint64_t *ts, size_t n, std::vector<uint8_t> &out)
+    {
+        if (n == 0)
+            return;
+        BitWriter writer(out);
+        writer.write(ts[0], 64);
+        // Deltas wrap modulo 2^64 so arbitrary timestamps round-trip
+        uint64_t prev_delta = 0;
+        for (size_t i = 1; i < n; ++i)
+        {
+            uint64_t delta = ts[i] - ts[i - 1];
+            uint64_t dod = zigzag(static_cast<int64_t>(delta - prev_delta));
+            prev_delta = delta;
+
+            if (dod == 0)
+            {
+                writer.write(0, 1);
+                continue;
+            }
+            size_t cls = 0;
+            while (cls + 1 < std::size(DOD_CLASS_BITS) && dod >= (1ULL << DOD_CLASS_BITS[cls]))
+                ++cls;
+            // cls + 1 one-bits, terminated by a zero except for the last class
+            int prefix_bits = static_cast<int>(cls) + 1;
+            uint64_t prefix = (1ULL << prefix_bits) - 1;
+            if (cls + 1 < std::size(DOD_CLASS_BITS))
+            {
+                prefix <<= 1;
+                ++prefix_bits;
+            }
+            writer.write(prefix, prefix_bits);
+            writer.write(dod, DOD_CLASS_BITS[cls]);
+        }
+        writer.finish();
+    }
+
+    void decode_timestamps(const uint8_t *data, size_t bytes, size_t n, uint64_t *out)
+    {
+        if (n == 0)
+            return;
+        BitReader reader(data, bytes);
+        out[0] = reader.read(64);
+        uint64_t prev_delta = 0;
+        for (size_t i = 1; i < n; ++i)
+        {
+            uint64_t dod = 0;
+            if (reader.bit())
+            {
+                size_t cls = 0;
+                while (cls + 1 < std::size(DOD_CLASS_BITS) && reader.bit())
+                    ++cls;
+                dod = reader.read(DOD_CLASS_BITS[cls]);
+            }
+            uint64_t delta = prev_delta + static_cast<uint64_t>(unzigzag(dod));
+            out[i] = out[i - 1] + delta;
+            prev_delta = delta;
+        }
+    }
+
+    void encode_prices(const double *px, size_t n, std::vector<uint8_t> &out)
+    {
+        if (n == 0)
+            return;
+        BitWriter writer(out);
+        uint64_t prev = std::bit_cast<uint64_t>(px[0]);
+        writer.write(prev, 64);
+        int prev_leading = -1;
+        int prev_trailing = 0;
+        for (size_t i = 1; i < n; ++i)
+        {
+            uint64_t bits = std::bit_cast<uint64_t>(px[i]);
+            uint64_t x = bits ^ prev;
+            prev = bits;
+            if (x == 0)
+            {
+                writer.write(0, 1);
+                continue;
+            }
+
+            int leading = std::min(std::countl_zero(x), 31);
+            int trailing = std::countr_zero(x);
+            if (prev_leading >= 0 && leading >= prev_leading && trailing >= prev_trailing)
+            {
+                // Fits the previous window: control bits 10
+                writer.write(0b10, 2);
+                writer.write(x >> prev_trailing, 64 - prev_leading - prev_trailing);
+                continue;
+            }
+
+            // New window: control bits 11, 5 bits leading zeros, 6 bits
+            // length (64 stored as 0), then the bits
+            int meaningful = 64 - leading - trailing;
+            writer.write(0b11, 2);
+            writer.write(static_cast<uint64_t>(leading), 5);
+            writer.write(static_cast<uint64_t>(meaningful & 63), 6);
+            writer.write(x >> trailing, meaningful);
+            prev_leading = leading;
+            prev_trailing = trailing;
+        }
+        writer.finish();
+    }
+
+    void decode_prices(const uint8_t *data, size_t bytes, size_t n, double *out)
+    {
+        if (n == 0)
+            return;
+        BitReader reader(data, bytes);
+        uint64_t prev = reader.read(64);
+        out[0] = std::bit_cast<double>(prev);
+        int leading = 0;
+        int trailing = 0;
+        for (size_t i = 1; i < n; ++i)
+        {
+            if (reader.bit())
+            {
+                if (reader.bit())
+                {
+                    leading = static_cast<int>(reader.read(5));
+                    int meaningful = static_cast<int>(reader.read(6));
+                    if (meaningful == 0)
+                        meaningful = 64;
+                    trailing = 64 - leading - meaningful;
+                }
+                int meaningful = 64 - leading - trailing;
+                prev ^= reader.read(meaningful) << trailing;
+            }
+            out[i] = std::bit_cast<double>(prev);
+        }
+    }
+
+    void encode_volumes(const uint64_t *vol, size_t n, std::vector<uint8_t> &out)
+    {
+        uint64_t prev = 0;
+        for (size_t i = 0; i < n; ++i)
+        {
+            uint64_t v = zigzag(static_cast<int64_t>(vol[i] - prev));
+            prev = vol[i];
+            while (v >= 0x80)
+            {
+                out.push_back(static_cast<uint8_t>(v | 0x80));
+                v >>= 7;
+            }
+            out.push_back(static_cast<uint8_t>(v));
+        }
+    }
+
+    void decode_volumes(const uint8_t *data, size_t bytes, size_t n, uint64_t *out)
+    {
+        uint64_t prev = 0;
+        size_t pos = 0;
+        for (size_t i = 0; i < n; ++i)
+        {
+            uint64_t v = 0;
+            int shift = 0;
+            while (pos < bytes && shift < 64)
+            {
+                uint8_t byte = data[pos++];
+                v |= static_cast<uint64_t>(byte & 0x7f) << shift;
+                shift += 7;
+                if ((byte & 0x80) == 0)
+                    break;
+            }
+            prev += static_cast<uint64_t>(unzigzag(v));
+            out[i] = prev;
+        }
+    }
+}
+
+void CompressedColumns::write(const std::string &path, const uint64_t *ts, const double *px, const uint64_t *vol,
+                              size_t rows, size_t block_rows)
+{
+    block_rows = std::max<size_t>(block_rows, 1);
+    size_t block_count = (rows + block_rows - 1) / block_rows;
+
+    std::vector<CompressedBlockInfo> directory(block_count);
+    std::vector<uint8_t> payload;
+    std::vector<uint8_t> ts_bytes, px_bytes, vol_bytes;
+    uint64_t offset = sizeof(CompressedHeader) + block_count * sizeof(CompressedBlockInfo);
+
+    for (size_t b = 0; b < block_count; ++b)
+    {
+        size_t first = b * block_rows;
+        size_t n = std::min(block_rows, rows - first);
+
+        ts_bytes.clear();
+        px_bytes.clear();
+        vol_bytes.clear();
+        codec::encode_timestamps(ts + first, n, ts_bytes);
+        codec::encode_prices(px + first, n, px_bytes);
+        codec::encode_volumes(vol + first, n, vol_bytes);
+
+        CompressedBlockInfo &info = directory[b];
+        info.first_row = first;
+        info.offset = offset + payload.size();
+        info.min_ts = *std::min_element(ts + first, ts + first + n);
+        info.max_ts = *std::max_element(ts + first, ts + first + n);
+        info.rows = static_cast<uint32_t>(n);
+        info.ts_bytes = static_cast<uint32_t>(ts_bytes.size());
+        info.px_bytes = static_cast<uint32_t>(px_bytes.size());
+        info.vol_bytes = static_cast<uint32_t>(vol_bytes.size());
+        info.reserved = 0;
+
+        size_t block_start = payload.size();
+        payload.insert(payload.end(), ts_bytes.begin(), ts_bytes.end());
+        payload.insert(payload.end(), px_bytes.begin(), px_bytes.end());
+        payload.insert(payload.end(), vol_bytes.begin(), vol_bytes.end());
+        info.crc = crc32c(payload.data() + block_start, payload.size() - block_start);
+    }
+
+    CompressedHeader header{COMPRESSED_MAGIC, COMPRESSED_VERSION, static_cast<uint32_t>(block_rows), rows, block_count,
+                            crc32c(directory.data(), directory.size() * sizeof(CompressedBlockInfo)), 0};
+
+    // The raw columns are deleted once this file is in place, so it must be
+    // on stable storage before the rename
+    std::string tmp_path = path + ".tmp";
+    int fd = open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (fd == -1)
+    {
+        throw std::system_error(errno, std::generic_category(), "Failed to open " + tmp_path);
+    }
+    try
+    {
+        write_fully(fd, &header, sizeof(header), tmp_path);
+        write_fully(fd, directory.data(), directory.size() * sizeof(CompressedBlockInfo), tmp_path);
+        write_fully(fd, payload.data(), payload.size(), tmp_path);
+        if (fsync(fd) == -1)
+        {
+            throw std::system_error(errno, std::generic_category(), "fsync failed for " + tmp_path);
+        }
+    }
+    catch (...)
+    {
+        close(fd);
+        std::remove(tmp_path.c_str());
+        throw;
+    }
+    close(fd);
+
+    if (std::rename(tmp_path.c_str(), path.c_str()) != 0)
+    {
+        throw std::system_error(errno, std::generic_category(), "Failed to install " + path);
+    }
+    fsync_directory(path);
+}
+
+CompressedColumns::CompressedColumns(const std::string &path) : path(path), cache_id(BlockCache::next_file_id())
+{
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd == -1)
+    {
+        throw std::system_error(errno, std::generic_category(), "Failed to open " + path);
+    }
+    struct stat st;
+    if (fstat(fd, &st) == -1)
+    {
+        close(fd);
+        throw std::system_error(errno, std::generic_category(), "Failed to stat " + path);
+    }
+    mapped_size = static_cast<size_t>(st.st_size);
+    if (mapped_size < sizeof(CompressedHeader))
+    {
+        close(fd);
+        throw std::runtime_error("Invalid compressed segment (too small): " + path);
+    }
+    mapped_data = mmap(nullptr, mapped_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapped_data == MAP_FAILED)
+    {
+        mapped_data = nullptr;
+        throw std::system_error(errno, std::generic_category(), "mmap failed for " + path);
+    }
+
+    CompressedHeader header;
+    std::memcpy(&header, mapped_data, sizeof(header));
+    size_t directory_bytes = header.block_count * sizeof(CompressedBlockInfo);
+    bool valid = header.magic == COMPRESSED_MAGIC && header.version == COMPRESSED_VERSION && header.block_rows > 0 &&
+                 header.block_count == (header.row_count + header.block_rows - 1) / header.block_rows &&
+                 sizeof(header) + directory_bytes <= mapped_size;
+    if (valid)
+    {
+        const char *dir = static_cast<const char *>(mapped_data) + sizeof(header);
+        valid = crc32c(dir, directory_bytes) == header.directory_crc;
+        if (valid)
+        {
+            directory.resize(header.block_count);
+            std::memcpy(directory.data(), dir, directory_bytes);
+            for (const auto &info : directory)
+            {
+                uint64_t end = info.offset + uint64_t(info.ts_bytes) + info.px_bytes + info.vol_bytes;
+                valid = valid && end <= mapped_size && info.rows <= header.block_rows;
+            }
+        }
+    }
+    if (!valid)
+    {
+        munmap(mapped_data, mapped_size);
+        mapped_data = nullptr;
+        throw std::runtime_error("Invalid compressed segment: " + path);
+    }
+
+    row_count = header.row_count;
+    block_rows = header.block_rows;
+}
+
+CompressedColumns::~CompressedColumns()
+{
+    BlockCache::global().erase_file(cache_id);
+    if (mapped_data)
+        munmap(mapped_data, mapped_size);
+}
+
+std::shared_ptr<const DecodedBlock> CompressedColumns::decode(size_t block) const
+{
+    const CompressedBlockInfo &info = directory.at(block);
+    const uint8_t *base = static_cast<const uint8_t *>(mapped_data) + info.offset;
+    size_t total = size_t(info.ts_bytes) + info.px_bytes + info.vol_bytes;
+    if (crc32c(base, total) != info.crc)
+    {
+        throw std::runtime_error("Checksum mismatch in block " + std::to_string(block) + " of " + path);
+    }
+
+    auto decoded = std::make_shared<DecodedBlock>();
+    decoded->first_row = info.first_row;
+    decoded->timestamps.resize(info.rows);
+    decoded->prices.resize(info.rows);
+    decoded->volumes.resize(info.rows);
+    codec::decode_timestamps(base, info.ts_bytes, info.rows, decoded->timestamps.data());
+    codec::decode_prices(base + info.ts_bytes, info.px_bytes, info.rows, decoded->prices.data());
+    codec::decode_volumes(base + info.ts_bytes + info.px_bytes, info.vol_bytes, info.rows, decoded->volumes.data());
+    return decoded;
+}
+
+std::shared_ptr<const DecodedBlock> CompressedColumns::block(size_t block, bool admit) const
+{
+    return BlockCache::global().get(cache_id, block, admit, [this, block]
+                                    { return decode(block); });
+}
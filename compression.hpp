@@ -0,0 +1,97 @@
+#ifndef COMPRESSION_HPP
+#define COMPRESSION_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Encoding used for sealed segments
+enum class Compression
+{
+    None,   // Keep the raw mapped columns (zero-copy views)
+    Gorilla // Delta-of-delta timestamps, XOR prices, zigzag varint volumes
+};
+
+// Block codecs. Every block is encoded independently so a query only
+// decodes the blocks its time range touches.
+namespace codec
+{
+    // Delta-of-delta, bit-packed in Gorilla-style size classes. Handles
+    // out-of-order timestamps (negative deltas) at a few extra bits each.
+    void encode_timestamps(const uint64_t *ts, size_t n, std::vector<uint8_t> &out);
+    void decode_timestamps(const uint8_t *data, size_t bytes, size_t n, uint64_t *out);
+
+    // XOR with the previous value, storing only the meaningful bits
+    void encode_prices(const double *px, size_t n, std::vector<uint8_t> &out);
+    void decode_prices(const uint8_t *data, size_t bytes, size_t n, double *out);
+
+    // Zigzag delta from the previous volume as LEB128 varints
+    void encode_volumes(const uint64_t *vol, size_t n, std::vector<uint8_t> &out);
+    void decode_volumes(const uint8_t *data, size_t bytes, size_t n, uint64_t *out);
+}
+
+struct CompressedBlockInfo
+{
+    uint64_t first_row;
+    uint64_t offset; // Payload start within the file
+    uint64_t min_ts;
+    uint64_t max_ts;
+    uint32_t rows;
+    uint32_t ts_bytes;
+    uint32_t px_bytes;
+    uint32_t vol_bytes;
+    uint32_t crc; // Over the three encoded streams
+    uint32_t reserved;
+};
+
+// Rows of one block, decoded
+struct DecodedBlock
+{
+    size_t first_row = 0;
+    std::vector<uint64_t> timestamps;
+    std::vector<double> prices;
+    std::vector<uint64_t> volumes;
+};
+
+// Read-only, memory-mapped compressed copy of a sealed segment's columns:
+// header, block directory, then the encoded blocks.
+class CompressedColumns
+{
+public:
+    // Encode rows into path, atomically (temporary file, fsync, rename)
+    static void write(const std::string &path, const uint64_t *ts, const double *px, const uint64_t *vol,
+                      size_t rows, size_t block_rows);
+
+    // Map and validate; throws std::runtime_error on a damaged file
+    explicit CompressedColumns(const std::string &path);
+    ~CompressedColumns();
+
+    CompressedColumns(const CompressedColumns &) = delete;
+    CompressedColumns &operator=(const CompressedColumns &) = delete;
+
+    size_t get_count() const { return row_count; }
+    size_t get_block_rows() const { return block_rows; }
+    const std::vector<CompressedBlockInfo> &blocks() const { return directory; }
+    size_t size_bytes() const { return mapped_size; }
+
+    // Decode one block; the result is independent of this object
+    std::shared_ptr<const DecodedBlock> decode(size_t block) const;
+    // decode() through BlockCache::global(); admit false leaves a miss out
+    // of the cache
+    std::shared_ptr<const DecodedBlock> block(size_t block, bool admit = true) const;
+
+    static constexpr const char *FILE_NAME = "compressed.bin";
+
+private:
+    std::string path;
+    uint64_t cache_id; // This file's key in the block cache
+    void *mapped_data = nullptr;
+    size_t mapped_size = 0;
+    size_t row_count = 0;
+    size_t block_rows = 0;
+    std::vector<CompressedBlockInfo> directory;
+};
+
+#endif // COMPRESSION_HPP
@@ -0,0 +1,120 @@
+#include "epoch.hpp"
+#include <limits>
+#include <thread>
+
+namespace
+{
+    // Hands the slot back when its thread exits
+    struct SlotOwner
+    {
+        std::atomic<bool> *in_use = nullptr;
+        ~SlotOwner()
+        {
+            if (in_use)
+                in_use->store(false, std::memory_order_release);
+        }
+    };
+}
+
+EpochDomain &EpochDomain::global()
+{
+    // Never destroyed: stores closed during static destruction still retire
+    static EpochDomain *instance = new EpochDomain;
+    return *instance;
+}
+
+EpochDomain::Slot &EpochDomain::thread_slot()
+{
+    thread_local Slot *slot = nullptr;
+    thread_local SlotOwner owner;
+    if (slot)
+        return *slot;
+
+    for (Slot *s = slots.load(std::memory_order_acquire); s; s = s->next)
+    {
+        bool free = false;
+        if (s->in_use.compare_exchange_strong(free, true, std::memory_order_acq_rel))
+        {
+            slot = s;
+            break;
+        }
+    }
+    if (!slot)
+    {
+        slot = new Slot;
+        slot->in_use.store(true, std::memory_order_relaxed);
+        Slot *head = slots.load(std::memory_order_relaxed);
+        do
+        {
+            slot->next = head;
+        } while (!slots.compare_exchange_weak(head, slot, std::memory_order_release, std::memory_order_relaxed));
+    }
+    owner.in_use = &slot->in_use;
+    return *slot;
+}
+
+void EpochDomain::enter()
+{
+    Slot &slot = thread_slot();
+    if (slot.depth++ > 0)
+        return;
+    slot.epoch.store(epoch.load(std::memory_order_acquire), std::memory_order_relaxed);
+    // Publish the pin before reading any shared pointer; pairs with the
+    // fence in oldest_pinned()
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+}
+
+void EpochDomain::leave()
+{
+    Slot &slot = thread_slot();
+    if (--slot.depth == 0)
+        slot.epoch.store(0, std::memory_order_release);
+}
+
+uint64_t EpochDomain::oldest_pinned() const
+{
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    uint64_t oldest = std::numeric_limits<uint64_t>::max();
+    for (Slot *s = slots.load(std::memory_order_acquire); s; s = s->next)
+    {
+        uint64_t pinned = s->epoch.load(std::memory_order_acquire);
+        if (pinned != 0)
+            oldest = std::min(oldest, pinned);
+    }
+    return oldest;
+}
+
+void EpochDomain::retire(void *p, void (*deleter)(void *))
+{
+    // Readers pinned after the bump cannot have seen p
+    uint64_t retired_at = epoch.fetch_add(1, std::memory_order_acq_rel);
+    {
+        std::lock_guard<std::mutex> lock(retired_mutex);
+        retired.push_back({retired_at, p, deleter});
+    }
+    collect(oldest_pinned());
+}
+
+void EpochDomain::collect(uint64_t oldest)
+{
+    std::vector<Retired> ready;
+    {
+        std::lock_guard<std::mutex> lock(retired_mutex);
+        auto keep = std::partition(retired.begin(), retired.end(), [&](const Retired &r)
+                                   { return r.epoch >= oldest; });
+        ready.assign(keep, retired.end());
+        retired.erase(keep, retired.end());
+    }
+    // Deleters may retire in turn (a snapshot releasing the last reference
+    // to a segment), so they run outside the lock
+    for (const Retired &r : ready)
+        r.deleter(r.p);
+}
+
+void EpochDomain::synchronize()
+{
+    uint64_t target = epoch.fetch_add(1, std::memory_order_acq_rel) + 1;
+    while (oldest_pinned() < target)
+        std::this_thread::yield();
+    collect(target);
+}
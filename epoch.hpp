@@ -0,0 +1,141 @@
+#ifndef EPOCH_HPP
+#define EPOCH_HPP
+
+#include "ring_buffer.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <vector>
+
+// Epoch-based reclamation for data the writer replaces while readers may
+// still be looking at it (published snapshots, grown index arrays). Readers
+// pin the current epoch for the duration of a query; the writer publishes
+// the replacement first and retires the old object, which is freed once
+// every reader pinned at or before the retiring epoch has let go. Readers
+// never wait; the writer never waits on readers either, it only defers the
+// free. One domain serves the whole process.
+class EpochDomain
+{
+public:
+    static EpochDomain &global();
+
+    // Pin the calling thread; nests
+    void enter();
+    void leave();
+
+    // Free p with deleter once no pinned reader can still reach it. The
+    // caller must already have unpublished p.
+    void retire(void *p, void (*deleter)(void *));
+
+    template <typename T>
+    void retire(T *p)
+    {
+        retire(const_cast<void *>(static_cast<const void *>(p)), [](void *q)
+               { delete static_cast<T *>(q); });
+    }
+
+    // Wait for every reader pinned now to leave, then free all that was
+    // retired before the call. For shutdown paths only.
+    void synchronize();
+
+private:
+    struct alignas(CACHE_LINE_SIZE) Slot
+    {
+        std::atomic<uint64_t> epoch{0}; // 0 while not pinned
+        std::atomic<bool> in_use{false};
+        Slot *next = nullptr;
+        uint32_t depth = 0; // Owner thread only
+    };
+
+    struct Retired
+    {
+        uint64_t epoch;
+        void *p;
+        void (*deleter)(void *);
+    };
+
+    EpochDomain() = default;
+    Slot &thread_slot();
+    uint64_t oldest_pinned() const;
+    void collect(uint64_t oldest);
+
+    std::atomic<uint64_t> epoch{1};
+    std::atomic<Slot *> slots{nullptr}; // Never shrinks; slots are reused
+
+    std::mutex retired_mutex;
+    std::vector<Retired> retired;
+};
+
+// RAII pin on the global epoch domain
+class EpochGuard
+{
+public:
+    EpochGuard() { EpochDomain::global().enter(); }
+    ~EpochGuard() { EpochDomain::global().leave(); }
+
+    EpochGuard(const EpochGuard &) = delete;
+    EpochGuard &operator=(const EpochGuard &) = delete;
+};
+
+// Append-only array with one writer and any number of pinned readers.
+// Readers load size() first and then data(); every element below that size
+// is complete. Growing copies into a larger buffer and retires the old one.
+template <typename T>
+class PublishedArray
+{
+public:
+    PublishedArray() = default;
+    ~PublishedArray() { delete[] items.load(std::memory_order_relaxed); }
+
+    PublishedArray(const PublishedArray &) = delete;
+    PublishedArray &operator=(const PublishedArray &) = delete;
+
+    size_t size() const { return count.load(std::memory_order_acquire); }
+    bool empty() const { return size() == 0; }
+    const T *data() const { return items.load(std::memory_order_acquire); }
+
+    // Writer only
+    void push_back(const T &value)
+    {
+        size_t n = count.load(std::memory_order_relaxed);
+        if (n == capacity)
+            grow(std::max<size_t>(16, capacity * 2));
+        items.load(std::memory_order_relaxed)[n] = value;
+        count.store(n + 1, std::memory_order_release);
+    }
+
+    // Writer only, with no reader attached yet (opening a segment)
+    void assign(const T *values, size_t n)
+    {
+        count.store(0, std::memory_order_relaxed);
+        if (n > capacity)
+            grow(n);
+        if (n > 0)
+            std::memcpy(items.load(std::memory_order_relaxed), values, n * sizeof(T));
+        count.store(n, std::memory_order_release);
+    }
+    void clear() { count.store(0, std::memory_order_release); }
+
+private:
+    void grow(size_t new_capacity)
+    {
+        T *old = items.load(std::memory_order_relaxed);
+        T *fresh = new T[new_capacity];
+        if (old)
+            std::memcpy(fresh, old, count.load(std::memory_order_relaxed) * sizeof(T));
+        items.store(fresh, std::memory_order_release);
+        capacity = new_capacity;
+        if (old)
+            EpochDomain::global().retire(old, [](void *p)
+                                         { delete[] static_cast<T *>(p); });
+    }
+
+    std::atomic<T *> items{nullptr};
+    std::atomic<size_t> count{0};
+    size_t capacity = 0;
+};
+
+#endif // EPOCH_HPP
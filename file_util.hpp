@@ -0,0 +1,148 @@
+#ifndef FILE_UTIL_HPP
+#define FILE_UTIL_HPP
+
+#include <cerrno>
+#include <cstddef>
+#include <fcntl.h>
+#include <filesystem>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <system_error>
+#include <unistd.h>
+#include <vector>
+
+// Small POSIX helpers shared by the files that must reach stable storage in
+// a known order (WAL, checkpoints, compressed segments) and the ones read
+// back whole (block indexes, bulk imports)
+
+// Read-only private mapping of a whole file. Throws std::system_error if it
+// cannot be opened or mapped; an empty file maps to data == nullptr.
+class MappedFile
+{
+public:
+    explicit MappedFile(const std::string &path)
+    {
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd == -1)
+        {
+            throw std::system_error(errno, std::generic_category(), "Failed to open " + path);
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0)
+        {
+            int err = errno;
+            close(fd);
+            throw std::system_error(err, std::generic_category(), "Failed to stat " + path);
+        }
+        size = static_cast<size_t>(st.st_size);
+        if (size > 0)
+        {
+            void *mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            int err = errno;
+            close(fd);
+            if (mapped == MAP_FAILED)
+            {
+                throw std::system_error(err, std::generic_category(), "mmap failed for " + path);
+            }
+            data = static_cast<const char *>(mapped);
+        }
+        else
+        {
+            close(fd);
+        }
+    }
+
+    ~MappedFile()
+    {
+        if (data)
+            munmap(const_cast<char *>(data), size);
+    }
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    const char *data = nullptr;
+    size_t size = 0;
+};
+
+// Copy of a whole file as it is now. Unlike a mapping, the copy cannot
+// fault if another process cuts the file meanwhile. Throws std::system_error.
+inline std::vector<char> read_file(const std::string &path)
+{
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd == -1)
+    {
+        throw std::system_error(errno, std::generic_category(), "Failed to open " + path);
+    }
+    std::vector<char> contents;
+    char buffer[64 * 1024];
+    while (true)
+    {
+        ssize_t n = ::read(fd, buffer, sizeof(buffer));
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            int err = errno;
+            close(fd);
+            throw std::system_error(err, std::generic_category(), "Failed to read " + path);
+        }
+        if (n == 0)
+            break;
+        contents.insert(contents.end(), buffer, buffer + n);
+    }
+    close(fd);
+    return contents;
+}
+
+// write() until everything is out, retrying on EINTR
+inline void write_fully(int fd, const void *data, size_t length, const std::string &path)
+{
+    const char *p = static_cast<const char *>(data);
+    while (length > 0)
+    {
+        ssize_t written = ::write(fd, p, length);
+        if (written < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            throw std::system_error(errno, std::generic_category(), "Failed to write " + path);
+        }
+        p += written;
+        length -= static_cast<size_t>(written);
+    }
+}
+
+// pwrite() until everything is out, retrying on EINTR
+inline void pwrite_fully(int fd, const void *data, size_t length, size_t offset, const std::string &path)
+{
+    const char *p = static_cast<const char *>(data);
+    while (length > 0)
+    {
+        ssize_t written = ::pwrite(fd, p, length, static_cast<off_t>(offset));
+        if (written < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            throw std::system_error(errno, std::generic_category(), "Failed to write " + path);
+        }
+        p += written;
+        offset += static_cast<size_t>(written);
+        length -= static_cast<size_t>(written);
+    }
+}
+
+// Make a rename or unlink of file_path durable
+inline void fsync_directory(const std::string &file_path)
+{
+    std::string dir = std::filesystem::path(file_path).parent_path().string();
+    int dir_fd = open(dir.empty() ? "." : dir.c_str(), O_RDONLY | O_DIRECTORY);
+    if (dir_fd != -1)
+    {
+        fsync(dir_fd);
+        close(dir_fd);
+    }
+}
+
+#endif // FILE_UTIL_HPP
@@ -0,0 +1,186 @@
+#include "maintenance.hpp"
+#include "metrics.hpp"
+#include "timeseries_db.hpp"
+#include <algorithm>
+#include <iostream>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+IoThrottle::IoThrottle(uint64_t bytes_per_second)
+    : rate(bytes_per_second), tokens(static_cast<double>(bytes_per_second)),
+      refilled(std::chrono::steady_clock::now())
+{
+}
+
+void IoThrottle::acquire(size_t bytes)
+{
+    Metrics &metrics = Metrics::global();
+    metrics.maintenance_bytes.add(bytes);
+    if (rate == 0)
+        return;
+
+    double debt;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto now = std::chrono::steady_clock::now();
+        double elapsed = std::chrono::duration<double>(now - refilled).count();
+        refilled = now;
+        // At most one second's worth builds up while idle
+        tokens = std::min(static_cast<double>(rate), tokens + elapsed * static_cast<double>(rate));
+        tokens -= static_cast<double>(bytes);
+        debt = -tokens;
+    }
+    if (debt > 0)
+    {
+        auto pause = std::chrono::nanoseconds(static_cast<int64_t>(debt * 1e9 / static_cast<double>(rate)));
+        metrics.maintenance_throttle_ns.add(static_cast<uint64_t>(pause.count()));
+        std::this_thread::sleep_for(pause);
+    }
+}
+
+MaintenanceScheduler &MaintenanceScheduler::global()
+{
+    // Never destroyed, like QueryPool::global(): stores may still be
+    // closing during static destruction
+    static MaintenanceScheduler *instance = new MaintenanceScheduler();
+    return *instance;
+}
+
+MaintenanceScheduler::MaintenanceScheduler(const MaintenanceOptions &options)
+    : options(options), throttle(options.io_bytes_per_second)
+{
+    for (size_t i = 0; i < std::max<size_t>(1, options.threads); ++i)
+        workers.emplace_back(&MaintenanceScheduler::worker_loop, this);
+}
+
+MaintenanceScheduler::~MaintenanceScheduler()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    changed.notify_all();
+    for (auto &worker : workers)
+        worker.join();
+}
+
+void MaintenanceScheduler::add(TimeSeriesDB *db)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        entries.push_back(Entry{db, false, std::chrono::steady_clock::now()});
+    }
+    changed.notify_all();
+}
+
+void MaintenanceScheduler::remove(TimeSeriesDB *db)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    auto find = [&]
+    { return std::find_if(entries.begin(), entries.end(), [db](const Entry &e)
+                          { return e.db == db; }); };
+    changed.wait(lock, [&]
+                 { auto it = find(); return it == entries.end() || !it->busy; });
+    auto it = find();
+    if (it != entries.end())
+        entries.erase(it);
+}
+
+void MaintenanceScheduler::wake(TimeSeriesDB *db)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (auto &entry : entries)
+        {
+            if (entry.db == db)
+                entry.due = std::chrono::steady_clock::now();
+        }
+    }
+    changed.notify_all();
+}
+
+void MaintenanceScheduler::set_thread_priority() const
+{
+    // Best effort: containers may forbid either
+    if (options.idle_priority)
+    {
+        sched_param param{};
+        pthread_setschedparam(pthread_self(), SCHED_IDLE, &param);
+        // ioprio_set(IOPRIO_WHO_PROCESS, this thread, IOPRIO_CLASS_IDLE)
+        syscall(SYS_ioprio_set, 1, 0, 3 << 13);
+    }
+    if (!options.cpus.empty())
+    {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for (int cpu : options.cpus)
+        {
+            if (cpu >= 0 && cpu < CPU_SETSIZE)
+                CPU_SET(cpu, &set);
+        }
+        pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    }
+}
+
+void MaintenanceScheduler::worker_loop()
+{
+    set_thread_priority();
+    auto interval = std::chrono::milliseconds(options.interval_ms);
+
+    std::unique_lock<std::mutex> lock(mutex);
+    while (!stopping)
+    {
+        auto now = std::chrono::steady_clock::now();
+        auto earliest = std::chrono::steady_clock::time_point::max();
+        Entry *due = nullptr;
+        for (size_t i = 0; i < entries.size() && !due; ++i)
+        {
+            Entry &entry = entries[(next + i) % entries.size()];
+            if (entry.busy)
+                continue;
+            if (entry.due <= now)
+            {
+                due = &entry;
+                next = (next + i + 1) % entries.size();
+            }
+            earliest = std::min(earliest, entry.due);
+        }
+        if (!due)
+        {
+            if (earliest == std::chrono::steady_clock::time_point::max())
+                changed.wait(lock);
+            else
+                changed.wait_until(lock, earliest);
+            continue;
+        }
+
+        TimeSeriesDB *db = due->db;
+        due->busy = true;
+        lock.unlock();
+        bool worked = false;
+        try
+        {
+            worked = db->maintenance_step(throttle);
+        }
+        catch (const std::exception &e)
+        {
+            std::cerr << "WARNING: Maintenance of " << db->symbol << " failed: " << e.what() << std::endl;
+        }
+        if (worked)
+            Metrics::global().maintenance_tasks.add();
+        lock.lock();
+
+        // remove() waits for busy entries, so db is still listed
+        for (auto &entry : entries)
+        {
+            if (entry.db == db)
+            {
+                entry.busy = false;
+                entry.due = worked ? std::chrono::steady_clock::now() : std::chrono::steady_clock::now() + interval;
+            }
+        }
+        changed.notify_all();
+    }
+}
@@ -0,0 +1,94 @@
+#ifndef MAINTENANCE_HPP
+#define MAINTENANCE_HPP
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class TimeSeriesDB;
+
+// Token bucket over bytes shared by the maintenance workers. acquire() takes
+// the bytes at once and sleeps off whatever the bucket runs short, so a
+// large request is paid for after the fact instead of never fitting.
+class IoThrottle
+{
+public:
+    // 0 never sleeps
+    explicit IoThrottle(uint64_t bytes_per_second);
+
+    void acquire(size_t bytes);
+
+private:
+    std::mutex mutex;
+    uint64_t rate;
+    double tokens;
+    std::chrono::steady_clock::time_point refilled;
+};
+
+struct MaintenanceOptions
+{
+    size_t threads = 1;
+    // Read and write budget of all workers together; 0 is unlimited
+    uint64_t io_bytes_per_second = uint64_t(64) << 20;
+    // Cores the workers are pinned to; empty leaves them unpinned
+    std::vector<int> cpus;
+    // Run the workers under SCHED_IDLE and the idle I/O class, so they only
+    // get the CPU and disk time that writers and queries leave over
+    bool idle_priority = true;
+    // How long a store with nothing to do waits before it is looked at again
+    uint64_t interval_ms = 1000;
+};
+
+// Background upkeep of stores, off their writer threads: retention,
+// compression of sealed partitions, sealing and merging the out-of-order
+// segments back into their partitions, and persisting sparse indexes of
+// sealed segments. Every store registers with the scheduler named in its
+// DBOptions (global() by default). Workers take due stores round-robin
+// and run one task of one store at a time; the writer only wakes a store
+// when a partition seals. Rewritten segments are swapped in with a single
+// snapshot publish, so readers see either the old segments or the new ones.
+class MaintenanceScheduler
+{
+public:
+    // Started on first use with MaintenanceOptions{}
+    static MaintenanceScheduler &global();
+
+    explicit MaintenanceScheduler(const MaintenanceOptions &options = MaintenanceOptions{});
+    // Stores must be removed first
+    ~MaintenanceScheduler();
+
+    MaintenanceScheduler(const MaintenanceScheduler &) = delete;
+    MaintenanceScheduler &operator=(const MaintenanceScheduler &) = delete;
+
+    void add(TimeSeriesDB *db);
+    // Returns once no task of db is running
+    void remove(TimeSeriesDB *db);
+    // Look at db now instead of after its interval; ignored if not added
+    void wake(TimeSeriesDB *db);
+
+private:
+    struct Entry
+    {
+        TimeSeriesDB *db;
+        bool busy = false; // A worker runs a task of db
+        std::chrono::steady_clock::time_point due;
+    };
+
+    void worker_loop();
+    void set_thread_priority() const;
+
+    MaintenanceOptions options;
+    IoThrottle throttle;
+    std::mutex mutex;
+    std::condition_variable changed; // Entries added, woken or freed, or stopping
+    std::vector<Entry> entries;
+    size_t next = 0; // Round-robin start
+    bool stopping = false;
+    std::vector<std::thread> workers;
+};
+
+#endif // MAINTENANCE_HPP
@@ -0,0 +1,157 @@
+#include "metrics.hpp"
+#include <algorithm>
+#include <sstream>
+
+uint64_t Histogram::bucket_value(size_t bucket)
+{
+    if (bucket < SUB_BUCKETS)
+        return bucket;
+    int msb = static_cast<int>(bucket / SUB_BUCKETS) + SUB_BITS - 1;
+    uint64_t mantissa = bucket % SUB_BUCKETS;
+    uint64_t width = uint64_t(1) << (msb - SUB_BITS);
+    uint64_t lower = (uint64_t(1) << msb) | (mantissa << (msb - SUB_BITS));
+    return lower + width / 2;
+}
+
+HistogramSummary Histogram::summarize(const std::string &name, const std::string &unit) const
+{
+    HistogramSummary summary;
+    summary.name = name;
+    summary.unit = unit;
+
+    // Buckets are read one by one while writers keep adding; the totals
+    // come from the same pass so the percentiles stay consistent
+    std::array<uint64_t, BUCKETS> counts;
+    uint64_t count = 0;
+    for (size_t b = 0; b < BUCKETS; ++b)
+    {
+        counts[b] = buckets[b].load(std::memory_order_relaxed);
+        count += counts[b];
+    }
+    summary.count = count;
+    summary.sum = sum.load(std::memory_order_relaxed);
+    summary.max = max.load(std::memory_order_relaxed);
+    if (count == 0)
+        return summary;
+
+    auto percentile = [&](double q)
+    {
+        uint64_t rank = std::max<uint64_t>(1, static_cast<uint64_t>(q * static_cast<double>(count) + 0.5));
+        uint64_t seen = 0;
+        for (size_t b = 0; b < BUCKETS; ++b)
+        {
+            seen += counts[b];
+            if (seen >= rank)
+                return std::min(bucket_value(b), summary.max);
+        }
+        return summary.max;
+    };
+    summary.p50 = percentile(0.50);
+    summary.p90 = percentile(0.90);
+    summary.p99 = percentile(0.99);
+    summary.p999 = percentile(0.999);
+    return summary;
+}
+
+void Histogram::reset()
+{
+    for (auto &bucket : buckets)
+        bucket.store(0, std::memory_order_relaxed);
+    sum.store(0, std::memory_order_relaxed);
+    max.store(0, std::memory_order_relaxed);
+}
+
+MetricsSnapshot Metrics::snapshot() const
+{
+    MetricsSnapshot snapshot;
+    snapshot.counters = {
+        {"ticks_appended", ticks_appended.value()},
+        {"writer_batches", writer_batches.value()},
+        {"ticks_written", ticks_written.value()},
+        {"wal_syncs", wal_syncs.value()},
+        {"checkpoints", checkpoints.value()},
+        {"segments_compressed", segments_compressed.value()},
+        {"late_ticks", late_ticks.value()},
+        {"column_remaps", column_remaps.value()},
+        {"column_tail_maps", column_tail_maps.value()},
+        {"column_file_grows", column_file_grows.value()},
+        {"io_block_reads", io_block_reads.value()},
+        {"io_cache_hits", io_cache_hits.value()},
+        {"io_bytes_read", io_bytes_read.value()},
+        {"block_cache_hits", block_cache_hits.value()},
+        {"block_cache_misses", block_cache_misses.value()},
+        {"block_cache_evictions", block_cache_evictions.value()},
+        {"maintenance_tasks", maintenance_tasks.value()},
+        {"maintenance_bytes", maintenance_bytes.value()},
+        {"maintenance_throttle_ns", maintenance_throttle_ns.value()},
+        {"late_segments_merged", late_segments_merged.value()},
+        {"queries", queries.value()},
+        {"query_rows", query_rows.value()},
+        {"stats_blocks", stats_blocks.value()},
+    };
+    snapshot.histograms = {
+        append_to_durable_ns.summarize("append_to_durable", "ns"),
+        writer_batch_size.summarize("writer_batch_size", "ticks"),
+        queue_depth.summarize("queue_depth", "ticks"),
+        lock_wait_ns.summarize("lock_wait", "ns"),
+        lock_hold_ns.summarize("lock_hold", "ns"),
+        io_read_latency_ns.summarize("io_read_latency", "ns"),
+        query_latency_ns.summarize("query_latency", "ns"),
+    };
+    uint64_t query_ns = query_time_ns.value();
+    if (query_ns > 0)
+        snapshot.query_rows_per_second = static_cast<double>(query_rows.value()) * 1e9 / static_cast<double>(query_ns);
+    return snapshot;
+}
+
+void Metrics::reset()
+{
+    for (Counter *counter : {&ticks_appended, &writer_batches, &ticks_written, &wal_syncs, &checkpoints,
+                             &segments_compressed, &late_ticks, &column_remaps, &column_tail_maps,
+                             &column_file_grows, &io_block_reads, &io_cache_hits, &io_bytes_read,
+                             &block_cache_hits, &block_cache_misses, &block_cache_evictions, &maintenance_tasks,
+                             &maintenance_bytes, &maintenance_throttle_ns, &late_segments_merged, &queries,
+                             &query_rows, &query_time_ns, &stats_blocks})
+        counter->reset();
+    for (Histogram *histogram : {&append_to_durable_ns, &writer_batch_size, &queue_depth, &lock_wait_ns,
+                                 &lock_hold_ns, &io_read_latency_ns, &query_latency_ns})
+        histogram->reset();
+}
+
+std::string format_metrics_text(const MetricsSnapshot &snapshot)
+{
+    std::ostringstream out;
+    if (!snapshot.enabled)
+    {
+        out << "Metrics compiled out (TSDB_NO_METRICS)\n";
+        return out.str();
+    }
+    for (const auto &[name, value] : snapshot.counters)
+        out << name << ": " << value << "\n";
+    out << "query_rows_per_second: " << static_cast<uint64_t>(snapshot.query_rows_per_second) << "\n";
+    for (const auto &h : snapshot.histograms)
+    {
+        out << h.name << " (" << h.unit << "): count " << h.count;
+        if (h.count > 0)
+            out << " p50 " << h.p50 << " p90 " << h.p90 << " p99 " << h.p99 << " p999 " << h.p999 << " max " << h.max;
+        out << "\n";
+    }
+    return out.str();
+}
+
+std::string format_metrics_json(const MetricsSnapshot &snapshot)
+{
+    std::ostringstream out;
+    out << "{\n  \"enabled\": " << (snapshot.enabled ? "true" : "false");
+    for (const auto &[name, value] : snapshot.counters)
+        out << ",\n  \"" << name << "\": " << value;
+    out << ",\n  \"query_rows_per_second\": " << static_cast<uint64_t>(snapshot.query_rows_per_second);
+    for (const auto &h : snapshot.histograms)
+    {
+        out << ",\n  \"" << h.name << "\": {\"unit\": \"" << h.unit << "\", \"count\": " << h.count
+            << ", \"sum\": " << h.sum << ", \"p50\": " << h.p50 << ", \"p90\": " << h.p90 << ", \"p99\": " << h.p99
+            << ", \"p999\": " << h.p999 << ", \"max\": " << h.max << "}";
+    }
+    out << "\n}\n";
+    return out.str();
+}
@@ -0,0 +1,302 @@
+#ifndef METRICS_HPP
+#define METRICS_HPP
+
+#include "ring_buffer.hpp"
+#include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Process-wide hot-path instrumentation. Build with -DTSDB_NO_METRICS
+// (make METRICS=0) to compile every recording call down to nothing.
+#ifdef TSDB_NO_METRICS
+inline constexpr bool metrics_enabled = false;
+#else
+inline constexpr bool metrics_enabled = true;
+#endif
+
+// Monotonic nanoseconds, or 0 with metrics compiled out
+inline uint64_t metrics_now()
+{
+    if constexpr (metrics_enabled)
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                         std::chrono::steady_clock::now().time_since_epoch())
+                                         .count());
+    return 0;
+}
+
+// Monotonic counter striped across cache lines; each thread adds to its own
+// stripe so producers on different cores never share a line
+class Counter
+{
+public:
+    void add(uint64_t n = 1)
+    {
+        if constexpr (metrics_enabled)
+            stripes[stripe_index()].value.fetch_add(n, std::memory_order_relaxed);
+    }
+
+    uint64_t value() const
+    {
+        uint64_t total = 0;
+        for (const auto &stripe : stripes)
+            total += stripe.value.load(std::memory_order_relaxed);
+        return total;
+    }
+
+    void reset()
+    {
+        for (auto &stripe : stripes)
+            stripe.value.store(0, std::memory_order_relaxed);
+    }
+
+private:
+    static constexpr size_t STRIPES = 16;
+
+    static size_t stripe_index()
+    {
+        static std::atomic<size_t> next{0};
+        thread_local size_t index = next.fetch_add(1, std::memory_order_relaxed) % STRIPES;
+        return index;
+    }
+
+    struct alignas(CACHE_LINE_SIZE) Stripe
+    {
+        std::atomic<uint64_t> value{0};
+    };
+    std::array<Stripe, STRIPES> stripes;
+};
+
+struct HistogramSummary
+{
+    std::string name;
+    std::string unit;
+    uint64_t count = 0;
+    uint64_t sum = 0;
+    uint64_t max = 0;
+    uint64_t p50 = 0;
+    uint64_t p90 = 0;
+    uint64_t p99 = 0;
+    uint64_t p999 = 0;
+};
+
+// HDR-style log-linear histogram over uint64 values: exact below 16, then
+// 16 linear sub-buckets per power of two (at most 6.25% relative error)
+class Histogram
+{
+public:
+    void record(uint64_t value)
+    {
+        if constexpr (metrics_enabled)
+        {
+            buckets[bucket_of(value)].fetch_add(1, std::memory_order_relaxed);
+            sum.fetch_add(value, std::memory_order_relaxed);
+            uint64_t seen = max.load(std::memory_order_relaxed);
+            while (value > seen && !max.compare_exchange_weak(seen, value, std::memory_order_relaxed))
+            {
+            }
+        }
+    }
+
+    HistogramSummary summarize(const std::string &name, const std::string &unit) const;
+    void reset();
+
+    static size_t bucket_of(uint64_t value)
+    {
+        if (value < SUB_BUCKETS)
+            return static_cast<size_t>(value);
+        int msb = std::bit_width(value) - 1;
+        size_t mantissa = (value >> (msb - SUB_BITS)) & (SUB_BUCKETS - 1);
+        return static_cast<size_t>(msb - SUB_BITS + 1) * SUB_BUCKETS + mantissa;
+    }
+    // Midpoint of the values bucket b holds
+    static uint64_t bucket_value(size_t bucket);
+
+private:
+    static constexpr int SUB_BITS = 4;
+    static constexpr size_t SUB_BUCKETS = size_t(1) << SUB_BITS;
+    static constexpr size_t BUCKETS = (64 - SUB_BITS + 1) * SUB_BUCKETS;
+
+    std::array<std::atomic<uint64_t>, BUCKETS> buckets{};
+    std::atomic<uint64_t> sum{0};
+    std::atomic<uint64_t> max{0};
+};
+
+struct MetricsSnapshot
+{
+    bool enabled = metrics_enabled;
+    std::vector<std::pair<std::string, uint64_t>> counters;
+    std::vector<HistogramSummary> histograms;
+    double query_rows_per_second = 0.0; // Rows returned per second of query time
+};
+
+class Metrics
+{
+public:
+    static Metrics &global()
+    {
+        static Metrics instance;
+        return instance;
+    }
+
+    // Ingest
+    Counter ticks_appended;
+    Counter writer_batches;
+    Counter ticks_written;
+    Counter wal_syncs;
+    Counter checkpoints;
+    Counter segments_compressed;
+    Counter late_ticks; // Older than the reorder window, sent to the out-of-order segments
+    Histogram append_to_durable_ns; // Sampled, see DurabilityProbe
+    Histogram writer_batch_size;    // Ticks per writer batch
+    Histogram queue_depth;          // Ring occupancy when the writer drains it
+
+    // segments_mutex held by the writer, maintenance swaps and retention
+    Histogram lock_wait_ns;
+    Histogram lock_hold_ns;
+
+    // Column files
+    Counter column_remaps;     // Whole-column (re)mappings
+    Counter column_tail_maps;  // In-place extensions of a reserved mapping
+    Counter column_file_grows; // ftruncate/fallocate calls
+
+    // Cold reads through AsyncReader
+    Counter io_block_reads;
+    Counter io_cache_hits;
+    Counter io_bytes_read;
+    Histogram io_read_latency_ns; // Submission to completion, per block
+
+    // Decoded blocks of compressed segments (BlockCache)
+    Counter block_cache_hits;
+    Counter block_cache_misses;
+    Counter block_cache_evictions;
+
+    // Background maintenance (MaintenanceScheduler)
+    Counter maintenance_tasks;
+    Counter maintenance_bytes;       // Read and written, as charged to the throttle
+    Counter maintenance_throttle_ns; // Slept off to stay under the rate
+    Counter late_segments_merged;
+
+    // Queries
+    Counter queries;
+    Counter query_rows;
+    Counter query_time_ns;
+    Counter stats_blocks; // Blocks an aggregate skipped or folded from segment.meta stats alone
+    Histogram query_latency_ns;
+
+    MetricsSnapshot snapshot() const;
+    void reset();
+
+private:
+    Metrics() = default;
+};
+
+std::string format_metrics_text(const MetricsSnapshot &snapshot);
+std::string format_metrics_json(const MetricsSnapshot &snapshot);
+
+// Lock on segments_mutex that records how long it waited and how long it
+// was held
+class TimedLock
+{
+public:
+    explicit TimedLock(std::mutex &mutex)
+        : requested(metrics_now()), lock(mutex), acquired(metrics_now())
+    {
+        Metrics::global().lock_wait_ns.record(acquired - requested);
+    }
+
+    ~TimedLock() { Metrics::global().lock_hold_ns.record(metrics_now() - acquired); }
+
+    TimedLock(const TimedLock &) = delete;
+    TimedLock &operator=(const TimedLock &) = delete;
+
+private:
+    uint64_t requested;
+    std::unique_lock<std::mutex> lock;
+    uint64_t acquired;
+};
+
+// Records one query: latency and the rows it produced
+class QueryTimer
+{
+public:
+    QueryTimer() : start(metrics_now()) {}
+    ~QueryTimer()
+    {
+        if constexpr (metrics_enabled)
+        {
+            uint64_t elapsed = metrics_now() - start;
+            Metrics &m = Metrics::global();
+            m.queries.add();
+            m.query_rows.add(rows);
+            m.query_time_ns.add(elapsed);
+            m.query_latency_ns.record(elapsed);
+        }
+    }
+
+    void set_rows(size_t n) { rows = n; }
+
+    QueryTimer(const QueryTimer &) = delete;
+    QueryTimer &operator=(const QueryTimer &) = delete;
+
+private:
+    uint64_t start;
+    size_t rows = 0;
+};
+
+// Append-to-durable latency. Producers sample one append in SAMPLE_EVERY,
+// tagged with the number of ticks accepted once it is in; the writer
+// reports how many ticks are durable (WAL synced, or applied without a WAL)
+// and the samples that are covered complete. With several producers the
+// accepted count is only approximately the ring position.
+class DurabilityProbe
+{
+public:
+    void enqueued(uint64_t accepted, uint64_t started_ns)
+    {
+        if constexpr (metrics_enabled)
+        {
+            thread_local uint32_t calls = 0;
+            if (++calls % SAMPLE_EVERY != 0)
+                return;
+            std::lock_guard<std::mutex> lock(mutex);
+            if (samples.size() < MAX_SAMPLES)
+                samples.emplace_back(accepted, started_ns);
+            waiting.store(true, std::memory_order_release);
+        }
+    }
+
+    void durable(uint64_t durable_ticks)
+    {
+        if constexpr (metrics_enabled)
+        {
+            if (!waiting.load(std::memory_order_acquire))
+                return;
+            uint64_t now = metrics_now();
+            std::lock_guard<std::mutex> lock(mutex);
+            while (!samples.empty() && samples.front().first <= durable_ticks)
+            {
+                Metrics::global().append_to_durable_ns.record(now - samples.front().second);
+                samples.pop_front();
+            }
+            waiting.store(!samples.empty(), std::memory_order_release);
+        }
+    }
+
+private:
+    static constexpr uint32_t SAMPLE_EVERY = 64;
+    static constexpr size_t MAX_SAMPLES = 4096;
+
+    std::mutex mutex;
+    std::deque<std::pair<uint64_t, uint64_t>> samples; // (accepted, start ns)
+    std::atomic<bool> waiting{false};
+};
+
+#endif // METRICS_HPP
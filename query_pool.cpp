@@ -0,0 +1,95 @@
+#include "query_pool.hpp"
+#include <algorithm>
+#include <thread>
+
+QueryPool &QueryPool::global()
+{
+    // Never destroyed: the workers park for good once main returns
+    static QueryPool *instance = new QueryPool(std::max(1u, std::thread::hardware_concurrency()) - 1);
+    return *instance;
+}
+
+QueryPool::QueryPool(size_t workers) : workers(workers)
+{
+    for (size_t i = 0; i < workers; ++i)
+        std::thread(&QueryPool::worker_loop, this).detach();
+}
+
+void QueryPool::worker_loop()
+{
+    while (true)
+    {
+        std::shared_ptr<Job> job;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [this]
+                      { return !jobs.empty(); });
+            job = jobs.front();
+            if (--job->helpers == 0)
+                jobs.pop_front();
+        }
+        run_tasks(*job);
+    }
+}
+
+void QueryPool::run_tasks(Job &job)
+{
+    // A late helper finds every task claimed and never touches the body,
+    // which lives on the caller's stack
+    size_t i;
+    while ((i = job.next.fetch_add(1, std::memory_order_relaxed)) < job.tasks)
+    {
+        if (!job.failed.load(std::memory_order_relaxed))
+        {
+            try
+            {
+                (*job.body)(i);
+            }
+            catch (...)
+            {
+                if (!job.failed.exchange(true, std::memory_order_relaxed))
+                    job.error = std::current_exception();
+            }
+        }
+        if (job.done.fetch_add(1, std::memory_order_acq_rel) + 1 == job.tasks)
+            job.done.notify_all();
+    }
+}
+
+void QueryPool::parallel_for(size_t tasks, size_t parallelism, const std::function<void(size_t)> &body)
+{
+    size_t helpers = std::min({parallelism == 0 ? workers : parallelism - 1, workers, tasks > 0 ? tasks - 1 : 0});
+    if (helpers == 0)
+    {
+        for (size_t i = 0; i < tasks; ++i)
+            body(i);
+        return;
+    }
+
+    auto job = std::make_shared<Job>();
+    job->body = &body;
+    job->tasks = tasks;
+    job->helpers = helpers;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        jobs.push_back(job);
+    }
+    for (size_t i = 0; i < helpers; ++i)
+        wake.notify_one();
+
+    run_tasks(*job);
+
+    // Helpers that have not started by now are not needed
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = std::find(jobs.begin(), jobs.end(), job);
+        if (it != jobs.end())
+            jobs.erase(it);
+    }
+    size_t done;
+    while ((done = job->done.load(std::memory_order_acquire)) != tasks)
+        job->done.wait(done, std::memory_order_acquire);
+
+    if (job->error)
+        std::rethrow_exception(job->error);
+}
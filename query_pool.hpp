@@ -0,0 +1,53 @@
+#ifndef QUERY_POOL_HPP
+#define QUERY_POOL_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+
+// Worker threads that parallel queries borrow. A query splits its rows into
+// tasks and calls parallel_for; the calling thread and up to parallelism - 1
+// workers claim tasks from a shared counter until none are left, so threads
+// that finish early take over the remaining blocks. One pool serves the
+// whole process and is started on first use.
+class QueryPool
+{
+public:
+    static QueryPool &global();
+
+    // Threads available to a query, the caller included
+    size_t max_parallelism() const { return workers + 1; }
+
+    // Run body(i) for every i in [0, tasks) and return once all are done.
+    // parallelism 0 uses every thread of the pool. The first exception a
+    // task throws is rethrown here after the others finished.
+    void parallel_for(size_t tasks, size_t parallelism, const std::function<void(size_t)> &body);
+
+private:
+    struct Job
+    {
+        const std::function<void(size_t)> *body = nullptr;
+        size_t tasks = 0;
+        size_t helpers = 0; // Workers still wanted; guarded by the pool mutex
+        std::atomic<size_t> next{0};
+        std::atomic<size_t> done{0};
+        std::atomic<bool> failed{false};
+        std::exception_ptr error; // Written by the first task to fail
+    };
+
+    explicit QueryPool(size_t workers);
+    void worker_loop();
+    static void run_tasks(Job &job);
+
+    size_t workers;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::deque<std::shared_ptr<Job>> jobs; // Jobs that still want helpers
+};
+
+#endif // QUERY_POOL_HPP
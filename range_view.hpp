@@ -0,0 +1,61 @@
+#ifndef RANGE_VIEW_HPP
+#define RANGE_VIEW_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <vector>
+
+// Contiguous rows [first_row, first_row + size()) of one segment. The spans
+// point straight into the memory-mapped columns; nothing is copied.
+struct ColumnView
+{
+    std::span<const uint64_t> timestamps;
+    std::span<const double> prices;
+    std::span<const uint64_t> volumes;
+    size_t first_row = 0;
+
+    size_t size() const { return timestamps.size(); }
+    bool empty() const { return timestamps.empty(); }
+};
+
+// Ownership tokens keeping the memory behind a set of views alive
+using ViewLeases = std::vector<std::shared_ptr<const void>>;
+
+// Result of a zero-copy range or tail query: an ordered list of column
+// views. The view holds a lease on every segment (and decoded block of a
+// compressed segment) it points into, so the memory stays valid for as long as the RangeView lives, even if the
+// partition is sealed or dropped by retention in the meantime.
+class RangeView
+{
+public:
+    const std::vector<ColumnView> &views() const { return chunks; }
+    std::vector<ColumnView>::const_iterator begin() const { return chunks.begin(); }
+    std::vector<ColumnView>::const_iterator end() const { return chunks.end(); }
+
+    size_t size() const
+    {
+        size_t total = 0;
+        for (const auto &chunk : chunks)
+            total += chunk.size();
+        return total;
+    }
+    bool empty() const { return size() == 0; }
+
+    // True when concatenating the views yields rows in timestamp order.
+    // Late (out-of-order) ticks in the range make this false.
+    bool is_time_ordered() const { return time_ordered; }
+
+private:
+    friend class TimeSeriesDB;
+
+    std::vector<ColumnView> chunks;
+    ViewLeases leases;
+    bool time_ordered = true;
+    // Leading chunks that are in order when concatenated; the rest (rows of
+    // the out-of-order segments) get merged in
+    size_t ordered_chunks = 0;
+};
+
+#endif // RANGE_VIEW_HPP
@@ -0,0 +1,306 @@
+#ifndef RING_BUFFER_HPP
+#define RING_BUFFER_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <thread>
+#include <type_traits>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+// Hot atomics are padded onto their own cache line to avoid false sharing
+inline constexpr size_t CACHE_LINE_SIZE = 64;
+
+inline void cpu_relax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    _mm_pause();
+#else
+    std::this_thread::yield();
+#endif
+}
+
+// How the consumer waits when the ring is empty
+enum class ConsumerWaitMode
+{
+    BusyPoll,     // Spin forever: lowest latency, burns a core
+    SpinThenPark, // Spin for a bounded number of iterations, then sleep
+    Blocking      // Sleep as soon as the ring is empty
+};
+
+// What a producer does when the ring is full
+enum class BackpressurePolicy
+{
+    Block, // Wait until the consumer frees space
+    Drop,  // Discard the element (counted by the caller)
+    Fail   // Reject the element and let the caller retry
+};
+
+// Futex-backed sleep/wake point. The waker only pays for a fence and a load
+// unless somebody is actually parked, so producers never issue a syscall on
+// the fast path.
+class WakeSignal
+{
+public:
+    // Waiter side: announce the intent to sleep, then re-check the condition
+    // before calling park(). Returns the token park() waits on.
+    uint32_t prepare_park()
+    {
+        sleepers.fetch_add(1, std::memory_order_seq_cst);
+        return seq.load(std::memory_order_acquire);
+    }
+
+    void park(uint32_t token)
+    {
+        seq.wait(token, std::memory_order_acquire);
+        sleepers.fetch_sub(1, std::memory_order_release);
+    }
+
+    void cancel_park() { sleepers.fetch_sub(1, std::memory_order_release); }
+
+    // Waker side: cheap when nobody sleeps
+    void notify()
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (sleepers.load(std::memory_order_relaxed) != 0)
+        {
+            seq.fetch_add(1, std::memory_order_release);
+            seq.notify_all();
+        }
+    }
+
+    // Unconditional wake, used for shutdown
+    void wake_all()
+    {
+        seq.fetch_add(1, std::memory_order_seq_cst);
+        seq.notify_all();
+    }
+
+private:
+    alignas(CACHE_LINE_SIZE) std::atomic<uint32_t> seq{0};
+    alignas(CACHE_LINE_SIZE) std::atomic<uint32_t> sleepers{0};
+};
+
+inline size_t round_up_pow2(size_t n)
+{
+    size_t cap = 2;
+    while (cap < n)
+        cap <<= 1;
+    return cap;
+}
+
+// Bounded single-producer/single-consumer ring (Lamport queue with cached
+// indices). Exactly one thread may push and one thread may pop.
+template <typename T>
+class SpscRingBuffer
+{
+    static_assert(std::is_trivially_copyable_v<T>, "ring elements must be trivially copyable");
+
+public:
+    explicit SpscRingBuffer(size_t min_capacity)
+        : mask(round_up_pow2(min_capacity) - 1),
+          slots(std::make_unique<T[]>(mask + 1))
+    {
+    }
+
+    SpscRingBuffer(const SpscRingBuffer &) = delete;
+    SpscRingBuffer &operator=(const SpscRingBuffer &) = delete;
+
+    bool try_push(const T &item) { return try_push_bulk(&item, 1) == 1; }
+
+    // Push up to n items, returns how many were accepted
+    size_t try_push_bulk(const T *items, size_t n)
+    {
+        size_t t = tail.load(std::memory_order_relaxed);
+        size_t free_slots = capacity() - (t - cached_head);
+        if (free_slots < n)
+        {
+            cached_head = head.load(std::memory_order_acquire);
+            free_slots = capacity() - (t - cached_head);
+        }
+        size_t accepted = std::min(n, free_slots);
+        for (size_t i = 0; i < accepted; ++i)
+        {
+            slots[(t + i) & mask] = items[i];
+        }
+        if (accepted > 0)
+            tail.store(t + accepted, std::memory_order_release);
+        return accepted;
+    }
+
+    bool try_pop(T &out) { return pop_bulk(&out, 1) == 1; }
+
+    // Pop up to max items into out, returns how many were taken
+    size_t pop_bulk(T *out, size_t max)
+    {
+        size_t h = head.load(std::memory_order_relaxed);
+        size_t available = cached_tail - h;
+        if (available < max)
+        {
+            cached_tail = tail.load(std::memory_order_acquire);
+            available = cached_tail - h;
+        }
+        size_t taken = std::min(max, available);
+        for (size_t i = 0; i < taken; ++i)
+        {
+            out[i] = slots[(h + i) & mask];
+        }
+        if (taken > 0)
+            head.store(h + taken, std::memory_order_release);
+        return taken;
+    }
+
+    bool empty() const { return size_approx() == 0; }
+    size_t size_approx() const
+    {
+        return tail.load(std::memory_order_acquire) - head.load(std::memory_order_acquire);
+    }
+    size_t capacity() const { return mask + 1; }
+
+    // Running push and pop positions: an item pushed before pushed() was
+    // read has been popped once popped() reaches that value
+    size_t pushed() const { return tail.load(std::memory_order_acquire); }
+    size_t popped() const { return head.load(std::memory_order_acquire); }
+
+private:
+    // Consumer-owned line
+    alignas(CACHE_LINE_SIZE) std::atomic<size_t> head{0};
+    size_t cached_tail = 0;
+
+    // Producer-owned line
+    alignas(CACHE_LINE_SIZE) std::atomic<size_t> tail{0};
+    size_t cached_head = 0;
+
+    alignas(CACHE_LINE_SIZE) const size_t mask;
+    std::unique_ptr<T[]> slots;
+};
+
+// Bounded multi-producer/single-consumer ring (Vyukov sequence-per-slot
+// design). Producers claim slots with a CAS on the tail; the single consumer
+// never needs an atomic RMW.
+template <typename T>
+class MpscRingBuffer
+{
+    static_assert(std::is_trivially_copyable_v<T>, "ring elements must be trivially copyable");
+
+    struct Slot
+    {
+        std::atomic<size_t> sequence;
+        T value;
+    };
+
+public:
+    explicit MpscRingBuffer(size_t min_capacity)
+        : mask(round_up_pow2(min_capacity) - 1),
+          slots(std::make_unique<Slot[]>(mask + 1))
+    {
+        for (size_t i = 0; i <= mask; ++i)
+        {
+            slots[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    MpscRingBuffer(const MpscRingBuffer &) = delete;
+    MpscRingBuffer &operator=(const MpscRingBuffer &) = delete;
+
+    bool try_push(const T &item) { return try_push_bulk(&item, 1) == 1; }
+
+    // Claim a contiguous run of up to n slots with a single CAS
+    size_t try_push_bulk(const T *items, size_t n)
+    {
+        if (n == 0)
+            return 0;
+
+        size_t pos = tail.load(std::memory_order_relaxed);
+        size_t claimed;
+        while (true)
+        {
+            size_t h = head.load(std::memory_order_acquire);
+            size_t free_slots = capacity() - (pos - h);
+            if (pos - h > capacity())
+                free_slots = 0; // Stale tail read, retry below
+            claimed = std::min(n, free_slots);
+            if (claimed == 0)
+            {
+                size_t fresh = tail.load(std::memory_order_relaxed);
+                if (fresh == pos)
+                    return 0; // Genuinely full
+                pos = fresh;
+                continue;
+            }
+
+            // The consumer frees slots in order, so the last slot of the run
+            // being free for this lap implies the whole run is free.
+            const Slot &last = slots[(pos + claimed - 1) & mask];
+            if (last.sequence.load(std::memory_order_acquire) != pos + claimed - 1)
+            {
+                pos = tail.load(std::memory_order_relaxed);
+                continue;
+            }
+            if (tail.compare_exchange_weak(pos, pos + claimed, std::memory_order_relaxed))
+                break;
+        }
+
+        for (size_t i = 0; i < claimed; ++i)
+        {
+            Slot &slot = slots[(pos + i) & mask];
+            slot.value = items[i];
+            slot.sequence.store(pos + i + 1, std::memory_order_release);
+        }
+        return claimed;
+    }
+
+    bool try_pop(T &out) { return pop_bulk(&out, 1) == 1; }
+
+    // Pop published elements in order; stops at the first slot a producer has
+    // claimed but not yet filled.
+    size_t pop_bulk(T *out, size_t max)
+    {
+        size_t h = head.load(std::memory_order_relaxed);
+        size_t taken = 0;
+        while (taken < max)
+        {
+            Slot &slot = slots[(h + taken) & mask];
+            if (slot.sequence.load(std::memory_order_acquire) != h + taken + 1)
+                break;
+            out[taken] = slot.value;
+            slot.sequence.store(h + taken + capacity(), std::memory_order_release);
+            ++taken;
+        }
+        if (taken > 0)
+            head.store(h + taken, std::memory_order_release);
+        return taken;
+    }
+
+    bool empty() const
+    {
+        size_t h = head.load(std::memory_order_acquire);
+        return slots[h & mask].sequence.load(std::memory_order_acquire) != h + 1;
+    }
+    size_t size_approx() const
+    {
+        size_t t = tail.load(std::memory_order_acquire);
+        size_t h = head.load(std::memory_order_acquire);
+        return t > h ? t - h : 0;
+    }
+    size_t capacity() const { return mask + 1; }
+
+    // Running push and pop positions: an item pushed before pushed() was
+    // read has been popped once popped() reaches that value
+    size_t pushed() const { return tail.load(std::memory_order_acquire); }
+    size_t popped() const { return head.load(std::memory_order_acquire); }
+
+private:
+    alignas(CACHE_LINE_SIZE) std::atomic<size_t> tail{0}; // Shared by producers
+    alignas(CACHE_LINE_SIZE) std::atomic<size_t> head{0}; // Written by the consumer only
+
+    alignas(CACHE_LINE_SIZE) const size_t mask;
+    std::unique_ptr<Slot[]> slots;
+};
+
+#endif // RING_BUFFER_HPP
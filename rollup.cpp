@@ -0,0 +1,215 @@
+#include "rollup.hpp"
+#include <algorithm>
+
+Rollup::Rollup(const std::string &symbol_dir, uint64_t resolution)
+    : resolution(resolution),
+      path(symbol_dir + "/" + dir_name(resolution)),
+      timestamps(symbol_dir, dir_name(resolution), "timestamps", sizeof(uint64_t)),
+      open(symbol_dir, dir_name(resolution), "open", sizeof(double)),
+      high(symbol_dir, dir_name(resolution), "high", sizeof(double)),
+      low(symbol_dir, dir_name(resolution), "low", sizeof(double)),
+      close(symbol_dir, dir_name(resolution), "close", sizeof(double)),
+      volume(symbol_dir, dir_name(resolution), "volume", sizeof(uint64_t)),
+      count(symbol_dir, dir_name(resolution), "count", sizeof(uint64_t)),
+      state(symbol_dir, dir_name(resolution), "state", sizeof(uint64_t)),
+      late_buckets(symbol_dir, dir_name(resolution), "late", sizeof(uint64_t))
+{
+    if (resolution == 0)
+    {
+        throw std::invalid_argument("Rollup resolution must be positive");
+    }
+
+    if (state.get_count() < STATE_SLOTS)
+    {
+        uint64_t zero = 0;
+        while (state.get_count() < STATE_SLOTS)
+            state.append(&zero);
+    }
+
+    // Bars are appended to all columns before the state moves on; a torn
+    // append leaves the shortest column authoritative
+    size_t bars = std::min({timestamps.get_count(), open.get_count(), high.get_count(), low.get_count(),
+                            close.get_count(), volume.get_count(), count.get_count()});
+    for (ColumnStorage *column : {&timestamps, &open, &high, &low, &close, &volume, &count})
+        column->truncate(bars);
+
+    if (bars > 0)
+    {
+        size_t last = bars - 1;
+        timestamps.read(last, &current.timestamp);
+        open.read(last, &current.open);
+        high.read(last, &current.high);
+        low.read(last, &current.low);
+        close.read(last, &current.close);
+        volume.read(last, &current.volume);
+        count.read(last, &current.count);
+        state.read(STATE_OPEN_TS, &open_ts);
+        state.read(STATE_CLOSE_TS, &close_ts);
+        has_current = true;
+    }
+
+    for (size_t i = 0; i < late_buckets.get_count(); ++i)
+    {
+        uint64_t bucket;
+        late_buckets.read(i, &bucket);
+        dirty.insert(bucket);
+    }
+}
+
+std::string Rollup::dir_name(uint64_t resolution)
+{
+    if (resolution % 86400 == 0)
+        return "bars_" + std::to_string(resolution / 86400) + "d";
+    if (resolution % 3600 == 0)
+        return "bars_" + std::to_string(resolution / 3600) + "h";
+    if (resolution % 60 == 0)
+        return "bars_" + std::to_string(resolution / 60) + "m";
+    return "bars_" + std::to_string(resolution) + "s";
+}
+
+void Rollup::add(const uint64_t *ts, const double *px, const uint64_t *vol, size_t n)
+{
+    if (n == 0)
+        return;
+
+    bool current_changed = false;
+    for (size_t i = 0; i < n; ++i)
+    {
+        uint64_t bucket = bucket_of(ts[i]);
+
+        if (!has_current || bucket > current.timestamp)
+        {
+            // The previous bar is final; its row is already up to date
+            if (current_changed)
+                store_current();
+            current = Bar{bucket, px[i], px[i], px[i], px[i], vol[i], 1};
+            open_ts = close_ts = ts[i];
+            append_bar(current);
+            has_current = true;
+            current_changed = false;
+            continue;
+        }
+
+        if (bucket < current.timestamp)
+        {
+            mark_dirty(bucket);
+            continue;
+        }
+
+        current.high = std::max(current.high, px[i]);
+        current.low = std::min(current.low, px[i]);
+        current.volume += vol[i];
+        current.count += 1;
+        if (ts[i] >= close_ts)
+        {
+            close_ts = ts[i];
+            current.close = px[i];
+        }
+        if (ts[i] < open_ts)
+        {
+            open_ts = ts[i];
+            current.open = px[i];
+        }
+        current_changed = true;
+    }
+
+    if (current_changed)
+        store_current();
+}
+
+void Rollup::append_bar(const Bar &bar)
+{
+    timestamps.append(&bar.timestamp);
+    open.append(&bar.open);
+    high.append(&bar.high);
+    low.append(&bar.low);
+    close.append(&bar.close);
+    volume.append(&bar.volume);
+    count.append(&bar.count);
+    state.write(STATE_OPEN_TS, &open_ts);
+    state.write(STATE_CLOSE_TS, &close_ts);
+}
+
+void Rollup::store_current()
+{
+    size_t last = timestamps.get_count() - 1;
+    open.write(last, &current.open);
+    high.write(last, &current.high);
+    low.write(last, &current.low);
+    close.write(last, &current.close);
+    volume.write(last, &current.volume);
+    count.write(last, &current.count);
+    state.write(STATE_OPEN_TS, &open_ts);
+    state.write(STATE_CLOSE_TS, &close_ts);
+}
+
+void Rollup::mark_dirty(uint64_t bucket)
+{
+    if (dirty.insert(bucket).second)
+        late_buckets.append(&bucket);
+}
+
+void Rollup::set_cursor(uint64_t partition_start, uint64_t rows)
+{
+    uint64_t one = 1;
+    state.write(STATE_CURSOR_PARTITION, &partition_start);
+    state.write(STATE_CURSOR_ROWS, &rows);
+    state.write(STATE_CURSOR_SET, &one);
+}
+
+bool Rollup::get_cursor(uint64_t &partition_start, uint64_t &rows) const
+{
+    uint64_t set;
+    state.read(STATE_CURSOR_SET, &set);
+    if (set == 0)
+        return false;
+    state.read(STATE_CURSOR_PARTITION, &partition_start);
+    state.read(STATE_CURSOR_ROWS, &rows);
+    return true;
+}
+
+void Rollup::set_late_cursor(uint64_t segment, uint64_t rows)
+{
+    uint64_t one = 1;
+    state.write(STATE_LATE_SEGMENT, &segment);
+    state.write(STATE_LATE_ROWS, &rows);
+    state.write(STATE_LATE_SET, &one);
+}
+
+bool Rollup::get_late_cursor(uint64_t &segment, uint64_t &rows) const
+{
+    uint64_t set;
+    state.read(STATE_LATE_SET, &set);
+    if (set == 0)
+        return false;
+    state.read(STATE_LATE_SEGMENT, &segment);
+    state.read(STATE_LATE_ROWS, &rows);
+    return true;
+}
+
+void Rollup::read_bars(uint64_t first_bucket, uint64_t last_bucket, std::vector<Bar> &out) const
+{
+    size_t bars = timestamps.get_count();
+    auto ts = timestamps.span<uint64_t>(0, bars);
+    size_t first = std::lower_bound(ts.begin(), ts.end(), first_bucket) - ts.begin();
+    size_t last = std::upper_bound(ts.begin() + first, ts.end(), last_bucket) - ts.begin();
+    if (first >= last)
+        return;
+
+    auto o = open.span<double>(first, last);
+    auto h = high.span<double>(first, last);
+    auto l = low.span<double>(first, last);
+    auto c = close.span<double>(first, last);
+    auto v = volume.span<uint64_t>(first, last);
+    auto k = count.span<uint64_t>(first, last);
+    out.reserve(out.size() + (last - first));
+    for (size_t i = 0; i < last - first; ++i)
+    {
+        out.push_back(Bar{ts[first + i], o[i], h[i], l[i], c[i], v[i], k[i]});
+    }
+}
+
+std::vector<uint64_t> Rollup::dirty_buckets(uint64_t first_bucket, uint64_t last_bucket) const
+{
+    return std::vector<uint64_t>(dirty.lower_bound(first_bucket), dirty.upper_bound(last_bucket));
+}
@@ -0,0 +1,102 @@
+#ifndef ROLLUP_HPP
+#define ROLLUP_HPP
+
+#include "column_storage.hpp"
+#include <cstdint>
+#include <set>
+#include <string>
+#include <vector>
+
+// One OHLCV bar. timestamp is the start of the bucket.
+struct Bar
+{
+    uint64_t timestamp;
+    double open;
+    double high;
+    double low;
+    double close;
+    uint64_t volume;
+    uint64_t count;
+};
+
+// Downsampled OHLCV bars at one fixed resolution, kept next to the raw
+// columns in symbol_dir/bars_<resolution>/ (open.bin, high.bin, ...). Bars
+// are appended in bucket order as ticks arrive, the newest bar is updated in
+// place. A late tick for an older bucket is not folded in: the bucket is
+// recorded as dirty and readers recompute it from the raw ticks.
+class Rollup
+{
+public:
+    Rollup(const std::string &symbol_dir, uint64_t resolution);
+
+    Rollup(const Rollup &) = delete;
+    Rollup &operator=(const Rollup &) = delete;
+
+    // Feed ticks in storage order
+    void add(const uint64_t *ts, const double *px, const uint64_t *vol, size_t n);
+
+    // Position in the raw columns up to which ticks have been fed: rows
+    // [0, rows) of the partition starting at partition_start, and every
+    // partition before it. Stored in the mapped state file so it moves
+    // together with the bars.
+    void set_cursor(uint64_t partition_start, uint64_t rows);
+    bool get_cursor(uint64_t &partition_start, uint64_t &rows) const;
+    // The same over the out-of-order segments, which are fed separately
+    void set_late_cursor(uint64_t segment, uint64_t rows);
+    bool get_late_cursor(uint64_t &segment, uint64_t &rows) const;
+
+    // Bars with first_bucket <= timestamp <= last_bucket, in bucket order
+    void read_bars(uint64_t first_bucket, uint64_t last_bucket, std::vector<Bar> &out) const;
+    // Buckets in [first_bucket, last_bucket] that late ticks made stale
+    std::vector<uint64_t> dirty_buckets(uint64_t first_bucket, uint64_t last_bucket) const;
+
+    uint64_t get_resolution() const { return resolution; }
+    uint64_t bucket_of(uint64_t ts) const { return ts - (ts % resolution); }
+    size_t get_count() const { return timestamps.get_count(); }
+    const std::string &get_path() const { return path; }
+
+    // bars_1s, bars_1m, bars_1h, bars_1d for whole units, bars_<n>s otherwise
+    static std::string dir_name(uint64_t resolution);
+
+private:
+    void append_bar(const Bar &bar);
+    void store_current();
+    void mark_dirty(uint64_t bucket);
+
+    // State slots
+    enum : size_t
+    {
+        STATE_CURSOR_SET,
+        STATE_CURSOR_PARTITION,
+        STATE_CURSOR_ROWS,
+        STATE_OPEN_TS,  // Timestamps of the newest bar's open and close
+        STATE_CLOSE_TS, // ticks, to place late ticks within it
+        STATE_LATE_SET,
+        STATE_LATE_SEGMENT,
+        STATE_LATE_ROWS,
+        STATE_SLOTS
+    };
+
+    uint64_t resolution;
+    std::string path;
+
+    ColumnStorage timestamps;
+    ColumnStorage open;
+    ColumnStorage high;
+    ColumnStorage low;
+    ColumnStorage close;
+    ColumnStorage volume;
+    ColumnStorage count;
+    ColumnStorage state;
+    ColumnStorage late_buckets;
+
+    std::set<uint64_t> dirty;
+
+    // Newest bar, written back after every add()
+    Bar current{};
+    bool has_current = false;
+    uint64_t open_ts = 0;
+    uint64_t close_ts = 0;
+};
+
+#endif // ROLLUP_HPP
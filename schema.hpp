@@ -0,0 +1,250 @@
+#ifndef SCHEMA_HPP
+#define SCHEMA_HPP
+
+#include "column_storage.hpp"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// Column name usable as a template argument
+template <size_t N>
+struct ColumnName
+{
+    constexpr ColumnName(const char (&text)[N]) { std::copy_n(text, N, value); }
+    constexpr std::string_view view() const { return std::string_view(value, N - 1); }
+    char value[N];
+};
+
+// One column of a schema. Values are stored packed at their native width,
+// so a uint8_t flag costs one byte per row and a float price four. The name
+// is also the column's file name.
+template <ColumnName Name, typename T>
+struct Column
+{
+    static_assert(std::is_trivially_copyable_v<T>, "columns hold raw bytes");
+    static_assert(alignof(T) <= 8, "rows follow an 8-byte column header");
+    using type = T;
+    static constexpr std::string_view name = Name.view();
+};
+
+// Ordered list of columns. The first is the row timestamp: a uint64_t that
+// never decreases from one row to the next.
+template <typename... Columns>
+struct Schema
+{
+    static constexpr size_t column_count = sizeof...(Columns);
+    static constexpr size_t row_bytes = (sizeof(typename Columns::type) + ...);
+    static constexpr std::array<std::string_view, column_count> names{Columns::name...};
+
+    template <size_t I>
+    using column = std::tuple_element_t<I, std::tuple<Columns...>>;
+    template <size_t I>
+    using type = typename column<I>::type;
+
+    using Row = std::tuple<typename Columns::type...>;
+    using Spans = std::tuple<std::span<const typename Columns::type>...>;
+    using Pointers = std::tuple<const typename Columns::type *...>;
+
+    static_assert(column_count > 0 && std::is_same_v<type<0>, uint64_t>, "the first column is a uint64_t timestamp");
+
+    template <ColumnName Name>
+    static constexpr size_t index_of()
+    {
+        constexpr size_t index = std::find(names.begin(), names.end(), Name.view()) - names.begin();
+        static_assert(index < column_count, "no such column");
+        return index;
+    }
+};
+
+// Rows [first_row(), first_row() + size()) of a TypedStore, one span per
+// column straight into the mappings. Valid while the store is open.
+template <typename S>
+class TypedView
+{
+public:
+    size_t size() const { return std::get<0>(columns).size(); }
+    bool empty() const { return size() == 0; }
+    size_t first_row() const { return first; }
+
+    template <size_t I>
+    std::span<const typename S::template type<I>> get() const { return std::get<I>(columns); }
+
+    template <ColumnName Name>
+    auto column() const { return get<S::template index_of<Name>()>(); }
+
+    std::span<const uint64_t> timestamps() const { return get<0>(); }
+
+    typename S::Row row(size_t i) const
+    {
+        return std::apply([i](const auto &...spans)
+                          { return typename S::Row{spans[i]...}; }, columns);
+    }
+
+private:
+    template <typename>
+    friend class TypedStore;
+
+    typename S::Spans columns;
+    size_t first = 0;
+};
+
+// Append-only table of one symbol laid out by a Schema: one ColumnStorage
+// per column under data_dir/name/. One writer appends while any number of
+// readers take views; rows become visible once every column holds them.
+//
+//   using Quotes = Schema<Column<"timestamps", uint64_t>, Column<"bid", float>,
+//                         Column<"exchange", uint8_t>>;
+//   TypedStore<Quotes> store("tsdb_data", "AAPL_quotes");
+//   store.append_columns(n, ts, bid, exchange);
+//   auto bids = store.view_range(start, end).column<"bid">();
+template <typename S>
+class TypedStore
+{
+public:
+    using Row = typename S::Row;
+
+    TypedStore(const std::string &data_dir, const std::string &name, const ColumnOptions &options = ColumnOptions{})
+    {
+        open_columns(data_dir, name, options, std::make_index_sequence<S::column_count>{});
+
+        // A crash between column appends leaves ragged columns
+        size_t rows = columns[0].get_count();
+        for (const auto &column : columns)
+            rows = std::min(rows, column.get_count());
+        for (auto &column : columns)
+            if (column.get_count() > rows)
+                column.truncate(rows);
+
+        if (rows > 0)
+            last_ts = columns[0].template span<uint64_t>(rows - 1, rows)[0];
+        visible.store(rows, std::memory_order_release);
+    }
+
+    TypedStore(const TypedStore &) = delete;
+    TypedStore &operator=(const TypedStore &) = delete;
+
+    // Append count rows given column by column, one array per column in
+    // schema order. Throws std::invalid_argument, before writing anything,
+    // if the timestamps would go backwards.
+    template <typename... Ts>
+    void append_columns(size_t count, const Ts *...values)
+    {
+        static_assert(sizeof...(Ts) == S::column_count, "one array per column");
+        typename S::Pointers arrays{values...};
+        if (count == 0)
+            return;
+
+        const uint64_t *ts = std::get<0>(arrays);
+        if (ts[0] < last_ts || !std::is_sorted(ts, ts + count))
+            throw std::invalid_argument("TypedStore rows must be appended in timestamp order");
+
+        append_arrays(arrays, count, std::make_index_sequence<S::column_count>{});
+        last_ts = ts[count - 1];
+        visible.store(visible.load(std::memory_order_relaxed) + count, std::memory_order_release);
+    }
+
+    // Row-major batch append; rows are split into columns first
+    void append_rows(std::span<const Row> rows)
+    {
+        split_rows(rows, std::make_index_sequence<S::column_count>{});
+    }
+
+    void append(const Row &row) { append_rows(std::span<const Row>(&row, 1)); }
+
+    size_t get_count() const { return visible.load(std::memory_order_acquire); }
+
+    TypedView<S> view_rows(size_t first, size_t last) const
+    {
+        return make_view(first, last, std::make_index_sequence<S::column_count>{});
+    }
+
+    // Rows with start <= timestamp <= end
+    TypedView<S> view_range(uint64_t start, uint64_t end) const
+    {
+        auto ts = columns[0].template span<uint64_t>(0, get_count());
+        size_t first = std::lower_bound(ts.begin(), ts.end(), start) - ts.begin();
+        size_t last = start > end ? first : std::upper_bound(ts.begin() + first, ts.end(), end) - ts.begin();
+        return view_rows(first, last);
+    }
+
+    // Block until every appended row is on stable storage
+    void sync()
+    {
+        for (auto &column : columns)
+            column.sync_data();
+    }
+
+    void flush()
+    {
+        for (auto &column : columns)
+            column.flush_header();
+    }
+
+private:
+    template <size_t... I>
+    void open_columns(const std::string &data_dir, const std::string &name, const ColumnOptions &options,
+                      std::index_sequence<I...>)
+    {
+        columns.reserve(S::column_count);
+        (columns.emplace_back(data_dir, name, std::string(S::template column<I>::name),
+                              sizeof(typename S::template type<I>), OpenMode::ReadWrite, options),
+         ...);
+    }
+
+    template <size_t... I>
+    void append_arrays(const typename S::Pointers &arrays, size_t count, std::index_sequence<I...>)
+    {
+        (columns[I].append_batch(std::get<I>(arrays), count), ...);
+    }
+
+    template <size_t... I>
+    void split_rows(std::span<const Row> rows, std::index_sequence<I...>)
+    {
+        std::tuple<std::vector<typename S::template type<I>>...> split;
+        (std::get<I>(split).reserve(rows.size()), ...);
+        for (const auto &row : rows)
+            (std::get<I>(split).push_back(std::get<I>(row)), ...);
+        append_columns(rows.size(), std::get<I>(split).data()...);
+    }
+
+    template <size_t... I>
+    TypedView<S> make_view(size_t first, size_t last, std::index_sequence<I...>) const
+    {
+        size_t rows = get_count();
+        if (first > last || last > rows)
+        {
+            throw std::out_of_range("Rows [" + std::to_string(first) + ", " + std::to_string(last) +
+                                    ") out of range for count " + std::to_string(rows));
+        }
+        TypedView<S> view;
+        view.columns = typename S::Spans{columns[I].template span<typename S::template type<I>>(first, last)...};
+        view.first = first;
+        return view;
+    }
+
+    std::vector<ColumnStorage> columns; // In schema order
+    std::atomic<size_t> visible{0};     // Rows present in every column
+    uint64_t last_ts = 0;               // Writer only
+};
+
+// Quote stream laid out at native widths: 26 bytes a row instead of the
+// 56 it would take as seven 8-byte fields
+using QuoteSchema = Schema<Column<"timestamps", uint64_t>,
+                           Column<"bid", float>,
+                           Column<"ask", float>,
+                           Column<"bid_size", uint32_t>,
+                           Column<"ask_size", uint32_t>,
+                           Column<"exchange", uint8_t>,
+                           Column<"conditions", uint8_t>>;
+
+#endif // SCHEMA_HPP
@@ -0,0 +1,824 @@
+#include "segment.hpp"
+#include "metrics.hpp"
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <numeric>
+#include <stdexcept>
+
+Segment::Segment(const std::string &parent_dir, const std::string &name,
+                 uint64_t partition_start, uint64_t partition_end, OpenMode mode,
+                 const SegmentOptions &options)
+    : parent_dir(parent_dir),
+      name(name),
+      path(parent_dir + "/" + name),
+      partition_start(partition_start),
+      partition_end(partition_end),
+      mode(mode),
+      sealed(mode == OpenMode::ReadOnly || (mode == OpenMode::ReadShared && has_seal_marker(path))),
+      options(options),
+      block_index(options.index_block_rows),
+      meta(options.index_block_rows)
+{
+    if (sealed && std::filesystem::exists(path + "/" + CompressedColumns::FILE_NAME))
+    {
+        try
+        {
+            compressed = std::make_unique<CompressedColumns>(path + "/" + CompressedColumns::FILE_NAME);
+        }
+        catch (const std::exception &e)
+        {
+            // Fall back to the raw columns if they are still around
+            std::cerr << "WARNING: " << e.what() << "; using the raw columns" << std::endl;
+        }
+        if (compressed)
+        {
+            uint64_t lo = std::numeric_limits<uint64_t>::max();
+            uint64_t hi = 0;
+            for (const auto &block : compressed->blocks())
+            {
+                lo = std::min(lo, block.min_ts);
+                hi = std::max(hi, block.max_ts);
+            }
+            min_ts.store(lo, std::memory_order_relaxed);
+            max_ts.store(hi, std::memory_order_relaxed);
+            // Stats committed before compression still describe the rows
+            meta.load(path + "/" + SegmentMeta::FILE_NAME, compressed->get_count(), nullptr, true);
+            return;
+        }
+    }
+
+    // Sealed files are complete: a reader maps them like any other
+    OpenMode column_mode = (mode == OpenMode::ReadShared && sealed) ? OpenMode::ReadOnly : mode;
+    timestamps.emplace(parent_dir, name, "timestamps", sizeof(uint64_t), column_mode, options.timestamps);
+    prices.emplace(parent_dir, name, "prices", sizeof(double), column_mode, options.prices);
+    volumes.emplace(parent_dir, name, "volumes", sizeof(uint64_t), column_mode, options.volumes);
+    if (mode == OpenMode::ReadShared)
+        return;
+
+    if (mode == OpenMode::ReadWrite && !verify_column_sync())
+    {
+        // A crash between column appends leaves ragged tails; keep only
+        // rows present in all three columns
+        size_t rows = column_count();
+        std::cerr << "WARNING: Truncating " << path << " to " << rows << " consistent rows" << std::endl;
+        timestamps->truncate(rows);
+        prices->truncate(rows);
+        volumes->truncate(rows);
+    }
+
+    // Rows past the last intact commit were never committed; a store
+    // without segment.meta (or with a damaged one) keeps all its rows
+    size_t rows = column_count();
+    std::optional<size_t> committed = meta.load(path + "/" + SegmentMeta::FILE_NAME, rows,
+                                                timestamps->span<uint64_t>(0, rows).data(), mode == OpenMode::ReadOnly);
+    if (mode == OpenMode::ReadWrite && committed && *committed < rows)
+    {
+        std::cerr << "WARNING: Truncating " << path << " to its last commit of " << *committed << " rows" << std::endl;
+        timestamps->truncate(*committed);
+        prices->truncate(*committed);
+        volumes->truncate(*committed);
+    }
+    if (mode == OpenMode::ReadWrite)
+    {
+        meta.open(path + "/" + SegmentMeta::FILE_NAME);
+        commit_meta(false);
+    }
+    else
+    {
+        meta_dirty = meta.covered_rows() < column_count();
+        catch_up_meta();
+        meta.finish();
+    }
+    rebuild_index();
+    visible_rows.store(column_count(), std::memory_order_release);
+}
+
+Segment::~Segment()
+{
+    if (mode == OpenMode::ReadShared)
+        return;
+    try
+    {
+        if (!compressed && !sealed)
+            flush_headers();
+        persist_index();
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << "WARNING: Could not persist index for " << path << ": " << e.what() << std::endl;
+    }
+}
+
+bool Segment::has_seal_marker(const std::string &segment_path)
+{
+    return std::filesystem::exists(segment_path + "/" + SEALED_MARKER);
+}
+
+bool Segment::truncate_rows(const std::string &parent_dir, const std::string &name, size_t rows)
+{
+    std::string segment_path = parent_dir + "/" + name;
+    std::filesystem::remove(segment_path + "/" + SEALED_MARKER);
+
+    ColumnStorage ts(parent_dir, name, "timestamps", sizeof(uint64_t));
+    ColumnStorage px(parent_dir, name, "prices", sizeof(double));
+    ColumnStorage vol(parent_dir, name, "volumes", sizeof(uint64_t));
+    if (std::min({ts.get_count(), px.get_count(), vol.get_count()}) < rows)
+    {
+        std::cerr << "WARNING: " << segment_path << " holds fewer rows than its checkpoint (" << rows << ")" << std::endl;
+    }
+    bool dropped = std::max({ts.get_count(), px.get_count(), vol.get_count()}) > rows;
+    ts.truncate(rows);
+    px.truncate(rows);
+    vol.truncate(rows);
+    // A persisted block index covering the dropped rows fails to load and is
+    // rebuilt. An older commit in segment.meta could still pass for one
+    // that covers fewer rows than the checkpoint, so it goes as well.
+    if (dropped)
+        std::filesystem::remove(segment_path + "/" + SegmentMeta::FILE_NAME);
+    return dropped;
+}
+
+void Segment::rebuild_index()
+{
+    size_t count = column_count();
+
+    if (options.index_mode == IndexMode::SparseBlock)
+    {
+        // Load the persisted index and only catch up on rows appended
+        // since, straight from the mapped column
+        std::span<const uint64_t> ts = timestamps->span<uint64_t>(0, count);
+        size_t from = 0;
+        if (block_index.load(path + "/" + BlockIndex::FILE_NAME, ts))
+            from = block_index.covered_rows();
+        else
+            index_dirty = true;
+
+        for (size_t i = from; i < count; ++i)
+            block_index.add(ts[i], i);
+        if (from < count)
+            index_dirty = true;
+        if (count > 0)
+        {
+            min_ts.store(block_index.get_min_ts(), std::memory_order_relaxed);
+            max_ts.store(block_index.get_max_ts(), std::memory_order_relaxed);
+        }
+        return;
+    }
+
+    // Full B+ tree: bulk-load it in timestamp order, equal timestamps in row
+    // order as inserts would have left them
+    if (count == 0)
+        return;
+    std::span<const uint64_t> ts = timestamps->span<uint64_t>(0, count);
+    std::unique_lock<std::shared_mutex> lock(time_index_mutex);
+    if (std::is_sorted(ts.begin(), ts.end()))
+    {
+        time_index.bulk_load(count, [&](size_t i)
+                             { return std::pair<uint64_t, size_t>(ts[i], i); });
+        min_ts.store(ts.front(), std::memory_order_relaxed);
+        max_ts.store(ts.back(), std::memory_order_relaxed);
+        return;
+    }
+    std::vector<size_t> order(count);
+    std::iota(order.begin(), order.end(), size_t(0));
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b)
+                     { return ts[a] < ts[b]; });
+    time_index.bulk_load(count, [&](size_t i)
+                         { return std::pair<uint64_t, size_t>(ts[order[i]], order[i]); });
+    min_ts.store(ts[order.front()], std::memory_order_relaxed);
+    max_ts.store(ts[order.back()], std::memory_order_relaxed);
+}
+
+void Segment::index_rows(size_t from, size_t to, const uint64_t *ts)
+{
+    uint64_t lo = min_ts.load(std::memory_order_relaxed);
+    uint64_t hi = max_ts.load(std::memory_order_relaxed);
+    if (options.index_mode == IndexMode::SparseBlock)
+    {
+        for (size_t i = from; i < to; ++i)
+        {
+            block_index.add(ts[i - from], i);
+            lo = std::min(lo, ts[i - from]);
+            hi = std::max(hi, ts[i - from]);
+        }
+        index_dirty = true;
+    }
+    else
+    {
+        for (size_t i = from; i < to; ++i)
+        {
+            lo = std::min(lo, ts[i - from]);
+            hi = std::max(hi, ts[i - from]);
+        }
+        // In-order runs go onto the tree's right edge a leaf at a time
+        size_t rows[256];
+        std::unique_lock<std::shared_mutex> lock(time_index_mutex);
+        for (size_t i = from; i < to; i += std::size(rows))
+        {
+            size_t n = std::min(std::size(rows), to - i);
+            std::iota(rows, rows + n, i);
+            time_index.append_sorted(ts + (i - from), rows, n);
+        }
+    }
+    min_ts.store(lo, std::memory_order_relaxed);
+    max_ts.store(hi, std::memory_order_relaxed);
+}
+
+void Segment::persist_index()
+{
+    if (options.index_mode != IndexMode::SparseBlock || !index_dirty || compressed)
+        return;
+    size_t covered = block_index.covered_rows();
+    uint64_t last_ts = 0;
+    if (covered > 0)
+        timestamps->read(covered - 1, &last_ts);
+    block_index.save(path + "/" + BlockIndex::FILE_NAME, last_ts);
+    index_dirty = false;
+}
+
+void Segment::catch_up_meta()
+{
+    size_t from = meta.covered_rows();
+    size_t to = column_count();
+    if (from < to)
+        meta.add(timestamps->span<uint64_t>(from, to).data(), prices->span<double>(from, to).data(),
+                 volumes->span<uint64_t>(from, to).data(), to - from);
+}
+
+void Segment::commit_meta(bool durable)
+{
+    catch_up_meta();
+    meta.commit(durable);
+}
+
+void Segment::append_batch(const uint64_t *ts, const double *px, const uint64_t *vol, size_t n)
+{
+    if (n == 0)
+        return;
+    if (sealed)
+    {
+        throw std::runtime_error("Cannot append to sealed segment " + path);
+    }
+
+    // Rows of an unfinished bulk load must not be published unindexed
+    index_pending();
+
+    // Get the starting index before any appends to ensure consistency
+    size_t start_index = timestamps->get_count();
+
+    if (n == 1)
+    {
+        // Single item - use regular append
+        timestamps->append(ts);
+        prices->append(px);
+        volumes->append(vol);
+    }
+    else
+    {
+        // Multiple items - use batch append for better performance
+        timestamps->append_batch(ts, n);
+        prices->append_batch(px, n);
+        volumes->append_batch(vol, n);
+    }
+
+    index_rows(start_index, start_index + n, ts);
+
+    // Readers see the new rows from here on
+    visible_rows.store(start_index + n, std::memory_order_release);
+}
+
+size_t Segment::append_unindexed(const uint64_t *ts, const double *px, const uint64_t *vol, size_t n)
+{
+    if (sealed)
+    {
+        throw std::runtime_error("Cannot append to sealed segment " + path);
+    }
+    timestamps->append_batch(ts, n);
+    prices->append_batch(px, n);
+    volumes->append_batch(vol, n);
+    return column_count();
+}
+
+void Segment::index_pending()
+{
+    if (compressed)
+        return;
+    size_t from = visible_rows.load(std::memory_order_relaxed);
+    size_t rows = column_count();
+    if (from >= rows)
+        return;
+    index_rows(from, rows, timestamps->span<uint64_t>(from, rows).data());
+    visible_rows.store(rows, std::memory_order_release);
+}
+
+void Segment::flush_headers()
+{
+    if (compressed)
+        return;
+    timestamps->flush_header();
+    prices->flush_header();
+    volumes->flush_header();
+    if (!sealed)
+        commit_meta(false);
+}
+
+void Segment::sync()
+{
+    if (compressed)
+        return;
+    timestamps->sync_data();
+    prices->sync_data();
+    volumes->sync_data();
+    if (!sealed)
+        commit_meta(true);
+
+    // Bounds the catch-up a reopen after a crash has to do. The index is
+    // derived data, so failing to write it is not fatal.
+    try
+    {
+        persist_index();
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << "WARNING: Could not persist index for " << path << ": " << e.what() << std::endl;
+    }
+}
+
+void Segment::read_row(size_t index, uint64_t &ts, double &price, uint64_t &volume) const
+{
+    if (compressed)
+    {
+        auto block = compressed->block(index / compressed->get_block_rows());
+        size_t i = index - block->first_row;
+        ts = block->timestamps.at(i);
+        price = block->prices[i];
+        volume = block->volumes[i];
+        return;
+    }
+    timestamps->read(index, &ts);
+    prices->read(index, &price);
+    volumes->read(index, &volume);
+}
+
+void Segment::view_rows(size_t first, size_t last, std::vector<ColumnView> &out, ViewLeases &leases) const
+{
+    if (first >= last)
+        return;
+    if (!compressed)
+    {
+        out.push_back(raw_view(first, last));
+        return;
+    }
+
+    size_t block_rows = compressed->get_block_rows();
+    for (size_t b = first / block_rows; b * block_rows < last; ++b)
+    {
+        auto block = compressed->block(b);
+        size_t from = std::max(first, block->first_row) - block->first_row;
+        size_t to = std::min(last, block->first_row + block->timestamps.size()) - block->first_row;
+        out.push_back(decoded_view(*block, from, to));
+        leases.push_back(std::move(block));
+    }
+}
+
+size_t Segment::first_row_at(uint64_t ts) const
+{
+    size_t rows = get_count();
+    if (compressed)
+    {
+        const auto &blocks = compressed->blocks();
+        for (size_t b = 0; b < blocks.size(); ++b)
+        {
+            if (blocks[b].max_ts < ts)
+                continue;
+            auto block = compressed->block(b);
+            auto it = std::find_if(block->timestamps.begin(), block->timestamps.end(),
+                                   [ts](uint64_t t)
+                                   { return t >= ts; });
+            return block->first_row + static_cast<size_t>(it - block->timestamps.begin());
+        }
+        return rows;
+    }
+
+    // A late row >= ts always follows the in-order row that raised the
+    // running maximum past it, so the first in-order match is the answer
+    if (options.index_mode == IndexMode::SparseBlock)
+        return locate_in_order(ts, rows);
+    auto column = timestamps->span<uint64_t>(0, rows);
+    return static_cast<size_t>(std::find_if(column.begin(), column.end(),
+                                            [ts](uint64_t t)
+                                            { return t >= ts; }) -
+                               column.begin());
+}
+
+ColumnView Segment::raw_view(size_t first, size_t last) const
+{
+    ColumnView view;
+    view.timestamps = timestamps->span<uint64_t>(first, last);
+    view.prices = prices->span<double>(first, last);
+    view.volumes = volumes->span<uint64_t>(first, last);
+    view.first_row = first;
+    return view;
+}
+
+ColumnView Segment::decoded_view(const DecodedBlock &block, size_t from, size_t to)
+{
+    ColumnView view;
+    view.timestamps = std::span<const uint64_t>(block.timestamps).subspan(from, to - from);
+    view.prices = std::span<const double>(block.prices).subspan(from, to - from);
+    view.volumes = std::span<const uint64_t>(block.volumes).subspan(from, to - from);
+    view.first_row = block.first_row + from;
+    return view;
+}
+
+bool Segment::view_range(uint64_t start, uint64_t end, std::vector<ColumnView> &out, ViewLeases &leases,
+                         bool cache_blocks) const
+{
+    if (!overlaps(start, end))
+        return true;
+    if (compressed)
+        return compressed_view_range(start, end, out, leases, cache_blocks);
+    size_t rows = get_count();
+    if (options.index_mode == IndexMode::SparseBlock)
+        return sparse_view_range(start, end, rows, out);
+
+    // Full B+ tree: collapse consecutive rows into runs while walking the
+    // leaves. The tree may already hold rows that are not published yet.
+    std::shared_lock<std::shared_mutex> lock(time_index_mutex);
+    auto it = time_index.lower_bound(start);
+    while (it.valid() && it.key() <= end)
+    {
+        size_t first = it.value();
+        size_t last = first + 1;
+        for (it.next(); it.valid() && it.key() <= end && it.value() == last; it.next())
+            ++last;
+        if (first < rows)
+            out.push_back(raw_view(first, std::min(last, rows)));
+    }
+    return true;
+}
+
+bool Segment::read_range(uint64_t start, uint64_t end, std::vector<ColumnView> &out, ViewLeases &leases,
+                         IoBatch &io, bool cache_blocks) const
+{
+    size_t first_chunk = out.size();
+    bool ordered = view_range(start, end, out, leases, cache_blocks);
+    // Only sealed files are complete on disk; compressed ones decode instead
+    if (compressed || !is_sealed() || out.size() == first_chunk)
+        return ordered;
+
+    open_block_files();
+
+    // The mapped views only say which rows to read. Each becomes one view
+    // per stretch of rows that lies within a single block of every column.
+    std::vector<ColumnView> mapped(out.begin() + static_cast<std::ptrdiff_t>(first_chunk), out.end());
+    out.resize(first_chunk);
+    const ColumnStorage *columns[3] = {&*timestamps, &*prices, &*volumes};
+    for (const ColumnView &chunk : mapped)
+    {
+        size_t row = chunk.first_row;
+        size_t last = row + chunk.size();
+        while (row < last)
+        {
+            size_t stop = last;
+            for (const ColumnStorage *column : columns)
+            {
+                size_t offset = column->file_offset(row);
+                size_t block_end = (offset / AsyncReader::BLOCK_BYTES + 1) * AsyncReader::BLOCK_BYTES;
+                stop = std::min(stop, row + std::max<size_t>(1, (block_end - offset) / column->get_element_size()));
+            }
+            size_t n = stop - row;
+            size_t index = out.size();
+            out.emplace_back().first_row = row;
+
+            io.read(block_files[0], columns[0]->file_offset(row), n * sizeof(uint64_t),
+                    [&out, index, n](const char *data)
+                    { out[index].timestamps = {reinterpret_cast<const uint64_t *>(data), n}; });
+            io.read(block_files[1], columns[1]->file_offset(row), n * sizeof(double),
+                    [&out, index, n](const char *data)
+                    { out[index].prices = {reinterpret_cast<const double *>(data), n}; });
+            io.read(block_files[2], columns[2]->file_offset(row), n * sizeof(uint64_t),
+                    [&out, index, n](const char *data)
+                    { out[index].volumes = {reinterpret_cast<const uint64_t *>(data), n}; });
+            row = stop;
+        }
+    }
+    return ordered;
+}
+
+void Segment::open_block_files() const
+{
+    std::call_once(block_files_once, [this]
+                   {
+        block_files[0] = std::make_shared<BlockFile>(timestamps->get_filename());
+        block_files[1] = std::make_shared<BlockFile>(prices->get_filename());
+        block_files[2] = std::make_shared<BlockFile>(volumes->get_filename()); });
+}
+
+bool Segment::compressed_view_range(uint64_t start, uint64_t end, std::vector<ColumnView> &out,
+                                    ViewLeases &leases, bool cache_blocks) const
+{
+    // Decode only blocks whose bounds meet the range, then emit the runs of
+    // rows inside it
+    bool ordered = true;
+    uint64_t previous = 0;
+    const auto &blocks = compressed->blocks();
+    for (size_t b = 0; b < blocks.size(); ++b)
+    {
+        if (blocks[b].min_ts > end || blocks[b].max_ts < start)
+            continue;
+
+        auto block = compressed->block(b, cache_blocks);
+        const auto &ts = block->timestamps;
+        size_t emitted = out.size();
+        size_t i = 0;
+        while (i < ts.size())
+        {
+            if (ts[i] < start || ts[i] > end)
+            {
+                ++i;
+                continue;
+            }
+            size_t run_start = i;
+            for (; i < ts.size() && ts[i] >= start && ts[i] <= end; ++i)
+            {
+                ordered = ordered && ts[i] >= previous;
+                previous = ts[i];
+            }
+            out.push_back(decoded_view(*block, run_start, i));
+        }
+        if (out.size() > emitted)
+            leases.push_back(std::move(block));
+    }
+    return ordered;
+}
+
+size_t Segment::locate_in_order(uint64_t ts, size_t rows) const
+{
+    // Binary search to the block, then scan it. Rows below the running
+    // maximum are out of order and do not count.
+    size_t row = block_index.scan_start_row(ts, rows);
+    uint64_t running = block_index.scan_floor(row, rows);
+    const uint64_t *column = timestamps->span<uint64_t>(0, rows).data();
+    for (; row < rows; ++row)
+    {
+        if (column[row] < running)
+            continue;
+        running = column[row];
+        if (running >= ts)
+            break;
+    }
+    return row;
+}
+
+bool Segment::sparse_view_range(uint64_t start, uint64_t end, size_t rows, std::vector<ColumnView> &out) const
+{
+    // In-order rows inside the range form one contiguous run [first, last)
+    size_t first = locate_in_order(start, rows);
+    size_t last = (end == std::numeric_limits<uint64_t>::max()) ? rows : locate_in_order(end + 1, rows);
+    bool ordered = true;
+
+    // Late rows stored inside the run but timestamped outside the range
+    // split it; late rows inside the range stay but break the ordering
+    auto late_rows = block_index.get_out_of_order_rows();
+    size_t run_start = first;
+    for (auto it = std::lower_bound(late_rows.begin(), late_rows.end(), first,
+                                    [](const LateRow &late, size_t row)
+                                    { return late.row < row; });
+         it != late_rows.end() && it->row < last; ++it)
+    {
+        if (it->ts >= start && it->ts <= end)
+        {
+            ordered = false;
+            continue;
+        }
+        if (it->row > run_start)
+            out.push_back(raw_view(run_start, it->row));
+        run_start = it->row + 1;
+    }
+    if (last > run_start)
+        out.push_back(raw_view(run_start, last));
+
+    // Late rows in the range that are stored outside the run. The tree
+    // returns equal timestamps in no particular order; sort by row so ties
+    // keep arrival order
+    auto late = block_index.out_of_order_range(start, end, rows);
+    std::sort(late.begin(), late.end());
+    for (const auto &[ts, row] : late)
+    {
+        if (row < first || row >= last)
+        {
+            out.push_back(raw_view(row, row + 1));
+            ordered = false;
+        }
+    }
+    return ordered;
+}
+
+void Segment::aggregate_bounds(uint64_t start, uint64_t end, Aggregator &out) const
+{
+    size_t rows = get_count();
+    std::vector<ColumnView> chunks;
+    ViewLeases leases;
+    auto scan = [&](size_t first, size_t last)
+    {
+        chunks.clear();
+        leases.clear();
+        view_rows(first, last, chunks, leases);
+        for (const ColumnView &chunk : chunks)
+        {
+            // Runs of rows inside the range
+            size_t i = 0;
+            while (i < chunk.size())
+            {
+                if (chunk.timestamps[i] < start || chunk.timestamps[i] > end)
+                {
+                    ++i;
+                    continue;
+                }
+                size_t run_start = i;
+                while (i < chunk.size() && chunk.timestamps[i] >= start && chunk.timestamps[i] <= end)
+                    ++i;
+                out.add(ColumnView{chunk.timestamps.subspan(run_start, i - run_start),
+                                   chunk.prices.subspan(run_start, i - run_start),
+                                   chunk.volumes.subspan(run_start, i - run_start), chunk.first_row + run_start},
+                        false);
+            }
+        }
+    };
+
+    std::span<const BlockStats> stats = meta.blocks(rows);
+    size_t block_rows = meta.get_block_rows();
+    size_t answered = 0;
+    for (size_t b = 0; b < stats.size(); ++b)
+    {
+        const BlockStats &block = stats[b];
+        if (block.max_ts < start || block.min_ts > end)
+        {
+            ++answered;
+            continue;
+        }
+        if (block.min_ts >= start && block.max_ts <= end)
+        {
+            out.add_bounds(meta.block_end(b) - b * block_rows, block.min_price, block.max_price);
+            ++answered;
+            continue;
+        }
+        scan(b * block_rows, meta.block_end(b));
+    }
+    size_t covered = stats.empty() ? 0 : meta.block_end(stats.size() - 1);
+    if (covered < rows)
+        scan(covered, rows);
+    Metrics::global().stats_blocks.add(answered);
+}
+
+void Segment::prefetch_range(uint64_t start, uint64_t end) const
+{
+    if (compressed || !overlaps(start, end))
+        return;
+    size_t rows = get_count();
+    size_t first = 0;
+    size_t last = rows;
+    if (options.index_mode == IndexMode::SparseBlock)
+    {
+        // Just the block entries: no column page is touched before the hint
+        first = block_index.scan_start_row(start, rows);
+        if (end != std::numeric_limits<uint64_t>::max())
+            last = std::min(rows, block_index.scan_start_row(end + 1, rows) + block_index.get_block_rows());
+    }
+    timestamps->prefetch(first, last);
+    prices->prefetch(first, last);
+    volumes->prefetch(first, last);
+}
+
+size_t Segment::follow()
+{
+    if (compressed)
+        return get_count();
+    size_t rows = std::min({timestamps->follow(), prices->follow(), volumes->follow()});
+    size_t from = visible_rows.load(std::memory_order_relaxed);
+    if (!index_loaded)
+    {
+        // What the writer persisted, caught up from the columns
+        rebuild_index();
+        meta.load(path + "/" + SegmentMeta::FILE_NAME, rows, timestamps->span<uint64_t>(0, rows).data(), sealed);
+        catch_up_meta();
+        if (sealed)
+            meta.finish();
+        index_loaded = true;
+    }
+    else if (rows > from)
+    {
+        index_rows(from, rows, timestamps->span<uint64_t>(from, rows).data());
+        catch_up_meta();
+    }
+    visible_rows.store(rows, std::memory_order_release);
+    return rows;
+}
+
+bool Segment::has_unfollowed_rows() const
+{
+    if (compressed)
+        return false;
+    size_t flushed = std::min({timestamps->flushed_count(), prices->flushed_count(), volumes->flushed_count()});
+    return flushed > visible_rows.load(std::memory_order_acquire);
+}
+
+size_t Segment::get_count() const
+{
+    if (compressed)
+        return compressed->get_count();
+    return visible_rows.load(std::memory_order_acquire);
+}
+
+size_t Segment::column_count() const
+{
+    return std::min({timestamps->get_count(), prices->get_count(), volumes->get_count()});
+}
+
+bool Segment::verify_column_sync() const
+{
+    if (compressed)
+        return true;
+    size_t ts_count = timestamps->get_count();
+    return ts_count == prices->get_count() && ts_count == volumes->get_count();
+}
+
+void Segment::seal()
+{
+    if (sealed)
+        return;
+
+    index_pending();
+    persist_index();
+
+    timestamps->seal();
+    prices->seal();
+    volumes->seal();
+
+    // The partial last block is final now, and goes in with the last commit
+    catch_up_meta();
+    meta.finish();
+    meta.commit(true);
+    meta.close();
+
+    // Marker goes down only once the trimmed files are complete
+    std::ofstream marker(path + "/" + SEALED_MARKER);
+    if (!marker)
+    {
+        throw std::runtime_error("Failed to write seal marker in " + path);
+    }
+    marker.close();
+    sealed.store(true, std::memory_order_release);
+}
+
+void Segment::compress() const
+{
+    if (!sealed || compressed)
+        return;
+
+    size_t rows = get_count();
+    CompressedColumns::write(path + "/" + CompressedColumns::FILE_NAME, timestamps->span<uint64_t>(0, rows).data(),
+                             prices->span<double>(0, rows).data(), volumes->span<uint64_t>(0, rows).data(), rows,
+                             options.index_block_rows);
+}
+
+void Segment::remove_raw_files()
+{
+    // The columns may still be mapped by readers; unlinking is safe, the
+    // pages stay valid until the last mapping goes away
+    index_dirty = false;
+    for (const char *file : {"timestamps.bin", "prices.bin", "volumes.bin", BlockIndex::FILE_NAME})
+    {
+        std::filesystem::remove(path + "/" + file);
+    }
+}
+
+bool Segment::save_index()
+{
+    if (!is_sealed() || mode == OpenMode::ReadShared)
+        return false;
+    bool saved = false;
+    if (meta_dirty)
+    {
+        meta.save(path + "/" + SegmentMeta::FILE_NAME);
+        meta_dirty = false;
+        saved = true;
+    }
+    if (index_dirty && !compressed && options.index_mode == IndexMode::SparseBlock)
+    {
+        persist_index();
+        saved = true;
+    }
+    return saved;
+}
+
+void Segment::retire()
+{
+    index_dirty = false;
+    meta_dirty = false;
+    if (is_sealed() && !compressed)
+        open_block_files();
+}
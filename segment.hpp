@@ -0,0 +1,239 @@
+#ifndef SEGMENT_HPP
+#define SEGMENT_HPP
+
+#include "async_io.hpp"
+#include "column_storage.hpp"
+#include "bplus_tree.hpp"
+#include "block_index.hpp"
+#include "range_view.hpp"
+#include "compression.hpp"
+#include "segment_meta.hpp"
+#include "aggregate.hpp"
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+// How a segment finds rows by timestamp
+enum class IndexMode
+{
+    BPlusTree,  // Every row in an in-memory B+ tree, rebuilt on open
+    SparseBlock // One entry per block over the sorted column, persisted;
+                // the B+ tree only holds out-of-order rows
+};
+
+// Per-column storage settings shared by every segment of a symbol
+struct SegmentOptions
+{
+    ColumnOptions timestamps;
+    ColumnOptions prices;
+    ColumnOptions volumes;
+
+    IndexMode index_mode = IndexMode::SparseBlock;
+    size_t index_block_rows = 4096; // Rows per sparse index entry
+
+    // Re-encode partitions once they are sealed; block_rows rows per
+    // compressed block (index_block_rows)
+    Compression compression = Compression::None;
+};
+
+// One time partition of a symbol: a directory holding the timestamp, price
+// and volume columns plus the time index over them. Row numbers are local to
+// the segment. Once a segment rolls over it is sealed: trimmed to its exact
+// size, marked on disk, and its mappings made read-only. A sealed segment
+// may then be compressed: opened read-only with a compressed.bin present, it
+// serves rows from decoded blocks instead of the raw column files.
+//
+// The row count all three columns hold is committed to segment.meta
+// (SegmentMeta) with every header flush, together with min/max stats per
+// index block. Opening a writable segment cuts the columns back to the last
+// intact commit; a missing or damaged file is rebuilt from the columns.
+//
+// Opened OpenMode::ReadShared, the segment is a view of one that a writer
+// in another process may still be appending to. Nothing is checked, cut or
+// built on open; follow() loads the index and stats on its first call,
+// then catches up on the rows the writer has flushed since. Such a segment
+// never writes a file.
+//
+// One writer appends while readers query without locks: append_batch()
+// writes the columns and the index first and then publishes the new row
+// count, and every read is clamped to the count it loaded. Readers must be
+// pinned (EpochGuard) while they touch the index. IndexMode::BPlusTree is
+// the exception: its tree is guarded by a per-segment lock.
+class Segment
+{
+public:
+    // Files live in parent_dir/name; the legacy unpartitioned layout uses
+    // parent_dir = data_dir and name = symbol.
+    Segment(const std::string &parent_dir, const std::string &name,
+            uint64_t partition_start, uint64_t partition_end, OpenMode mode,
+            const SegmentOptions &options = SegmentOptions{});
+
+    ~Segment();
+
+    Segment(const Segment &) = delete;
+    Segment &operator=(const Segment &) = delete;
+
+    // Append rows to all three columns, index them, then publish them
+    void append_batch(const uint64_t *ts, const double *px, const uint64_t *vol, size_t n);
+    // Bulk loads: append to the columns only. The rows stay invisible until
+    // index_pending() indexes them in one pass and publishes them; seal()
+    // and append_batch() call it first. Returns the rows in the columns.
+    size_t append_unindexed(const uint64_t *ts, const double *px, const uint64_t *vol, size_t n);
+    void index_pending();
+    void flush_headers();
+    // Flush headers and block until every row is on stable storage
+    void sync();
+
+    void read_row(size_t index, uint64_t &ts, double &price, uint64_t &volume) const;
+
+    // Append views covering exactly the rows with start <= timestamp <= end.
+    // Returns false if the views are not in timestamp order when
+    // concatenated (late ticks in the range). Raw views point into the
+    // mapped columns; compressed ones into decoded blocks, which are added
+    // to leases and must outlive the views. Decoded blocks come from
+    // BlockCache::global(); with cache_blocks false, misses are not kept.
+    bool view_range(uint64_t start, uint64_t end, std::vector<ColumnView> &out, ViewLeases &leases,
+                    bool cache_blocks = true) const;
+
+    // view_range, except that the rows of a sealed raw segment are read
+    // into blocks through io instead of from the mapping: out gets
+    // placeholder views that io.wait() fills in (and leases the blocks of),
+    // so out must outlive it. Other segments are viewed as usual.
+    bool read_range(uint64_t start, uint64_t end, std::vector<ColumnView> &out, ViewLeases &leases,
+                    IoBatch &io, bool cache_blocks = true) const;
+
+    // First row in storage order with timestamp >= ts, or get_count()
+    size_t first_row_at(uint64_t ts) const;
+
+    // Views of rows [first, last) in storage order
+    void view_rows(size_t first, size_t last, std::vector<ColumnView> &out, ViewLeases &leases) const;
+
+    // Fold the rows with start <= timestamp <= end into out, whose ops must
+    // be Aggregator::bounds_only(). Blocks inside the range are folded from
+    // their stats and blocks outside it skipped, without reading a row; only
+    // blocks straddling the range and rows past the stats are scanned.
+    void aggregate_bounds(uint64_t start, uint64_t end, Aggregator &out) const;
+
+    // Start reading the column pages a view_range(start, end) would touch,
+    // to block granularity and without the late rows stored elsewhere.
+    // Compressed segments decode on read and are skipped.
+    void prefetch_range(uint64_t start, uint64_t end) const;
+
+    // ReadShared: publish the rows the writer has flushed since the last
+    // call, loading the index and stats first if this is the first one.
+    // Same single-caller rule as append_batch(). Returns the row count.
+    size_t follow();
+    // ReadShared: whether follow() would publish more rows. Lock-free, so
+    // callers can leave follow() alone when there is nothing to pick up.
+    bool has_unfollowed_rows() const;
+
+    // Rows published to readers
+    size_t get_count() const;
+    bool verify_column_sync() const;
+
+    // Trim preallocated space, write the marker and downgrade to read-only
+    void seal();
+    bool is_sealed() const { return sealed.load(std::memory_order_acquire); }
+
+    // Write compressed.bin next to the raw columns of a sealed segment. This
+    // object keeps serving the raw columns; reopen it to switch over.
+    void compress() const;
+    bool is_compressed() const { return compressed != nullptr; }
+    // Delete the raw column and index files once compressed.bin is in place
+    void remove_raw_files();
+
+    // Write block_index.bin and segment.meta of a sealed segment opened
+    // without usable ones. Returns true if either was written.
+    bool save_index();
+    // Before this segment's directory is replaced or deleted under readers
+    // that still hold it: open the files read_range would open later by
+    // path, and never write the index back
+    void retire();
+
+    // Partition interval [partition_start, partition_end) this segment owns
+    uint64_t get_partition_start() const { return partition_start; }
+    uint64_t get_partition_end() const { return partition_end; }
+
+    // Actual timestamp bounds of rows stored here (late ticks may fall
+    // outside the partition interval)
+    uint64_t get_min_ts() const { return min_ts.load(std::memory_order_relaxed); }
+    uint64_t get_max_ts() const { return max_ts.load(std::memory_order_relaxed); }
+    bool overlaps(uint64_t start, uint64_t end) const
+    {
+        return get_count() > 0 && get_min_ts() <= end && get_max_ts() >= start;
+    }
+
+    const std::string &get_path() const { return path; }
+
+    static bool has_seal_marker(const std::string &segment_path);
+
+    // Recovery: cut the segment in parent_dir/name back to rows and make it
+    // writable again. Must run before the segment is opened. Returns true if
+    // any row was dropped.
+    static bool truncate_rows(const std::string &parent_dir, const std::string &name, size_t rows);
+
+    static constexpr const char *SEALED_MARKER = "SEALED";
+
+private:
+    void rebuild_index();
+    void index_rows(size_t from, size_t to, const uint64_t *ts);
+    void persist_index();
+    // Fold the rows appended since into the stats (and commit them)
+    void catch_up_meta();
+    void commit_meta(bool durable);
+    void open_block_files() const;
+    bool sparse_view_range(uint64_t start, uint64_t end, size_t rows, std::vector<ColumnView> &out) const;
+    bool compressed_view_range(uint64_t start, uint64_t end, std::vector<ColumnView> &out, ViewLeases &leases,
+                               bool cache_blocks) const;
+    ColumnView raw_view(size_t first, size_t last) const;
+    static ColumnView decoded_view(const DecodedBlock &block, size_t from, size_t to);
+    size_t locate_in_order(uint64_t ts, size_t rows) const;
+    size_t column_count() const;
+
+    std::string parent_dir;
+    std::string name;
+    std::string path;
+    uint64_t partition_start;
+    uint64_t partition_end;
+    OpenMode mode;
+    std::atomic<bool> sealed; // Set once the sealed files are on stable storage
+    SegmentOptions options;
+
+    // Raw columns, absent once the segment is served from compressed blocks
+    std::optional<ColumnStorage> timestamps;
+    std::optional<ColumnStorage> prices;
+    std::optional<ColumnStorage> volumes;
+    std::unique_ptr<CompressedColumns> compressed;
+
+    // The raw columns opened for read_range, once the segment is sealed
+    mutable std::once_flag block_files_once;
+    mutable std::array<std::shared_ptr<const BlockFile>, 3> block_files;
+
+    // B+ Tree index for efficient time range lookups (IndexMode::BPlusTree)
+    BPlusTree<uint64_t, size_t> time_index;
+    mutable std::shared_mutex time_index_mutex;
+
+    // Sparse block index (IndexMode::SparseBlock)
+    BlockIndex block_index;
+    bool index_dirty = false; // Rows indexed since the file was last written
+    bool index_loaded = false; // ReadShared: follow() has run
+
+    // Committed row count and block stats (segment.meta)
+    SegmentMeta meta;
+    bool meta_dirty = false; // Sealed, with no intact file on disk
+
+    // Published after the rows they describe; bounds may run slightly ahead
+    std::atomic<size_t> visible_rows{0};
+    std::atomic<uint64_t> min_ts{std::numeric_limits<uint64_t>::max()};
+    std::atomic<uint64_t> max_ts{0};
+};
+
+#endif // SEGMENT_HPP
@@ -0,0 +1,320 @@
+#include "segment_meta.hpp"
+#include "checksum.hpp"
+#include "file_util.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <stdexcept>
+
+namespace
+{
+    constexpr uint64_t SEGMENT_META_MAGIC = 0x54454d4745535354ULL; // "TSSEGMET"
+    constexpr uint32_t SEGMENT_META_VERSION = 1;
+
+    // The header and each slot get a sector of their own, so a torn write
+    // of one slot cannot reach the other
+    constexpr size_t SECTOR = 512;
+    constexpr size_t BLOCKS_OFFSET = 3 * SECTOR;
+
+    struct MetaHeader
+    {
+        uint64_t magic;
+        uint32_t version;
+        uint32_t block_rows;
+        uint32_t crc; // Of the fields above
+        uint32_t reserved;
+    };
+
+    struct CommitSlot
+    {
+        uint64_t generation; // 0: never written
+        uint64_t rows;
+        uint64_t block_count; // rows / block_rows, rounded up once sealed
+        uint64_t last_ts;     // Timestamp of row rows - 1, checked against the column
+        uint32_t blocks_crc;  // CRC32C of the first block_count blocks
+        uint32_t crc;         // CRC32C of this slot (this field zeroed)
+    };
+
+    size_t slot_offset(uint64_t generation)
+    {
+        return SECTOR * (1 + generation % 2);
+    }
+
+    MetaHeader make_header(size_t block_rows)
+    {
+        MetaHeader header{SEGMENT_META_MAGIC, SEGMENT_META_VERSION, static_cast<uint32_t>(block_rows), 0, 0};
+        header.crc = crc32c(&header, offsetof(MetaHeader, crc));
+        return header;
+    }
+
+    uint32_t slot_crc(CommitSlot slot)
+    {
+        slot.crc = 0;
+        return crc32c(&slot, sizeof(slot));
+    }
+
+    // Header and two empty slots, padded to where the blocks start
+    std::vector<char> empty_prefix(size_t block_rows)
+    {
+        std::vector<char> prefix(BLOCKS_OFFSET, 0);
+        MetaHeader header = make_header(block_rows);
+        std::memcpy(prefix.data(), &header, sizeof(header));
+        return prefix;
+    }
+}
+
+SegmentMeta::SegmentMeta(size_t block_rows)
+    : block_rows(std::max<size_t>(block_rows, 1))
+{
+}
+
+SegmentMeta::~SegmentMeta()
+{
+    close();
+}
+
+void SegmentMeta::reset()
+{
+    covered = 0;
+    last_ts = 0;
+    completed.clear();
+    published_rows.store(0, std::memory_order_release);
+    loaded = false;
+    generation = 0;
+    persisted_blocks = 0;
+    blocks_crc = 0;
+    committed_rows = 0;
+    committed_durably = true;
+}
+
+void SegmentMeta::publish(const BlockStats &block)
+{
+    completed.push_back(block);
+    published_rows.store(covered, std::memory_order_release);
+}
+
+void SegmentMeta::add(const uint64_t *ts, const double *px, const uint64_t *vol, size_t n)
+{
+    for (size_t i = 0; i < n; ++i)
+    {
+        if (covered % block_rows == 0)
+        {
+            tail = BlockStats{ts[i], ts[i], px[i], px[i], vol[i], vol[i]};
+        }
+        else
+        {
+            tail.min_ts = std::min(tail.min_ts, ts[i]);
+            tail.max_ts = std::max(tail.max_ts, ts[i]);
+            tail.min_price = std::min(tail.min_price, px[i]);
+            tail.max_price = std::max(tail.max_price, px[i]);
+            tail.min_volume = std::min(tail.min_volume, vol[i]);
+            tail.max_volume = std::max(tail.max_volume, vol[i]);
+        }
+        ++covered;
+        if (covered % block_rows == 0)
+            publish(tail);
+    }
+    if (n > 0)
+        last_ts = ts[n - 1];
+}
+
+void SegmentMeta::finish()
+{
+    if (covered > completed.size() * block_rows)
+        publish(tail);
+}
+
+std::span<const BlockStats> SegmentMeta::blocks(size_t rows) const
+{
+    // Rows before the published count are in published blocks; a partial
+    // block is only ever the last one, published at sealing
+    size_t published = published_rows.load(std::memory_order_acquire);
+    size_t limit = std::min(rows, published);
+    size_t n = limit / block_rows;
+    if (limit == published && limit % block_rows != 0)
+        ++n;
+    return std::span<const BlockStats>(completed.data(), n);
+}
+
+size_t SegmentMeta::block_end(size_t block) const
+{
+    return std::min((block + 1) * block_rows, published_rows.load(std::memory_order_acquire));
+}
+
+std::optional<size_t> SegmentMeta::load(const std::string &path, size_t rows, const uint64_t *timestamps,
+                                        bool sealed)
+{
+    reset();
+    if (!std::filesystem::exists(path))
+        return std::nullopt;
+
+    // Copied rather than mapped: a live writer rewrites the file in place,
+    // and readers in other processes load it too
+    std::vector<char> file;
+    try
+    {
+        file = read_file(path);
+    }
+    catch (const std::system_error &)
+    {
+        return std::nullopt;
+    }
+    if (file.size() < BLOCKS_OFFSET)
+        return std::nullopt;
+    MetaHeader header;
+    std::memcpy(&header, file.data(), sizeof(header));
+    if (header.magic != SEGMENT_META_MAGIC || header.version != SEGMENT_META_VERSION ||
+        header.block_rows != block_rows || header.crc != crc32c(&header, offsetof(MetaHeader, crc)))
+    {
+        return std::nullopt;
+    }
+
+    // Newest commit first; the other one is what a torn commit left behind
+    CommitSlot slots[2];
+    std::memcpy(&slots[0], file.data() + slot_offset(0), sizeof(CommitSlot));
+    std::memcpy(&slots[1], file.data() + slot_offset(1), sizeof(CommitSlot));
+    if (slots[1].generation > slots[0].generation)
+        std::swap(slots[0], slots[1]);
+
+    const char *block_bytes = file.data() + BLOCKS_OFFSET;
+    for (const CommitSlot &slot : slots)
+    {
+        size_t full = slot.rows / block_rows;
+        if (slot.generation == 0 || slot.crc != slot_crc(slot) || slot.rows > rows ||
+            (slot.block_count != full && slot.block_count != (slot.rows + block_rows - 1) / block_rows) ||
+            file.size() < BLOCKS_OFFSET + slot.block_count * sizeof(BlockStats) ||
+            crc32c(block_bytes, slot.block_count * sizeof(BlockStats)) != slot.blocks_crc ||
+            (timestamps && slot.rows > 0 && timestamps[slot.rows - 1] != slot.last_ts))
+        {
+            continue;
+        }
+
+        // A writable segment reopens the partial last block of a sealed
+        // commit: more rows may join it
+        size_t keep = sealed ? slot.block_count : full;
+        completed.assign(reinterpret_cast<const BlockStats *>(block_bytes), keep);
+        covered = std::min(keep * block_rows, static_cast<size_t>(slot.rows));
+        published_rows.store(covered, std::memory_order_release);
+        last_ts = slot.last_ts;
+
+        this->path = path;
+        loaded = true;
+        generation = slot.generation;
+        persisted_blocks = keep;
+        blocks_crc = keep == slot.block_count ? slot.blocks_crc : crc32c(block_bytes, keep * sizeof(BlockStats));
+        committed_rows = slot.rows;
+        return static_cast<size_t>(slot.rows);
+    }
+    return std::nullopt;
+}
+
+void SegmentMeta::open(const std::string &path)
+{
+    close();
+    bool fresh = !loaded || path != this->path;
+    this->path = path;
+    fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0666);
+    if (fd == -1)
+    {
+        throw std::system_error(errno, std::generic_category(), "Failed to open " + path);
+    }
+    if (!fresh)
+        return;
+
+    // A commit left from before must not survive next to the new ones: it
+    // could describe rows that were since cut and rewritten. Empty slots go
+    // over it first, so the file never shrinks below them.
+    std::vector<char> prefix = empty_prefix(block_rows);
+    pwrite_fully(fd, prefix.data(), prefix.size(), 0, path);
+    if (ftruncate(fd, BLOCKS_OFFSET) == -1)
+    {
+        int err = errno;
+        ::close(fd);
+        fd = -1;
+        throw std::system_error(err, std::generic_category(), "Failed to truncate " + path);
+    }
+    generation = 0;
+    persisted_blocks = 0;
+    blocks_crc = 0;
+    committed_rows = 0;
+    committed_durably = false;
+    loaded = true;
+}
+
+void SegmentMeta::commit(bool durable)
+{
+    if (fd == -1)
+        return;
+    size_t count = completed.size();
+    if (covered == committed_rows && count == persisted_blocks && (committed_durably || !durable))
+        return;
+
+    // Blocks completed since the last commit, then the slot naming them
+    if (count > persisted_blocks)
+    {
+        const BlockStats *fresh = completed.data() + persisted_blocks;
+        size_t bytes = (count - persisted_blocks) * sizeof(BlockStats);
+        pwrite_fully(fd, fresh, bytes, BLOCKS_OFFSET + persisted_blocks * sizeof(BlockStats), path);
+        blocks_crc = crc32c(fresh, bytes, blocks_crc);
+    }
+    if (durable && fdatasync(fd) == -1)
+    {
+        throw std::system_error(errno, std::generic_category(), "fdatasync failed for " + path);
+    }
+
+    CommitSlot slot{generation + 1, covered, count, last_ts, blocks_crc, 0};
+    slot.crc = slot_crc(slot);
+    pwrite_fully(fd, &slot, sizeof(slot), slot_offset(slot.generation), path);
+    if (durable && fdatasync(fd) == -1)
+    {
+        throw std::system_error(errno, std::generic_category(), "fdatasync failed for " + path);
+    }
+
+    generation = slot.generation;
+    persisted_blocks = count;
+    committed_rows = covered;
+    committed_durably = durable;
+}
+
+void SegmentMeta::close()
+{
+    if (fd != -1)
+    {
+        ::close(fd);
+        fd = -1;
+    }
+}
+
+void SegmentMeta::save(const std::string &path) const
+{
+    size_t count = completed.size();
+    std::vector<char> buffer = empty_prefix(block_rows);
+    const BlockStats *stats = completed.data();
+    CommitSlot slot{1, covered, count, last_ts, crc32c(stats, count * sizeof(BlockStats)), 0};
+    slot.crc = slot_crc(slot);
+    std::memcpy(buffer.data() + slot_offset(slot.generation), &slot, sizeof(slot));
+    buffer.insert(buffer.end(), reinterpret_cast<const char *>(stats),
+                  reinterpret_cast<const char *>(stats + count));
+
+    std::string tmp_path = path + ".tmp";
+    int out = ::open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (out == -1)
+    {
+        throw std::system_error(errno, std::generic_category(), "Failed to open " + tmp_path);
+    }
+    try
+    {
+        write_fully(out, buffer.data(), buffer.size(), tmp_path);
+    }
+    catch (...)
+    {
+        ::close(out);
+        throw;
+    }
+    ::close(out);
+    if (std::rename(tmp_path.c_str(), path.c_str()) != 0)
+    {
+        throw std::runtime_error("Failed to install " + path);
+    }
+}
@@ -0,0 +1,112 @@
+#ifndef SEGMENT_META_HPP
+#define SEGMENT_META_HPP
+
+#include "epoch.hpp"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <optional>
+#include <span>
+#include <string>
+#include <vector>
+
+// Bounds of every column over one block of rows
+struct BlockStats
+{
+    uint64_t min_ts;
+    uint64_t max_ts;
+    double min_price;
+    double max_price;
+    uint64_t min_volume;
+    uint64_t max_volume;
+};
+
+// Committed row count and per-block column statistics of one segment,
+// persisted as segment.meta next to the columns:
+//
+//   header (magic, version, block size)
+//   two commit slots, each in its own sector
+//   BlockStats array, one entry per block of block_rows rows
+//
+// A commit writes the stats of blocks completed since the last one, then
+// the slot not holding the newest commit: a generation number, the row
+// count all three columns agree on, the number of blocks it covers, the
+// last row's timestamp and checksums over itself and the blocks. A torn
+// commit leaves the other slot intact, so opening the segment falls back to
+// the previous commit. Completed blocks never change, so the block checksum
+// is extended rather than recomputed.
+//
+// One writer feeds rows in storage order with add(); readers pinned with an
+// EpochGuard query the completed blocks concurrently. The last block is
+// only published once it is complete or the segment is sealed.
+class SegmentMeta
+{
+public:
+    explicit SegmentMeta(size_t block_rows);
+    ~SegmentMeta();
+
+    SegmentMeta(const SegmentMeta &) = delete;
+    SegmentMeta &operator=(const SegmentMeta &) = delete;
+
+    // Fold the next n rows in storage order into the stats
+    void add(const uint64_t *ts, const double *px, const uint64_t *vol, size_t n);
+    // Publish the partial last block as well; no rows follow (sealing)
+    void finish();
+    // Rows folded in so far
+    size_t covered_rows() const { return covered; }
+    size_t get_block_rows() const { return block_rows; }
+
+    // Completed blocks whose rows all lie below rows, in row order. Block b
+    // covers rows [b * block_rows, block_end(b)).
+    std::span<const BlockStats> blocks(size_t rows) const;
+    size_t block_end(size_t block) const;
+
+    // Load the newest intact commit from path. A commit is intact if both
+    // its checksums match, it was made with this block size, it covers at
+    // most rows rows and, given the timestamp column, its last row still
+    // has the timestamp it was committed with. Only the stats of completed
+    // blocks are kept unless sealed is set. Returns the committed row
+    // count, or nullopt (leaving the stats empty) if no commit is intact.
+    std::optional<size_t> load(const std::string &path, size_t rows, const uint64_t *timestamps, bool sealed);
+
+    // Keep path open for commit(), starting it afresh unless load() just
+    // accepted it
+    void open(const std::string &path);
+    // Commit the rows folded in so far. durable: the blocks reach stable
+    // storage before the slot does, and the slot before this returns. No-op
+    // if nothing changed since the last commit.
+    void commit(bool durable);
+    // Release the file; commits end here (sealing)
+    void close();
+
+    // Write a whole file with one commit of the rows folded in so far
+    // (temporary file and rename), for sealed segments opened without an
+    // intact one
+    void save(const std::string &path) const;
+
+    static constexpr const char *FILE_NAME = "segment.meta";
+
+private:
+    void reset();
+    void publish(const BlockStats &block);
+
+    size_t block_rows;
+    size_t covered = 0;
+    uint64_t last_ts = 0;                    // Of row covered - 1
+    BlockStats tail{};                       // Rows of the block in progress
+    PublishedArray<BlockStats> completed;
+    std::atomic<size_t> published_rows{0};   // Rows the published blocks cover
+
+    // Commit state, writer only
+    std::string path;
+    int fd = -1;
+    bool loaded = false;         // load() accepted the file at path
+    uint64_t generation = 0;     // Of the newest commit
+    size_t persisted_blocks = 0; // Blocks in the file the newest commit covers
+    uint32_t blocks_crc = 0;     // Over those blocks
+    size_t committed_rows = 0;
+    bool committed_durably = true;
+};
+
+#endif // SEGMENT_META_HPP
@@ -0,0 +1,679 @@
+#include "server.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+#include <system_error>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace
+{
+    constexpr size_t READ_CHUNK = 64 * 1024;
+    constexpr size_t MAX_EVENTS = 64;
+    constexpr size_t SEND_IOVS = 64; // iovecs gathered per sendmsg
+    constexpr int SYNC_POLL_MS = 1;  // Writers cannot wake the loop; pending syncs are polled
+
+    // Symbols become directory names: no separators, no leading dot
+    bool valid_symbol(const std::string &symbol)
+    {
+        if (symbol.empty() || symbol[0] == '.')
+            return false;
+        return std::all_of(symbol.begin(), symbol.end(), [](char c)
+                           { return (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z') || (c >= '0' && c <= '9') ||
+                                    c == '_' || c == '-' || c == '.'; });
+    }
+
+    template <typename T>
+    T read_field(const char *at)
+    {
+        T value;
+        std::memcpy(&value, at, sizeof(T));
+        return value;
+    }
+
+    template <typename T>
+    void add_span(std::vector<iovec> &iov, std::span<const T> span)
+    {
+        if (!span.empty())
+            iov.push_back({const_cast<T *>(span.data()), span.size_bytes()});
+    }
+
+    [[noreturn]] void throw_errno(const std::string &what)
+    {
+        throw std::system_error(errno, std::generic_category(), what);
+    }
+}
+
+TsdbServer::TsdbServer(TSDBManager &manager, const ServerOptions &options) : manager(manager), options(options)
+{
+    try
+    {
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(options.port);
+        if (inet_pton(AF_INET, options.bind_address.c_str(), &addr.sin_addr) != 1)
+            throw std::invalid_argument("Invalid bind address " + options.bind_address);
+
+        listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (listen_fd == -1)
+            throw_errno("Failed to create socket");
+        int on = 1;
+        setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+        if (bind(listen_fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) == -1)
+            throw_errno("Failed to bind " + options.bind_address + ":" + std::to_string(options.port));
+        if (listen(listen_fd, options.listen_backlog) == -1)
+            throw_errno("Failed to listen");
+        socklen_t length = sizeof(addr);
+        if (getsockname(listen_fd, reinterpret_cast<sockaddr *>(&addr), &length) == -1)
+            throw_errno("Failed to read the bound address");
+        bound_port = ntohs(addr.sin_port);
+
+        epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        if (epoll_fd == -1)
+            throw_errno("Failed to create epoll instance");
+        wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (wake_fd == -1)
+            throw_errno("Failed to create eventfd");
+
+        for (int fd : {listen_fd, wake_fd})
+        {
+            epoll_event event{};
+            event.events = EPOLLIN;
+            event.data.fd = fd;
+            if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) == -1)
+                throw_errno("Failed to register with epoll");
+        }
+    }
+    catch (...)
+    {
+        for (int fd : {listen_fd, epoll_fd, wake_fd})
+            if (fd != -1)
+                close(fd);
+        throw;
+    }
+}
+
+TsdbServer::~TsdbServer()
+{
+    for (auto &[fd, conn] : connections)
+        close(fd);
+    close(listen_fd);
+    close(epoll_fd);
+    close(wake_fd);
+}
+
+void TsdbServer::stop()
+{
+    uint64_t one = 1;
+    if (write(wake_fd, &one, sizeof(one)) == -1)
+    {
+        // Only fails if the counter is saturated, and then a wake is pending anyway
+    }
+}
+
+void TsdbServer::run()
+{
+    epoll_event events[MAX_EVENTS];
+    while (true)
+    {
+        int ready = epoll_wait(epoll_fd, events, MAX_EVENTS, syncing.empty() ? -1 : SYNC_POLL_MS);
+        if (ready == -1)
+        {
+            if (errno == EINTR)
+                continue;
+            throw_errno("epoll_wait failed");
+        }
+
+        for (int i = 0; i < ready; ++i)
+        {
+            int fd = events[i].data.fd;
+            if (fd == wake_fd)
+            {
+                uint64_t count;
+                if (read(wake_fd, &count, sizeof(count)) == -1)
+                {
+                    // Drained by an earlier wake
+                }
+                return;
+            }
+            if (fd == listen_fd)
+            {
+                accept_connections();
+                continue;
+            }
+
+            auto it = connections.find(fd);
+            if (it == connections.end())
+                continue;
+            Connection &conn = *it->second;
+            uint32_t ready_events = events[i].events;
+            bool keep = !(ready_events & EPOLLERR);
+            if (keep && (ready_events & (EPOLLIN | EPOLLHUP)))
+                keep = on_readable(conn);
+            if (keep && (ready_events & EPOLLOUT))
+                keep = on_writable(conn);
+            // Peer gone and nothing left to answer
+            if (keep && conn.peer_closed && conn.out.empty())
+                keep = false;
+            if (keep)
+                update_interest(conn);
+            else
+                close_connection(fd);
+        }
+        poll_syncs();
+    }
+}
+
+void TsdbServer::poll_syncs()
+{
+    for (auto it = syncing.begin(); it != syncing.end();)
+    {
+        int fd = *it;
+        auto found = connections.find(fd);
+        if (found == connections.end())
+        {
+            it = syncing.erase(it);
+            continue;
+        }
+        Connection &conn = *found->second;
+        bool keep = serve(conn);
+        if (keep && conn.peer_closed && conn.out.empty())
+            keep = false;
+        if (!keep || conn.syncs == 0)
+            it = syncing.erase(it);
+        else
+            ++it;
+        if (keep)
+            update_interest(conn);
+        else
+            close_connection(fd);
+    }
+}
+
+void TsdbServer::accept_connections()
+{
+    while (true)
+    {
+        int fd = accept4(listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd == -1)
+        {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                std::cerr << "WARNING: accept failed: " << std::strerror(errno) << std::endl;
+            return;
+        }
+
+        // Responses are already batched; do not hold small ones back
+        int on = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+        auto conn = std::make_unique<Connection>();
+        conn->fd = fd;
+        conn->events = EPOLLIN;
+        epoll_event event{};
+        event.events = EPOLLIN;
+        event.data.fd = fd;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) == -1)
+        {
+            std::cerr << "WARNING: Failed to register connection: " << std::strerror(errno) << std::endl;
+            close(fd);
+            continue;
+        }
+        connections.emplace(fd, std::move(conn));
+    }
+}
+
+void TsdbServer::close_connection(int fd)
+{
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+    close(fd);
+    connections.erase(fd);
+    syncing.erase(fd);
+}
+
+void TsdbServer::update_interest(Connection &conn)
+{
+    uint32_t wanted = 0;
+    if (!conn.peer_closed && conn.out.size() < options.max_pipeline)
+        wanted |= EPOLLIN;
+    // A sync at the front has nothing to send until poll_syncs() clears it
+    if (!conn.out.empty() && !conn.out.front().sync_db)
+        wanted |= EPOLLOUT;
+    if (wanted == conn.events)
+        return;
+    epoll_event event{};
+    event.events = wanted;
+    event.data.fd = conn.fd;
+    epoll_ctl(epoll_fd, EPOLL_CTL_MOD, conn.fd, &event);
+    conn.events = wanted;
+}
+
+bool TsdbServer::on_readable(Connection &conn)
+{
+    while (!conn.peer_closed && conn.out.size() < options.max_pipeline)
+    {
+        // Drop parsed bytes, then make room for the next read
+        if (conn.in_start > 0)
+        {
+            std::memmove(conn.in.data(), conn.in.data() + conn.in_start, conn.in_end - conn.in_start);
+            conn.in_end -= conn.in_start;
+            conn.in_start = 0;
+        }
+        if (conn.in.size() - conn.in_end < READ_CHUNK)
+            conn.in.resize(std::max(conn.in.size() * 2, conn.in_end + READ_CHUNK));
+
+        ssize_t received = recv(conn.fd, conn.in.data() + conn.in_end, conn.in.size() - conn.in_end, 0);
+        if (received == 0)
+        {
+            // Half-close: answer what was sent, then hang up
+            conn.peer_closed = true;
+            break;
+        }
+        if (received == -1)
+        {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
+            return false;
+        }
+        conn.in_end += received;
+        if (!serve(conn))
+            return false;
+    }
+    return serve(conn);
+}
+
+bool TsdbServer::on_writable(Connection &conn)
+{
+    return serve(conn);
+}
+
+bool TsdbServer::serve(Connection &conn)
+{
+    // Frames held back by a full pipeline get their turn once it drains, as
+    // no further event may arrive for them
+    while (true)
+    {
+        bool was_full = conn.out.size() >= options.max_pipeline;
+        size_t handled = 0;
+        if (!process_frames(conn, handled) || !flush(conn))
+            return false;
+        if (!conn.out.empty() || (handled == 0 && !was_full))
+            return true;
+    }
+}
+
+bool TsdbServer::process_frames(Connection &conn, size_t &handled)
+{
+    while (conn.out.size() < options.max_pipeline)
+    {
+        size_t available = conn.in_end - conn.in_start;
+        if (available < sizeof(RequestHeader))
+            break;
+        auto header = read_field<RequestHeader>(conn.in.data() + conn.in_start);
+        if (header.length > options.max_frame_bytes)
+        {
+            std::cerr << "WARNING: Closing connection: " << header.length << "-byte frame exceeds the "
+                      << options.max_frame_bytes << "-byte limit" << std::endl;
+            return false;
+        }
+        if (available < sizeof(RequestHeader) + header.length)
+            break;
+
+        Response response = handle(header, conn.in.data() + conn.in_start + sizeof(RequestHeader));
+        auto out = read_field<ResponseHeader>(response.head.data());
+        out.request_id = header.request_id;
+        out.op = header.op;
+        std::memcpy(response.head.data(), &out, sizeof(out));
+        if (response.sync_db)
+        {
+            ++conn.syncs;
+            syncing.insert(conn.fd);
+        }
+        conn.out.push_back(std::move(response));
+        conn.in_start += sizeof(RequestHeader) + header.length;
+        ++handled;
+    }
+    if (conn.in_start == conn.in_end)
+        conn.in_start = conn.in_end = 0;
+    return true;
+}
+
+bool TsdbServer::flush(Connection &conn)
+{
+    while (!conn.out.empty())
+    {
+        // Gather the front responses into one send
+        iovec batch[SEND_IOVS];
+        size_t count = 0;
+        for (Response &response : conn.out)
+        {
+            // Responses go in request order: an unfinished sync holds back the rest
+            if (response.sync_db)
+            {
+                if (!response.sync_db->sync_done(response.sync_ticket))
+                    break;
+                response.sync_db = nullptr;
+                --conn.syncs;
+            }
+            for (size_t i = response.next_iov; i < response.iov.size() && count < SEND_IOVS; ++i)
+            {
+                iovec part = response.iov[i];
+                if (i == response.next_iov)
+                {
+                    part.iov_base = static_cast<char *>(part.iov_base) + response.iov_offset;
+                    part.iov_len -= response.iov_offset;
+                }
+                batch[count++] = part;
+            }
+            if (count == SEND_IOVS)
+                break;
+        }
+
+        if (count == 0)
+            return true;
+
+        msghdr message{};
+        message.msg_iov = batch;
+        message.msg_iovlen = count;
+        ssize_t sent = sendmsg(conn.fd, &message, MSG_NOSIGNAL);
+        if (sent == -1)
+        {
+            if (errno == EINTR)
+                continue;
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+        }
+
+        // Retire what went out; a response (and its lease) goes once whole
+        size_t left = sent;
+        while (left > 0)
+        {
+            Response &front = conn.out.front();
+            size_t remaining = front.iov[front.next_iov].iov_len - front.iov_offset;
+            if (left < remaining)
+            {
+                front.iov_offset += left;
+                break;
+            }
+            left -= remaining;
+            front.iov_offset = 0;
+            if (++front.next_iov == front.iov.size())
+                conn.out.pop_front();
+        }
+    }
+    return true;
+}
+
+TimeSeriesDB *TsdbServer::find_store(const std::string &symbol, bool create, WireStatus &status)
+{
+    if (TimeSeriesDB *db = manager.find(symbol))
+        return db;
+
+    // Opening maps the columns and replays the WAL, and checking that a
+    // symbol exists lists the data directory: both run off the loop
+    auto it = opening.find(symbol);
+    if (it != opening.end())
+    {
+        if (it->second.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+        {
+            status = WireStatus::Busy;
+            return nullptr;
+        }
+        std::future<bool> done = std::move(it->second);
+        opening.erase(it);
+        if (done.get()) // Rethrows if the open failed
+            return manager.find(symbol);
+        if (!create)
+        {
+            status = WireStatus::NotFound;
+            return nullptr;
+        }
+        // An append creates the symbol a query found missing
+    }
+
+    auto open = [this, symbol, create]
+    {
+        // Queries never create a symbol; opening an existing one is fine
+        if (!create)
+        {
+            auto symbols = manager.list_symbols();
+            if (!std::binary_search(symbols.begin(), symbols.end(), symbol))
+                return false;
+        }
+        manager.get(symbol);
+        return true;
+    };
+    opening.emplace(symbol, std::async(std::launch::async, open));
+    status = WireStatus::Busy;
+    return nullptr;
+}
+
+TsdbServer::Response TsdbServer::handle(const RequestHeader &header, const char *payload)
+{
+    auto op = static_cast<WireOp>(header.op);
+    if (op < WireOp::Append || op > WireOp::Stats)
+        return error(WireStatus::BadRequest, "Unknown op " + std::to_string(header.op));
+    if (header.symbol_length > header.length)
+        return error(WireStatus::BadRequest, "Symbol runs past the end of the frame");
+    std::string symbol(payload, header.symbol_length);
+    // Stats without a symbol reports the process-wide figures only
+    if (!valid_symbol(symbol) && !(op == WireOp::Stats && symbol.empty()))
+        return error(WireStatus::BadRequest, "Invalid symbol '" + symbol + "'");
+    const char *body = payload + header.symbol_length;
+    size_t size = header.length - header.symbol_length;
+
+    try
+    {
+        if (op == WireOp::Stats)
+            return handle_stats(symbol, body, size);
+        WireStatus status = WireStatus::Ok;
+        TimeSeriesDB *db = find_store(symbol, op == WireOp::Append, status);
+        if (!db && status == WireStatus::Busy)
+            return error(status, "Store for '" + symbol + "' is opening; retry");
+        if (!db)
+            return error(WireStatus::NotFound, "No such symbol '" + symbol + "'");
+
+        switch (op)
+        {
+        case WireOp::Append:
+            return handle_append(*db, body, size);
+        case WireOp::Range:
+        {
+            if (size != 2 * sizeof(uint64_t))
+                return error(WireStatus::BadRequest, "Range takes a start and an end timestamp");
+            uint64_t start = read_field<uint64_t>(body);
+            uint64_t end = read_field<uint64_t>(body + 8);
+            RangeView view = db->view_range(start, end);
+            if (view.is_time_ordered())
+                return rows_response(std::move(view));
+            return rows_response(db->query_range(start, end));
+        }
+        case WireOp::Last:
+        {
+            if (size != sizeof(uint64_t))
+                return error(WireStatus::BadRequest, "Last takes a row count");
+            uint64_t n = read_field<uint64_t>(body);
+            return rows_response(db->view_last(n));
+        }
+        case WireOp::Aggregate:
+            return handle_aggregate(*db, body, size);
+        case WireOp::Sync:
+        {
+            // Sent once the writer completes the ticket (see flush)
+            Response response = reply(WireStatus::Ok, nullptr, 0);
+            response.sync_db = db;
+            response.sync_ticket = db->request_sync();
+            return response;
+        }
+        case WireOp::Stats:
+            break;
+        }
+    }
+    catch (const std::exception &e)
+    {
+        return error(WireStatus::Error, e.what());
+    }
+    return error(WireStatus::BadRequest, "Unknown op");
+}
+
+TsdbServer::Response TsdbServer::handle_append(TimeSeriesDB &db, const char *body, size_t size)
+{
+    if (size < sizeof(uint32_t))
+        return error(WireStatus::BadRequest, "Append needs a tick count");
+    uint64_t count = read_field<uint32_t>(body);
+    if (size != sizeof(uint32_t) + count * sizeof(Tick))
+        return error(WireStatus::BadRequest, "Append payload does not match its tick count");
+
+    // The columns arrive transposed already; copy them into a pooled batch
+    const char *columns = body + sizeof(uint32_t);
+    auto batch = db.acquire_batch();
+    batch->timestamps.resize(count);
+    batch->prices.resize(count);
+    batch->volumes.resize(count);
+    std::memcpy(batch->timestamps.data(), columns, count * sizeof(uint64_t));
+    std::memcpy(batch->prices.data(), columns + count * sizeof(uint64_t), count * sizeof(double));
+    std::memcpy(batch->volumes.data(), columns + count * (sizeof(uint64_t) + sizeof(double)), count * sizeof(uint64_t));
+    // Never waits for queue space, whatever the store's policy
+    if (!db.try_append_columns(std::move(batch)))
+        return error(WireStatus::Rejected, "Store's batch queue is full; retry");
+    return reply(WireStatus::Ok, &count, sizeof(count));
+}
+
+TsdbServer::Response TsdbServer::handle_aggregate(TimeSeriesDB &db, const char *body, size_t size)
+{
+    if (size != 2 * sizeof(uint64_t) + sizeof(uint32_t))
+        return error(WireStatus::BadRequest, "Aggregate takes a start, an end and op flags");
+    uint64_t start = read_field<uint64_t>(body);
+    uint64_t end = read_field<uint64_t>(body + 8);
+    auto ops = static_cast<AggregateOp>(read_field<uint32_t>(body + 16));
+
+    AggregateResult result = db.aggregate_range(start, end, ops);
+    WireAggregate wire{};
+    wire.count = result.count;
+    wire.open = result.open;
+    wire.high = result.high;
+    wire.low = result.low;
+    wire.close = result.close;
+    wire.volume = result.volume;
+    wire.sum = result.sum;
+    wire.vwap = result.vwap();
+    wire.open_ts = result.open_ts;
+    wire.close_ts = result.close_ts;
+    return reply(WireStatus::Ok, &wire, sizeof(wire));
+}
+
+TsdbServer::Response TsdbServer::handle_stats(const std::string &symbol, const char *body, size_t size)
+{
+    if (size != sizeof(uint8_t))
+        return error(WireStatus::BadRequest, "Stats takes a format byte");
+    bool json = read_field<uint8_t>(body) != 0;
+
+    // Only a store this process already serves: asking must not open one
+    TimeSeriesDB *db = symbol.empty() ? nullptr : manager.find(symbol);
+    MetricsSnapshot metrics = Metrics::global().snapshot();
+    std::ostringstream out;
+    if (json)
+    {
+        out << "{\n  \"symbol\": \"" << symbol << "\", \"open\": " << (db ? "true" : "false");
+        if (db)
+        {
+            DBStats stats = db->get_stats();
+            out << ", \"rows\": " << stats.rows << ", \"partitions\": " << stats.partitions
+                << ", \"compressed_partitions\": " << stats.compressed_partitions
+                << ", \"late_rows\": " << stats.late_rows << ", \"queue_depth\": " << stats.queue_depth
+                << ", \"queue_capacity\": " << stats.queue_capacity << ", \"pending_writes\": " << stats.pending_writes
+                << ", \"dropped_ticks\": " << stats.dropped_ticks << ", \"staged_ticks\": " << stats.staged_ticks;
+        }
+        out << ",\n  \"metrics\": " << format_metrics_json(metrics) << "}\n";
+    }
+    else
+    {
+        if (db)
+        {
+            DBStats stats = db->get_stats();
+            out << "Symbol: " << symbol << "\n"
+                << "Rows: " << stats.rows << " (" << stats.late_rows << " out of order)\n"
+                << "Partitions: " << stats.partitions << " (" << stats.compressed_partitions << " compressed)\n"
+                << "Queue: " << stats.queue_depth << "/" << stats.queue_capacity << "\n"
+                << "Pending: " << stats.pending_writes << " (" << stats.staged_ticks << " staged, "
+                << stats.dropped_ticks << " dropped)\n";
+        }
+        else if (!symbol.empty())
+        {
+            out << "Symbol: " << symbol << " (not open in this server)\n";
+        }
+        out << format_metrics_text(metrics);
+    }
+    std::string document = out.str();
+    return reply(WireStatus::Ok, document.data(), document.size());
+}
+
+TsdbServer::Response TsdbServer::rows_response(RangeView view)
+{
+    uint64_t rows = view.size();
+    if (sizeof(rows) + rows * sizeof(Tick) > std::numeric_limits<uint32_t>::max())
+        return error(WireStatus::BadRequest, "Result exceeds 4 GiB; narrow the range");
+
+    Response response = reply(WireStatus::Ok, &rows, sizeof(rows), rows * sizeof(Tick));
+    for (const ColumnView &chunk : view)
+        add_span(response.iov, chunk.timestamps);
+    for (const ColumnView &chunk : view)
+        add_span(response.iov, chunk.prices);
+    for (const ColumnView &chunk : view)
+        add_span(response.iov, chunk.volumes);
+    response.view = std::move(view);
+    return response;
+}
+
+TsdbServer::Response TsdbServer::rows_response(const std::vector<std::tuple<uint64_t, double, uint64_t>> &rows)
+{
+    uint64_t count = rows.size();
+    if (sizeof(count) + count * sizeof(Tick) > std::numeric_limits<uint32_t>::max())
+        return error(WireStatus::BadRequest, "Result exceeds 4 GiB; narrow the range");
+
+    Response response = reply(WireStatus::Ok, &count, sizeof(count), count * sizeof(Tick));
+    response.timestamps.reserve(count);
+    response.prices.reserve(count);
+    response.volumes.reserve(count);
+    for (const auto &[ts, price, volume] : rows)
+    {
+        response.timestamps.push_back(ts);
+        response.prices.push_back(price);
+        response.volumes.push_back(volume);
+    }
+    add_span(response.iov, std::span<const uint64_t>(response.timestamps));
+    add_span(response.iov, std::span<const double>(response.prices));
+    add_span(response.iov, std::span<const uint64_t>(response.volumes));
+    return response;
+}
+
+TsdbServer::Response TsdbServer::reply(WireStatus status, const void *payload, size_t size, size_t trailing)
+{
+    Response response;
+    response.head.resize(sizeof(ResponseHeader) + size);
+    ResponseHeader header{};
+    header.length = static_cast<uint32_t>(size + trailing);
+    header.status = static_cast<uint8_t>(status);
+    std::memcpy(response.head.data(), &header, sizeof(header));
+    if (size > 0)
+        std::memcpy(response.head.data() + sizeof(header), payload, size);
+    response.iov.push_back({response.head.data(), response.head.size()});
+    return response;
+}
+
+TsdbServer::Response TsdbServer::error(WireStatus status, const std::string &message)
+{
+    return reply(status, message.data(), message.size());
+}
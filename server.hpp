@@ -0,0 +1,128 @@
+#ifndef SERVER_HPP
+#define SERVER_HPP
+
+#include "tsdb_manager.hpp"
+#include "wire_protocol.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <span>
+#include <string>
+#include <future>
+#include <tuple>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include <sys/uio.h>
+
+struct ServerOptions
+{
+    std::string bind_address = "127.0.0.1";
+    uint16_t port = 7070; // 0 picks a free port (see TsdbServer::port())
+    int listen_backlog = 128;
+    // Larger frames close the connection: the stream cannot be resynced
+    size_t max_frame_bytes = 64 << 20;
+    // Responses queued per connection before the server stops reading
+    // from it, so a client that does not read cannot pile up memory
+    size_t max_pipeline = 256;
+};
+
+// Network front end over a TSDBManager, speaking wire_protocol.hpp. One
+// thread runs an epoll loop over non-blocking sockets and serves requests
+// in order per connection, never waiting on a store: stores open on a
+// background thread (the request is answered Busy meanwhile), a full queue
+// rejects an append, and a sync is answered once the loop sees the
+// writer's ticket complete. Range and tail responses are written
+// with sendmsg straight from the mapped column spans of a RangeView, which
+// stays leased until the last byte is sent; only ranges with out-of-order
+// rows are copied (and sorted) first.
+class TsdbServer
+{
+public:
+    // Binds and listens; throws std::system_error on failure
+    TsdbServer(TSDBManager &manager, const ServerOptions &options = ServerOptions{});
+    ~TsdbServer();
+
+    TsdbServer(const TsdbServer &) = delete;
+    TsdbServer &operator=(const TsdbServer &) = delete;
+
+    // Serve until stop() is called
+    void run();
+    // Make run() return. Safe from any thread and from a signal handler.
+    void stop();
+
+    uint16_t port() const { return bound_port; }
+
+private:
+    // One queued response. iov covers head, then any column spans.
+    struct Response
+    {
+        Response() = default;
+        Response(Response &&) = default;
+        Response &operator=(Response &&) = default;
+        Response(const Response &) = delete; // iov points into this object's buffers
+
+        std::vector<char> head; // Header plus inline payload
+        std::vector<iovec> iov;
+        RangeView view; // Lease on the spans iov points into
+        std::vector<uint64_t> timestamps; // Copied rows, when the view is not ordered
+        std::vector<double> prices;
+        std::vector<uint64_t> volumes;
+        size_t next_iov = 0; // Progress of a partial send
+        size_t iov_offset = 0;
+        // Sync: held back, with everything behind it, until the ticket is done
+        TimeSeriesDB *sync_db = nullptr;
+        uint64_t sync_ticket = 0;
+    };
+
+    struct Connection
+    {
+        int fd = -1;
+        std::vector<char> in; // Received bytes; in[in_start, in_end) unparsed
+        size_t in_start = 0;
+        size_t in_end = 0;
+        bool peer_closed = false; // Read side shut: answer what came, then close
+        std::deque<Response> out;
+        size_t syncs = 0;    // Responses in out still waiting on a sync ticket
+        uint32_t events = 0; // Interest currently registered with epoll
+    };
+
+    void accept_connections();
+    // Each returns false once the connection should be closed
+    bool on_readable(Connection &conn);
+    bool on_writable(Connection &conn);
+    bool serve(Connection &conn); // Answer buffered frames, send what fits
+    bool process_frames(Connection &conn, size_t &handled);
+    bool flush(Connection &conn);
+    void update_interest(Connection &conn);
+    void close_connection(int fd);
+    void poll_syncs(); // Send the responses of syncs that completed
+
+    Response handle(const RequestHeader &header, const char *payload);
+    Response handle_append(TimeSeriesDB &db, const char *body, size_t size);
+    Response handle_aggregate(TimeSeriesDB &db, const char *body, size_t size);
+    Response handle_stats(const std::string &symbol, const char *body, size_t size);
+    // Rows sent from the view's spans, or from a sorted copy
+    static Response rows_response(RangeView view);
+    static Response rows_response(const std::vector<std::tuple<uint64_t, double, uint64_t>> &rows);
+    // Open store for symbol, or nullptr with status NotFound or Busy
+    TimeSeriesDB *find_store(const std::string &symbol, bool create, WireStatus &status);
+
+    // Header plus size inline payload bytes; trailing more follow from iovecs
+    static Response reply(WireStatus status, const void *payload, size_t size, size_t trailing = 0);
+    static Response error(WireStatus status, const std::string &message);
+
+    TSDBManager &manager;
+    ServerOptions options;
+    int listen_fd = -1;
+    int epoll_fd = -1;
+    int wake_fd = -1; // eventfd written by stop()
+    uint16_t bound_port = 0;
+    std::unordered_map<int, std::unique_ptr<Connection>> connections;
+    std::unordered_set<int> syncing; // Connections with syncs pending
+    // Background opens by symbol; the result says whether the symbol exists
+    std::unordered_map<std::string, std::future<bool>> opening;
+};
+
+#endif // SERVER_HPP
@@ -0,0 +1,72 @@
+#include "server.hpp"
+#include "tsdb_manager.hpp"
+#include <csignal>
+#include <iostream>
+#include <string>
+
+namespace {
+TsdbServer *running_server = nullptr;
+
+void handle_signal(int) {
+    if (running_server)
+        running_server->stop();
+}
+
+void print_help() {
+    std::cout << "Usage:\n"
+              << "  tsdb_server [--bind <address>] [--port <port>] [--data-dir <dir>] [--writers <n>]\n";
+}
+}
+
+int main(int argc, char* argv[]) {
+    ServerOptions server_options;
+    ManagerOptions manager_options;
+    std::string data_dir = "tsdb_data";
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--bind" && i + 1 < argc) {
+            server_options.bind_address = argv[++i];
+        }
+        else if (arg == "--port" && i + 1 < argc) {
+            server_options.port = static_cast<uint16_t>(std::stoul(argv[++i]));
+        }
+        else if (arg == "--data-dir" && i + 1 < argc) {
+            data_dir = argv[++i];
+        }
+        else if (arg == "--writers" && i + 1 < argc) {
+            manager_options.writer_threads = std::stoull(argv[++i]);
+        }
+        else {
+            print_help();
+            return 1;
+        }
+    }
+
+    try {
+        TSDBManager manager(data_dir, manager_options);
+        TsdbServer server(manager, server_options);
+
+        running_server = &server;
+        struct sigaction action {};
+        action.sa_handler = handle_signal;
+        sigemptyset(&action.sa_mask);
+        sigaction(SIGINT, &action, nullptr);
+        sigaction(SIGTERM, &action, nullptr);
+        std::signal(SIGPIPE, SIG_IGN);
+
+        std::cout << "Serving " << data_dir << " on " << server_options.bind_address << ":" << server.port()
+                  << " (" << manager.get_writer_threads() << " writer threads)" << std::endl;
+        server.run();
+        running_server = nullptr;
+
+        // Stores flush and checkpoint as the manager closes them
+        std::cout << "Shutting down" << std::endl;
+    }
+    catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
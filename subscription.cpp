@@ -0,0 +1,87 @@
+#include "subscription.hpp"
+#include "timeseries_db.hpp"
+
+Subscription::Subscription(std::shared_ptr<SubscriberHub> hub, const TailCursor &cursor)
+    : hub(std::move(hub)),
+      cursor(cursor)
+{
+}
+
+Subscription::~Subscription()
+{
+    close();
+}
+
+void Subscription::start_dispatcher(std::function<void(const RangeView &)> callback, size_t max_rows)
+{
+    dispatcher = std::thread([this, callback = std::move(callback), max_rows]
+                             {
+                                 while (true)
+                                 {
+                                     RangeView view = next(max_rows);
+                                     if (view.empty())
+                                         break; // Closed
+                                     callback(view);
+                                 } });
+}
+
+bool Subscription::is_closed() const
+{
+    if (closed.load(std::memory_order_acquire))
+        return true;
+    std::shared_lock<std::shared_mutex> lock(hub->mutex);
+    return hub->db == nullptr;
+}
+
+void Subscription::close()
+{
+    closed.store(true, std::memory_order_release);
+    hub->signal.wake_all();
+    if (dispatcher.joinable())
+    {
+        // The callback itself may drop the last reference
+        if (dispatcher.get_id() == std::this_thread::get_id())
+            dispatcher.detach();
+        else
+            dispatcher.join();
+    }
+}
+
+RangeView Subscription::try_next(size_t max_rows)
+{
+    if (max_rows == 0 || closed.load(std::memory_order_acquire))
+        return RangeView{};
+
+    std::lock_guard<std::mutex> cursor_lock(cursor_mutex);
+    std::shared_lock<std::shared_mutex> lock(hub->mutex);
+    if (!hub->db)
+        return RangeView{};
+    bool gap = false;
+    RangeView view = hub->db->read_tail(cursor, max_rows, gap);
+    if (gap)
+        gaps.fetch_add(1, std::memory_order_relaxed);
+    return view;
+}
+
+RangeView Subscription::next(size_t max_rows)
+{
+    while (true)
+    {
+        // Re-check after announcing ourselves so a batch cannot be missed
+        uint32_t token = hub->signal.prepare_park();
+        RangeView view = try_next(max_rows);
+        if (!view.empty() || max_rows == 0 || is_closed())
+        {
+            hub->signal.cancel_park();
+            return view;
+        }
+        hub->signal.park(token);
+    }
+}
+
+size_t Subscription::lag() const
+{
+    std::lock_guard<std::mutex> cursor_lock(cursor_mutex);
+    std::shared_lock<std::shared_mutex> lock(hub->mutex);
+    return hub->db ? hub->db->tail_lag(cursor) : 0;
+}
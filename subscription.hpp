@@ -0,0 +1,90 @@
+#ifndef SUBSCRIPTION_HPP
+#define SUBSCRIPTION_HPP
+
+#include "range_view.hpp"
+#include "ring_buffer.hpp"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <thread>
+
+class TimeSeriesDB;
+
+// Position in one list of segments consumed in order: every row of the
+// segments before the one starting at start and its first row rows were
+// consumed. valid is false while the list is empty.
+struct TailPosition
+{
+    uint64_t start = 0;
+    size_t row = 0;
+    bool valid = false;
+};
+
+// Arrival-order position in the partitions, and in the out-of-order
+// segments of a store with a reorder window
+struct TailCursor
+{
+    TailPosition partitions;
+    TailPosition late;
+};
+
+// State a store shares with its subscriptions, so a subscriber can outlive
+// the store. The writer notifies signal after every batch; db goes to
+// nullptr (under mutex) when the store closes.
+struct SubscriberHub
+{
+    WakeSignal signal;
+    std::shared_mutex mutex;
+    const TimeSeriesDB *db = nullptr;
+};
+
+// Live tail of one store, created by TimeSeriesDB::subscribe(). Each
+// subscription has its own cursor: the writer never waits for a slow
+// consumer, which simply lags behind (rows stay in the columns). Views are
+// zero-copy and in arrival order, so late ticks make them unordered.
+class Subscription
+{
+public:
+    // Start position for subscribe(): only rows committed from now on
+    static constexpr uint64_t NOW = std::numeric_limits<uint64_t>::max();
+
+    ~Subscription();
+
+    Subscription(const Subscription &) = delete;
+    Subscription &operator=(const Subscription &) = delete;
+
+    // Up to max_rows rows past the cursor, advancing it. next() waits until
+    // there is at least one; both return an empty view once closed.
+    RangeView next(size_t max_rows);
+    RangeView try_next(size_t max_rows);
+
+    // Committed rows not consumed yet
+    size_t lag() const;
+    // Times retention dropped rows this subscriber had not read yet; the
+    // cursor then resumes at the oldest remaining partition
+    uint64_t get_gaps() const { return gaps.load(std::memory_order_relaxed); }
+
+    // Stop delivering: wakes next() and joins the callback thread
+    void close();
+    bool is_closed() const;
+
+private:
+    friend class TimeSeriesDB;
+
+    Subscription(std::shared_ptr<SubscriberHub> hub, const TailCursor &cursor);
+    void start_dispatcher(std::function<void(const RangeView &)> callback, size_t max_rows);
+
+    std::shared_ptr<SubscriberHub> hub;
+    mutable std::mutex cursor_mutex; // One consumer at a time
+    TailCursor cursor;
+    std::atomic<uint64_t> gaps{0};
+    std::atomic<bool> closed{false};
+    std::thread dispatcher;
+};
+
+#endif // SUBSCRIPTION_HPP
@@ -1,233 +1,2640 @@
 #include "timeseries_db.hpp"
+#include "file_util.hpp"
+#include "maintenance.hpp"
 #include <algorithm>
+#include <fstream>
 #include <iostream>
+#include <map>
 
-TimeSeriesDB::TimeSeriesDB(const std::string &data_dir, const std::string &symbol)
-    : timestamps(data_dir, symbol, "timestamps", sizeof(uint64_t)),
-      prices(data_dir, symbol, "prices", sizeof(double)),
-      volumes(data_dir, symbol, "volumes", sizeof(uint64_t))
+TimeSeriesDB::TimeSeriesDB(const std::string &data_dir, const std::string &symbol, const DBOptions &options)
+    : TimeSeriesDB(data_dir, symbol, options, nullptr)
 {
+    // Start background writer thread
+    if (!options.read_only)
+        writer_thread = std::thread(&TimeSeriesDB::writer_loop, this);
+}
+
+TimeSeriesDB::TimeSeriesDB(const std::string &data_dir, const std::string &symbol, const DBOptions &options,
+                           WakeSignal *pool_wake)
+    : data_dir(data_dir),
+      symbol(symbol),
+      symbol_dir(data_dir + "/" + symbol),
+      options(options),
+      batch_pool(options.batch_queue_capacity),
+      writer_wake(pool_wake ? pool_wake : &data_signal),
+      subscribers(std::make_shared<SubscriberHub>())
+{
+    if (this->options.writer_batch_size == 0)
+        this->options.writer_batch_size = 1;
+    if (options.read_only)
+    {
+        if (pool_wake)
+            throw std::invalid_argument("A read-only store has no writer to pool");
+        // Nothing to recover or maintain: the first query opens what the
+        // writer has on disk
+        maintenance = nullptr;
+        subscribers->db = this;
+        std::lock_guard<std::mutex> lock(segments_mutex);
+        publish_segments();
+        return;
+    }
+    maintenance = options.maintenance ? options.maintenance : &MaintenanceScheduler::global();
+
+    if (this->options.single_producer)
+        spsc_queue = std::make_unique<SpscRingBuffer<Tick>>(this->options.ring_capacity);
+    else
+        mpsc_queue = std::make_unique<MpscRingBuffer<Tick>>(this->options.ring_capacity);
+    batch_queue = std::make_unique<MpscRingBuffer<TickBatch *>>(std::max<size_t>(1, this->options.batch_queue_capacity));
+
+    // Open segments from storage (each rebuilds its index), then bring them
+    // up to date from the write-ahead log
+    recover_compaction();
+    recover();
+    open_rollups();
+
+    // Drain buffers are allocated once and reused for every batch
+    drain_buffer.resize(this->options.writer_batch_size);
+    drain_ts.resize(this->options.writer_batch_size);
+    drain_px.resize(this->options.writer_batch_size);
+    drain_vol.resize(this->options.writer_batch_size);
+    subscribers->db = this;
+    maintenance->add(this);
+}
+
+TimeSeriesDB::~TimeSeriesDB()
+{
+    if (maintenance)
+        maintenance->remove(this);
+
+    // Subscriptions may outlive the store; cut them off first
+    {
+        std::unique_lock<std::shared_mutex> lock(subscribers->mutex);
+        subscribers->db = nullptr;
+    }
+    subscribers->signal.wake_all();
+
+    if (writer_thread.joinable())
+    {
+        // Signal writer thread to stop and wait for it
+        stop_writer.store(true, std::memory_order_release);
+        data_signal.wake_all();
+        writer_thread.join();
+    }
+    else if (!options.read_only)
+    {
+        // Pooled: the pool has let go of this store, so this thread is the
+        // writer now
+        while (drain_batch())
+        {
+        }
+        finish_writer();
+    }
+
+    // Retired snapshots still reference segments; release them before the
+    // segments close so their indexes are persisted now, not whenever the
+    // epoch domain next collects
+    EpochDomain::global().retire(read_snapshot.exchange(nullptr, std::memory_order_acq_rel));
+    EpochDomain::global().synchronize();
+}
+
+size_t TimeSeriesDB::enqueue(const Tick *ticks, size_t count)
+{
+    return spsc_queue ? spsc_queue->try_push_bulk(ticks, count) : mpsc_queue->try_push_bulk(ticks, count);
+}
+
+size_t TimeSeriesDB::dequeue(Tick *out, size_t max)
+{
+    return spsc_queue ? spsc_queue->pop_bulk(out, max) : mpsc_queue->pop_bulk(out, max);
+}
+
+bool TimeSeriesDB::queue_empty() const
+{
+    return (spsc_queue ? spsc_queue->empty() : mpsc_queue->empty()) && batch_queue->empty();
+}
+
+BatchPool::BatchPool(size_t max_free) : max_free(max_free)
+{
+    free_batches.reserve(max_free);
+}
+
+std::unique_ptr<TickBatch> BatchPool::acquire()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!free_batches.empty())
+        {
+            auto batch = std::move(free_batches.back());
+            free_batches.pop_back();
+            return batch;
+        }
+    }
+    return std::make_unique<TickBatch>();
+}
+
+void BatchPool::release(std::unique_ptr<TickBatch> batch)
+{
+    batch->clear();
+    std::lock_guard<std::mutex> lock(mutex);
+    if (free_batches.size() < max_free)
+        free_batches.push_back(std::move(batch));
+}
+
+bool TimeSeriesDB::append(uint64_t timestamp, double price, uint64_t volume)
+{
+    Tick tick{timestamp, price, volume};
+    return append_batch_impl(&tick, 1) == 1;
+}
+
+size_t TimeSeriesDB::append_batch(const std::vector<Tick> &ticks)
+{
+    return append_batch_impl(ticks.data(), ticks.size());
+}
+
+size_t TimeSeriesDB::append_batch_impl(const Tick *ticks, size_t count)
+{
+    check_writable();
+    uint64_t started = metrics_now();
+
+    // Count the ticks as pending up front; rejected ones are taken back below
+    pending_writes.fetch_add(count, std::memory_order_acq_rel);
+
+    size_t accepted = 0;
+    while (accepted < count)
+    {
+        size_t pushed = enqueue(ticks + accepted, count - accepted);
+        accepted += pushed;
+        if (pushed > 0)
+        {
+            if constexpr (metrics_enabled)
+            {
+                Metrics::global().ticks_appended.add(pushed);
+                uint64_t position = accepted_ticks.fetch_add(pushed, std::memory_order_relaxed) + pushed;
+                durability_probe.enqueued(position, started);
+            }
+            writer_wake->notify();
+            continue;
+        }
+
+        // Ring is full
+        if (options.backpressure == BackpressurePolicy::Block)
+        {
+            wait_for_space();
+            continue;
+        }
+        if (options.backpressure == BackpressurePolicy::Drop)
+        {
+            dropped_ticks.fetch_add(count - accepted, std::memory_order_relaxed);
+        }
+        break;
+    }
+
+    if (accepted < count)
+    {
+        pending_writes.fetch_sub(count - accepted, std::memory_order_acq_rel);
+    }
+    return accepted;
+}
+
+bool TimeSeriesDB::append_columns(std::unique_ptr<TickBatch> &&batch)
+{
+    return enqueue_columns(batch, options.backpressure);
+}
+
+bool TimeSeriesDB::try_append_columns(std::unique_ptr<TickBatch> &&batch)
+{
+    BackpressurePolicy policy = options.backpressure;
+    return enqueue_columns(batch, policy == BackpressurePolicy::Block ? BackpressurePolicy::Fail : policy);
+}
+
+bool TimeSeriesDB::enqueue_columns(std::unique_ptr<TickBatch> &batch, BackpressurePolicy policy)
+{
+    check_writable();
+    size_t n = batch->size();
+    if (batch->prices.size() != n || batch->volumes.size() != n)
+        throw std::invalid_argument("TickBatch columns differ in length");
+    if (n == 0)
+    {
+        batch_pool.release(std::move(batch));
+        return true;
+    }
+    uint64_t started = metrics_now();
+    pending_writes.fetch_add(n, std::memory_order_acq_rel);
+
+    // The writer may apply and recycle the batch as soon as it is queued
+    TickBatch *queued = batch.get();
+    while (!batch_queue->try_push(queued))
+    {
+        if (policy == BackpressurePolicy::Block)
+        {
+            wait_for_space(&TimeSeriesDB::batch_queue_full);
+            continue;
+        }
+        pending_writes.fetch_sub(n, std::memory_order_acq_rel);
+        if (policy == BackpressurePolicy::Drop)
+        {
+            dropped_ticks.fetch_add(n, std::memory_order_relaxed);
+            batch_pool.release(std::move(batch));
+        }
+        return false;
+    }
+    batch.release();
+
+    if constexpr (metrics_enabled)
+    {
+        Metrics::global().ticks_appended.add(n);
+        uint64_t position = accepted_ticks.fetch_add(n, std::memory_order_relaxed) + n;
+        durability_probe.enqueued(position, started);
+    }
+    writer_wake->notify();
+    return true;
+}
+
+void TimeSeriesDB::bulk_append(const uint64_t *ts, const double *px, const uint64_t *vol, size_t n)
+{
+    if (n == 0)
+        return;
+    BulkJob job{ts, px, vol, n, false, nullptr};
+    submit_bulk(job);
+}
+
+void TimeSeriesDB::end_bulk_load()
+{
+    BulkJob job{nullptr, nullptr, nullptr, 0, true, nullptr};
+    submit_bulk(job);
+}
+
+void TimeSeriesDB::submit_bulk(BulkJob &job)
+{
+    check_writable();
+    std::lock_guard<std::mutex> lock(bulk_mutex);
+    bulk_job.store(&job, std::memory_order_release);
+    writer_wake->notify();
+    bulk_job.wait(&job, std::memory_order_acquire);
+    if (job.error)
+        std::rethrow_exception(job.error);
+}
+
+void TimeSeriesDB::check_writable() const
+{
+    if (options.read_only)
+    {
+        throw std::runtime_error("Cannot write to read-only store " + symbol_dir);
+    }
+}
+
+bool TimeSeriesDB::queue_full() const
+{
+    return spsc_queue ? spsc_queue->size_approx() >= spsc_queue->capacity()
+                      : mpsc_queue->size_approx() >= mpsc_queue->capacity();
+}
+
+bool TimeSeriesDB::batch_queue_full() const
+{
+    return batch_queue->size_approx() >= batch_queue->capacity();
+}
+
+void TimeSeriesDB::wait_for_space(bool (TimeSeriesDB::*full)() const)
+{
+    // Short spin first: the writer usually frees a whole batch at once
+    for (size_t i = 0; i < options.spin_iterations; ++i)
+    {
+        cpu_relax();
+        if (!(this->*full)())
+            return;
+    }
+
+    uint32_t token = space_signal.prepare_park();
+    if (!(this->*full)())
+    {
+        space_signal.cancel_park();
+        return;
+    }
+    space_signal.park(token);
+}
+
+void TimeSeriesDB::wait_for_data()
+{
+    if (options.wait_mode == ConsumerWaitMode::BusyPoll)
+    {
+        cpu_relax();
+        return;
+    }
+
+    if (options.wait_mode == ConsumerWaitMode::SpinThenPark)
+    {
+        for (size_t i = 0; i < options.spin_iterations; ++i)
+        {
+            if (!queue_empty() || has_writer_request() || stop_writer.load(std::memory_order_acquire))
+                return;
+            cpu_relax();
+        }
+    }
+
+    // Re-check after announcing ourselves so a concurrent push cannot be missed
+    uint32_t token = data_signal.prepare_park();
+    if (!queue_empty() || has_writer_request() || stop_writer.load(std::memory_order_acquire))
+    {
+        data_signal.cancel_park();
+        return;
+    }
+    data_signal.park(token);
+}
+
+void TimeSeriesDB::writer_loop()
+{
+    while (true)
+    {
+        if (bulk_step() || sync_step() || drain_batch())
+            continue;
+        if (stop_writer.load(std::memory_order_acquire))
+        {
+            // Drain whatever producers published before the stop flag
+            if (drain_batch())
+                continue;
+            break;
+        }
+        if (idle_work())
+            continue;
+        wait_for_data();
+    }
+    finish_writer();
+}
+
+bool TimeSeriesDB::writer_step()
+{
+    return bulk_step() || sync_step() || drain_batch() || idle_work();
+}
+
+bool TimeSeriesDB::has_writer_work() const
+{
+    return !queue_empty() || has_writer_request() || (wal && wal->has_unsynced());
+}
+
+bool TimeSeriesDB::has_writer_request() const
+{
+    return bulk_job.load(std::memory_order_acquire) ||
+           sync_requested.load(std::memory_order_acquire) != sync_completed.load(std::memory_order_acquire);
+}
+
+bool TimeSeriesDB::drain_batch()
+{
+    size_t depth = metrics_enabled ? (spsc_queue ? spsc_queue->size_approx() : mpsc_queue->size_approx()) : 0;
+    size_t batch_size = dequeue(drain_buffer.data(), drain_buffer.size());
+    if (batch_size > 0)
+    {
+        Metrics &metrics = Metrics::global();
+        metrics.queue_depth.record(depth);
+        metrics.writer_batch_size.record(batch_size);
+        metrics.writer_batches.add();
+        metrics.ticks_written.add(batch_size);
+        drained_ticks += batch_size;
+
+        // Slots are free again; wake any producer blocked on a full ring
+        space_signal.notify();
+        write_batch(drain_buffer.data(), batch_size);
+    }
+    if (!drain_columns() && batch_size == 0)
+        return false;
+    if (!wal)
+        durability_probe.durable(drained_ticks); // Applied is as durable as it gets
+
+    if (wal && (std::chrono::steady_clock::now() - last_checkpoint >=
+                    std::chrono::milliseconds(options.checkpoint_interval_ms) ||
+                wal->size_bytes() >= options.wal_max_bytes))
+    {
+        std::lock_guard<std::mutex> lock(segments_mutex);
+        write_checkpoint();
+    }
+    return true;
+}
+
+bool TimeSeriesDB::bulk_step()
+{
+    BulkJob *job = bulk_job.load(std::memory_order_acquire);
+    if (!job)
+        return false;
+    try
+    {
+        apply_bulk(*job);
+    }
+    catch (...)
+    {
+        job->error = std::current_exception();
+    }
+    bulk_job.store(nullptr, std::memory_order_release);
+    bulk_job.notify_all();
+    return true;
+}
+
+bool TimeSeriesDB::sync_step()
+{
+    uint64_t completed = sync_completed.load(std::memory_order_relaxed);
+    if (sync_ticket == completed)
+    {
+        uint64_t requested = sync_requested.load(std::memory_order_acquire);
+        if (requested == completed)
+            return false;
+        // Whatever was accepted before the request sits below these positions
+        sync_ticket = requested;
+        sync_ring_target = spsc_queue ? spsc_queue->pushed() : mpsc_queue->pushed();
+        sync_batch_target = batch_queue->pushed();
+    }
+    size_t ring_popped = spsc_queue ? spsc_queue->popped() : mpsc_queue->popped();
+    if (ring_popped < sync_ring_target || batch_queue->popped() < sync_batch_target)
+        return false;
+
+    // Popped means applied: drain_batch() writes what it takes before returning
+    if (options.reorder_window != 0)
+    {
+        {
+            TimedLock lock(segments_mutex);
+            flush_staged(staged.size());
+            if (!segments.empty())
+                segments.back()->flush_headers();
+        }
+        subscribers->signal.notify();
+    }
+    sync_completed.store(sync_ticket, std::memory_order_release);
+    sync_completed.notify_all();
+    return true;
+}
+
+bool TimeSeriesDB::idle_work()
+{
+    // The ring drained: commit whatever the group collected
+    if (!wal || !wal->has_unsynced())
+        return false;
+    sync_wal();
+    return true;
+}
+
+void TimeSeriesDB::sync_wal()
+{
+    // Everything drained so far was logged before it was applied
+    wal->sync();
+    Metrics::global().wal_syncs.add();
+    durability_probe.durable(drained_ticks);
+}
+
+void TimeSeriesDB::finish_writer()
+{
+    std::lock_guard<std::mutex> lock(segments_mutex);
+    // Clean shutdown empties the reorder window...
+    flush_staged(staged.size());
+    if (!segments.empty())
+        segments.back()->flush_headers();
+    if (wal)
+    {
+        // ... and leaves an empty WAL behind
+        sync_wal();
+        write_checkpoint();
+    }
+    // Nothing accepted is left unapplied: release any sync() still waiting
+    sync_completed.store(sync_requested.load(std::memory_order_acquire), std::memory_order_release);
+    sync_completed.notify_all();
+}
+
+bool TimeSeriesDB::drain_columns()
+{
+    TickBatch *queued;
+    if (!batch_queue->try_pop(queued))
+        return false;
+    std::unique_ptr<TickBatch> batch(queued);
+    space_signal.notify();
+
+    size_t n = batch->size();
+    Metrics &metrics = Metrics::global();
+    metrics.writer_batch_size.record(n);
+    metrics.writer_batches.add();
+    metrics.ticks_written.add(n);
+    drained_ticks += n;
+
+    // Chunked like ring batches, so WAL records and lock holds stay bounded
+    for (size_t i = 0; i < n; i += options.writer_batch_size)
+    {
+        size_t chunk = std::min(options.writer_batch_size, n - i);
+        write_columns(batch->timestamps.data() + i, batch->prices.data() + i, batch->volumes.data() + i, chunk);
+    }
+    batch_pool.release(std::move(batch));
+    return true;
+}
+
+void TimeSeriesDB::write_batch(const Tick *batch, size_t batch_size)
+{
+    // Split the rows into the reused column scratch
+    for (size_t i = 0; i < batch_size; ++i)
+    {
+        drain_ts[i] = batch[i].timestamp;
+        drain_px[i] = batch[i].price;
+        drain_vol[i] = batch[i].volume;
+    }
+    write_columns(drain_ts.data(), drain_px.data(), drain_vol.data(), batch_size);
+}
+
+void TimeSeriesDB::write_columns(const uint64_t *ts, const double *px, const uint64_t *vol, size_t batch_size)
+{
+    uint64_t first_seq = next_seq;
+    next_seq += batch_size;
+
+    if (wal)
+    {
+        // Log before applying: one record and at most one fdatasync per batch
+        wal->append(first_seq, ts, px, vol, batch_size);
+        logged_seq = first_seq + batch_size - 1;
+        if (options.durability == DurabilityMode::BatchFsync ||
+            std::chrono::steady_clock::now() - wal->last_sync() >= std::chrono::milliseconds(options.fsync_interval_ms))
+        {
+            sync_wal();
+        }
+    }
+
+    // Process batch - ensure all columns stay synchronized
+    {
+        // Keeps retention and the compression swap off the segment list.
+        // Readers do not wait: each segment publishes its rows once they
+        // are written and indexed.
+        TimedLock lock(segments_mutex);
+
+        route_batch(first_seq, ts, px, vol, batch_size);
+
+        // Flush headers to ensure persistence. The reorder window may still
+        // hold every tick of a new store, with no partition yet.
+        if (!segments.empty())
+            segments.back()->flush_headers();
+        if (!late_segments.empty() && !late_segments.back()->is_sealed())
+            late_segments.back()->flush_headers();
+
+        // Verify synchronization (debug check)
+        if (!segments.empty() && !segments.back()->verify_column_sync())
+        {
+            std::cerr << "ERROR: Columns became desynchronized during batch write!" << std::endl;
+        }
+    }
+
+    // The rows are published; wake subscribers waiting for them
+    subscribers->signal.notify();
+
+    pending_writes.fetch_sub(batch_size, std::memory_order_acq_rel);
+}
+
+void TimeSeriesDB::apply_batch(uint64_t first_seq, const uint64_t *ts, const double *px, const uint64_t *vol, size_t n)
+{
+    // Split the batch into runs that land in the same partition. Late
+    // ticks for an already sealed partition stay in the active segment,
+    // whose min/max timestamp bounds widen to cover them.
+    size_t run_start = 0;
+    while (run_start < n)
+    {
+        Segment &segment = active_segment_for(ts[run_start]);
+        size_t run_end = run_start + 1;
+        while (run_end < n && ts[run_end] < segment.get_partition_end())
+        {
+            ++run_end;
+        }
+
+        segment.append_batch(ts + run_start, px + run_start, vol + run_start, run_end - run_start);
+        if (!rollups.empty())
+        {
+            std::unique_lock<std::shared_mutex> lock(rollup_mutex);
+            for (auto &rollup : rollups)
+            {
+                rollup->add(ts + run_start, px + run_start, vol + run_start, run_end - run_start);
+                rollup->set_cursor(segment.get_partition_start(), segment.get_count());
+            }
+        }
+        if (first_seq != 0)
+            applied_seq = first_seq + run_end - 1;
+        run_start = run_end;
+    }
+}
+
+void TimeSeriesDB::route_batch(uint64_t first_seq, const uint64_t *ts, const double *px, const uint64_t *vol,
+                               size_t n)
+{
+    if (options.reorder_window == 0)
+    {
+        apply_batch(first_seq, ts, px, vol, n);
+        return;
+    }
+    // Staged ticks count as applied: checkpoints save them
+    stage_batch(ts, px, vol, n);
+    applied_seq = first_seq + n - 1;
+}
+
+void TimeSeriesDB::stage_batch(const uint64_t *ts, const double *px, const uint64_t *vol, size_t n)
+{
+    // Ticks older than what the partitions hold are past the window
+    stage_incoming.clear();
+    scratch_ts.clear();
+    scratch_px.clear();
+    scratch_vol.clear();
+    for (size_t i = 0; i < n; ++i)
+    {
+        if (ts[i] < flushed_max)
+        {
+            scratch_ts.push_back(ts[i]);
+            scratch_px.push_back(px[i]);
+            scratch_vol.push_back(vol[i]);
+        }
+        else
+        {
+            stage_incoming.push_back(Tick{ts[i], px[i], vol[i]});
+        }
+    }
+    if (!scratch_ts.empty())
+        apply_late(scratch_ts.data(), scratch_px.data(), scratch_vol.data(), scratch_ts.size());
+
+    if (!stage_incoming.empty())
+    {
+        auto by_time = [](const Tick &a, const Tick &b)
+        { return a.timestamp < b.timestamp; };
+        std::stable_sort(stage_incoming.begin(), stage_incoming.end(), by_time);
+
+        // In-order arrivals append; late ones only merge with the staged
+        // ticks they overtake
+        auto tail = std::upper_bound(staged.begin() + staged_head, staged.end(), stage_incoming.front(), by_time);
+        if (tail == staged.end())
+        {
+            staged.insert(staged.end(), stage_incoming.begin(), stage_incoming.end());
+        }
+        else
+        {
+            size_t at = static_cast<size_t>(tail - staged.begin());
+            stage_merged.clear();
+            std::merge(tail, staged.end(), stage_incoming.begin(), stage_incoming.end(),
+                       std::back_inserter(stage_merged), by_time);
+            staged.resize(at);
+            staged.insert(staged.end(), stage_merged.begin(), stage_merged.end());
+        }
+    }
+
+    // Everything more than the window behind the newest tick is final
+    if (staged_head < staged.size() && staged.back().timestamp > options.reorder_window)
+    {
+        Tick cutoff{staged.back().timestamp - options.reorder_window, 0.0, 0};
+        auto until = std::lower_bound(staged.begin() + staged_head, staged.end(), cutoff,
+                                      [](const Tick &a, const Tick &b)
+                                      { return a.timestamp < b.timestamp; });
+        flush_staged(static_cast<size_t>(until - staged.begin()));
+    }
+    staged_count.store(staged.size() - staged_head, std::memory_order_relaxed);
+}
+
+void TimeSeriesDB::flush_staged(size_t until)
+{
+    if (until <= staged_head)
+        return;
+
+    size_t n = until - staged_head;
+    scratch_ts.resize(n);
+    scratch_px.resize(n);
+    scratch_vol.resize(n);
+    for (size_t i = 0; i < n; ++i)
+    {
+        const Tick &tick = staged[staged_head + i];
+        scratch_ts[i] = tick.timestamp;
+        scratch_px[i] = tick.price;
+        scratch_vol[i] = tick.volume;
+    }
+    apply_batch(0, scratch_ts.data(), scratch_px.data(), scratch_vol.data(), n);
+    flushed_max = std::max(flushed_max, scratch_ts[n - 1]);
+
+    // Drop the written prefix once it outweighs the rest
+    staged_head = until;
+    if (staged_head == staged.size())
+    {
+        staged.clear();
+        staged_head = 0;
+    }
+    else if (staged_head > staged.size() / 2)
+    {
+        staged.erase(staged.begin(), staged.begin() + static_cast<std::ptrdiff_t>(staged_head));
+        staged_head = 0;
+    }
+    staged_count.store(staged.size() - staged_head, std::memory_order_relaxed);
+}
+
+void TimeSeriesDB::apply_late(const uint64_t *ts, const double *px, const uint64_t *vol, size_t n)
+{
+    if (late_segments.empty() || late_segments.back()->is_sealed())
+    {
+        // Numbered like partitions, from 1; recovery drops the ones opened
+        // after the last checkpoint and replays their ticks
+        uint64_t number = late_segments.empty() ? 1 : late_segments.back()->get_partition_start() + 1;
+        late_segments.push_back(std::make_shared<Segment>(symbol_dir, late_name(number), number, number + 1,
+                                                          OpenMode::ReadWrite, options.segment));
+        publish_segments();
+    }
+
+    Segment &segment = *late_segments.back();
+    segment.append_batch(ts, px, vol, n);
+    if (!rollups.empty())
+    {
+        std::unique_lock<std::shared_mutex> lock(rollup_mutex);
+        for (auto &rollup : rollups)
+        {
+            rollup->add(ts, px, vol, n);
+            rollup->set_late_cursor(segment.get_partition_start(), segment.get_count());
+        }
+    }
+    Metrics::global().late_ticks.add(n);
+}
+
+void TimeSeriesDB::apply_bulk(const BulkJob &job)
+{
+    {
+        TimedLock lock(segments_mutex);
+        // Bulk rows bypass the reorder window: empty it first, and late
+        // rows within the load stay in their partition
+        if (options.reorder_window != 0)
+            flush_staged(staged.size());
+
+        size_t run_start = 0;
+        while (run_start < job.n)
+        {
+            // Same routing as apply_batch, minus indexing and publishing
+            Segment &segment = active_segment_for(job.ts[run_start]);
+            size_t run_end = run_start + 1;
+            while (run_end < job.n && job.ts[run_end] < segment.get_partition_end())
+            {
+                ++run_end;
+            }
+
+            size_t rows = segment.append_unindexed(job.ts + run_start, job.px + run_start, job.vol + run_start,
+                                                   run_end - run_start);
+            flushed_max = std::max(flushed_max, *std::max_element(job.ts + run_start, job.ts + run_end));
+            if (!rollups.empty())
+            {
+                std::unique_lock<std::shared_mutex> rollup_lock(rollup_mutex);
+                for (auto &rollup : rollups)
+                {
+                    rollup->add(job.ts + run_start, job.px + run_start, job.vol + run_start, run_end - run_start);
+                    rollup->set_cursor(segment.get_partition_start(), rows);
+                }
+            }
+            run_start = run_end;
+        }
+
+        if (job.finish && !segments.empty())
+        {
+            segments.back()->index_pending();
+            segments.back()->flush_headers();
+            if (wal)
+                write_checkpoint();
+        }
+    }
+
+    // Rolled-over partitions and, at the end, the last one are published
+    subscribers->signal.notify();
+}
+
+void TimeSeriesDB::write_checkpoint()
+{
+    // Sealed segments were synced when they rolled over; only the active one
+    // can hold rows that are not yet on stable storage
+    WalCheckpoint checkpoint;
+    checkpoint.applied_seq = applied_seq;
+    if (!segments.empty())
+    {
+        Segment &active = *segments.back();
+        active.sync();
+        checkpoint.active_partition = active.get_partition_start();
+        checkpoint.active_rows = active.get_count();
+    }
+    if (!late_segments.empty())
+    {
+        Segment &late = *late_segments.back();
+        if (!late.is_sealed())
+            late.sync();
+        checkpoint.late_segment = late.get_partition_start();
+        checkpoint.late_rows = late.get_count();
+    }
+    checkpoint_late = checkpoint.late_segment;
+    // The reorder window holds logged ticks that are in no column yet
+    for (size_t i = staged_head; i < staged.size(); ++i)
+    {
+        checkpoint.staged_ts.push_back(staged[i].timestamp);
+        checkpoint.staged_px.push_back(staged[i].price);
+        checkpoint.staged_vol.push_back(staged[i].volume);
+    }
+    checkpoint.save(symbol_dir + "/" + WalCheckpoint::FILE_NAME);
+    Metrics::global().checkpoints.add();
+
+    // A rollover mid-batch checkpoints before the rest of the logged batch
+    // is applied; keep the log until it is fully covered
+    if (applied_seq == logged_seq)
+        wal->reset();
+    last_checkpoint = std::chrono::steady_clock::now();
+}
+
+void TimeSeriesDB::recover()
+{
+    std::string checkpoint_path = symbol_dir + "/" + WalCheckpoint::FILE_NAME;
+    std::string wal_path = symbol_dir + "/" + WriteAheadLog::FILE_NAME;
+
+    WalCheckpoint checkpoint;
+    bool have_checkpoint = WalCheckpoint::load(checkpoint_path, checkpoint);
+    if (!have_checkpoint && std::filesystem::exists(wal_path) && std::filesystem::file_size(wal_path) > 0)
+    {
+        // Without a checkpoint there is no telling which records were applied
+        std::cerr << "WARNING: Discarding write-ahead log without a checkpoint in " << symbol_dir << std::endl;
+        std::filesystem::remove(wal_path);
+    }
+
+    if (have_checkpoint)
+    {
+        // Everything after the checkpoint is rebuilt from the log: cut the
+        // active partition back and drop partitions opened after it
+        if (options.partition_duration == 0)
+        {
+            rows_rewritten |= Segment::truncate_rows(data_dir, symbol, checkpoint.active_rows);
+        }
+        else if (std::filesystem::exists(symbol_dir))
+        {
+            for (const auto &entry : std::filesystem::directory_iterator(symbol_dir))
+            {
+                std::string name = entry.path().filename().string();
+                if (!entry.is_directory() || name.rfind("part_", 0) != 0)
+                    continue;
+                uint64_t start;
+                try
+                {
+                    start = std::stoull(name.substr(5));
+                }
+                catch (const std::exception &)
+                {
+                    continue;
+                }
+                if (start > checkpoint.active_partition)
+                {
+                    std::filesystem::remove_all(entry.path());
+                    rows_rewritten = true;
+                }
+                else if (start == checkpoint.active_partition)
+                {
+                    rows_rewritten |= Segment::truncate_rows(symbol_dir, name, checkpoint.active_rows);
+                }
+            }
+        }
+
+        // Out-of-order segments likewise, against the one the checkpoint names
+        if (std::filesystem::exists(symbol_dir))
+        {
+            for (const auto &entry : std::filesystem::directory_iterator(symbol_dir))
+            {
+                std::string name = entry.path().filename().string();
+                if (!entry.is_directory() || name.rfind("late_", 0) != 0)
+                    continue;
+                uint64_t number;
+                try
+                {
+                    number = std::stoull(name.substr(5));
+                }
+                catch (const std::exception &)
+                {
+                    continue;
+                }
+                if (number > checkpoint.late_segment)
+                {
+                    std::filesystem::remove_all(entry.path());
+                    rows_rewritten = true;
+                }
+                else if (number == checkpoint.late_segment)
+                {
+                    rows_rewritten |= Segment::truncate_rows(symbol_dir, name, checkpoint.late_rows);
+                }
+            }
+        }
+    }
+
+    open_segments();
+    open_late_segments();
+    {
+        std::lock_guard<std::mutex> lock(segments_mutex);
+        for (const auto &segment : segments)
+        {
+            if (segment->get_count() > 0)
+                flushed_max = std::max(flushed_max, segment->get_max_ts());
+        }
+        if (have_checkpoint && !checkpoint.staged_ts.empty())
+        {
+            if (options.reorder_window != 0)
+            {
+                // The reorder window as of the checkpoint, still sorted
+                for (size_t i = 0; i < checkpoint.staged_ts.size(); ++i)
+                    staged.push_back(Tick{checkpoint.staged_ts[i], checkpoint.staged_px[i], checkpoint.staged_vol[i]});
+                staged_count.store(staged.size(), std::memory_order_relaxed);
+            }
+            else
+            {
+                // The window is off now: its ticks go straight to the partitions
+                apply_batch(0, checkpoint.staged_ts.data(), checkpoint.staged_px.data(), checkpoint.staged_vol.data(),
+                            checkpoint.staged_ts.size());
+                rows_rewritten = true;
+            }
+        }
+    }
+
+    std::unique_ptr<WriteAheadLog> log;
+    if (have_checkpoint || options.durability != DurabilityMode::None)
+        log = std::make_unique<WriteAheadLog>(wal_path);
+
+    applied_seq = have_checkpoint ? checkpoint.applied_seq : 0;
+    if (have_checkpoint)
+    {
+        std::lock_guard<std::mutex> lock(segments_mutex);
+        size_t replayed = 0;
+        uint64_t last = log->replay(
+            [&](uint64_t first_seq, const uint64_t *ts, const double *px, const uint64_t *vol, size_t n)
+            {
+                // Records may straddle the checkpoint after a mid-batch rollover
+                if (first_seq + n - 1 <= applied_seq)
+                    return;
+                size_t skip = first_seq > applied_seq ? 0 : static_cast<size_t>(applied_seq - first_seq + 1);
+                route_batch(first_seq + skip, ts + skip, px + skip, vol + skip, n - skip);
+                replayed += n - skip;
+            });
+        applied_seq = std::max(applied_seq, last);
+        rows_rewritten |= (replayed > 0);
+
+        // A reopened store shows every tick it recovered; the checkpoint
+        // keeps the window until the next one is written
+        flush_staged(staged.size());
+        if (replayed > 0 && !segments.empty())
+        {
+            segments.back()->flush_headers();
+            if (!late_segments.empty() && !late_segments.back()->is_sealed())
+                late_segments.back()->flush_headers();
+            std::cerr << "Recovered " << replayed << " ticks from the write-ahead log of " << symbol << std::endl;
+        }
+    }
+    next_seq = applied_seq + 1;
+    logged_seq = applied_seq;
+
+    if (options.durability == DurabilityMode::None)
+    {
+        // Not logging from here on; a stale checkpoint would truncate rows
+        // written without a WAL the next time durability is enabled
+        if (have_checkpoint && !segments.empty())
+        {
+            std::lock_guard<std::mutex> lock(segments_mutex);
+            segments.back()->sync();
+            if (!late_segments.empty() && !late_segments.back()->is_sealed())
+                late_segments.back()->sync();
+        }
+        log.reset();
+        std::filesystem::remove(wal_path);
+        std::filesystem::remove(checkpoint_path);
+        return;
+    }
+
+    wal = std::move(log);
+    std::lock_guard<std::mutex> lock(segments_mutex);
+    write_checkpoint();
+}
+
+uint64_t TimeSeriesDB::partition_start_for(uint64_t timestamp) const
+{
+    if (options.partition_duration == 0)
+        return 0;
+    return timestamp - (timestamp % options.partition_duration);
+}
+
+namespace
+{
+    // Zero-padded so directory listings sort chronologically
+    std::string zero_padded(uint64_t value)
+    {
+        std::string digits = std::to_string(value);
+        return std::string(20 - std::min<size_t>(20, digits.size()), '0') + digits;
+    }
+}
+
+std::string TimeSeriesDB::partition_name(uint64_t partition_start) const
+{
+    return "part_" + zero_padded(partition_start);
+}
+
+std::string TimeSeriesDB::late_name(uint64_t number) const
+{
+    return "late_" + zero_padded(number);
+}
+
+Segment &TimeSeriesDB::active_segment_for(uint64_t timestamp)
+{
+    if (!segments.empty() && timestamp < segments.back()->get_partition_end())
+    {
+        return *segments.back();
+    }
+
+    // Roll over: seal the current partition and start a new one
+    if (!segments.empty())
+    {
+        segments.back()->flush_headers();
+        segments.back()->seal();
+        if (options.segment.compression != Compression::None)
+            pending_compression.push_back(segments.back());
+        maintenance->wake(this);
+    }
+
+    uint64_t start = partition_start_for(timestamp);
+    segments.push_back(std::make_shared<Segment>(symbol_dir, partition_name(start), start,
+                                                 start + options.partition_duration, OpenMode::ReadWrite, options.segment));
+    publish_segments();
+
+    // The checkpoint must name the new active partition before any row
+    // lands in it, or recovery would not know to truncate it. The reorder
+    // window is mid-flush here and cannot be saved; recovery drops the new
+    // partition instead and replays its ticks from the last checkpoint.
+    if (wal && options.reorder_window == 0)
+        write_checkpoint();
+    return *segments.back();
+}
+
+void TimeSeriesDB::publish_segments()
+{
+    const ReadSnapshot *previous =
+        read_snapshot.exchange(new ReadSnapshot{segments, late_segments}, std::memory_order_acq_rel);
+    if (previous)
+        EpochDomain::global().retire(previous);
+}
+
+const TimeSeriesDB::ReadSnapshot &TimeSeriesDB::snapshot() const
+{
+    return *read_snapshot.load(std::memory_order_acquire);
+}
+
+void TimeSeriesDB::open_segments()
+{
+    std::lock_guard<std::mutex> lock(segments_mutex);
+
+    if (options.partition_duration == 0)
+    {
+        // Legacy layout: the column files sit directly in the symbol directory
+        segments.push_back(std::make_shared<Segment>(data_dir, symbol, 0, std::numeric_limits<uint64_t>::max(),
+                                                     OpenMode::ReadWrite, options.segment));
+        publish_segments();
+        return;
+    }
+
+    std::filesystem::create_directories(symbol_dir);
+
+    std::vector<std::pair<uint64_t, std::string>> partitions;
+    for (const auto &entry : std::filesystem::directory_iterator(symbol_dir))
+    {
+        std::string name = entry.path().filename().string();
+        if (!entry.is_directory() || name.rfind("part_", 0) != 0)
+            continue;
+        try
+        {
+            partitions.emplace_back(std::stoull(name.substr(5)), name);
+        }
+        catch (const std::exception &)
+        {
+            std::cerr << "WARNING: Ignoring unrecognised partition directory " << entry.path() << std::endl;
+        }
+    }
+    std::sort(partitions.begin(), partitions.end());
+
+    for (size_t i = 0; i < partitions.size(); ++i)
+    {
+        const auto &[start, name] = partitions[i];
+        uint64_t end = start + options.partition_duration;
+        bool is_last = (i + 1 == partitions.size());
+
+        if (Segment::has_seal_marker(symbol_dir + "/" + name))
+        {
+            auto segment = std::make_shared<Segment>(symbol_dir, name, start, end, OpenMode::ReadOnly, options.segment);
+            if (segment->is_compressed())
+                segment->remove_raw_files(); // Crashed before removing them
+            else if (options.segment.compression != Compression::None)
+                pending_compression.push_back(segment);
+            segments.push_back(std::move(segment));
+            continue;
+        }
+
+        auto segment = std::make_shared<Segment>(symbol_dir, name, start, end, OpenMode::ReadWrite, options.segment);
+        if (!is_last)
+        {
+            // Crashed between rolling over and sealing: finish the job now
+            segment->seal();
+            if (options.segment.compression != Compression::None)
+                pending_compression.push_back(segment);
+        }
+        segments.push_back(std::move(segment));
+    }
+    publish_segments();
+}
+
+void TimeSeriesDB::open_late_segments()
+{
+    std::lock_guard<std::mutex> lock(segments_mutex);
+    if (!std::filesystem::exists(symbol_dir))
+        return;
+
+    std::vector<std::pair<uint64_t, std::string>> found;
+    for (const auto &entry : std::filesystem::directory_iterator(symbol_dir))
+    {
+        std::string name = entry.path().filename().string();
+        if (!entry.is_directory() || name.rfind("late_", 0) != 0)
+            continue;
+        try
+        {
+            found.emplace_back(std::stoull(name.substr(5)), name);
+        }
+        catch (const std::exception &)
+        {
+            std::cerr << "WARNING: Ignoring unrecognised out-of-order directory " << entry.path() << std::endl;
+        }
+    }
+    if (found.empty())
+        return;
+    std::sort(found.begin(), found.end());
+
+    for (size_t i = 0; i < found.size(); ++i)
+    {
+        const auto &[number, name] = found[i];
+        bool sealed = Segment::has_seal_marker(symbol_dir + "/" + name);
+        auto segment = std::make_shared<Segment>(symbol_dir, name, number, number + 1,
+                                                 sealed ? OpenMode::ReadOnly : OpenMode::ReadWrite, options.segment);
+        if (!sealed && i + 1 < found.size())
+            segment->seal(); // Only the last one takes new ticks
+        late_segments.push_back(std::move(segment));
+    }
+    publish_segments();
+}
+
+namespace
+{
+    int64_t steady_ns()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                   std::chrono::steady_clock::now().time_since_epoch())
+            .count();
+    }
+}
+
+void TimeSeriesDB::follow_writer() const
+{
+    if (!options.read_only)
+        return;
+    // Logically const: only this reader's view of the files moves forward
+    auto *self = const_cast<TimeSeriesDB *>(this);
+    if (steady_ns() >= next_refresh_ns.load(std::memory_order_relaxed))
+        self->refresh_from_disk(false);
+
+    // Sealed segments cannot grow: only the newest of each list takes rows
+    EpochGuard guard;
+    const ReadSnapshot &current = snapshot();
+    for (const auto *list : {&current.segments, &current.late})
+    {
+        if (!list->empty() && list->back()->has_unfollowed_rows())
+        {
+            std::lock_guard<std::mutex> lock(self->follow_mutex);
+            list->back()->follow();
+        }
+    }
+}
+
+void TimeSeriesDB::refresh_from_disk(bool wait)
+{
+    // One query lists at a time; the others carry on with the snapshot
+    std::unique_lock<std::mutex> lock(segments_mutex, std::defer_lock);
+    if (wait)
+        lock.lock();
+    else if (!lock.try_lock())
+        return;
+    auto interval = std::chrono::milliseconds(options.refresh_interval_ms);
+    next_refresh_ns.store(steady_ns() + std::chrono::nanoseconds(interval).count(), std::memory_order_relaxed);
+
+    bool changed = false;
+    if (options.partition_duration == 0)
+    {
+        // Legacy layout: one base segment, there once the writer has
+        // created it; late segments are listed below as for partitions
+        if (segments.empty() && std::filesystem::exists(symbol_dir + "/timestamps.bin"))
+        {
+            try
+            {
+                segments.push_back(std::make_shared<Segment>(data_dir, symbol, 0, std::numeric_limits<uint64_t>::max(),
+                                                             OpenMode::ReadShared, options.segment));
+                changed = true;
+            }
+            catch (const std::exception &)
+            {
+                // Caught mid-creation; try again on the next query
+            }
+        }
+    }
+
+    // Directory timestamps are coarse: a listing taken within a second of
+    // the last change may have missed a later one with the same time
+    std::error_code ec;
+    auto mtime = std::filesystem::last_write_time(symbol_dir, ec);
+    if (!ec && (!listed || mtime != listed_mtime || listed_at - mtime < std::chrono::seconds(1)))
+    {
+        // A merge renames partitions one by one; wait until it is done
+        if (std::filesystem::exists(symbol_dir + "/" + COMPACTION_FILE))
+        {
+            listed = false;
+        }
+        else
+        {
+            listed_at = std::filesystem::file_time_type::clock::now();
+            listed_mtime = mtime;
+            listed = list_partitions();
+            changed = true;
+        }
+    }
+
+    if (!changed)
+        return;
+
+    // Catch up new segments before queries see them, and the previous
+    // newest ones, which queries stop following. Newest first: the writer
+    // flushes a partition before it starts the next one, so rows seen in
+    // one mean every earlier one is complete.
+    {
+        std::lock_guard<std::mutex> follow_lock(follow_mutex);
+        for (const auto *list : {&segments, &late_segments})
+        {
+            for (auto it = list->rbegin(); it != list->rend(); ++it)
+                if ((*it)->has_unfollowed_rows())
+                    (*it)->follow();
+        }
+    }
+    publish_segments();
+}
+
+bool TimeSeriesDB::list_partitions()
+{
+    using Listing = std::vector<std::pair<uint64_t, std::string>>;
+    auto scan = [this](Listing &partitions, Listing &late)
+    {
+        std::error_code ec;
+        for (const auto &entry : std::filesystem::directory_iterator(symbol_dir, ec))
+        {
+            std::string name = entry.path().filename().string();
+            bool is_partition = name.rfind("part_", 0) == 0;
+            if (!entry.is_directory() || (!is_partition && name.rfind("late_", 0) != 0))
+                continue;
+            try
+            {
+                (is_partition ? partitions : late).emplace_back(std::stoull(name.substr(5)), name);
+            }
+            catch (const std::exception &)
+            {
+                // The writer warns about these
+            }
+        }
+        std::sort(partitions.begin(), partitions.end());
+        std::sort(late.begin(), late.end());
+        return !ec;
+    };
+
+    // A listing may return a directory created while it ran and skip an
+    // older one created alongside it. A second listing holds both, and the
+    // writer creates directories in name order, so it has no holes up to
+    // the newest name the first one returned; the rest waits a refresh.
+    Listing seen_partitions, seen_late, partitions, late;
+    if (!scan(seen_partitions, seen_late) || !scan(partitions, late))
+        return false;
+    bool complete = true;
+    auto trim = [&complete](Listing &found, const Listing &seen)
+    {
+        size_t keep = 0;
+        if (!seen.empty())
+            keep = static_cast<size_t>(std::upper_bound(found.begin(), found.end(), seen.back()) - found.begin());
+        complete = complete && keep == found.size();
+        found.resize(keep);
+    };
+    trim(partitions, seen_partitions);
+    trim(late, seen_late);
+
+    // Segments already open are kept unless their directory was replaced
+    // (a merge installs a rewritten partition under the same name) or the
+    // writer has sealed them since: reopened, they hold no descriptor or
+    // address space reservation
+    std::map<std::string, ino_t> inodes;
+    auto reopen = [&](const Listing &found,
+                      std::vector<std::shared_ptr<Segment>> &open, bool is_late)
+    {
+        std::vector<std::shared_ptr<Segment>> kept;
+        for (const auto &[start, name] : found)
+        {
+            std::string path = symbol_dir + "/" + name;
+            struct stat st;
+            if (::stat(path.c_str(), &st) != 0)
+            {
+                complete = false;
+                continue;
+            }
+            auto known = listed_inodes.find(path);
+            auto it = std::find_if(open.begin(), open.end(), [&](const std::shared_ptr<Segment> &segment)
+                                   { return segment->get_path() == path; });
+            if (it != open.end() && known != listed_inodes.end() && known->second == st.st_ino &&
+                ((*it)->is_sealed() || !Segment::has_seal_marker(path)))
+            {
+                kept.push_back(*it);
+                inodes[path] = st.st_ino;
+                continue;
+            }
+            uint64_t end = is_late ? start + 1 : start + options.partition_duration;
+            try
+            {
+                kept.push_back(std::make_shared<Segment>(symbol_dir, name, start, end, OpenMode::ReadShared,
+                                                         options.segment));
+                inodes[path] = st.st_ino;
+            }
+            catch (const std::exception &)
+            {
+                // Being created or removed right now; try again next time
+                complete = false;
+            }
+        }
+        open = std::move(kept);
+    };
+    // The legacy layout's one base segment is not a part_ directory
+    if (options.partition_duration != 0)
+        reopen(partitions, segments, false);
+    reopen(late, late_segments, true);
+    listed_inodes = std::move(inodes);
+    return complete;
+}
+
+namespace
+{
+    constexpr size_t ROW_BYTES = sizeof(uint64_t) + sizeof(double) + sizeof(uint64_t);
+    constexpr size_t MERGE_BATCH_ROWS = 64 * 1024; // Rows per append (and throttle charge) of a merge
+
+    // Replace path with contents in one rename, both on stable storage
+    void write_durably(const std::string &path, const std::string &contents)
+    {
+        std::string tmp_path = path + ".tmp";
+        int fd = open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+        if (fd == -1)
+        {
+            throw std::system_error(errno, std::generic_category(), "Failed to open " + tmp_path);
+        }
+        try
+        {
+            write_fully(fd, contents.data(), contents.size(), tmp_path);
+        }
+        catch (...)
+        {
+            close(fd);
+            throw;
+        }
+        if (fsync(fd) == -1)
+        {
+            int err = errno;
+            close(fd);
+            throw std::system_error(err, std::generic_category(), "fsync failed for " + tmp_path);
+        }
+        close(fd);
+        if (std::rename(tmp_path.c_str(), path.c_str()) != 0)
+        {
+            throw std::system_error(errno, std::generic_category(), "Failed to install " + path);
+        }
+        fsync_directory(path);
+    }
+
+    void read_rows(const Segment &segment, IoThrottle &throttle, std::vector<Tick> &out)
+    {
+        std::vector<ColumnView> chunks;
+        ViewLeases leases;
+        segment.view_rows(0, segment.get_count(), chunks, leases);
+        for (const ColumnView &chunk : chunks)
+        {
+            throttle.acquire(chunk.size() * ROW_BYTES);
+            for (size_t i = 0; i < chunk.size(); ++i)
+                out.push_back(Tick{chunk.timestamps[i], chunk.prices[i], chunk.volumes[i]});
+        }
+    }
+}
+
+size_t TimeSeriesDB::run_maintenance()
+{
+    if (options.read_only)
+        return 0;
+    IoThrottle unlimited(0);
+    size_t tasks = 0;
+    while (maintenance_step(unlimited))
+        ++tasks;
+    return tasks;
+}
+
+bool TimeSeriesDB::maintenance_step(IoThrottle &throttle)
+{
+    // Space first, then read speed, then tidiness
+    std::lock_guard<std::mutex> lock(maintenance_mutex);
+    return enforce_retention() || compress_next_segment(throttle) || seal_idle_late_segment() ||
+           merge_late_segment(throttle) || save_sealed_indexes();
+}
+
+bool TimeSeriesDB::enforce_retention()
+{
+    if (options.retention == 0)
+        return false;
+    uint64_t cutoff;
+    {
+        TimedLock lock(segments_mutex);
+        // The active partition is never dropped
+        if (segments.size() < 2 || segments.back()->get_count() == 0)
+            return false;
+        uint64_t newest = segments.back()->get_max_ts();
+        if (newest < options.retention)
+            return false;
+        cutoff = newest - options.retention;
+        if (!segments.front()->is_sealed() || segments.front()->get_partition_end() > cutoff)
+            return false;
+    }
+    return drop_partitions_before(cutoff) > 0;
+}
+
+bool TimeSeriesDB::compress_next_segment(IoThrottle &throttle)
+{
+    std::shared_ptr<Segment> raw;
+    {
+        TimedLock lock(segments_mutex);
+        if (pending_compression.empty())
+            return false;
+        raw = std::move(pending_compression.front());
+        pending_compression.erase(pending_compression.begin());
+    }
+    throttle.acquire(raw->get_count() * ROW_BYTES);
+
+    // Encoding and reopening need no lock: a sealed segment's rows never
+    // change, and the swap below rechecks that retention has not dropped it
+    std::shared_ptr<Segment> packed;
+    try
+    {
+        raw->compress();
+        packed = std::make_shared<Segment>(symbol_dir, std::filesystem::path(raw->get_path()).filename().string(),
+                                           raw->get_partition_start(), raw->get_partition_end(),
+                                           OpenMode::ReadOnly, options.segment);
+    }
+    catch (const std::exception &e)
+    {
+        // Retention may have removed the partition meanwhile
+        std::cerr << "WARNING: Could not compress " << raw->get_path() << ": " << e.what() << std::endl;
+        return true;
+    }
+    if (!packed->is_compressed() || packed->get_count() != raw->get_count())
+        return true;
+
+    {
+        TimedLock lock(segments_mutex);
+        auto it = std::find(segments.begin(), segments.end(), raw);
+        if (it == segments.end())
+            return true; // Dropped by retention
+        *it = packed;
+        publish_segments();
+    }
+
+    // Views handed out earlier still lease the raw segment and its mappings
+    raw->retire();
+    raw->remove_raw_files();
+    Metrics::global().segments_compressed.add();
+    return true;
+}
+
+bool TimeSeriesDB::seal_idle_late_segment()
+{
+    if (!options.merge_late_segments || options.partition_duration == 0)
+        return false;
+    TimedLock lock(segments_mutex);
+    if (late_segments.empty() || segments.empty())
+        return false;
+
+    // Ticks keep arriving late for a while after a disruption; wait until
+    // a whole interval went by without any before starting a new segment
+    Segment &late = *late_segments.back();
+    uint64_t number = late.get_partition_start();
+    size_t rows = late.get_count();
+    bool idle = number == late_seen_segment && rows == late_seen_rows;
+    late_seen_segment = number;
+    late_seen_rows = rows;
+    // Rows for the active partition could not be merged yet
+    if (late.is_sealed() || rows == 0 || !idle || late.get_max_ts() >= segments.back()->get_partition_start())
+        return false;
+    late.flush_headers();
+    late.seal();
+    return true;
+}
+
+bool TimeSeriesDB::merge_late_segment(IoThrottle &throttle)
+{
+    if (!options.merge_late_segments || options.partition_duration == 0)
+        return false;
+
+    std::shared_ptr<Segment> late;
+    std::vector<std::shared_ptr<Segment>> partitions;
+    {
+        TimedLock lock(segments_mutex);
+        if (segments.empty())
+            return false;
+        uint64_t active_start = segments.back()->get_partition_start();
+        // Never the last one, which keeps the numbering going. With a WAL
+        // only those before the checkpoint's: rows of later ones may be
+        // replayed into them.
+        for (size_t i = 0; i + 1 < late_segments.size() && !late; ++i)
+        {
+            const auto &segment = late_segments[i];
+            bool covered = options.durability == DurabilityMode::None || segment->get_partition_start() < checkpoint_late;
+            if (segment->is_sealed() && covered && (segment->get_count() == 0 || segment->get_max_ts() < active_start))
+                late = segment;
+        }
+        if (!late)
+            return false;
+        partitions = segments;
+    }
+
+    // The late rows by the partition they belong in
+    std::map<uint64_t, std::vector<Tick>> homes;
+    {
+        std::vector<Tick> rows;
+        read_rows(*late, throttle, rows);
+        for (const Tick &tick : rows)
+            homes[partition_start_for(tick.timestamp)].push_back(tick);
+    }
+
+    // Write each partition afresh next to the old one, as compact_<name>
+    struct Rewrite
+    {
+        uint64_t start;
+        std::string name;
+        std::shared_ptr<Segment> replaced; // nullptr if there was no partition (or retention dropped it)
+    };
+    std::vector<Rewrite> rewrites;
+    auto discard = [&]
+    {
+        for (const auto &rewrite : rewrites)
+            std::filesystem::remove_all(symbol_dir + "/compact_" + rewrite.name);
+    };
+    try
+    {
+        std::vector<uint64_t> ts;
+        std::vector<double> px;
+        std::vector<uint64_t> vol;
+        for (const auto &[start, late_rows] : homes)
+        {
+            Rewrite rewrite{start, partition_name(start), nullptr};
+            auto it = std::lower_bound(partitions.begin(), partitions.end(), start,
+                                       [](const std::shared_ptr<Segment> &segment, uint64_t value)
+                                       { return segment->get_partition_start() < value; });
+            if (it != partitions.end() && (*it)->get_partition_start() == start)
+                rewrite.replaced = *it;
+
+            // Partition rows go first, so among equal timestamps they stay
+            // ahead of the ones that arrived late
+            std::vector<Tick> rows;
+            if (rewrite.replaced)
+                read_rows(*rewrite.replaced, throttle, rows);
+            rows.insert(rows.end(), late_rows.begin(), late_rows.end());
+            std::stable_sort(rows.begin(), rows.end(), [](const Tick &a, const Tick &b)
+                             { return a.timestamp < b.timestamp; });
+
+            std::string staging = "compact_" + rewrite.name;
+            std::filesystem::remove_all(symbol_dir + "/" + staging);
+            rewrites.push_back(rewrite);
+            Segment out(symbol_dir, staging, start, start + options.partition_duration, OpenMode::ReadWrite,
+                        options.segment);
+            for (size_t first = 0; first < rows.size(); first += MERGE_BATCH_ROWS)
+            {
+                size_t n = std::min(MERGE_BATCH_ROWS, rows.size() - first);
+                ts.resize(n);
+                px.resize(n);
+                vol.resize(n);
+                for (size_t i = 0; i < n; ++i)
+                {
+                    ts[i] = rows[first + i].timestamp;
+                    px[i] = rows[first + i].price;
+                    vol[i] = rows[first + i].volume;
+                }
+                throttle.acquire(n * ROW_BYTES);
+                out.append_batch(ts.data(), px.data(), vol.data(), n);
+            }
+            out.flush_headers();
+            out.seal();
+        }
+
+        // Commit point: from here on opening the store finishes the merge
+        std::string plan = std::filesystem::path(late->get_path()).filename().string() + "\n";
+        for (const auto &rewrite : rewrites)
+            plan += rewrite.name + "\n";
+        write_durably(symbol_dir + "/" + COMPACTION_FILE, plan);
+    }
+    catch (...)
+    {
+        discard();
+        throw;
+    }
+
+    {
+        TimedLock lock(segments_mutex);
+        auto late_it = std::find(late_segments.begin(), late_segments.end(), late);
+        bool current = late_it != late_segments.end() &&
+                       std::all_of(rewrites.begin(), rewrites.end(), [&](const Rewrite &rewrite)
+                                   { return !rewrite.replaced ||
+                                            std::find(segments.begin(), segments.end(), rewrite.replaced) != segments.end(); });
+        if (!current)
+        {
+            // Retention dropped a part of it meanwhile
+            std::filesystem::remove(symbol_dir + "/" + COMPACTION_FILE);
+            discard();
+            return true;
+        }
+
+        // Directory renames and read-only opens only; readers still on the
+        // old snapshot keep the replaced segments' files open
+        for (const auto &rewrite : rewrites)
+        {
+            std::string path = symbol_dir + "/" + rewrite.name;
+            if (rewrite.replaced)
+            {
+                rewrite.replaced->retire();
+                std::filesystem::rename(path, symbol_dir + "/retired_" + rewrite.name);
+            }
+            std::filesystem::rename(symbol_dir + "/compact_" + rewrite.name, path);
+            auto merged = std::make_shared<Segment>(symbol_dir, rewrite.name, rewrite.start,
+                                                    rewrite.start + options.partition_duration, OpenMode::ReadOnly,
+                                                    options.segment);
+            if (rewrite.replaced)
+            {
+                *std::find(segments.begin(), segments.end(), rewrite.replaced) = merged;
+                auto queued = std::find(pending_compression.begin(), pending_compression.end(), rewrite.replaced);
+                if (queued != pending_compression.end())
+                    pending_compression.erase(queued);
+            }
+            else
+            {
+                auto at = std::lower_bound(segments.begin(), segments.end(), rewrite.start,
+                                           [](const std::shared_ptr<Segment> &segment, uint64_t value)
+                                           { return segment->get_partition_start() < value; });
+                segments.insert(at, merged);
+            }
+            if (options.segment.compression != Compression::None)
+                pending_compression.push_back(merged);
+        }
+        late->retire();
+        late_segments.erase(late_it);
+        publish_segments();
+    }
+
+    for (const auto &rewrite : rewrites)
+    {
+        if (rewrite.replaced)
+            std::filesystem::remove_all(symbol_dir + "/retired_" + rewrite.name);
+    }
+    std::filesystem::remove_all(late->get_path());
+    std::filesystem::remove(symbol_dir + "/" + COMPACTION_FILE);
+    Metrics::global().late_segments_merged.add();
+    return true;
+}
+
+bool TimeSeriesDB::save_sealed_indexes()
+{
+    std::vector<std::shared_ptr<Segment>> sealed;
+    {
+        EpochGuard guard;
+        const ReadSnapshot &current = snapshot();
+        for (const auto &list : {&current.segments, &current.late})
+        {
+            for (const auto &segment : *list)
+            {
+                if (segment->is_sealed())
+                    sealed.push_back(segment);
+            }
+        }
+    }
+    bool saved = false;
+    for (const auto &segment : sealed)
+        saved |= segment->save_index();
+    return saved;
+}
 
-    // Rebuild index from storage
-    rebuild_index();
+void TimeSeriesDB::recover_compaction()
+{
+    if (options.partition_duration == 0 || !std::filesystem::exists(symbol_dir))
+        return;
 
-    // Start background writer thread
-    writer_thread = std::thread(&TimeSeriesDB::writer_loop, this);
+    std::string plan_path = symbol_dir + "/" + COMPACTION_FILE;
+    std::ifstream plan(plan_path);
+    if (plan)
+    {
+        // Committed: install the rewritten partitions still waiting, then
+        // drop the out-of-order segment they absorbed
+        std::string late_dir;
+        std::string name;
+        std::getline(plan, late_dir);
+        while (std::getline(plan, name))
+        {
+            std::string staging = symbol_dir + "/compact_" + name;
+            if (name.rfind("part_", 0) != 0 || !std::filesystem::exists(staging))
+                continue;
+            std::filesystem::remove_all(symbol_dir + "/" + name);
+            std::filesystem::rename(staging, symbol_dir + "/" + name);
+        }
+        if (late_dir.rfind("late_", 0) == 0)
+            std::filesystem::remove_all(symbol_dir + "/" + late_dir);
+        plan.close();
+    }
+
+    // Stand-ins of an uncommitted merge, and partitions a merge replaced
+    std::vector<std::filesystem::path> leftovers;
+    for (const auto &entry : std::filesystem::directory_iterator(symbol_dir))
+    {
+        std::string name = entry.path().filename().string();
+        if (entry.is_directory() && (name.rfind("compact_", 0) == 0 || name.rfind("retired_", 0) == 0))
+            leftovers.push_back(entry.path());
+    }
+    for (const auto &path : leftovers)
+        std::filesystem::remove_all(path);
+    std::filesystem::remove(plan_path);
+    std::filesystem::remove(plan_path + ".tmp");
 }
 
-TimeSeriesDB::~TimeSeriesDB()
+DBStats TimeSeriesDB::get_stats() const
 {
-    // Signal writer thread to stop and wait for it
-    stop_writer.store(true, std::memory_order_release);
-    cv.notify_all();
-    if (writer_thread.joinable())
+    follow_writer();
+    DBStats stats;
+    if (spsc_queue || mpsc_queue)
     {
-        writer_thread.join();
+        stats.queue_depth = spsc_queue ? spsc_queue->size_approx() : mpsc_queue->size_approx();
+        stats.queue_capacity = spsc_queue ? spsc_queue->capacity() : mpsc_queue->capacity();
     }
+    stats.pending_writes = pending_writes.load(std::memory_order_relaxed);
+    stats.dropped_ticks = dropped_ticks.load(std::memory_order_relaxed);
+
+    EpochGuard guard;
+    const ReadSnapshot &current = snapshot();
+    stats.partitions = current.segments.size();
+    for (const auto &segment : current.segments)
+    {
+        stats.rows += segment->get_count();
+        stats.compressed_partitions += segment->is_compressed() ? 1 : 0;
+    }
+    for (const auto &segment : current.late)
+        stats.late_rows += segment->get_count();
+    stats.rows += stats.late_rows;
+    stats.staged_ticks = staged_count.load(std::memory_order_relaxed);
+    return stats;
 }
 
-void TimeSeriesDB::append(uint64_t timestamp, double price, uint64_t volume)
+size_t TimeSeriesDB::get_count() const
 {
-    Tick tick{timestamp, price, volume};
+    follow_writer();
+    EpochGuard guard;
+    const ReadSnapshot &current = snapshot();
+    size_t total = 0;
+    for (const auto &segment : current.segments)
+        total += segment->get_count(); // Published rows only
+    for (const auto &segment : current.late)
+        total += segment->get_count();
+    return total;
+}
+
+bool TimeSeriesDB::verify_column_sync() const
+{
+    follow_writer();
+    // Column counts are only equal between batches
+    std::lock_guard<std::mutex> lock(segments_mutex);
+
+    return std::all_of(segments.begin(), segments.end(),
+                       [](const auto &segment)
+                       { return segment->verify_column_sync(); });
+}
+
+size_t TimeSeriesDB::get_partition_count() const
+{
+    follow_writer();
+    EpochGuard guard;
+    return snapshot().segments.size();
+}
+
+size_t TimeSeriesDB::drop_partitions_before(uint64_t cutoff)
+{
+    check_writable();
+    std::vector<std::shared_ptr<Segment>> dropped;
+    std::vector<std::shared_ptr<Segment>> dropped_late;
+    {
+        TimedLock lock(segments_mutex);
+
+        // The active segment is never dropped, only sealed ones
+        auto keep_from = segments.begin();
+        while (keep_from != segments.end() && std::next(keep_from) != segments.end() &&
+               (*keep_from)->is_sealed() && (*keep_from)->get_partition_end() <= cutoff)
+        {
+            ++keep_from;
+        }
+        dropped.assign(segments.begin(), keep_from);
+        segments.erase(segments.begin(), keep_from);
+
+        // Out-of-order segments mix ticks of any age: seal the active one
+        // once it holds rows older than the cutoff, and drop sealed ones
+        // from the front once all of their rows are
+        if (!late_segments.empty() && !late_segments.back()->is_sealed() && late_segments.back()->get_count() > 0 &&
+            late_segments.back()->get_min_ts() < cutoff)
+        {
+            late_segments.back()->flush_headers();
+            late_segments.back()->seal();
+        }
+        auto late_keep_from = late_segments.begin();
+        while (late_keep_from != late_segments.end() && (*late_keep_from)->is_sealed() &&
+               ((*late_keep_from)->get_count() == 0 || (*late_keep_from)->get_max_ts() < cutoff))
+        {
+            ++late_keep_from;
+        }
+        dropped_late.assign(late_segments.begin(), late_keep_from);
+        late_segments.erase(late_segments.begin(), late_keep_from);
 
-    // Increment pending writes counter
-    pending_writes.fetch_add(1, std::memory_order_acq_rel);
+        if (!dropped.empty() || !dropped_late.empty())
+            publish_segments();
+    }
 
-    // Queue the tick for background writing
+    // Whole partitions go at once; no per-row work at all. Readers still on
+    // the old snapshot keep the unlinked files mapped.
+    for (const auto &segment : dropped)
     {
-        std::lock_guard<std::mutex> lock(write_mutex);
-        write_queue.push(tick);
+        std::filesystem::remove_all(segment->get_path());
     }
-    cv.notify_one();
+    for (const auto &segment : dropped_late)
+    {
+        std::filesystem::remove_all(segment->get_path());
+    }
+    return dropped.size();
+}
+
+RangeView TimeSeriesDB::view_range(uint64_t start, uint64_t end) const
+{
+    follow_writer();
+    QueryTimer timer;
+    EpochGuard guard;
+    RangeView view = view_range_unlocked(snapshot(), start, end);
+    timer.set_rows(view.size());
+    return view;
 }
 
-void TimeSeriesDB::append_batch(const std::vector<Tick> &ticks)
+RangeView TimeSeriesDB::view_range_unlocked(const ReadSnapshot &snapshot, uint64_t start, uint64_t end,
+                                            const QueryOptions &query) const
 {
-    // Increment pending writes counter by the number of ticks
-    pending_writes.fetch_add(ticks.size(), std::memory_order_acq_rel);
+    IoBatch batch;
+    IoBatch *io = query.async_io ? &batch : nullptr;
+    RangeView view;
+    uint64_t previous_max = 0;
+    bool any = false;
+
+    for (const auto &segment : snapshot.segments)
+    {
+        // Skip partitions that fall entirely outside the range
+        if (!segment->overlaps(start, end))
+            continue;
+
+        // Late ticks can make neighbouring partitions overlap in time
+        if (any && segment->get_min_ts() < previous_max)
+            view.time_ordered = false;
+        previous_max = std::max(previous_max, segment->get_max_ts());
 
-    // Queue all ticks for background writing
+        size_t before = view.chunks.size();
+        bool ordered = io ? segment->read_range(start, end, view.chunks, view.leases, *io, query.cache_blocks)
+                          : segment->view_range(start, end, view.chunks, view.leases, query.cache_blocks);
+        if (!ordered)
+            view.time_ordered = false;
+        if (view.chunks.size() > before)
+        {
+            view.leases.push_back(segment);
+            any = true;
+        }
+    }
+
+    // Ticks that arrived too late for the reorder window. Their chunks go
+    // after the partitions' ones, which alone are in order.
+    size_t in_order = view.chunks.size();
+    bool partitions_ordered = view.time_ordered;
+    for (const auto &segment : snapshot.late)
     {
-        std::lock_guard<std::mutex> lock(write_mutex);
-        for (const auto &tick : ticks)
+        if (!segment->overlaps(start, end))
+            continue;
+        size_t before = view.chunks.size();
+        if (io)
+            segment->read_range(start, end, view.chunks, view.leases, *io, query.cache_blocks);
+        else
+            segment->view_range(start, end, view.chunks, view.leases, query.cache_blocks);
+        if (view.chunks.size() > before)
         {
-            write_queue.push(tick);
+            view.leases.push_back(segment);
+            view.time_ordered = false;
         }
     }
-    cv.notify_one();
+    view.ordered_chunks = partitions_ordered ? in_order : 0;
+    if (io)
+        io->wait(view.leases);
+
+    return view;
 }
 
-void TimeSeriesDB::writer_loop()
+void TimeSeriesDB::prefetch_range(uint64_t start, uint64_t end) const
+{
+    follow_writer();
+    EpochGuard guard;
+    prefetch_unlocked(snapshot(), start, end);
+}
+
+void TimeSeriesDB::prefetch_unlocked(const ReadSnapshot &snapshot, uint64_t start, uint64_t end) const
 {
-    while (!stop_writer.load(std::memory_order_acquire))
+    for (const auto *list : {&snapshot.segments, &snapshot.late})
     {
-        std::vector<Tick> batch;
+        for (const auto &segment : *list)
+            segment->prefetch_range(start, end);
+    }
+}
+
+RangeView TimeSeriesDB::view_last(size_t n) const
+{
+    follow_writer();
+    QueryTimer timer;
+    EpochGuard guard;
+    RangeView view = view_last_unlocked(snapshot(), n);
+    timer.set_rows(view.size());
+    return view;
+}
 
-        // Get items from queue up to a certain batch size
+RangeView TimeSeriesDB::view_last_unlocked(const ReadSnapshot &snapshot, size_t n) const
+{
+    // Walk back from the active segment until n rows are covered. Each
+    // count is loaded once: the active segment may grow meanwhile.
+    const auto &parts = snapshot.segments;
+    std::vector<size_t> counts(parts.size());
+    size_t first_segment = parts.size();
+    size_t skip = 0; // Rows of first_segment that are older than the last n
+    size_t needed = n;
+    while (first_segment > 0 && needed > 0)
+    {
+        --first_segment;
+        size_t count = counts[first_segment] = parts[first_segment]->get_count();
+        if (count >= needed)
         {
-            std::unique_lock<std::mutex> lock(write_mutex);
-            cv.wait(lock, [this]
-                    { return !write_queue.empty() || stop_writer.load(std::memory_order_acquire); });
+            skip = count - needed;
+            needed = 0;
+        }
+        else
+        {
+            needed -= count;
+        }
+    }
 
-            if (stop_writer.load(std::memory_order_acquire) && write_queue.empty())
-            {
-                break;
-            }
+    // Storage (arrival) order, like query_last
+    RangeView view;
+    view.time_ordered = false;
+    for (size_t s = first_segment; s < parts.size(); ++s)
+    {
+        size_t count = counts[s];
+        size_t first = (s == first_segment) ? skip : 0;
+        if (first < count)
+        {
+            parts[s]->view_rows(first, count, view.chunks, view.leases);
+            view.leases.push_back(parts[s]);
+        }
+    }
+
+    return view;
+}
+
+namespace
+{
+    // Rows [first, last) of chunk, written from row offset of the result
+    struct RowBlock
+    {
+        size_t chunk;
+        size_t first;
+        size_t last;
+        size_t offset;
+    };
 
-            // Process up to 1000 ticks at once for better batching
-            const size_t BATCH_SIZE = 1000;
-            for (size_t i = 0; i < BATCH_SIZE && !write_queue.empty(); ++i)
+    // Cut the chunks into blocks of at most block_rows rows, in order
+    std::vector<RowBlock> split_blocks(const std::vector<ColumnView> &chunks, size_t block_rows)
+    {
+        block_rows = std::max<size_t>(block_rows, 1);
+        std::vector<RowBlock> blocks;
+        size_t offset = 0;
+        for (size_t c = 0; c < chunks.size(); ++c)
+        {
+            for (size_t first = 0; first < chunks[c].size(); first += block_rows)
             {
-                batch.push_back(write_queue.front());
-                write_queue.pop();
+                size_t last = std::min(chunks[c].size(), first + block_rows);
+                blocks.push_back(RowBlock{c, first, last, offset});
+                offset += last - first;
             }
         }
+        return blocks;
+    }
+
+    ColumnView sub_view(const ColumnView &chunk, size_t first, size_t last)
+    {
+        return ColumnView{chunk.timestamps.subspan(first, last - first), chunk.prices.subspan(first, last - first),
+                          chunk.volumes.subspan(first, last - first), chunk.first_row + first};
+    }
+
+    bool wants_parallel(const QueryOptions &query, size_t rows)
+    {
+        return query.parallelism != 1 && QueryPool::global().max_parallelism() > 1 &&
+               rows >= 2 * std::max<size_t>(query.block_rows, 1);
+    }
 
-        // Process batch - ensure all columns stay synchronized
-        if (!batch.empty())
+    // Stable sort of rows by timestamp: the runs between bounds are sorted
+    // in parallel, then neighbouring runs merged pairwise, a round at a time
+    template <typename Row>
+    void parallel_stable_sort(std::vector<Row> &rows, std::vector<size_t> bounds, size_t parallelism)
+    {
+        auto by_time = [](const Row &a, const Row &b)
+        { return std::get<0>(a) < std::get<0>(b); };
+        QueryPool &pool = QueryPool::global();
+        pool.parallel_for(bounds.size() - 1, parallelism, [&](size_t r)
+                          { std::stable_sort(rows.begin() + bounds[r], rows.begin() + bounds[r + 1], by_time); });
+        while (bounds.size() > 2)
         {
-            // Lock for writing to storage and updating index
-            std::unique_lock<std::shared_mutex> lock(query_mutex);
+            size_t pairs = (bounds.size() - 1) / 2;
+            pool.parallel_for(pairs, parallelism, [&](size_t p)
+                              { std::inplace_merge(rows.begin() + bounds[2 * p], rows.begin() + bounds[2 * p + 1],
+                                                   rows.begin() + bounds[2 * p + 2], by_time); });
+            std::vector<size_t> merged;
+            for (size_t b = 0; b < bounds.size(); b += 2)
+                merged.push_back(bounds[b]);
+            if (merged.back() != bounds.back())
+                merged.push_back(bounds.back());
+            bounds.swap(merged);
+        }
+    }
+}
 
-            // Get the starting index before any appends to ensure consistency
-            size_t start_index = timestamps.get_count();
+AggregateResult TimeSeriesDB::aggregate_range(uint64_t start, uint64_t end, AggregateOp ops) const
+{
+    follow_writer();
+    QueryTimer timer;
+    EpochGuard guard;
+    AggregateResult result = aggregate_unlocked(snapshot(), start, end, ops);
+    timer.set_rows(result.count);
+    return result;
+}
 
-            // Prepare data arrays for batch operations
-            std::vector<uint64_t> ts_data;
-            std::vector<double> price_data;
-            std::vector<uint64_t> vol_data;
+AggregateResult TimeSeriesDB::aggregate_range(uint64_t start, uint64_t end, AggregateOp ops,
+                                              const QueryOptions &query) const
+{
+    // Stats answer most blocks of a bounds-only aggregate; the few left to
+    // scan are not worth spreading over threads
+    if ((query.parallelism == 1 && !query.prefetch && !query.async_io && query.cache_blocks) ||
+        Aggregator::bounds_only(ops))
+        return aggregate_range(start, end, ops);
 
-            ts_data.reserve(batch.size());
-            price_data.reserve(batch.size());
-            vol_data.reserve(batch.size());
+    follow_writer();
+    QueryTimer timer;
+    EpochGuard guard;
+    const ReadSnapshot &current = snapshot();
+    if (query.prefetch)
+        prefetch_unlocked(current, start, end);
 
-            for (const auto &tick : batch)
-            {
-                ts_data.push_back(tick.timestamp);
-                price_data.push_back(tick.price);
-                vol_data.push_back(tick.volume);
-            }
+    // Unlike the serial pass, every chunk (and decoded block) stays live
+    // until the tasks are done
+    std::vector<ColumnView> chunks;
+    std::vector<char> ordered; // Per chunk
+    ViewLeases blocks;
+    IoBatch io;
+    for (const auto *list : {&current.segments, &current.late})
+    {
+        for (const auto &segment : *list)
+        {
+            if (!segment->overlaps(start, end))
+                continue;
+            bool in_order = (query.async_io ? segment->read_range(start, end, chunks, blocks, io, query.cache_blocks)
+                                            : segment->view_range(start, end, chunks, blocks, query.cache_blocks)) &&
+                            list == &current.segments;
+            ordered.resize(chunks.size(), in_order);
+        }
+    }
+    io.wait(blocks);
+    size_t rows = 0;
+    for (const auto &chunk : chunks)
+        rows += chunk.size();
 
-            // Batch append to all columns atomically
-            if (batch.size() == 1)
-            {
-                // Single item - use regular append
-                timestamps.append(&ts_data[0]);
-                prices.append(&price_data[0]);
-                volumes.append(&vol_data[0]);
-            }
-            else
+    Aggregator aggregator(ops);
+    if (!wants_parallel(query, rows))
+    {
+        for (size_t c = 0; c < chunks.size(); ++c)
+            aggregator.add(chunks[c], ordered[c] != 0);
+    }
+    else
+    {
+        std::vector<RowBlock> tasks = split_blocks(chunks, query.block_rows);
+        std::vector<Aggregator> partial(tasks.size(), Aggregator(ops));
+        QueryPool::global().parallel_for(tasks.size(), query.parallelism, [&](size_t t)
+                                         {
+            const RowBlock &task = tasks[t];
+            partial[t].add(sub_view(chunks[task.chunk], task.first, task.last), ordered[task.chunk] != 0); });
+        for (const Aggregator &part : partial)
+            aggregator.merge(part);
+    }
+
+    AggregateResult result = aggregator.result();
+    timer.set_rows(result.count);
+    return result;
+}
+
+AggregateResult TimeSeriesDB::aggregate_unlocked(const ReadSnapshot &snapshot, uint64_t start, uint64_t end,
+                                                 AggregateOp ops) const
+{
+    Aggregator aggregator(ops);
+    if (Aggregator::bounds_only(ops))
+    {
+        // Count, high and low do not care about row order
+        for (const auto *list : {&snapshot.segments, &snapshot.late})
+        {
+            for (const auto &segment : *list)
             {
-                // Multiple items - use batch append for better performance
-                timestamps.append_batch(ts_data.data(), batch.size());
-                prices.append_batch(price_data.data(), batch.size());
-                volumes.append_batch(vol_data.data(), batch.size());
+                if (segment->overlaps(start, end))
+                    segment->aggregate_bounds(start, end, aggregator);
             }
+        }
+        return aggregator.result();
+    }
+
+    // The pinned snapshot keeps the mappings alive, so only decoded blocks
+    // need leases; both lists are reused across segments
+    std::vector<ColumnView> chunks;
+    ViewLeases blocks;
+    for (const auto &segment : snapshot.segments)
+    {
+        if (!segment->overlaps(start, end))
+            continue;
+        chunks.clear();
+        blocks.clear();
+        bool ordered = segment->view_range(start, end, chunks, blocks);
+        for (const auto &chunk : chunks)
+            aggregator.add(chunk, ordered);
+    }
+    for (const auto &segment : snapshot.late)
+    {
+        if (!segment->overlaps(start, end))
+            continue;
+        chunks.clear();
+        blocks.clear();
+        segment->view_range(start, end, chunks, blocks);
+        for (const auto &chunk : chunks)
+            aggregator.add(chunk, false);
+    }
+    return aggregator.result();
+}
+
+namespace
+{
+    // Last timestamp of the bucket starting at bucket, without wrapping
+    uint64_t bucket_last(uint64_t bucket, uint64_t resolution)
+    {
+        uint64_t remaining = std::numeric_limits<uint64_t>::max() - bucket;
+        return bucket + std::min(resolution - 1, remaining);
+    }
+
+    // Fold a bar (or a one-tick bar) into a time-ordered bar series
+    void fold_bar(std::vector<Bar> &bars, const Bar &bar, uint64_t resolution)
+    {
+        uint64_t bucket = bar.timestamp - (bar.timestamp % resolution);
+        if (bars.empty() || bars.back().timestamp != bucket)
+        {
+            bars.push_back(bar);
+            bars.back().timestamp = bucket;
+            return;
+        }
+        Bar &into = bars.back();
+        into.high = std::max(into.high, bar.high);
+        into.low = std::min(into.low, bar.low);
+        into.close = bar.close;
+        into.volume += bar.volume;
+        into.count += bar.count;
+    }
+}
+
+void TimeSeriesDB::open_rollups()
+{
+    std::vector<uint64_t> resolutions = options.rollup_resolutions;
+    resolutions.erase(std::remove(resolutions.begin(), resolutions.end(), 0), resolutions.end());
+    std::sort(resolutions.begin(), resolutions.end());
+    resolutions.erase(std::unique(resolutions.begin(), resolutions.end()), resolutions.end());
+
+    std::lock_guard<std::mutex> lock(segments_mutex);
 
-            // Flush headers to ensure persistence
-            timestamps.flush_header();
-            prices.flush_header();
-            volumes.flush_header();
+    for (uint64_t resolution : resolutions)
+    {
+        auto rollup = std::make_unique<Rollup>(symbol_dir, resolution);
 
-            // Update time index for all items
-            for (size_t i = 0; i < batch.size(); ++i)
+        // Resume where the rollup stopped unless recovery rewrote rows it
+        // may already have seen, or retention dropped its position
+        size_t from_segment = 0;
+        size_t from_row = 0;
+        uint64_t cursor_partition = 0;
+        uint64_t cursor_rows = 0;
+        bool resume = !rows_rewritten && rollup->get_cursor(cursor_partition, cursor_rows);
+        if (resume)
+        {
+            auto it = std::find_if(segments.begin(), segments.end(),
+                                   [&](const auto &segment)
+                                   { return segment->get_partition_start() == cursor_partition; });
+            resume = (it != segments.end() && cursor_rows <= (*it)->get_count());
+            if (resume)
             {
-                time_index.insert(batch[i].timestamp, start_index + i);
+                from_segment = static_cast<size_t>(it - segments.begin());
+                from_row = cursor_rows;
             }
+        }
+        if (!resume)
+        {
+            // Bars are derived data: rebuild them from the raw columns
+            rollup.reset();
+            std::filesystem::remove_all(symbol_dir + "/" + Rollup::dir_name(resolution));
+            rollup = std::make_unique<Rollup>(symbol_dir, resolution);
+        }
+
+        std::vector<ColumnView> chunks;
+        ViewLeases blocks;
+        for (size_t s = from_segment; s < segments.size(); ++s)
+        {
+            size_t count = segments[s]->get_count();
+            size_t first = (s == from_segment) ? from_row : 0;
+            chunks.clear();
+            blocks.clear();
+            segments[s]->view_rows(first, count, chunks, blocks);
+            for (const auto &rows : chunks)
+                rollup->add(rows.timestamps.data(), rows.prices.data(), rows.volumes.data(), rows.size());
+            rollup->set_cursor(segments[s]->get_partition_start(), count);
+        }
+
+        // Then the out-of-order segments, which have a cursor of their own
+        uint64_t late_segment = 0;
+        uint64_t late_rows = 0;
+        bool late_resume = resume && rollup->get_late_cursor(late_segment, late_rows);
+        for (const auto &segment : late_segments)
+        {
+            size_t count = segment->get_count();
+            size_t first = 0;
+            if (late_resume && segment->get_partition_start() < late_segment)
+                continue;
+            if (late_resume && segment->get_partition_start() == late_segment)
+                first = std::min<size_t>(late_rows, count);
+            chunks.clear();
+            blocks.clear();
+            segment->view_rows(first, count, chunks, blocks);
+            for (const auto &rows : chunks)
+                rollup->add(rows.timestamps.data(), rows.prices.data(), rows.volumes.data(), rows.size());
+            rollup->set_late_cursor(segment->get_partition_start(), count);
+        }
+
+        rollups.push_back(std::move(rollup));
+    }
+}
+
+std::vector<Bar> TimeSeriesDB::query_bars(uint64_t start, uint64_t end, uint64_t resolution) const
+{
+    if (resolution == 0 || start > end)
+        return {};
+
+    follow_writer();
+    QueryTimer timer;
+    EpochGuard guard;
+    std::vector<Bar> bars = query_bars_unlocked(snapshot(), start, end, resolution);
+    timer.set_rows(bars.size());
+    return bars;
+}
+
+std::vector<Bar> TimeSeriesDB::query_bars_unlocked(const ReadSnapshot &snapshot, uint64_t start, uint64_t end,
+                                                   uint64_t resolution) const
+{
+    std::vector<Bar> bars;
+
+    uint64_t first_bucket = start - (start % resolution);
+    uint64_t last_ts = bucket_last(end - (end % resolution), resolution);
+
+    // Coarsest rollup whose buckets tile the requested ones
+    const Rollup *source = nullptr;
+    for (const auto &rollup : rollups)
+    {
+        if (resolution % rollup->get_resolution() == 0)
+            source = rollup.get();
+    }
+
+    if (!source)
+    {
+        // No rollup fits: bucket the raw ticks in timestamp order
+        RangeView view = view_range_unlocked(snapshot, first_bucket, last_ts);
+        if (view.is_time_ordered())
+        {
+            for (const auto &chunk : view)
+                for (size_t i = 0; i < chunk.size(); ++i)
+                    fold_bar(bars, Bar{chunk.timestamps[i], chunk.prices[i], chunk.prices[i], chunk.prices[i], chunk.prices[i], chunk.volumes[i], 1}, resolution);
+            return bars;
+        }
+
+        std::vector<Bar> ticks;
+        ticks.reserve(view.size());
+        for (const auto &chunk : view)
+            for (size_t i = 0; i < chunk.size(); ++i)
+                ticks.push_back(Bar{chunk.timestamps[i], chunk.prices[i], chunk.prices[i], chunk.prices[i], chunk.prices[i], chunk.volumes[i], 1});
+        std::stable_sort(ticks.begin(), ticks.end(),
+                         [](const Bar &a, const Bar &b)
+                         { return a.timestamp < b.timestamp; });
+        for (const Bar &tick : ticks)
+            fold_bar(bars, tick, resolution);
+        return bars;
+    }
+
+    std::vector<Bar> fine;
+    std::vector<uint64_t> stale;
+    {
+        std::shared_lock<std::shared_mutex> lock(rollup_mutex);
+        source->read_bars(first_bucket, last_ts, fine);
+        // Buckets that received late ticks are recomputed from the raw columns
+        stale = source->dirty_buckets(first_bucket, last_ts);
+    }
+    if (!stale.empty())
+    {
+        fine.erase(std::remove_if(fine.begin(), fine.end(),
+                                  [&](const Bar &bar)
+                                  { return std::binary_search(stale.begin(), stale.end(), bar.timestamp); }),
+                   fine.end());
+
+        std::vector<Bar> recomputed;
+        for (uint64_t bucket : stale)
+        {
+            AggregateResult agg = aggregate_unlocked(snapshot, bucket, bucket_last(bucket, source->get_resolution()),
+                                                     AggregateOp::All);
+            if (agg.count > 0)
+                recomputed.push_back(Bar{bucket, agg.open, agg.high, agg.low, agg.close, agg.volume, agg.count});
+        }
+
+        std::vector<Bar> merged;
+        merged.reserve(fine.size() + recomputed.size());
+        std::merge(fine.begin(), fine.end(), recomputed.begin(), recomputed.end(), std::back_inserter(merged),
+                   [](const Bar &a, const Bar &b)
+                   { return a.timestamp < b.timestamp; });
+        fine.swap(merged);
+    }
+
+    if (source->get_resolution() == resolution)
+        return fine;
+
+    for (const Bar &bar : fine)
+        fold_bar(bars, bar, resolution);
+    return bars;
+}
+
+std::shared_ptr<Subscription> TimeSeriesDB::subscribe(uint64_t from_ts)
+{
+    if (options.read_only)
+    {
+        // Subscriptions wait on the writer's batches, which never come here
+        throw std::runtime_error("Cannot subscribe to read-only store " + symbol_dir);
+    }
+    return std::shared_ptr<Subscription>(new Subscription(subscribers, tail_cursor_at(from_ts)));
+}
+
+std::shared_ptr<Subscription> TimeSeriesDB::subscribe(uint64_t from_ts, std::function<void(const RangeView &)> callback,
+                                                      size_t max_rows)
+{
+    auto subscription = subscribe(from_ts);
+    subscription->start_dispatcher(std::move(callback), std::max<size_t>(max_rows, 1));
+    return subscription;
+}
 
-            // Verify synchronization (debug check)
-            if (!verify_column_sync())
+namespace
+{
+    using SegmentList = std::vector<std::shared_ptr<Segment>>;
+
+    // Where a tail starting at from_ts begins. Rows arrive in partition
+    // order, so the first partition that reaches from_ts holds the start.
+    TailPosition tail_position_at(const SegmentList &parts, uint64_t from_ts)
+    {
+        if (parts.empty())
+            return TailPosition{};
+        if (from_ts != Subscription::NOW)
+        {
+            for (const auto &segment : parts)
             {
-                std::cerr << "ERROR: Columns became desynchronized during batch write!" << std::endl;
+                if (segment->get_count() > 0 && segment->get_max_ts() >= from_ts)
+                    return TailPosition{segment->get_partition_start(), segment->first_row_at(from_ts), true};
             }
+        }
+        return TailPosition{parts.back()->get_partition_start(), parts.back()->get_count(), true};
+    }
+
+    // Up to remaining rows past pos, in storage order. Returns true if
+    // retention dropped rows pos had not reached.
+    bool read_tail_rows(const SegmentList &parts, TailPosition &pos, size_t &remaining, std::vector<ColumnView> &chunks,
+                        ViewLeases &leases)
+    {
+        if (parts.empty())
+            return false;
 
-            // Decrement pending writes counter by the number of processed ticks
-            pending_writes.fetch_sub(batch.size(), std::memory_order_acq_rel);
+        size_t s = 0;
+        if (pos.valid)
+        {
+            while (s < parts.size() && parts[s]->get_partition_start() < pos.start)
+                ++s;
+            if (s == parts.size())
+                return false;
+        }
+        bool gap = false;
+        if (!pos.valid || parts[s]->get_partition_start() != pos.start)
+        {
+            // Retention only drops whole segments from the front
+            gap = pos.valid;
+            pos = TailPosition{parts[s]->get_partition_start(), 0, true};
+        }
 
-            // Notify sync if it's waiting and no more pending writes
-            if (sync_requested.load(std::memory_order_acquire) &&
-                pending_writes.load(std::memory_order_acquire) == 0)
+        while (remaining > 0)
+        {
+            size_t count = parts[s]->get_count();
+            if (pos.row < count)
             {
-                sync_cv.notify_all();
+                size_t last = pos.row + std::min(remaining, count - pos.row);
+                parts[s]->view_rows(pos.row, last, chunks, leases);
+                leases.push_back(parts[s]);
+                remaining -= last - pos.row;
+                pos.row = last;
             }
+            // Only the last segment still grows; earlier ones are sealed
+            if (pos.row < count || s + 1 == parts.size())
+                break;
+            ++s;
+            pos = TailPosition{parts[s]->get_partition_start(), 0, true};
+        }
+        return gap;
+    }
+
+    size_t tail_rows_behind(const SegmentList &parts, const TailPosition &pos)
+    {
+        size_t lag = 0;
+        for (const auto &segment : parts)
+        {
+            if (!pos.valid || segment->get_partition_start() > pos.start)
+                lag += segment->get_count();
+            else if (segment->get_partition_start() == pos.start)
+                lag += segment->get_count() - std::min(pos.row, segment->get_count());
         }
+        return lag;
     }
 }
 
-void TimeSeriesDB::rebuild_index()
+TailCursor TimeSeriesDB::tail_cursor_at(uint64_t from_ts) const
+{
+    // Out-of-order segments are not sorted either way, so a subscription
+    // picks up late ticks from now on only
+    EpochGuard guard;
+    const ReadSnapshot &current = snapshot();
+    return TailCursor{tail_position_at(current.segments, from_ts), tail_position_at(current.late, Subscription::NOW)};
+}
+
+RangeView TimeSeriesDB::read_tail(TailCursor &cursor, size_t max_rows, bool &gap) const
 {
-    std::unique_lock<std::shared_mutex> lock(query_mutex);
+    EpochGuard guard;
+    const ReadSnapshot &current = snapshot();
+    RangeView view;
+    view.time_ordered = false;
+    size_t remaining = max_rows;
+    gap |= read_tail_rows(current.segments, cursor.partitions, remaining, view.chunks, view.leases);
+    gap |= read_tail_rows(current.late, cursor.late, remaining, view.chunks, view.leases);
+    return view;
+}
 
-    size_t count = timestamps.get_count();
-    for (size_t i = 0; i < count; ++i)
-    {
-        uint64_t ts;
-        timestamps.read(i, &ts);
-        time_index.insert(ts, i);
-    }
+size_t TimeSeriesDB::tail_lag(const TailCursor &cursor) const
+{
+    EpochGuard guard;
+    const ReadSnapshot &current = snapshot();
+    return tail_rows_behind(current.segments, cursor.partitions) + tail_rows_behind(current.late, cursor.late);
 }
 
 std::vector<std::tuple<uint64_t, double, uint64_t>> TimeSeriesDB::query_range(uint64_t start, uint64_t end) const
 {
-    std::shared_lock<std::shared_mutex> lock(query_mutex);
+    return query_range(start, end, QueryOptions{});
+}
+
+std::vector<std::tuple<uint64_t, double, uint64_t>> TimeSeriesDB::query_range(uint64_t start, uint64_t end,
+                                                                              const QueryOptions &query) const
+{
+    follow_writer();
+    QueryTimer timer;
+    RangeView view;
+    {
+        // The view's leases keep the rows alive once the guard is released
+        EpochGuard guard;
+        if (query.prefetch)
+            prefetch_unlocked(snapshot(), start, end);
+        view = view_range_unlocked(snapshot(), start, end, query);
+    }
 
-    // Use B+ Tree for efficient range lookup
-    auto results = time_index.range_query(start, end);
+    size_t ordered_rows = 0;
+    for (size_t c = 0; c < view.ordered_chunks; ++c)
+        ordered_rows += view.chunks[c].size();
+    auto by_time = [](const auto &a, const auto &b)
+    { return std::get<0>(a) < std::get<0>(b); };
 
     std::vector<std::tuple<uint64_t, double, uint64_t>> ticks;
-    ticks.reserve(results.size());
-
-    for (const auto &[ts, idx] : results)
+    size_t rows = view.size();
+    if (!wants_parallel(query, rows))
     {
-        double price;
-        uint64_t volume;
+        ticks.reserve(rows);
+        for (const auto &chunk : view)
+        {
+            for (size_t i = 0; i < chunk.size(); ++i)
+            {
+                ticks.emplace_back(chunk.timestamps[i], chunk.prices[i], chunk.volumes[i]);
+            }
+        }
 
-        // Zero-copy reading from mmap'd files
-        prices.read(idx, &price);
-        volumes.read(idx, &volume);
+        if (!view.is_time_ordered())
+        {
+            // Only the late ticks need sorting when the partitions are in order
+            std::stable_sort(ticks.begin() + ordered_rows, ticks.end(), by_time);
+            std::inplace_merge(ticks.begin(), ticks.begin() + ordered_rows, ticks.end(), by_time);
+        }
+        timer.set_rows(ticks.size());
+        return ticks;
+    }
+
+    // Each block copies into its own slice of the result
+    std::vector<RowBlock> blocks = split_blocks(view.chunks, query.block_rows);
+    ticks.resize(rows);
+    QueryPool::global().parallel_for(blocks.size(), query.parallelism, [&](size_t b)
+                                     {
+        const RowBlock &block = blocks[b];
+        const ColumnView &chunk = view.chunks[block.chunk];
+        auto out = ticks.begin() + block.offset;
+        for (size_t i = block.first; i < block.last; ++i)
+            *out++ = std::make_tuple(chunk.timestamps[i], chunk.prices[i], chunk.volumes[i]); });
 
-        ticks.emplace_back(ts, price, volume);
+    if (!view.is_time_ordered())
+    {
+        // Sort the runs that are not already in order, block by block
+        std::vector<size_t> bounds{ordered_rows};
+        for (const RowBlock &block : blocks)
+        {
+            if (block.offset > ordered_rows)
+                bounds.push_back(block.offset);
+        }
+        bounds.push_back(rows);
+        parallel_stable_sort(ticks, std::move(bounds), query.parallelism);
+        std::inplace_merge(ticks.begin(), ticks.begin() + ordered_rows, ticks.end(), by_time);
     }
 
+    timer.set_rows(ticks.size());
     return ticks;
 }
 
 std::vector<std::tuple<uint64_t, double, uint64_t>> TimeSeriesDB::query_last(size_t n) const
 {
-    std::shared_lock<std::shared_mutex> lock(query_mutex);
-
-    size_t count = timestamps.get_count();
-    size_t start_idx = (count > n) ? (count - n) : 0;
+    follow_writer();
+    QueryTimer timer;
+    RangeView view;
+    {
+        EpochGuard guard;
+        view = view_last_unlocked(snapshot(), n);
+    }
 
     std::vector<std::tuple<uint64_t, double, uint64_t>> result;
-    result.reserve(count - start_idx);
-
-    for (size_t i = start_idx; i < count; ++i)
+    result.reserve(view.size());
+    for (const auto &chunk : view)
     {
-        uint64_t ts;
-        double price;
-        uint64_t volume;
-
-        timestamps.read(i, &ts);
-        prices.read(i, &price);
-        volumes.read(i, &volume);
-
-        result.emplace_back(ts, price, volume);
+        for (size_t i = 0; i < chunk.size(); ++i)
+        {
+            result.emplace_back(chunk.timestamps[i], chunk.prices[i], chunk.volumes[i]);
+        }
     }
 
+    timer.set_rows(result.size());
     return result;
 }
 
 void TimeSeriesDB::sync()
 {
-    // Set sync requested flag
-    sync_requested.store(true, std::memory_order_release);
+    uint64_t ticket = request_sync();
+    uint64_t completed;
+    while ((completed = sync_completed.load(std::memory_order_acquire)) < ticket)
+    {
+        sync_completed.wait(completed, std::memory_order_acquire);
+    }
+}
 
-    // Wait for all pending writes to complete
-    std::unique_lock<std::mutex> lock(write_mutex);
-    sync_cv.wait(lock, [this]
-                 { return pending_writes.load(std::memory_order_acquire) == 0; });
+uint64_t TimeSeriesDB::request_sync()
+{
+    if (options.read_only)
+    {
+        refresh_from_disk(true);
+        follow_writer();
+        return 0;
+    }
+    uint64_t ticket = sync_requested.fetch_add(1, std::memory_order_acq_rel) + 1;
+    writer_wake->notify();
+    return ticket;
+}
 
-    // Reset sync requested flag
-    sync_requested.store(false, std::memory_order_release);
-}
\ No newline at end of file
+bool TimeSeriesDB::sync_done(uint64_t ticket) const
+{
+    return sync_completed.load(std::memory_order_acquire) >= ticket;
+}
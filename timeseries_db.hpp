@@ -1,8 +1,15 @@
 #ifndef TIMESERIES_DB_HPP
 #define TIMESERIES_DB_HPP
 
-#include "column_storage.hpp"
-#include "bplus_tree.hpp"
+#include "segment.hpp"
+#include "ring_buffer.hpp"
+#include "wal.hpp"
+#include "aggregate.hpp"
+#include "rollup.hpp"
+#include "metrics.hpp"
+#include "epoch.hpp"
+#include "subscription.hpp"
+#include "query_pool.hpp"
 #include <vector>
 #include <tuple>
 #include <string>
@@ -10,11 +17,18 @@
 #include <shared_mutex>
 #include <thread>
 #include <atomic>
-#include <condition_variable>
-#include <queue>
+#include <chrono>
+#include <exception>
 #include <functional>
+#include <memory>
 #include <iostream>  // Added for std::cerr
 #include <algorithm> // Added for std::min
+#include <filesystem>
+#include <map>
+#include <sys/types.h>
+
+class MaintenanceScheduler;
+class IoThrottle;
 
 struct Tick
 {
@@ -23,84 +37,525 @@ struct Tick
     uint64_t volume;
 };
 
+// A run of ticks already split into columns, for append_columns(). Borrow
+// one from acquire_batch(); the writer returns it to the pool once applied.
+struct TickBatch
+{
+    std::vector<uint64_t> timestamps;
+    std::vector<double> prices;
+    std::vector<uint64_t> volumes;
+
+    size_t size() const { return timestamps.size(); }
+    bool empty() const { return timestamps.empty(); }
+
+    void push_back(uint64_t timestamp, double price, uint64_t volume)
+    {
+        timestamps.push_back(timestamp);
+        prices.push_back(price);
+        volumes.push_back(volume);
+    }
+
+    // Keeps the capacity for the next use
+    void clear()
+    {
+        timestamps.clear();
+        prices.clear();
+        volumes.clear();
+    }
+};
+
+// Free list of TickBatch buffers. Released batches keep their capacity, so
+// once the pool is warm borrowing and filling a batch does not allocate.
+class BatchPool
+{
+public:
+    explicit BatchPool(size_t max_free);
+
+    // A cleared batch; a new one only if the pool is empty
+    std::unique_ptr<TickBatch> acquire();
+    // Keep the batch for reuse, or free it if max_free are already kept
+    void release(std::unique_ptr<TickBatch> batch);
+
+private:
+    std::mutex mutex;
+    std::vector<std::unique_ptr<TickBatch>> free_batches; // Reserved up front
+    size_t max_free;
+};
+
+// Execution settings for a single query
+struct QueryOptions
+{
+    // Threads scanning the range, the caller included: 1 runs the query on
+    // the calling thread, 0 uses every thread of QueryPool::global()
+    size_t parallelism = 1;
+    // Rows per task; ranges of fewer than two blocks run serially
+    size_t block_rows = 64 * 1024;
+    // Hint the kernel to read the range's column pages in (prefetch_range)
+    // before scanning; pays off for wide scans of data not yet cached
+    bool prefetch = false;
+    // Read sealed raw partitions with AsyncReader::global() (io_uring,
+    // O_DIRECT, its own block cache) instead of faulting in their mapping.
+    // Every block the range needs is in flight at once, and concurrent
+    // cold queries overlap their reads. Other partitions are read as usual.
+    bool async_io = false;
+    // Keep blocks of compressed partitions decoded for this query in
+    // BlockCache::global(). Turn off for one-off scans such as backtests so
+    // they do not push out the blocks other queries keep coming back to;
+    // cached blocks are still used.
+    bool cache_blocks = true;
+};
+
+// Tuning knobs for a TimeSeriesDB instance
+struct DBOptions
+{
+    // Ingest staging ring (rounded up to a power of two)
+    size_t ring_capacity = 1 << 16;
+    // Use the cheaper SPSC ring when exactly one thread calls append()
+    bool single_producer = false;
+    ConsumerWaitMode wait_mode = ConsumerWaitMode::SpinThenPark;
+    size_t spin_iterations = 4096; // Empty polls before parking (SpinThenPark)
+    BackpressurePolicy backpressure = BackpressurePolicy::Block;
+    // Maximum ticks the writer drains from the ring per batch
+    size_t writer_batch_size = 1000;
+    // Columnar batches (append_columns) queued for the writer; also the
+    // number of idle buffers the batch pool keeps
+    size_t batch_queue_capacity = 64;
+
+    // Width of a time partition in timestamp units (86400 = one day of
+    // second timestamps). 0 keeps the legacy single-segment layout with the
+    // column files directly under the symbol directory.
+    uint64_t partition_duration = 0;
+
+    // Reorder window in timestamp units. 0 writes ticks in arrival order,
+    // late ones included. Otherwise the writer holds the newest ticks in a
+    // sorted staging buffer and writes a tick once the newest timestamp is
+    // more than reorder_window past it, so the partitions stay sorted. Ticks
+    // older than what was already written go to out-of-order segments
+    // instead, which queries merge in.
+    uint64_t reorder_window = 0;
+
+    // Growth policy, preallocation and address-space reservation per column
+    SegmentOptions segment;
+
+    // Crash safety. With a WAL, every writer batch is logged before it is
+    // applied and recovery replays it on top of the last checkpoint.
+    DurabilityMode durability = DurabilityMode::None;
+    uint64_t fsync_interval_ms = 10;         // PeriodicFdatasync group-commit window
+    uint64_t checkpoint_interval_ms = 1000;  // Sync columns and trim the WAL this often
+    size_t wal_max_bytes = 64 * 1024 * 1024; // ... or once the WAL grows this large
+
+    // Bar widths (timestamp units) to maintain rollups for, e.g.
+    // {1, 60, 3600} for 1s/1m/1h bars over second timestamps. Empty disables
+    // rollups; query_bars then buckets the raw ticks.
+    std::vector<uint64_t> rollup_resolutions;
+
+    // Background upkeep (maintenance.hpp): compression, retention and
+    // merging the out-of-order segments run there, never on the writer.
+    // nullptr uses MaintenanceScheduler::global().
+    MaintenanceScheduler *maintenance = nullptr;
+    // Timestamp units of history to keep: sealed partitions ending more
+    // than this before the newest tick are dropped. 0 keeps everything.
+    uint64_t retention = 0;
+    // Rewrite partitions with the rows of sealed out-of-order segments
+    // merged in, then delete the segments, so queries over that history
+    // are back on the in-order path
+    bool merge_late_segments = true;
+
+    // Attach to a store another process writes, e.g. for queries from a
+    // CLI or an analytics job: no writer thread, ring, recovery or rollups,
+    // the columns are mapped read-only and nothing is built on open. Each
+    // query first picks up the rows the writer has flushed to its newest
+    // partition since (it flushes after every batch); a partition loads its
+    // index and stats the first time. Must match the writer's
+    // partition_duration and segment options. Writes throw
+    // std::runtime_error, and subscriptions are not available. Standalone
+    // stores only, not TSDBManager ones.
+    bool read_only = false;
+    // read_only: queries look for partitions the writer has added (or
+    // merged) at most this often; sync() looks right away
+    size_t refresh_interval_ms = 100;
+};
+
+// Point-in-time state of one store, for monitoring
+struct DBStats
+{
+    size_t rows = 0;
+    size_t partitions = 0;
+    size_t compressed_partitions = 0;
+    size_t queue_depth = 0; // Ticks staged in the ring, not yet written
+    size_t queue_capacity = 0;
+    uint64_t pending_writes = 0; // Accepted but not yet applied
+    uint64_t dropped_ticks = 0;
+    size_t staged_ticks = 0; // Held in the reorder window, not yet in rows
+    size_t late_rows = 0;    // Of rows, those in the out-of-order segments
+};
+
 class TimeSeriesDB
 {
 public:
-    TimeSeriesDB(const std::string &data_dir, const std::string &symbol);
+    TimeSeriesDB(const std::string &data_dir, const std::string &symbol, const DBOptions &options = DBOptions{});
+
+    // Insert a new tick. Returns false if the ring was full and the
+    // backpressure policy is Drop or Fail.
+    bool append(uint64_t timestamp, double price, uint64_t volume);
 
-    // Insert a new tick
-    void append(uint64_t timestamp, double price, uint64_t volume);
+    // Batch append for better performance. Returns the number of ticks
+    // accepted; with BackpressurePolicy::Fail the caller may retry the rest.
+    size_t append_batch(const std::vector<Tick> &ticks);
 
-    // Batch append for better performance
-    void append_batch(const std::vector<Tick> &ticks);
+    // Columnar ingest without a copy into the ring. Fill a batch from
+    // acquire_batch() and move it in; the writer logs and applies it in
+    // writer_batch_size chunks, then recycles the buffer. Batches and
+    // ring ticks reach the writer through separate queues, so their
+    // relative order is not kept. Returns false if the batch queue was
+    // full and the backpressure policy is Drop (the batch is discarded) or
+    // Fail (batch is left with the caller to retry).
+    std::unique_ptr<TickBatch> acquire_batch() { return batch_pool.acquire(); }
+    bool append_columns(std::unique_ptr<TickBatch> &&batch);
+    // append_columns() that never waits: a full batch queue is handled as
+    // under Drop if that is the policy, and as under Fail otherwise
+    bool try_append_columns(std::unique_ptr<TickBatch> &&batch);
+
+    // Bulk load for importers: the writer thread appends the columns
+    // directly, bypassing the ring and the WAL, and indexes them in one
+    // pass when the load ends. Rows become visible at end_bulk_load() (or
+    // when their partition rolls over); with a WAL it checkpoints, so they
+    // are durable once it returns. Each call returns once the rows are
+    // copied. One bulk load at a time per store.
+    void bulk_append(const uint64_t *ts, const double *px, const uint64_t *vol, size_t n);
+    void end_bulk_load();
 
     // Query by time range
     std::vector<std::tuple<uint64_t, double, uint64_t>> query_range(uint64_t start, uint64_t end) const;
+    // Same rows, copied (and sorted, if late ticks require it) block by
+    // block on query.parallelism threads
+    std::vector<std::tuple<uint64_t, double, uint64_t>> query_range(uint64_t start, uint64_t end,
+                                                                    const QueryOptions &query) const;
 
-    // Get last N ticks
+    // Get last N ticks (of the partitions: rows in the out-of-order
+    // segments are not part of the tail)
     std::vector<std::tuple<uint64_t, double, uint64_t>> query_last(size_t n) const;
 
+    // Zero-copy variants: column spans pointing straight into the mapped
+    // files, kept alive by the returned view
+    RangeView view_range(uint64_t start, uint64_t end) const;
+    RangeView view_last(size_t n) const;
+
+    // Ask the kernel to start reading the column pages that hold
+    // [start, end] (MADV_WILLNEED) and return without waiting. Compressed
+    // partitions are skipped; they decode what they read.
+    void prefetch_range(uint64_t start, uint64_t end) const;
+
+    // Aggregates over start <= timestamp <= end, computed in one pass over
+    // the mapped columns without materialising rows
+    AggregateResult aggregate_range(uint64_t start, uint64_t end, AggregateOp ops = AggregateOp::All) const;
+    // Each block of rows aggregated on its own thread, the partial results
+    // merged in row order. Sums may differ from the serial ones in the last
+    // bits.
+    AggregateResult aggregate_range(uint64_t start, uint64_t end, AggregateOp ops, const QueryOptions &query) const;
+
+    // OHLCV bars of the given width for every bucket that intersects
+    // [start, end]; boundary bars cover their whole bucket. Served from the
+    // coarsest rollup whose width divides resolution.
+    std::vector<Bar> query_bars(uint64_t start, uint64_t end, uint64_t resolution) const;
+
+    // Live tail in arrival order, from the first row with timestamp >=
+    // from_ts (0 replays everything stored, Subscription::NOW starts at the
+    // end). Pull views with next(), or pass a callback that a thread of the
+    // subscription runs on batches of at most max_rows rows until closed.
+    std::shared_ptr<Subscription> subscribe(uint64_t from_ts = Subscription::NOW);
+    std::shared_ptr<Subscription> subscribe(uint64_t from_ts, std::function<void(const RangeView &)> callback,
+                                            size_t max_rows = 4096);
+
     // Get total count of ticks
-    size_t get_count() const
-    {
-        // Ensure all columns have the same count
-        size_t ts_count = timestamps.get_count();
-        size_t pr_count = prices.get_count();
-        size_t vol_count = volumes.get_count();
-
-        if (ts_count != pr_count || pr_count != vol_count)
-        {
-            std::cerr << "WARNING: Column counts out of sync! ts=" << ts_count
-                      << " pr=" << pr_count << " vol=" << vol_count << std::endl;
-            return std::min({ts_count, pr_count, vol_count}); // Return minimum to be safe
-        }
-
-        return ts_count;
-    }
+    size_t get_count() const;
 
-    // Verify that all columns are synchronized
-    bool verify_column_sync() const
-    {
-        size_t ts_count = timestamps.get_count();
-        size_t pr_count = prices.get_count();
-        size_t vol_count = volumes.get_count();
-        return (ts_count == pr_count && pr_count == vol_count);
-    }
+    // Verify that all columns are synchronized (waits for the batch being
+    // applied, if any)
+    bool verify_column_sync() const;
+
+    // Retention: delete every sealed partition whose interval ends at or
+    // before cutoff. Returns the number of partitions removed.
+    size_t drop_partitions_before(uint64_t cutoff);
 
-    // Wait for background tasks to complete
+    // Number of segments currently open
+    size_t get_partition_count() const;
+
+    // Wait for background tasks to complete (read_only: pick up what the
+    // writer has flushed). Ticks are applied to the
+    // columns by then; with PeriodicFdatasync they reach the WAL's stable
+    // storage within fsync_interval_ms (or as soon as the ring drains).
+    // The reorder window is flushed too, so ticks arriving afterwards with
+    // older timestamps go to the out-of-order segments.
     void sync();
 
+    // sync() for callers that must not block, such as an event loop:
+    // request_sync() returns a ticket, and sync_done(ticket) turns true once
+    // every tick accepted before the request is applied and the reorder
+    // window flushed. sync() is the two with a wait in between.
+    uint64_t request_sync();
+    bool sync_done(uint64_t ticket) const;
+
+    // Ticks discarded under BackpressurePolicy::Drop
+    uint64_t get_dropped_count() const { return dropped_ticks.load(std::memory_order_relaxed); }
+
+    // Run maintenance tasks on the calling thread, unthrottled, until none
+    // is left to do. Returns the number run.
+    size_t run_maintenance();
+
+    // Row, partition and ring occupancy figures for this store. Process-wide
+    // latency and event metrics are in Metrics::global().
+    DBStats get_stats() const;
+
     ~TimeSeriesDB();
 
 private:
-    // Columnar storage
-    ColumnStorage timestamps;
-    ColumnStorage prices;
-    ColumnStorage volumes;
+    friend class TSDBManager;
+    friend class Subscription;
+    friend class MaintenanceScheduler;
+
+    // Pooled store for TSDBManager: no writer thread of its own. Producers
+    // wake pool_wake and the pool thread drives the writer via writer_step().
+    TimeSeriesDB(const std::string &data_dir, const std::string &symbol, const DBOptions &options,
+                 WakeSignal *pool_wake);
+
+    std::string data_dir;
+    std::string symbol;
+    std::string symbol_dir;
+
+    // Time partitions ordered by partition start; the last one is active.
+    // Guarded by segments_mutex, which only the writer side takes (writer
+    // thread, compression swap, retention); readers never do.
+    std::vector<std::shared_ptr<Segment>> segments;
+    mutable std::mutex segments_mutex;
+
+    // What readers see instead: an immutable copy of segments, republished
+    // after every change and retired through the epoch domain. Rows
+    // appended to a published segment become visible through its own
+    // published row count, so a batch needs no republish.
+    struct ReadSnapshot
+    {
+        std::vector<std::shared_ptr<Segment>> segments;
+        std::vector<std::shared_ptr<Segment>> late; // late_segments
+    };
+    std::atomic<const ReadSnapshot *> read_snapshot{nullptr};
+    void publish_segments(); // Caller holds segments_mutex
+    const ReadSnapshot &snapshot() const; // Caller holds an EpochGuard
 
-    // B+ Tree index for efficient time range lookups
-    BPlusTree<uint64_t, size_t> time_index;
+    DBOptions options;
 
-    // Concurrency control
-    mutable std::shared_mutex query_mutex;
+    // Lock-free staging ring drained by writer_loop; exactly one is allocated
+    std::unique_ptr<SpscRingBuffer<Tick>> spsc_queue;
+    std::unique_ptr<MpscRingBuffer<Tick>> mpsc_queue;
+    // Columnar batches owned by the queue until the writer pops them
+    std::unique_ptr<MpscRingBuffer<TickBatch *>> batch_queue;
+    BatchPool batch_pool;
+    WakeSignal data_signal;  // Producers -> parked writer
+    WakeSignal space_signal; // Writer -> producers blocked on a full ring
+    WakeSignal *writer_wake; // data_signal, or the shard signal of a writer pool
 
     // Background writer thread
     std::thread writer_thread;
     std::atomic<bool> stop_writer{false};
-    std::condition_variable cv;
-    std::mutex write_mutex;
-    std::queue<Tick> write_queue;
 
-    // Synchronization for sync() operation
-    std::condition_variable sync_cv;
+    // Ticks accepted but not yet written, for get_stats()
     std::atomic<size_t> pending_writes{0};
-    std::atomic<bool> sync_requested{false};
+    std::atomic<uint64_t> dropped_ticks{0};
+
+    // Sync tickets. The writer takes the newest requested ticket, notes how
+    // far producers had pushed into both queues, and completes it once it
+    // has popped (and so applied) that far; requests arriving meanwhile
+    // wait for the next round, so steady ingest cannot hold a ticket back.
+    std::atomic<uint64_t> sync_requested{0};
+    std::atomic<uint64_t> sync_completed{0}; // sync() waits on it
+    uint64_t sync_ticket = 0; // Writer only, with the positions below
+    size_t sync_ring_target = 0;
+    size_t sync_batch_target = 0;
+
+    // Append-to-durable sampling: producers count accepted ticks, the
+    // writer counts drained ones and reports them once durable
+    std::atomic<uint64_t> accepted_ticks{0};
+    uint64_t drained_ticks = 0;
+    DurabilityProbe durability_probe;
+    void sync_wal(); // wal->sync() plus its metrics
+
+    // Ring helpers hiding the SPSC/MPSC choice
+    size_t append_batch_impl(const Tick *ticks, size_t count);
+    bool enqueue_columns(std::unique_ptr<TickBatch> &batch, BackpressurePolicy policy);
+    size_t enqueue(const Tick *ticks, size_t count);
+    size_t dequeue(Tick *out, size_t max);
+    bool queue_empty() const;
+    bool queue_full() const;
+    bool batch_queue_full() const;
+    void wait_for_space(bool (TimeSeriesDB::*full)() const = &TimeSeriesDB::queue_full);
+    void wait_for_data();
 
     // Worker thread function
     void writer_loop();
+    // Writer work shared by writer_loop and pool threads. bulk_step() runs a
+    // pending bulk load step and sync_step() completes a sync ticket once
+    // the rings drained past it; drain_batch() applies one batch from the ring;
+    // idle_work() commits the WAL. Each returns true if it did anything.
+    bool bulk_step();
+    bool sync_step();
+    bool has_writer_request() const;
+    bool drain_batch();
+    bool idle_work();
+    bool writer_step();
+    bool has_writer_work() const;
+    void finish_writer(); // Final WAL commit and checkpoint
+    std::vector<Tick> drain_buffer;
+    // Column scratch for write_batch, sized once to writer_batch_size
+    std::vector<uint64_t> drain_ts;
+    std::vector<double> drain_px;
+    std::vector<uint64_t> drain_vol;
+    void write_batch(const Tick *batch, size_t batch_size);
+    // Log and apply n rows, then count them out of pending_writes
+    void write_columns(const uint64_t *ts, const double *px, const uint64_t *vol, size_t n);
+    bool drain_columns(); // Apply one queued columnar batch
+    // Route rows to segments; caller holds segments_mutex. first_seq 0
+    // marks rows from the reorder window, which do not move applied_seq.
+    void apply_batch(uint64_t first_seq, const uint64_t *ts, const double *px, const uint64_t *vol, size_t n);
+    // A logged batch: straight to apply_batch, or through the reorder window
+    void route_batch(uint64_t first_seq, const uint64_t *ts, const double *px, const uint64_t *vol, size_t n);
+
+    // Reorder window, owned by the writer and guarded by segments_mutex.
+    // staged[staged_head, end) is sorted by timestamp (arrival order among
+    // equal ones); flushed_max is the newest timestamp in the partitions.
+    // Checkpoints save the staged ticks, so the WAL can be trimmed anyway.
+    std::vector<Tick> staged;
+    size_t staged_head = 0;
+    uint64_t flushed_max = 0;
+    std::atomic<size_t> staged_count{0};      // For get_stats()
+    std::vector<Tick> stage_incoming;         // Scratch buffers, reused per batch
+    std::vector<Tick> stage_merged;
+    std::vector<uint64_t> scratch_ts;
+    std::vector<double> scratch_px;
+    std::vector<uint64_t> scratch_vol;
+    void stage_batch(const uint64_t *ts, const double *px, const uint64_t *vol, size_t n);
+    void flush_staged(size_t until); // Write staged[staged_head, until) to the partitions
+
+    // Out-of-order segments late_<n> in creation order, guarded by
+    // segments_mutex. Ticks older than the reorder window are appended to
+    // the last one; retention seals it and drops sealed ones from the front
+    // once all their rows are older than the cutoff.
+    std::vector<std::shared_ptr<Segment>> late_segments;
+    void open_late_segments();
+    void apply_late(const uint64_t *ts, const double *px, const uint64_t *vol, size_t n);
+    std::string late_name(uint64_t number) const;
+
+    // Bulk load step handed to the writer, which clears it once applied
+    struct BulkJob
+    {
+        const uint64_t *ts;
+        const double *px;
+        const uint64_t *vol;
+        size_t n;
+        bool finish; // end_bulk_load(): index, publish and checkpoint
+        std::exception_ptr error;
+    };
+    std::atomic<BulkJob *> bulk_job{nullptr};
+    std::mutex bulk_mutex; // One bulk caller at a time
+    void submit_bulk(BulkJob &job);
+    void apply_bulk(const BulkJob &job);
+
+    // Write-ahead log state, owned by the writer thread after construction
+    std::unique_ptr<WriteAheadLog> wal;
+    uint64_t next_seq = 1;    // Sequence number of the next tick to log
+    uint64_t logged_seq = 0;  // Last tick appended to the WAL
+    uint64_t applied_seq = 0; // Last tick applied to the columns
+    std::chrono::steady_clock::time_point last_checkpoint;
+
+    // Replay the WAL over the last checkpoint; runs before the writer starts
+    void recover();
+    // Make the columns durable up to applied_seq and trim the WAL; caller
+    // holds segments_mutex
+    void write_checkpoint();
+
+    // Open existing segments from disk (each rebuilds its own index)
+    void open_segments();
+
+    // read_only: segments and late_segments mirror the writer's directory
+    // as of its last listing. Once refresh_interval_ms has passed (a clock
+    // check, no lock) one query takes segments_mutex and lists it again if
+    // it changed or the last listing may have raced a change; the listing
+    // state below is guarded by it. Every query then has the newest
+    // partition and late segment of the snapshot follow the writer's rows:
+    // sealed ones cannot grow, so the read path stays lock-free unless
+    // there are rows to pick up.
+    std::filesystem::file_time_type listed_mtime{};
+    std::filesystem::file_time_type listed_at{};
+    std::map<std::string, ino_t> listed_inodes; // Segment path -> directory inode
+    bool listed = false;
+    std::atomic<int64_t> next_refresh_ns{0}; // steady_clock time of the next look
+    std::mutex follow_mutex;                 // Segment::follow() takes one caller at a time
+    void follow_writer() const; // Called at the start of every query
+    // wait: block on segments_mutex instead of leaving it to the query
+    // already listing
+    void refresh_from_disk(bool wait);
+    bool list_partitions(); // Caller holds segments_mutex; false if incomplete
+    void check_writable() const;
+
+    // Sealed segments waiting to be compressed, oldest first, guarded by
+    // segments_mutex. Maintenance compresses one per task and swaps it in.
+    std::vector<std::shared_ptr<Segment>> pending_compression;
+
+    // Maintenance tasks, run by the scheduler one at a time per store (or by
+    // run_maintenance) under maintenance_mutex. Each returns true if it did
+    // anything.
+    MaintenanceScheduler *maintenance;
+    std::mutex maintenance_mutex;
+    bool maintenance_step(IoThrottle &throttle); // The first task with work to do
+    bool enforce_retention();
+    bool compress_next_segment(IoThrottle &throttle);
+    bool seal_idle_late_segment();
+    bool merge_late_segment(IoThrottle &throttle);
+    bool save_sealed_indexes();
+    // Active out-of-order segment and its rows as of the previous task run;
+    // it is sealed once a run finds it unchanged
+    uint64_t late_seen_segment = 0;
+    size_t late_seen_rows = 0;
+    // Out-of-order segment named by the last checkpoint, guarded by
+    // segments_mutex. Only those before it are merged: rows of later ones
+    // may be replayed from the WAL.
+    uint64_t checkpoint_late = 0;
+
+    // A merge commits by writing COMPACTION_FILE (the out-of-order segment,
+    // then the partitions replacing their compact_<name> stand-ins). Opening
+    // the store finishes a committed merge and discards an uncommitted one.
+    static constexpr const char *COMPACTION_FILE = "compaction.pending";
+    void recover_compaction();
+
+    // Rollups ordered by resolution, fed from apply_batch. Bars are updated
+    // in place, so the writer's update and query_bars share a lock.
+    std::vector<std::unique_ptr<Rollup>> rollups;
+    mutable std::shared_mutex rollup_mutex;
+    bool rows_rewritten = false; // Recovery truncated or replayed rows
+    void open_rollups();
+
+    // Query bodies over one snapshot; caller holds an EpochGuard
+    // Honours query.async_io and query.cache_blocks
+    RangeView view_range_unlocked(const ReadSnapshot &snapshot, uint64_t start, uint64_t end,
+                                  const QueryOptions &query = QueryOptions{}) const;
+    void prefetch_unlocked(const ReadSnapshot &snapshot, uint64_t start, uint64_t end) const;
+    RangeView view_last_unlocked(const ReadSnapshot &snapshot, size_t n) const;
+    AggregateResult aggregate_unlocked(const ReadSnapshot &snapshot, uint64_t start, uint64_t end,
+                                       AggregateOp ops) const;
+    std::vector<Bar> query_bars_unlocked(const ReadSnapshot &snapshot, uint64_t start, uint64_t end,
+                                         uint64_t resolution) const;
+
+    // Subscriptions; the writer notifies the hub after every batch
+    std::shared_ptr<SubscriberHub> subscribers;
+    TailCursor tail_cursor_at(uint64_t from_ts) const;
+    // Views past cursor in arrival order, advancing it; gap is set if
+    // retention dropped the partition under the cursor
+    RangeView read_tail(TailCursor &cursor, size_t max_rows, bool &gap) const;
+    size_t tail_lag(const TailCursor &cursor) const;
 
-    // Rebuild index from storage
-    void rebuild_index();
+    // Partition routing
+    uint64_t partition_start_for(uint64_t timestamp) const;
+    Segment &active_segment_for(uint64_t timestamp);
+    std::string partition_name(uint64_t partition_start) const;
 };
 
 #endif // TIMESERIES_DB_HPP
\ No newline at end of file
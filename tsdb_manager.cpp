@@ -0,0 +1,201 @@
+#include "tsdb_manager.hpp"
+#include <algorithm>
+#include <filesystem>
+#include <functional>
+#include <stdexcept>
+
+TSDBManager::TSDBManager(const std::string &data_dir, const ManagerOptions &options)
+    : data_dir(data_dir),
+      options(options)
+{
+    size_t threads = options.writer_threads;
+    if (threads == 0)
+        threads = std::max(1u, std::thread::hardware_concurrency());
+
+    std::filesystem::create_directories(data_dir);
+
+    shards.reserve(threads);
+    for (size_t i = 0; i < threads; ++i)
+        shards.push_back(std::make_unique<Shard>());
+    for (auto &shard : shards)
+        shard->thread = std::thread(&TSDBManager::writer_loop, this, std::ref(*shard));
+}
+
+TSDBManager::~TSDBManager()
+{
+    stop.store(true, std::memory_order_release);
+    for (auto &shard : shards)
+    {
+        shard->wake.wake_all();
+        if (shard->thread.joinable())
+            shard->thread.join();
+    }
+
+    // Each store drains what is left in its ring as it closes
+    stores.clear();
+}
+
+TSDBManager::Shard &TSDBManager::shard_for(const std::string &symbol)
+{
+    return *shards[std::hash<std::string>{}(symbol) % shards.size()];
+}
+
+TimeSeriesDB &TSDBManager::get(const std::string &symbol)
+{
+    {
+        std::shared_lock<std::shared_mutex> lock(catalog_mutex);
+        auto it = stores.find(symbol);
+        if (it != stores.end())
+            return *it->second;
+    }
+
+    std::promise<TimeSeriesDB *> opened;
+    std::shared_future<TimeSeriesDB *> other;
+    {
+        std::unique_lock<std::shared_mutex> lock(catalog_mutex);
+        auto it = stores.find(symbol);
+        if (it != stores.end())
+            return *it->second;
+        auto open = opening.find(symbol);
+        if (open != opening.end())
+            other = open->second;
+        else
+            opening.emplace(symbol, opened.get_future().share());
+    }
+    if (other.valid())
+        return *other.get(); // Rethrows if that open failed
+
+    // Opening maps the columns and replays the WAL. It runs outside the
+    // catalog lock, so lookups of other symbols do not wait for it.
+    Shard &shard = shard_for(symbol);
+    std::unique_ptr<TimeSeriesDB> store;
+    try
+    {
+        store.reset(new TimeSeriesDB(data_dir, symbol, options.store, &shard.wake));
+    }
+    catch (...)
+    {
+        {
+            std::unique_lock<std::shared_mutex> lock(catalog_mutex);
+            opening.erase(symbol);
+        }
+        opened.set_exception(std::current_exception());
+        throw;
+    }
+    TimeSeriesDB &ref = *store;
+
+    {
+        std::lock_guard<std::mutex> shard_lock(shard.mutex);
+        shard.stores.push_back(&ref);
+        shard.version.fetch_add(1, std::memory_order_release);
+    }
+    shard.wake.wake_all();
+
+    {
+        std::unique_lock<std::shared_mutex> lock(catalog_mutex);
+        stores.emplace(symbol, std::move(store));
+        opening.erase(symbol);
+    }
+    opened.set_value(&ref);
+    return ref;
+}
+
+TimeSeriesDB *TSDBManager::find(const std::string &symbol) const
+{
+    std::shared_lock<std::shared_mutex> lock(catalog_mutex);
+    auto it = stores.find(symbol);
+    return it == stores.end() ? nullptr : it->second.get();
+}
+
+std::vector<std::string> TSDBManager::list_symbols() const
+{
+    std::vector<std::string> symbols;
+    for (const auto &entry : std::filesystem::directory_iterator(data_dir))
+    {
+        if (entry.is_directory())
+            symbols.push_back(entry.path().filename().string());
+    }
+    std::sort(symbols.begin(), symbols.end());
+    return symbols;
+}
+
+size_t TSDBManager::open_count() const
+{
+    std::shared_lock<std::shared_mutex> lock(catalog_mutex);
+    return stores.size();
+}
+
+void TSDBManager::sync_all()
+{
+    std::shared_lock<std::shared_mutex> lock(catalog_mutex);
+    for (const auto &[symbol, store] : stores)
+        store->sync();
+}
+
+std::vector<const TimeSeriesDB *> TSDBManager::existing_stores(const std::vector<std::string> &symbols)
+{
+    std::vector<const TimeSeriesDB *> found;
+    for (const auto &symbol : symbols)
+    {
+        // get() would create a store for a mistyped symbol
+        TimeSeriesDB *store = find(symbol);
+        if (!store && !std::filesystem::is_directory(data_dir + "/" + symbol))
+        {
+            throw std::invalid_argument("Unknown symbol: " + symbol);
+        }
+        found.push_back(store ? store : &get(symbol));
+    }
+    return found;
+}
+
+void TSDBManager::query_asof(const std::vector<std::string> &symbols, uint64_t start, uint64_t end,
+                             const AsofOptions &options, const AsofCallback &callback)
+{
+    ::query_asof(existing_stores(symbols), start, end, options, callback);
+}
+
+void TSDBManager::query_merge(const std::vector<std::string> &symbols, uint64_t start, uint64_t end,
+                              const MergeCallback &callback, size_t batch_rows)
+{
+    ::query_merge(existing_stores(symbols), start, end, callback, batch_rows);
+}
+
+void TSDBManager::writer_loop(Shard &shard)
+{
+    // Private copy of the shard's store list, refreshed when it changes.
+    // Stores outlive the pool threads, so plain pointers are safe.
+    std::vector<TimeSeriesDB *> local;
+    uint64_t seen = 0;
+
+    while (true)
+    {
+        uint64_t version = shard.version.load(std::memory_order_acquire);
+        if (version != seen)
+        {
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            local = shard.stores;
+            seen = version;
+        }
+
+        // One batch (or one piece of idle work) per store per pass keeps a
+        // busy symbol from starving the rest of the shard
+        bool busy = false;
+        for (TimeSeriesDB *store : local)
+            busy |= store->writer_step();
+        if (busy)
+            continue;
+        if (stop.load(std::memory_order_acquire))
+            break;
+
+        // Re-check after announcing ourselves so a concurrent push cannot be missed
+        uint32_t token = shard.wake.prepare_park();
+        if (stop.load(std::memory_order_acquire) || shard.version.load(std::memory_order_acquire) != seen ||
+            std::any_of(local.begin(), local.end(), [](TimeSeriesDB *store)
+                        { return store->has_writer_work(); }))
+        {
+            shard.wake.cancel_park();
+            continue;
+        }
+        shard.wake.park(token);
+    }
+}
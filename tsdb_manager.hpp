@@ -0,0 +1,92 @@
+#ifndef TSDB_MANAGER_HPP
+#define TSDB_MANAGER_HPP
+
+#include "asof.hpp"
+#include "timeseries_db.hpp"
+#include <atomic>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+struct ManagerOptions
+{
+    // Writer threads shared by all symbols; 0 uses one per hardware thread
+    size_t writer_threads = 0;
+
+    // Options for every symbol store. The ring is allocated per symbol, so
+    // the default is much smaller than a standalone TimeSeriesDB's.
+    // wait_mode is ignored: pool threads park once all their symbols idle.
+    DBOptions store = []
+    {
+        DBOptions options;
+        options.ring_capacity = 4096;
+        return options;
+    }();
+};
+
+// Catalog of the symbol stores under one data directory. Stores are opened
+// on first use and kept open until the manager goes away. Instead of one
+// writer thread per store, a fixed pool of writer threads each owns a shard
+// of the symbols and drains their rings round-robin, one batch per symbol
+// per pass.
+class TSDBManager
+{
+public:
+    explicit TSDBManager(const std::string &data_dir, const ManagerOptions &options = ManagerOptions{});
+    ~TSDBManager();
+
+    TSDBManager(const TSDBManager &) = delete;
+    TSDBManager &operator=(const TSDBManager &) = delete;
+
+    // Store for symbol, opening (or creating) it on first use
+    TimeSeriesDB &get(const std::string &symbol);
+    // Store for symbol if it is already open, nullptr otherwise
+    TimeSeriesDB *find(const std::string &symbol) const;
+
+    // Symbols with a directory under data_dir, open or not, sorted
+    std::vector<std::string> list_symbols() const;
+    size_t open_count() const;
+    size_t get_writer_threads() const { return shards.size(); }
+
+    // Wait until every open store has applied all accepted ticks
+    void sync_all();
+
+    // Cross-symbol queries (asof.hpp) over the stores of symbols, opened as
+    // needed. Throws std::invalid_argument for a symbol with no directory.
+    void query_asof(const std::vector<std::string> &symbols, uint64_t start, uint64_t end,
+                    const AsofOptions &options, const AsofCallback &callback);
+    void query_merge(const std::vector<std::string> &symbols, uint64_t start, uint64_t end,
+                     const MergeCallback &callback, size_t batch_rows = 4096);
+
+private:
+    struct Shard
+    {
+        WakeSignal wake;
+        std::mutex mutex;
+        std::vector<TimeSeriesDB *> stores; // Guarded by mutex
+        std::atomic<uint64_t> version{0};   // Bumped when stores changes
+        std::thread thread;
+    };
+
+    void writer_loop(Shard &shard);
+    std::vector<const TimeSeriesDB *> existing_stores(const std::vector<std::string> &symbols);
+    Shard &shard_for(const std::string &symbol);
+
+    std::string data_dir;
+    ManagerOptions options;
+
+    mutable std::shared_mutex catalog_mutex;
+    std::unordered_map<std::string, std::unique_ptr<TimeSeriesDB>> stores;
+    // Symbols being opened by some get() call; others wait on its result
+    std::unordered_map<std::string, std::shared_future<TimeSeriesDB *>> opening;
+
+    std::vector<std::unique_ptr<Shard>> shards;
+    std::atomic<bool> stop{false};
+};
+
+#endif // TSDB_MANAGER_HPP
@@ -0,0 +1,318 @@
+#include "wal.hpp"
+#include "checksum.hpp"
+#include "file_util.hpp"
+#include <cerrno>
+#include <cstdio>
+#include <fcntl.h>
+#include <filesystem>
+#include <stdexcept>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <system_error>
+#include <unistd.h>
+#include <vector>
+
+namespace
+{
+    constexpr uint32_t WAL_RECORD_MAGIC = 0x4c415754; // "TWAL"
+    constexpr uint64_t CHECKPOINT_MAGIC = 0x54504b4342445354ULL; // "TSDBCKPT"
+
+    struct WalRecordHeader
+    {
+        uint32_t magic;
+        uint32_t count;
+        uint64_t first_seq;
+        uint32_t crc; // Over first_seq, count and the three column arrays
+        uint32_t reserved;
+    };
+
+    struct CheckpointRecord
+    {
+        uint64_t magic;
+        uint64_t applied_seq;
+        uint64_t active_partition;
+        uint64_t active_rows;
+        uint32_t crc;
+        uint32_t flags;
+    };
+
+    // Flag: a CheckpointReorderRecord and the staged columns follow
+    constexpr uint32_t CHECKPOINT_HAS_REORDER = 1;
+
+    struct CheckpointReorderRecord
+    {
+        uint64_t late_segment;
+        uint64_t late_rows;
+        uint64_t staged;
+        uint32_t crc; // Over the fields above and the three staged columns
+        uint32_t reserved;
+    };
+
+    uint32_t reorder_crc(const CheckpointReorderRecord &record, const void *ts, const void *px, const void *vol)
+    {
+        size_t bytes = record.staged * sizeof(uint64_t);
+        uint32_t crc = crc32c(&record, offsetof(CheckpointReorderRecord, crc));
+        crc = crc32c(ts, bytes, crc);
+        crc = crc32c(px, bytes, crc);
+        return crc32c(vol, bytes, crc);
+    }
+
+    uint32_t record_crc(uint64_t first_seq, uint32_t count, const void *ts, const void *px, const void *vol)
+    {
+        uint32_t crc = crc32c(&first_seq, sizeof(first_seq));
+        crc = crc32c(&count, sizeof(count), crc);
+        crc = crc32c(ts, count * sizeof(uint64_t), crc);
+        crc = crc32c(px, count * sizeof(double), crc);
+        return crc32c(vol, count * sizeof(uint64_t), crc);
+    }
+}
+
+WriteAheadLog::WriteAheadLog(const std::string &path)
+    : path(path), last_sync_time(std::chrono::steady_clock::now())
+{
+    fd = open(path.c_str(), O_RDWR | O_CREAT | O_APPEND, 0666);
+    if (fd == -1)
+    {
+        throw std::system_error(errno, std::generic_category(), "Failed to open WAL " + path);
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) == -1)
+    {
+        close(fd);
+        throw std::system_error(errno, std::generic_category(), "Failed to stat WAL " + path);
+    }
+    file_size = static_cast<size_t>(st.st_size);
+}
+
+WriteAheadLog::~WriteAheadLog()
+{
+    if (fd != -1)
+    {
+        if (unsynced)
+            fdatasync(fd);
+        close(fd);
+    }
+}
+
+void WriteAheadLog::append(uint64_t first_seq, const uint64_t *ts, const double *px, const uint64_t *vol, size_t n)
+{
+    if (n == 0)
+        return;
+
+    WalRecordHeader header{WAL_RECORD_MAGIC, static_cast<uint32_t>(n), first_seq, 0, 0};
+    header.crc = record_crc(first_seq, header.count, ts, px, vol);
+
+    // One gathered write per batch
+    iovec parts[4] = {
+        {&header, sizeof(header)},
+        {const_cast<uint64_t *>(ts), n * sizeof(uint64_t)},
+        {const_cast<double *>(px), n * sizeof(double)},
+        {const_cast<uint64_t *>(vol), n * sizeof(uint64_t)},
+    };
+    size_t total = sizeof(header) + n * (sizeof(uint64_t) + sizeof(double) + sizeof(uint64_t));
+
+    ssize_t written = writev(fd, parts, 4);
+    if (written < 0 || static_cast<size_t>(written) != total)
+    {
+        // Partial writev is rare (signals, full disk); finish it piecewise
+        size_t done = written < 0 ? 0 : static_cast<size_t>(written);
+        if (written < 0 && errno != EINTR)
+        {
+            throw std::system_error(errno, std::generic_category(), "Failed to append to WAL " + path);
+        }
+        for (const auto &part : parts)
+        {
+            if (done >= part.iov_len)
+            {
+                done -= part.iov_len;
+                continue;
+            }
+            write_fully(fd, static_cast<const char *>(part.iov_base) + done, part.iov_len - done, path);
+            done = 0;
+        }
+    }
+
+    file_size += total;
+    unsynced = true;
+}
+
+void WriteAheadLog::sync()
+{
+    if (unsynced && fdatasync(fd) == -1)
+    {
+        throw std::system_error(errno, std::generic_category(), "fdatasync failed for WAL " + path);
+    }
+    unsynced = false;
+    last_sync_time = std::chrono::steady_clock::now();
+}
+
+void WriteAheadLog::reset()
+{
+    if (ftruncate(fd, 0) == -1)
+    {
+        throw std::system_error(errno, std::generic_category(), "Failed to truncate WAL " + path);
+    }
+    file_size = 0;
+    unsynced = false;
+}
+
+uint64_t WriteAheadLog::replay(const ReplayFn &fn)
+{
+    uint64_t last_seq = 0;
+    size_t offset = 0;
+    std::vector<char> payload;
+
+    while (offset + sizeof(WalRecordHeader) <= file_size)
+    {
+        WalRecordHeader header;
+        if (pread(fd, &header, sizeof(header), static_cast<off_t>(offset)) != static_cast<ssize_t>(sizeof(header)) ||
+            header.magic != WAL_RECORD_MAGIC || header.count == 0)
+            break;
+
+        size_t n = header.count;
+        size_t payload_size = n * (sizeof(uint64_t) + sizeof(double) + sizeof(uint64_t));
+        if (offset + sizeof(header) + payload_size > file_size)
+            break;
+
+        payload.resize(payload_size);
+        if (pread(fd, payload.data(), payload_size, static_cast<off_t>(offset + sizeof(header))) !=
+            static_cast<ssize_t>(payload_size))
+            break;
+
+        const char *ts = payload.data();
+        const char *px = ts + n * sizeof(uint64_t);
+        const char *vol = px + n * sizeof(double);
+        if (record_crc(header.first_seq, header.count, ts, px, vol) != header.crc)
+            break;
+
+        fn(header.first_seq, reinterpret_cast<const uint64_t *>(ts), reinterpret_cast<const double *>(px),
+           reinterpret_cast<const uint64_t *>(vol), n);
+        last_seq = header.first_seq + n - 1;
+        offset += sizeof(header) + payload_size;
+    }
+
+    if (offset < file_size)
+    {
+        // Torn tail from a crash mid-append: cut it off before new records land
+        if (ftruncate(fd, static_cast<off_t>(offset)) == -1)
+        {
+            throw std::system_error(errno, std::generic_category(), "Failed to truncate WAL " + path);
+        }
+        file_size = offset;
+    }
+    return last_seq;
+}
+
+bool WalCheckpoint::load(const std::string &path, WalCheckpoint &out)
+{
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd == -1)
+        return false;
+
+    CheckpointRecord record;
+    ssize_t got = pread(fd, &record, sizeof(record), 0);
+    if (got != static_cast<ssize_t>(sizeof(record)) || record.magic != CHECKPOINT_MAGIC ||
+        crc32c(&record, offsetof(CheckpointRecord, crc)) != record.crc)
+    {
+        close(fd);
+        return false;
+    }
+
+    out = WalCheckpoint{};
+    out.applied_seq = record.applied_seq;
+    out.active_partition = record.active_partition;
+    out.active_rows = record.active_rows;
+    if (record.flags & CHECKPOINT_HAS_REORDER)
+    {
+        CheckpointReorderRecord reorder;
+        got = pread(fd, &reorder, sizeof(reorder), sizeof(record));
+        if (got != static_cast<ssize_t>(sizeof(reorder)))
+        {
+            close(fd);
+            return false;
+        }
+        // The count is not covered by a CRC yet: it has to fit in the file
+        // before it sizes anything
+        struct stat st;
+        off_t offset = sizeof(record) + sizeof(reorder);
+        if (fstat(fd, &st) == -1 || st.st_size < offset ||
+            reorder.staged > static_cast<uint64_t>(st.st_size - offset) / (3 * sizeof(uint64_t)))
+        {
+            close(fd);
+            return false;
+        }
+        size_t bytes = reorder.staged * sizeof(uint64_t);
+        out.staged_ts.resize(reorder.staged);
+        out.staged_px.resize(reorder.staged);
+        out.staged_vol.resize(reorder.staged);
+        bool complete = pread(fd, out.staged_ts.data(), bytes, offset) == static_cast<ssize_t>(bytes) &&
+                        pread(fd, out.staged_px.data(), bytes, offset + bytes) == static_cast<ssize_t>(bytes) &&
+                        pread(fd, out.staged_vol.data(), bytes, offset + 2 * bytes) == static_cast<ssize_t>(bytes);
+        if (!complete || reorder_crc(reorder, out.staged_ts.data(), out.staged_px.data(), out.staged_vol.data()) !=
+                             reorder.crc)
+        {
+            close(fd);
+            return false;
+        }
+        out.late_segment = reorder.late_segment;
+        out.late_rows = reorder.late_rows;
+    }
+    close(fd);
+    return true;
+}
+
+void WalCheckpoint::save(const std::string &path) const
+{
+    bool reorder = late_segment != 0 || !staged_ts.empty();
+    CheckpointRecord record{CHECKPOINT_MAGIC, applied_seq, active_partition, active_rows, 0,
+                            reorder ? CHECKPOINT_HAS_REORDER : 0};
+    record.crc = crc32c(&record, offsetof(CheckpointRecord, crc));
+
+    // One buffer, one write: header, then the reorder state if any
+    std::vector<char> buffer(reinterpret_cast<const char *>(&record),
+                             reinterpret_cast<const char *>(&record) + sizeof(record));
+    if (reorder)
+    {
+        CheckpointReorderRecord extra{late_segment, late_rows, staged_ts.size(), 0, 0};
+        extra.crc = reorder_crc(extra, staged_ts.data(), staged_px.data(), staged_vol.data());
+        size_t bytes = staged_ts.size() * sizeof(uint64_t);
+        buffer.insert(buffer.end(), reinterpret_cast<const char *>(&extra),
+                      reinterpret_cast<const char *>(&extra) + sizeof(extra));
+        for (const void *column : {static_cast<const void *>(staged_ts.data()),
+                                   static_cast<const void *>(staged_px.data()),
+                                   static_cast<const void *>(staged_vol.data())})
+        {
+            buffer.insert(buffer.end(), static_cast<const char *>(column), static_cast<const char *>(column) + bytes);
+        }
+    }
+
+    std::string tmp_path = path + ".tmp";
+    int fd = open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (fd == -1)
+    {
+        throw std::system_error(errno, std::generic_category(), "Failed to open checkpoint " + tmp_path);
+    }
+    try
+    {
+        write_fully(fd, buffer.data(), buffer.size(), tmp_path);
+    }
+    catch (...)
+    {
+        close(fd);
+        throw;
+    }
+    if (fsync(fd) == -1)
+    {
+        int err = errno;
+        close(fd);
+        throw std::system_error(err, std::generic_category(), "fsync failed for checkpoint " + tmp_path);
+    }
+    close(fd);
+
+    if (std::rename(tmp_path.c_str(), path.c_str()) != 0)
+    {
+        throw std::system_error(errno, std::generic_category(), "Failed to install checkpoint " + path);
+    }
+    fsync_directory(path);
+}
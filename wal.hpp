@@ -0,0 +1,84 @@
+#ifndef WAL_HPP
+#define WAL_HPP
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+// How hard the writer works to make accepted ticks survive a crash
+enum class DurabilityMode
+{
+    None,             // No WAL; columns are flushed with MS_ASYNC only
+    BatchFsync,       // Every writer batch is fdatasync'd before it is applied
+    PeriodicFdatasync // At most one fdatasync per interval, and when the ring drains
+};
+
+// Sequential write-ahead log of tick batches. Each record carries the
+// sequence number of its first tick and a CRC over header and payload, so
+// replay stops cleanly at a torn tail. Ticks are stored column-wise, exactly
+// as the writer hands them to the segments.
+class WriteAheadLog
+{
+public:
+    explicit WriteAheadLog(const std::string &path);
+    ~WriteAheadLog();
+
+    WriteAheadLog(const WriteAheadLog &) = delete;
+    WriteAheadLog &operator=(const WriteAheadLog &) = delete;
+
+    // Append one batch record (one write, not yet durable)
+    void append(uint64_t first_seq, const uint64_t *ts, const double *px, const uint64_t *vol, size_t n);
+
+    // fdatasync everything appended so far (group commit)
+    void sync();
+    bool has_unsynced() const { return unsynced; }
+    std::chrono::steady_clock::time_point last_sync() const { return last_sync_time; }
+
+    // Drop all records (after a checkpoint made them redundant)
+    void reset();
+
+    size_t size_bytes() const { return file_size; }
+
+    // Call fn for each intact record in order; a torn or corrupt record ends
+    // the log and is truncated away. Returns the last sequence number seen.
+    using ReplayFn = std::function<void(uint64_t first_seq, const uint64_t *ts, const double *px,
+                                        const uint64_t *vol, size_t n)>;
+    uint64_t replay(const ReplayFn &fn);
+
+    static constexpr const char *FILE_NAME = "wal.log";
+
+private:
+    int fd = -1;
+    std::string path;
+    size_t file_size = 0;
+    bool unsynced = false;
+    std::chrono::steady_clock::time_point last_sync_time;
+};
+
+// What the columns are known to hold durably: every tick with sequence
+// number <= applied_seq, with the active partition holding exactly
+// active_rows rows. With a reorder window, some of those ticks are still in
+// the staging buffer instead and are saved here, and the active
+// out-of-order segment (0: none yet) holds exactly late_rows rows. Written
+// atomically (temp file, fsync, rename).
+struct WalCheckpoint
+{
+    uint64_t applied_seq = 0;
+    uint64_t active_partition = 0;
+    uint64_t active_rows = 0;
+    uint64_t late_segment = 0;
+    uint64_t late_rows = 0;
+    std::vector<uint64_t> staged_ts;
+    std::vector<double> staged_px;
+    std::vector<uint64_t> staged_vol;
+
+    static bool load(const std::string &path, WalCheckpoint &out);
+    void save(const std::string &path) const;
+
+    static constexpr const char *FILE_NAME = "checkpoint.bin";
+};
+
+#endif // WAL_HPP
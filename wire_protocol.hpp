@@ -0,0 +1,92 @@
+#ifndef WIRE_PROTOCOL_HPP
+#define WIRE_PROTOCOL_HPP
+
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+
+// Binary protocol of tsdb_server. Every message is a fixed header followed
+// by length payload bytes; integers and doubles are little-endian, exactly
+// as they sit in the column files. A connection may send any number of
+// requests without waiting: responses come back in request order, tagged
+// with the request_id they answer. A request for a symbol the server has
+// not opened yet is answered Busy while the store opens in the background;
+// send it again a little later.
+//
+// Request payload: symbol_length bytes of symbol, then per op
+//   Append     u32 count, u64 timestamps[count], f64 prices[count],
+//              u64 volumes[count]
+//   Range      u64 start, u64 end (inclusive)
+//   Last       u64 n
+//   Aggregate  u64 start, u64 end, u32 AggregateOp flags
+//   Sync       nothing
+//   Stats      u8 format (0 text, 1 JSON); the symbol may be empty
+//
+// Response payload when status is Ok
+//   Append     u64 accepted ticks
+//   Range/Last u64 rows, u64 timestamps[rows], f64 prices[rows],
+//              u64 volumes[rows]
+//   Aggregate  WireAggregate
+//   Sync       nothing
+//   Stats      the server's metrics snapshot rendered in that format,
+//              preceded by the symbol's store figures if it is open
+// Any other status carries an error message as its payload.
+
+static_assert(std::endian::native == std::endian::little, "the wire format is the in-memory layout");
+
+enum class WireOp : uint8_t
+{
+    Append = 1,
+    Range = 2,
+    Last = 3,
+    Aggregate = 4,
+    Sync = 5, // Answered once the symbol's accepted ticks are applied
+    Stats = 6 // Metrics of the serving process; never opens a store
+};
+
+enum class WireStatus : uint8_t
+{
+    Ok = 0,
+    BadRequest = 1, // Malformed payload, unknown op or invalid symbol
+    NotFound = 2,   // Query for a symbol with no data directory
+    Rejected = 3,   // Append refused: the store's queue is full, retry later
+    Error = 4,      // The store threw while serving the request
+    Busy = 5        // The symbol's store is still opening, retry later
+};
+
+struct RequestHeader
+{
+    uint32_t length; // Payload bytes after the header, symbol included
+    uint32_t request_id;
+    uint8_t op; // WireOp
+    uint8_t symbol_length;
+    uint16_t reserved;
+};
+static_assert(sizeof(RequestHeader) == 12);
+
+struct ResponseHeader
+{
+    uint32_t length; // Payload bytes after the header
+    uint32_t request_id;
+    uint8_t op;     // WireOp of the request
+    uint8_t status; // WireStatus
+    uint16_t reserved;
+};
+static_assert(sizeof(ResponseHeader) == 12);
+
+struct WireAggregate
+{
+    uint64_t count;
+    double open;
+    double high;
+    double low;
+    double close;
+    uint64_t volume;
+    double sum;
+    double vwap;
+    uint64_t open_ts;
+    uint64_t close_ts;
+};
+static_assert(sizeof(WireAggregate) == 80);
+
+#endif // WIRE_PROTOCOL_HPP